@@ -0,0 +1,64 @@
+# Pre build step: minify and gzip web/dashboard.html into a PROGMEM array,
+# so the dashboard is served straight from flash without touching the heap.
+# Runs from platformio.ini (extra_scripts), or by hand: python scripts/embed_dashboard.py
+
+import gzip
+import hashlib
+import os
+import re
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+SOURCE = os.path.join(ROOT, "web", "dashboard.html")
+OUTPUT = os.path.join(ROOT, "src", "esp", "dashboard_html.h")
+
+
+def minify(html):
+    # Indentation, blank lines and CSS spacing only. Line breaks stay so
+    # the inline scripts keep their automatic semicolons.
+    lines = (line.strip() for line in html.splitlines())
+    html = "\n".join(line for line in lines if line)
+    html = re.sub(r"\s*([{};:,])\s*(?=[^<]*</style>)", r"\1", html)
+    return html.encode("utf-8")
+
+
+def embed():
+    with open(SOURCE, encoding="utf-8") as f:
+        raw = f.read()
+    # mtime=0 keeps the output, and so the ETag, stable between builds
+    data = gzip.compress(minify(raw), compresslevel=9, mtime=0)
+    etag = hashlib.sha1(data).hexdigest()[:16]
+
+    rows = []
+    for i in range(0, len(data), 16):
+        rows.append("  " + ", ".join("0x%02x" % b for b in data[i:i + 16]) + ",")
+
+    header = (
+        "#pragma once\n"
+        "\n"
+        "// Generated by scripts/embed_dashboard.py from web/dashboard.html, do not edit\n"
+        "// %d bytes, %d before gzip\n"
+        "\n"
+        "#include <Arduino.h>\n"
+        "\n"
+        "#define DASHBOARD_ETAG \"\\\"%s\\\"\"\n"
+        "\n"
+        "static const uint8_t DASHBOARD_HTML_GZ[] PROGMEM = {\n"
+        "%s\n"
+        "};\n"
+    ) % (len(data), len(raw.encode("utf-8")), etag, "\n".join(rows))
+
+    # Only rewrite on change, so the firmware is not rebuilt every time
+    if os.path.exists(OUTPUT):
+        with open(OUTPUT, encoding="utf-8") as f:
+            if f.read() == header:
+                return
+    with open(OUTPUT, "w", encoding="utf-8") as f:
+        f.write(header)
+    print("Embedded dashboard: %d bytes gzipped, ETag %s" % (len(data), etag))
+
+
+try:
+    Import("env")  # noqa: F821, defined when PlatformIO runs the script
+except NameError:
+    pass
+embed()
@@ -0,0 +1,73 @@
+# Prepare a pull update (src/ota_pull.h): gzip the firmware and write the
+# manifest next to it, and optionally serve them with Range support.
+#   python scripts/publish_update.py VERSION [--firmware PATH] [--out DIR] [--serve PORT]
+# Build the firmware with -DFIRMWARE_VERSION=\"VERSION\" first, units running
+# another version download it on their next check or on /update.
+
+import argparse
+import gzip
+import hashlib
+import http.server
+import os
+import re
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+FIRMWARE = os.path.join(ROOT, ".pio", "build", "nodemcuv2", "firmware.bin")
+PREFIX = "morningleds"
+
+
+def publish(version, firmware, out):
+    with open(firmware, "rb") as f:
+        raw = f.read()
+    # The boot loader unpacks it, mtime=0 keeps the file and its hash stable
+    data = gzip.compress(raw, compresslevel=9, mtime=0)
+    directory = os.path.join(out, PREFIX)
+    os.makedirs(directory, exist_ok=True)
+    with open(os.path.join(directory, "firmware.bin.gz"), "wb") as f:
+        f.write(data)
+    with open(os.path.join(directory, "firmware.txt"), "w") as f:
+        f.write("%s %d %s\n" % (version, len(data), hashlib.sha256(data).hexdigest()))
+    print("Published %s: %d bytes, %d gzipped (%d%%)" % (version, len(raw), len(data), 100 * len(data) // len(raw)))
+
+
+class RangeHandler(http.server.SimpleHTTPRequestHandler):
+    # SimpleHTTPRequestHandler ignores Range, a resumed download needs it
+    def send_head(self):
+        match = re.match(r"bytes=(\d+)-$", self.headers.get("Range", ""))
+        if not match:
+            return super().send_head()
+        path = self.translate_path(self.path)
+        if not os.path.isfile(path):
+            self.send_error(404)
+            return None
+        size = os.path.getsize(path)
+        start = int(match.group(1))
+        if start >= size:
+            self.send_error(416)
+            return None
+        f = open(path, "rb")
+        f.seek(start)
+        self.send_response(206)
+        self.send_header("Content-Type", "application/octet-stream")
+        self.send_header("Content-Range", "bytes %d-%d/%d" % (start, size - 1, size))
+        self.send_header("Content-Length", str(size - start))
+        self.end_headers()
+        return f
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("version")
+    parser.add_argument("--firmware", default=FIRMWARE)
+    parser.add_argument("--out", default=os.path.join(ROOT, ".pio", "updates"))
+    parser.add_argument("--serve", type=int, metavar="PORT")
+    args = parser.parse_args()
+    publish(args.version, args.firmware, args.out)
+    if args.serve:
+        os.chdir(args.out)
+        print("Serving %s on port %d" % (args.out, args.serve))
+        http.server.ThreadingHTTPServer(("", args.serve), RangeHandler).serve_forever()
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stdint.h>
+
+#if defined(ARDUINO)
+#include <pgmspace.h>
+#else
+#ifndef PROGMEM
+#define PROGMEM
+#endif
+#ifndef pgm_read_word
+#define pgm_read_word(addr) (*(const uint16_t*)(addr))
+#endif
+#endif
+
+// CIE 1931 lightness -> PWM duty lookup table.
+// Brightness levels (0..1023) are perceptual lightness, the table maps them to
+// linear PWM duty (0..1023) so every level looks like the same step to the eye.
+// Duty values are stored with CIE_DUTY_FRAC_BITS fractional bits so the ramp can
+// interpolate between levels, the table itself is generated by the compiler.
+
+#define CIE_LEVELS 1024
+#define CIE_MAX_LEVEL (CIE_LEVELS - 1)
+#define CIE_PWM_RANGE 1023
+#define CIE_DUTY_FRAC_BITS 6
+
+struct CieLut {
+  uint16_t duty[CIE_LEVELS];
+};
+
+constexpr double cieLuminance(double lightness) {
+  // lightness is L* in 0..100, returns relative luminance Y in 0..1
+  return lightness <= 8.0
+    ? lightness / 903.3
+    : ((lightness + 16.0) / 116.0) * ((lightness + 16.0) / 116.0) * ((lightness + 16.0) / 116.0);
+}
+
+constexpr CieLut buildCieLut() {
+  CieLut lut{};
+  for (int i = 0; i < CIE_LEVELS; i++) {
+    double y = cieLuminance(100.0 * i / CIE_MAX_LEVEL);
+    lut.duty[i] = (uint16_t)(y * (CIE_PWM_RANGE << CIE_DUTY_FRAC_BITS) + 0.5);
+  }
+  return lut;
+}
+
+// Lives in flash, read it with cieDuty()
+extern const CieLut cieLut PROGMEM;
+
+// Duty for a whole level, with CIE_DUTY_FRAC_BITS fractional bits
+inline uint16_t cieDutyFrac(uint16_t level) {
+  if (level > CIE_MAX_LEVEL) level = CIE_MAX_LEVEL;
+  return pgm_read_word(&cieLut.duty[level]);
+}
+
+// Duty for a whole level, ready for analogWrite()
+inline uint16_t cieDuty(uint16_t level) {
+  return (cieDutyFrac(level) + (1 << (CIE_DUTY_FRAC_BITS - 1))) >> CIE_DUTY_FRAC_BITS;
+}
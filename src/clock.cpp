@@ -0,0 +1,105 @@
+#include "clock.h"
+
+#include "hal.h"
+
+// The clock is refUs at halMillis() == refMs, plus the drift corrected time since
+static uint64_t refUs = 0;
+static uint32_t refMs = 0;
+static int32_t driftPpm = 0;
+static int64_t slewRemainingUs = 0;
+static ClockSource source = CLOCK_UNSET;
+// Last sample used for the drift estimate
+static uint32_t lastSampleMs = 0;
+static bool haveDriftBase = false;
+static ClockStats stats = {};
+
+// Corrected microseconds for elapsedMs of millis(), without the slew
+static int64_t correctedUs(uint32_t elapsedMs) {
+  return (int64_t)elapsedMs * 1000 + (int64_t)elapsedMs * driftPpm / 1000;
+}
+
+// Part of the pending slew applied over elapsedMs
+static int64_t slewUs(uint32_t elapsedMs) {
+  int64_t limit = (int64_t)elapsedMs * CLOCK_SLEW_PPM / 1000;
+  if (slewRemainingUs > limit) return limit;
+  if (slewRemainingUs < -limit) return -limit;
+  return slewRemainingUs;
+}
+
+static void rebase(uint32_t now) {
+  uint32_t elapsed = now - refMs;
+  int64_t slew = slewUs(elapsed);
+  refUs += correctedUs(elapsed) + slew;
+  slewRemainingUs -= slew;
+  refMs = now;
+}
+
+void clockSet(uint64_t utcMs, int32_t drift, ClockSource newSource) {
+  refUs = utcMs * 1000;
+  refMs = halMillis();
+  driftPpm = drift;
+  slewRemainingUs = 0;
+  source = newSource;
+  haveDriftBase = false;
+}
+
+void clockNtpSample(uint64_t utcMs, uint32_t atMs) {
+  rebase(atMs);
+  stats.samples++;
+  int64_t errorUs = (int64_t)(utcMs * 1000 - refUs);
+  stats.lastErrorMs = (int32_t)(errorUs / 1000);
+
+  if (source == CLOCK_UNSET || errorUs > CLOCK_STEP_THRESHOLD_MS * 1000LL || errorUs < -CLOCK_STEP_THRESHOLD_MS * 1000LL) {
+    clockSet(utcMs, driftPpm, CLOCK_NTP);
+    refMs = atMs;
+    stats.steps++;
+  } else {
+    uint32_t interval = atMs - lastSampleMs;
+    if (source == CLOCK_NTP && haveDriftBase && interval >= CLOCK_MIN_DRIFT_INTERVAL_MS) {
+      // What the pending correction from the last sample does not explain is drift
+      int64_t residualUs = errorUs - slewRemainingUs;
+      // Take half of it per sample so one bad sample cannot take over
+      driftPpm += (int32_t)(residualUs * 1000 / interval) / 2;
+      if (driftPpm > CLOCK_MAX_DRIFT_PPM) driftPpm = CLOCK_MAX_DRIFT_PPM;
+      if (driftPpm < -CLOCK_MAX_DRIFT_PPM) driftPpm = -CLOCK_MAX_DRIFT_PPM;
+    }
+    slewRemainingUs = errorUs;
+    source = CLOCK_NTP;
+  }
+  lastSampleMs = atMs;
+  haveDriftBase = true;
+}
+
+void clockLoop() {
+  // Keeps the elapsed time small, the slew is applied as it goes
+  uint32_t now = halMillis();
+  if (source != CLOCK_UNSET && now - refMs >= 100) {
+    rebase(now);
+  }
+  stats.slewPendingUs = (int32_t)slewRemainingUs;
+}
+
+bool clockValid() {
+  return source != CLOCK_UNSET;
+}
+
+ClockSource clockSource() {
+  return source;
+}
+
+uint64_t clockUtcMs() {
+  uint32_t elapsed = halMillis() - refMs;
+  return (refUs + correctedUs(elapsed) + slewUs(elapsed)) / 1000;
+}
+
+uint32_t clockUtc() {
+  return (uint32_t)(clockUtcMs() / 1000);
+}
+
+int32_t clockDriftPpm() {
+  return driftPpm;
+}
+
+const ClockStats& clockStats() {
+  return stats;
+}
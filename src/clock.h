@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stdint.h>
+
+// Disciplined UTC clock on top of millis().
+// NTP samples do not step the time, small errors are slewed out at a bounded
+// rate so the clock never jumps back or skips a second, and the measured
+// drift of the crystal is corrected continuously between samples. Only the
+// first sample, or one that is too far off, steps the clock.
+
+// Larger errors are stepped instead of slewed
+#ifndef CLOCK_STEP_THRESHOLD_MS
+#define CLOCK_STEP_THRESHOLD_MS 2000
+#endif
+// Slew rate, 5000 ppm corrects one second in 200 s
+#ifndef CLOCK_SLEW_PPM
+#define CLOCK_SLEW_PPM 5000
+#endif
+#define CLOCK_MAX_DRIFT_PPM 500
+// Drift is only estimated over intervals at least this long, shorter ones are all noise
+#define CLOCK_MIN_DRIFT_INTERVAL_MS 600000UL
+
+enum ClockSource : uint8_t {
+  CLOCK_UNSET,
+  CLOCK_RTC, // restored after a reset, good to a second or so
+  CLOCK_NTP,
+};
+
+struct ClockStats {
+  uint32_t samples;
+  uint32_t steps;
+  int32_t lastErrorMs;   // sample minus clock, before correcting it
+  int32_t slewPendingUs; // correction not applied yet
+};
+
+// Set the clock outright, e.g. from the RTC cache
+void clockSet(uint64_t utcMs, int32_t driftPpm, ClockSource source);
+// An NTP reading taken at halMillis() == atMs
+void clockNtpSample(uint64_t utcMs, uint32_t atMs);
+// Fold elapsed time into the reference, call it from loop()
+void clockLoop();
+
+bool clockValid();
+ClockSource clockSource();
+uint64_t clockUtcMs();
+uint32_t clockUtc();
+int32_t clockDriftPpm();
+const ClockStats& clockStats();
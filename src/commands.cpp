@@ -0,0 +1,495 @@
+#include "commands.h"
+
+#include "hal.h"
+#include "sunrise.h"
+#include "scheduler.h"
+#include "program.h"
+#include "peer_sync.h"
+#include "ota_pull.h"
+#include "telemetry.h"
+#include "log.h"
+
+// Cursor over the unparsed part of a message
+struct CommandArgs {
+  const char* pos;
+  const char* end;
+};
+
+typedef bool (*CommandHandler)(CommandArgs& args);
+
+struct Command {
+  const char* name;
+  uint8_t nameLength;
+  CommandHandler handler;
+};
+
+static bool isSpace(char c) {
+  return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+static void skipSpaces(CommandArgs& args) {
+  while (args.pos < args.end && isSpace(*args.pos)) args.pos++;
+}
+
+static bool atEnd(CommandArgs& args) {
+  skipSpaces(args);
+  return args.pos == args.end;
+}
+
+static bool expectChar(CommandArgs& args, char c) {
+  if (args.pos == args.end || *args.pos != c) return false;
+  args.pos++;
+  return true;
+}
+
+static bool parseInt(CommandArgs& args, int& value) {
+  skipSpaces(args);
+  bool negative = false;
+  if (args.pos < args.end && (*args.pos == '-' || *args.pos == '+')) {
+    negative = *args.pos == '-';
+    args.pos++;
+  }
+
+  // At most 9 digits, so the value always fits an int
+  int digits = 0;
+  long result = 0;
+  while (args.pos < args.end && *args.pos >= '0' && *args.pos <= '9') {
+    if (++digits > 9) return false;
+    result = result * 10 + (*args.pos - '0');
+    args.pos++;
+  }
+  if (digits == 0) return false;
+
+  value = negative ? -result : result;
+  return true;
+}
+
+// A single integer argument and nothing after it
+static bool intArgument(CommandArgs& args, int& value, const char* usage) {
+  if (parseInt(args, value) && atEnd(args)) return true;
+  sendMessage(usage, true, false);
+  return false;
+}
+
+// Nothing after the command, so "/reboot 5" is not taken for something it is not
+static bool noArguments(CommandArgs& args, const char* usage) {
+  if (atEnd(args)) return true;
+  sendMessage(usage, true, false);
+  return false;
+}
+
+// ----------------- Commands -----------------
+
+static bool commandSetTime(CommandArgs& args) {
+  int hour;
+  int minute;
+  if (!parseInt(args, hour) || !expectChar(args, ':') || !parseInt(args, minute) || !atEnd(args)) {
+    sendMessage("Please specify a time. Example: /settime 14:30", true, false);
+    return false;
+  }
+  return setSunriseTime(hour, minute);
+}
+
+static bool commandSetDuration(CommandArgs& args) {
+  int minutes;
+  if (!intArgument(args, minutes, "Please specify minutes. Example: /setduration 45")) return false;
+  return setSunriseDuration(minutes);
+}
+
+static bool commandSetBrightness(CommandArgs& args) {
+  int level;
+  if (!intArgument(args, level, "Please specify a brightness. Example: /setbrightness 512")) return false;
+  return setBrightness(level);
+}
+
+static bool commandSetMaxBrightness(CommandArgs& args) {
+  int level;
+  if (!intArgument(args, level, "Please specify a brightness. Example: /setmaxbrightness 1023")) return false;
+  return setMaxBrightness(level);
+}
+
+// A program id that is set, otherwise it says why not
+static bool checkProgram(int id) {
+  if (id < 0 || id >= PROGRAM_SLOTS) {
+    sendMessagef(true, false, "No such program, ids are 0 to %d", PROGRAM_SLOTS - 1);
+    return false;
+  }
+  return true;
+}
+
+// With a program id after the days the schedule runs that program instead of a sunrise
+static bool commandSchedule(CommandArgs& args) {
+  int hour;
+  int minute;
+  uint8_t days;
+  int program = -1;
+  bool hasProgram = false;
+  bool valid = parseInt(args, hour) && expectChar(args, ':') && parseInt(args, minute);
+  skipSpaces(args);
+  const char* daysText = args.pos;
+  while (args.pos < args.end && !isSpace(*args.pos)) args.pos++;
+  valid = valid && parseScheduleDays(daysText, args.pos - daysText, days);
+  if (valid && !atEnd(args)) valid = hasProgram = parseInt(args, program) && atEnd(args);
+  if (!valid) {
+    sendMessage("Please specify a time and days. Example: /schedule 6:30 mon-fri", true, false);
+    return false;
+  }
+  if (hasProgram) {
+    if (!checkProgram(program)) return false;
+    if (!programDurationMs(program)) {
+      sendMessagef(true, false, "Program %d is empty, set it with /program", program);
+      return false;
+    }
+  }
+  int id = schedulerAdd(hour, minute, days, program + 1);
+  if (id < 0) {
+    sendMessage(hour < 0 || hour > 23 || minute < 0 || minute > 59 ? "Invalid time format. Please use HH:MM format."
+                                                                   : "No free schedule, remove one with /unschedule", true, false);
+    return false;
+  }
+  char dayText[32];
+  formatScheduleDays(days, dayText, sizeof(dayText));
+  if (hasProgram) {
+    sendMessagef(true, false, "Schedule %d added: %d:%02d %s, program %d", id, hour, minute, dayText, program);
+  } else {
+    sendMessagef(true, false, "Schedule %d added: %d:%02d %s", id, hour, minute, dayText);
+  }
+  telemetryStateChangedNow();
+  return true;
+}
+
+static bool commandUnschedule(CommandArgs& args) {
+  int id;
+  if (!intArgument(args, id, "Please specify a schedule id. Example: /unschedule 1")) return false;
+  if (id < 0 || !schedulerRemove(id)) {
+    sendMessage("No such schedule, list them with /schedules", true, false);
+    return false;
+  }
+  sendMessagef(true, false, "Schedule %d removed", id);
+  telemetryStateChangedNow();
+  return true;
+}
+
+// Without an id the schedule that fires next is skipped
+static bool commandSkipNext(CommandArgs& args) {
+  int id = -1;
+  if (!atEnd(args) && !intArgument(args, id, "Please specify a schedule id or none. Example: /skipnext 1")) return false;
+  if (id < -1 || (id = schedulerSkipNext(id)) < 0) {
+    sendMessage("No such schedule, list them with /schedules", true, false);
+    return false;
+  }
+  sendMessagef(true, false, "Next sunrise of schedule %d skipped", id);
+  return true;
+}
+
+// One message per schedule, a full list would not fit a message
+static bool commandSchedules(CommandArgs& args) {
+  if (!noArguments(args, "/schedules takes no arguments")) return false;
+  if (schedulerCount() == 0) {
+    sendMessage("No schedules, add one with /schedule or /settime", true, false);
+    return true;
+  }
+  for (uint8_t id = 0; id < SCHEDULER_MAX_SCHEDULES; id++) {
+    const Schedule& schedule = schedulerGet(id);
+    if (schedule.hour < 0) continue;
+    char dayText[32];
+    formatScheduleDays(schedule.days, dayText, sizeof(dayText));
+    char programText[16] = "";
+    if (schedule.program) snprintf(programText, sizeof(programText), ", program %d", schedule.program - 1);
+    sendMessagef(true, false, "Schedule %d: %d:%02d %s%s%s", id, schedule.hour, schedule.minute, dayText, programText,
+                 schedule.skipNext ? ", next one skipped" : "");
+  }
+  return true;
+}
+
+// ----------------- Programs -----------------
+
+static const char* const easingNames[] = { "linear", "in", "out", "inout" };
+
+static bool parseEasing(const char* name, size_t length, RampEasing& easing) {
+  for (uint8_t i = 0; i < sizeof(easingNames) / sizeof(easingNames[0]); i++) {
+    if (strlen(easingNames[i]) == length && memcmp(easingNames[i], name, length) == 0) {
+      easing = (RampEasing)i;
+      return true;
+    }
+  }
+  return false;
+}
+
+const char* parseProgramKeyframes(const char* text, size_t length, ProgramKeyframe* keyframes, uint8_t& count) {
+  CommandArgs args = { text, text + length };
+  count = 0;
+  do {
+    if (count == PROGRAM_MAX_KEYFRAMES) return "Too many keyframes";
+    int minutes;
+    int seconds = 0;
+    int level;
+    if (!parseInt(args, minutes) || minutes < 0) return "Keyframes are MINUTES[:SS] LEVEL [EASING]";
+    if (expectChar(args, ':') && (!parseInt(args, seconds) || seconds < 0 || seconds > 59)) {
+      return "Seconds must be between 0 and 59";
+    }
+    if (!parseInt(args, level)) return "Keyframes are MINUTES[:SS] LEVEL [EASING]";
+    if (minutes > (int)(PROGRAM_MAX_SECONDS / 60)) return "A program can last at most 24 hours";
+    if (level < 0 || level > CIE_MAX_LEVEL) return "Levels must be between 0 and 1023";
+
+    RampEasing easing = RAMP_LINEAR;
+    skipSpaces(args);
+    const char* name = args.pos;
+    while (args.pos < args.end && *args.pos != ',' && !isSpace(*args.pos)) args.pos++;
+    if (args.pos > name && !parseEasing(name, args.pos - name, easing)) return "Easing is linear, in, out or inout";
+
+    keyframes[count++] = { (uint32_t)(minutes * 60 + seconds), (uint16_t)level, easing };
+    skipSpaces(args);
+  } while (expectChar(args, ','));
+  if (!atEnd(args)) return "Expected , between keyframes";
+  return nullptr;
+}
+
+// Keyframes in the form they are set, split over several messages when long
+static void reportProgram(uint8_t id) {
+  const ProgramKeyframe* keyframes;
+  uint8_t count = programKeyframes(id, keyframes);
+  if (!count) {
+    sendMessagef(true, false, "Program %d is empty", id);
+    return;
+  }
+  char text[TELEMETRY_MESSAGE_SIZE];
+  size_t length = snprintf(text, sizeof(text), "Program %d:", id);
+  for (uint8_t i = 0; i < count; i++) {
+    char keyframe[32];
+    const ProgramKeyframe& frame = keyframes[i];
+    int written = frame.seconds % 60 ? snprintf(keyframe, sizeof(keyframe), " %lu:%02lu %u", (unsigned long)(frame.seconds / 60),
+                                                (unsigned long)(frame.seconds % 60), frame.level)
+                                     : snprintf(keyframe, sizeof(keyframe), " %lu %u", (unsigned long)(frame.seconds / 60), frame.level);
+    if (i && frame.easing != RAMP_LINEAR) {
+      written += snprintf(keyframe + written, sizeof(keyframe) - written, " %s", easingNames[frame.easing]);
+    }
+    if (i + 1 < count) keyframe[written++] = ',';
+    keyframe[written] = '\0';
+    if (length + written >= sizeof(text)) {
+      sendMessage(text, true, false);
+      length = snprintf(text, sizeof(text), "Program %d, continued:", id);
+    }
+    memcpy(text + length, keyframe, written + 1);
+    length += written;
+  }
+  sendMessage(text, true, false);
+}
+
+// Without keyframes the program is shown
+static bool commandProgram(CommandArgs& args) {
+  int id;
+  if (!parseInt(args, id)) {
+    sendMessage("Please specify a program id and keyframes. Example: /program 0 0 0, 30 1023 in, 90 1023, 100 0 out",
+                true, false);
+    return false;
+  }
+  if (!checkProgram(id)) return false;
+  if (atEnd(args)) {
+    reportProgram(id);
+    return true;
+  }
+  ProgramKeyframe keyframes[PROGRAM_MAX_KEYFRAMES];
+  uint8_t count;
+  const char* error = parseProgramKeyframes(args.pos, args.end - args.pos, keyframes, count);
+  if (!error) error = programSet(id, keyframes, count);
+  if (error) {
+    sendMessagef(true, false, "Program rejected: %s", error);
+    return false;
+  }
+  sendMessagef(true, false, "Program %d set, duration: %lu minutes", id, (unsigned long)(programDurationMs(id) / 60000));
+  return true;
+}
+
+static bool commandUnprogram(CommandArgs& args) {
+  int id;
+  if (!intArgument(args, id, "Please specify a program id. Example: /unprogram 0") || !checkProgram(id)) return false;
+  programSet(id, nullptr, 0);
+  sendMessagef(true, false, "Program %d removed", id);
+  return true;
+}
+
+static bool commandPrograms(CommandArgs& args) {
+  if (!noArguments(args, "/programs takes no arguments")) return false;
+  bool any = false;
+  for (uint8_t id = 0; id < PROGRAM_SLOTS; id++) {
+    if (!programDurationMs(id)) continue;
+    reportProgram(id);
+    any = true;
+  }
+  if (!any) sendMessage("No programs, add one with /program", true, false);
+  return true;
+}
+
+static bool commandRun(CommandArgs& args) {
+  int id;
+  if (!intArgument(args, id, "Please specify a program id. Example: /run 0") || !checkProgram(id)) return false;
+  return startProgram(id);
+}
+
+static bool commandStatus(CommandArgs& args) {
+  if (!noArguments(args, "/status takes no arguments")) return false;
+  reportStatus();
+  return true;
+}
+
+static bool commandPeers(CommandArgs& args) {
+  if (!noArguments(args, "/peers takes no arguments")) return false;
+  if (!peerSyncEnabled()) {
+    sendMessage("Peer sync is off, enable it with ENABLE_PEER_SYNC", true, false);
+    return true;
+  }
+  uint32_t now = halMillis();
+  for (uint8_t i = 0; i < peerCount(); i++) {
+    const PeerInfo& peer = peerGet(i);
+    sendMessagef(true, false, "Peer %08lx: brightness %u, seen %lu ms ago", (unsigned long)peer.id, peer.level,
+                 (unsigned long)(now - peer.lastSeenMs));
+  }
+  const PeerSyncStats& stats = peerSyncStats();
+  sendMessagef(true, false, "%u peers, leader %08lx%s, phase error %ld ms, %lu corrections", peerCount(),
+               (unsigned long)peerSyncLeader(), peerSyncMayFire() ? " (this unit)" : "", (long)stats.lastPhaseErrorMs,
+               (unsigned long)stats.phaseCorrections);
+  return true;
+}
+
+static bool commandUpdate(CommandArgs& args) {
+  if (!noArguments(args, "/update takes no arguments")) return false;
+  otaPullCheck();
+  return true;
+}
+
+// The log goes to its own topic in chunks, it does not fit the message queue
+static bool commandLog(CommandArgs& args) {
+  int since = logOldest();
+  if (!atEnd(args) && !intArgument(args, since, "Please specify a log position or none. Example: /log 2048")) return false;
+  logDumpRequested(since);
+  sendMessagef(true, false, "Log up to %lu on " MQTT_LOG_DUMP_TOPIC, (unsigned long)logEnd());
+  return true;
+}
+
+static bool commandReboot(CommandArgs& args) {
+  if (!noArguments(args, "/reboot takes no arguments")) return false;
+  halRestart();
+  return true;
+}
+
+// ----------------- Settings JSON -----------------
+
+// Flat object of integer fields, e.g. {"hour":6,"minute":30,"sunriseDuration":45}
+struct SettingsKey {
+  const char* name;
+  uint8_t nameLength;
+  uint8_t field;
+  int SettingsUpdate::*value;
+};
+
+#define SETTINGS_KEY(name, field, member) { name, sizeof(name) - 1, field, &SettingsUpdate::member }
+
+static const SettingsKey settingsKeys[] = {
+  SETTINGS_KEY("currentBrightness", SETTING_BRIGHTNESS, currentBrightness),
+  SETTINGS_KEY("maxBrightness", SETTING_MAX_BRIGHTNESS, maxBrightness),
+  SETTINGS_KEY("sunriseDuration", SETTING_DURATION, sunriseDuration),
+  SETTINGS_KEY("hour", SETTING_SUNRISE_TIME, hour),
+  SETTINGS_KEY("minute", SETTING_SUNRISE_TIME, minute),
+};
+
+const char* parseSettingsJson(const char* json, size_t length, SettingsUpdate& update) {
+  CommandArgs args = { json, json + length };
+  update.fields = 0;
+  bool hasHour = false;
+  bool hasMinute = false;
+
+  skipSpaces(args);
+  if (!expectChar(args, '{')) return "Expected a JSON object";
+  skipSpaces(args);
+  if (expectChar(args, '}')) return atEnd(args) ? "No settings given" : "Unexpected data after the object";
+
+  while (true) {
+    skipSpaces(args);
+    if (!expectChar(args, '"')) return "Expected a field name";
+    const char* name = args.pos;
+    while (args.pos < args.end && *args.pos != '"') args.pos++;
+    size_t nameLength = args.pos - name;
+    if (!expectChar(args, '"')) return "Unterminated field name";
+
+    const SettingsKey* key = nullptr;
+    for (const SettingsKey& candidate : settingsKeys) {
+      if (candidate.nameLength == nameLength && memcmp(candidate.name, name, nameLength) == 0) {
+        key = &candidate;
+        break;
+      }
+    }
+    if (!key) return "Unknown field";
+
+    skipSpaces(args);
+    if (!expectChar(args, ':') || !parseInt(args, update.*key->value)) return "Fields must be integers";
+    update.fields |= key->field;
+    if (key->value == &SettingsUpdate::hour) hasHour = true;
+    if (key->value == &SettingsUpdate::minute) hasMinute = true;
+
+    skipSpaces(args);
+    if (expectChar(args, ',')) continue;
+    if (!expectChar(args, '}')) return "Expected , or }";
+    break;
+  }
+  if (!atEnd(args)) return "Unexpected data after the object";
+  if (hasHour != hasMinute) return "hour and minute go together";
+  return nullptr;
+}
+
+// MQTT and Telegram take the same object as POST /api/config
+static bool commandSettings(const char* message, size_t length) {
+  SettingsUpdate update;
+  const char* error = parseSettingsJson(message, length, update);
+  if (!error) error = applySettings(update);
+  if (error) {
+    sendMessagef(true, false, "Settings rejected: %s", error);
+    return false;
+  }
+  return true;
+}
+
+#define COMMAND(name, handler) { name, sizeof(name) - 1, handler }
+
+static const Command commandTable[] = {
+  COMMAND("/settime", commandSetTime),
+  COMMAND("/setduration", commandSetDuration),
+  COMMAND("/setbrightness", commandSetBrightness),
+  COMMAND("/setmaxbrightness", commandSetMaxBrightness),
+  COMMAND("/schedule", commandSchedule),
+  COMMAND("/unschedule", commandUnschedule),
+  COMMAND("/skipnext", commandSkipNext),
+  COMMAND("/schedules", commandSchedules),
+  COMMAND("/program", commandProgram),
+  COMMAND("/unprogram", commandUnprogram),
+  COMMAND("/programs", commandPrograms),
+  COMMAND("/run", commandRun),
+  COMMAND("/status", commandStatus),
+  COMMAND("/peers", commandPeers),
+  COMMAND("/log", commandLog),
+  COMMAND("/update", commandUpdate),
+  COMMAND("/reboot", commandReboot),
+};
+
+bool actByMessage(const char* message, size_t length) {
+  CommandArgs args = { message, message + length };
+  skipSpaces(args);
+  if (args.pos < args.end && *args.pos == '{') {
+    return commandSettings(message, length);
+  }
+
+  const char* name = args.pos;
+  while (args.pos < args.end && !isSpace(*args.pos)) args.pos++;
+  size_t nameLength = args.pos - name;
+
+  // Telegram group chats append the bot name: /status@MorningLEDsBot
+  const char* mention = (const char*)memchr(name, '@', nameLength);
+  if (mention) nameLength = mention - name;
+
+  for (const Command& command : commandTable) {
+    if (command.nameLength == nameLength && memcmp(command.name, name, nameLength) == 0) {
+      return command.handler(args);
+    }
+  }
+  return false;
+}
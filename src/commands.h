@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stddef.h>
+#include <string.h>
+
+#include "sunrise.h"
+#include "program.h"
+
+// Text command parser shared by the web server, MQTT and Telegram.
+// Parses in place from a buffer that does not need to be null terminated,
+// so it never allocates, and dispatches through a static command table.
+//
+//   /settime HH:MM        /setduration MINUTES
+//   /setbrightness LEVEL  /setmaxbrightness LEVEL
+//   /schedule HH:MM DAYS [PROGRAM]        DAYS is mon-fri, sat,sun, daily, weekdays...
+//   /unschedule ID        /skipnext [ID]   /schedules
+//   /program ID [KEYFRAMES]               set or show a light program, see program.h
+//   /unprogram ID         /programs        /run ID
+//   /status               /reboot
+//   /log [FROM]           dump the log to MQTT, from a position or all of it
+//   /peers                list the peer sync group and its leader
+//   /update               check for a pull update now, or show how the download is going
+//
+//   {"currentBrightness":0,"maxBrightness":1023,"sunriseDuration":45,"hour":6,"minute":30}
+//                         any subset, applied together, see applySettings()
+//
+// Returns false for unknown commands and bad arguments.
+bool actByMessage(const char* message, size_t length);
+
+inline bool actByMessage(const char* message) {
+  return actByMessage(message, strlen(message));
+}
+
+// Parse a settings object without applying it, returns nullptr or what was wrong
+const char* parseSettingsJson(const char* json, size_t length, SettingsUpdate& update);
+// Parse "MINUTES[:SS] LEVEL [EASING]" keyframes separated by commas, e.g.
+// "0 0, 30 1023 in, 90 1023, 100 0 out". EASING is linear, in, out or inout.
+const char* parseProgramKeyframes(const char* text, size_t length, ProgramKeyframe* keyframes, uint8_t& count);
@@ -2,11 +2,20 @@
 const char* ssid = "SSID";
 const char* password = "PASS";
 
-#define MAX_BRIGHTNESS 255
+// Brightness levels are perceptual (0-1023), 583 gives the same PWM duty as 255 used to
+#define MAX_BRIGHTNESS 583
 #define SUNRISE_DURATION_MINUTES 45
 
 #define LED_PIN 2
 
+// Several strips fading together, the color goes from amber to daylight during a sunrise.
+// One pin per channel: LIGHT_WARM_COOL is warm then cool white, LIGHT_RGB is red, green, blue
+// #define LIGHT_LAYOUT LIGHT_WARM_COOL
+// #define LED_PINS { 12, 13 }
+
+// POSIX TZ string, DST transitions follow it without a reboot
+#define TIMEZONE "EET-2EEST,M3.5.0/3,M10.5.0/4"
+
 // Enable web server
 #define ENABLE_WEB_SERVER
 
@@ -31,6 +40,19 @@ const char* mqtt_server = "192.168.0.XXX";
 const char* token = "123123:AAhhh";
 #endif
 
+// Units on the same network light up together, one of them fires the schedules
+// and the others follow its ramp, see peer_sync.h
+// #define ENABLE_PEER_SYNC
+
+// Pull updates from a local server, see ota_pull.h and scripts/publish_update.py.
+// Build with -DFIRMWARE_VERSION=\"...\" so the unit knows when it is up to date.
+// #define ENABLE_PULL_OTA
+
+#ifdef ENABLE_PULL_OTA
+#define OTA_SERVER_HOST "192.168.0.XXX"
+#define OTA_SERVER_PORT 8266
+#endif
+
 
 
 
@@ -0,0 +1,192 @@
+#include "connectivity.h"
+
+#include "clock.h"
+#include "hal.h"
+#include "log.h"
+
+static LinkStatus wifi = {};
+static LinkStatus ntp = {};
+static LinkStatus mqtt = {};
+static bool mqttActive = false;
+static bool everSynced = false;
+
+static void setState(LinkStatus& link, LinkState state, uint32_t now) {
+  link.state = state;
+  link.changedMs = now;
+}
+
+static const char* linkName(const LinkStatus& link) {
+  return &link == &wifi ? "WiFi" : &link == &ntp ? "NTP" : "MQTT";
+}
+
+static void linkUp(LinkStatus& link, uint32_t now) {
+  logInfo("%s up", linkName(link));
+  link.failures = 0;
+  link.upCount++;
+  setState(link, LINK_UP, now);
+}
+
+static void linkFailed(LinkStatus& link, uint32_t now) {
+  link.deadlineMs = now + backoffDelay(link.failures, halRandom());
+  logWarn("%s failed, retry in %lu ms", linkName(link), (unsigned long)(link.deadlineMs - now));
+  if (link.failures < 255) link.failures++;
+  setState(link, LINK_BACKOFF, now);
+}
+
+// Deadlines are compared with a signed difference so millis() rollover is harmless
+static bool reached(uint32_t now, uint32_t deadline) {
+  return (int32_t)(now - deadline) >= 0;
+}
+
+uint32_t backoffDelay(uint8_t failures, uint32_t random) {
+  uint32_t delay = BACKOFF_MAX_MS;
+  if (failures < 20) {
+    uint32_t exponential = (uint32_t)BACKOFF_BASE_MS << failures;
+    if (exponential < BACKOFF_MAX_MS) delay = exponential;
+  }
+  return delay / 2 + random % (delay / 2 + 1);
+}
+
+void connectivityBegin(bool mqttEnabled) {
+  mqttActive = mqttEnabled;
+}
+
+static void stepWifi(uint32_t now) {
+  switch (wifi.state) {
+    case LINK_DOWN:
+      halWifiBegin();
+      wifi.deadlineMs = now + WIFI_CONNECT_TIMEOUT_MS;
+      setState(wifi, LINK_CONNECTING, now);
+      break;
+
+    case LINK_CONNECTING:
+      if (halWifiConnected()) {
+        linkUp(wifi, now);
+        halOnWifiUp();
+      } else if (reached(now, wifi.deadlineMs)) {
+        linkFailed(wifi, now);
+      }
+      break;
+
+    case LINK_UP:
+      if (!halWifiConnected()) {
+        // The SDK reconnects on its own, give it the usual timeout first
+        wifi.deadlineMs = now + WIFI_CONNECT_TIMEOUT_MS;
+        setState(wifi, LINK_CONNECTING, now);
+      }
+      break;
+
+    case LINK_BACKOFF:
+      if (reached(now, wifi.deadlineMs)) {
+        setState(wifi, LINK_DOWN, now);
+      }
+      break;
+  }
+}
+
+static void stepNtp(uint32_t now) {
+  switch (ntp.state) {
+    case LINK_DOWN:
+      halNtpRequest();
+      ntp.deadlineMs = now + NTP_REPLY_TIMEOUT_MS;
+      setState(ntp, LINK_CONNECTING, now);
+      break;
+
+    case LINK_CONNECTING: {
+      uint64_t utcMs;
+      if (halNtpPoll(utcMs)) {
+        everSynced = true;
+        // Slewed into the clock, only the first reply or a large error steps it
+        clockNtpSample(utcMs, now);
+        halSetUtcTime(clockUtc());
+        linkUp(ntp, now);
+        ntp.deadlineMs = now + NTP_SYNC_INTERVAL_MS;
+      } else if (reached(now, ntp.deadlineMs)) {
+        linkFailed(ntp, now);
+      }
+      break;
+    }
+
+    case LINK_UP:
+      // Synced, resync once the interval is over
+      if (reached(now, ntp.deadlineMs)) {
+        setState(ntp, LINK_DOWN, now);
+      }
+      break;
+
+    case LINK_BACKOFF:
+      if (reached(now, ntp.deadlineMs)) {
+        setState(ntp, LINK_DOWN, now);
+      }
+      break;
+  }
+}
+
+static void stepMqtt(uint32_t now) {
+  switch (mqtt.state) {
+    case LINK_DOWN:
+    case LINK_CONNECTING:
+      // A connect attempt is a single bounded call, see halMqttConnect()
+      if (halMqttConnect()) {
+        linkUp(mqtt, now);
+      } else {
+        linkFailed(mqtt, now);
+      }
+      break;
+
+    case LINK_UP:
+      if (!halMqttConnected()) {
+        linkFailed(mqtt, now);
+      } else {
+        halMqttLoop();
+      }
+      break;
+
+    case LINK_BACKOFF:
+      if (reached(now, mqtt.deadlineMs)) {
+        setState(mqtt, LINK_DOWN, now);
+      }
+      break;
+  }
+}
+
+void connectivityLoop() {
+  uint32_t now = halMillis();
+  stepWifi(now);
+
+  if (wifi.state != LINK_UP) {
+    // Everything else waits for WiFi, without counting it as a failure
+    if (ntp.state == LINK_CONNECTING) setState(ntp, LINK_DOWN, now);
+    if (mqtt.state == LINK_UP) setState(mqtt, LINK_DOWN, now);
+    return;
+  }
+
+  stepNtp(now);
+  if (mqttActive) {
+    stepMqtt(now);
+  }
+}
+
+bool wifiUp() {
+  return wifi.state == LINK_UP;
+}
+
+bool timeSynced() {
+  return everSynced;
+}
+
+bool mqttUp() {
+  return mqtt.state == LINK_UP;
+}
+
+const LinkStatus& wifiStatus() {
+  return wifi;
+}
+
+const LinkStatus& ntpStatus() {
+  return ntp;
+}
+
+const LinkStatus& mqttStatus() {
+  return mqtt;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <stdint.h>
+
+// Non-blocking connectivity for WiFi, NTP and MQTT.
+// Each link is a small state machine stepped from loop(); failed attempts are
+// retried with exponential backoff and jitter, nothing here waits, so the
+// sunrise keeps running whether or not the network is up.
+
+#ifndef WIFI_CONNECT_TIMEOUT_MS
+#define WIFI_CONNECT_TIMEOUT_MS 15000
+#endif
+#ifndef NTP_REPLY_TIMEOUT_MS
+#define NTP_REPLY_TIMEOUT_MS 2000
+#endif
+#ifndef NTP_SYNC_INTERVAL_MS
+#define NTP_SYNC_INTERVAL_MS 3600000UL
+#endif
+// TCP connect timeout for the broker, a connect attempt blocks at most this long
+#ifndef MQTT_CONNECT_TIMEOUT_MS
+#define MQTT_CONNECT_TIMEOUT_MS 500
+#endif
+#ifndef BACKOFF_BASE_MS
+#define BACKOFF_BASE_MS 1000
+#endif
+#ifndef BACKOFF_MAX_MS
+#define BACKOFF_MAX_MS 300000UL
+#endif
+
+enum LinkState : uint8_t {
+  LINK_DOWN,       // idle, next step starts an attempt
+  LINK_CONNECTING, // attempt in flight
+  LINK_UP,
+  LINK_BACKOFF,    // waiting before the next attempt
+};
+
+struct LinkStatus {
+  LinkState state;
+  uint8_t failures;      // consecutive failed attempts
+  uint32_t deadlineMs;   // attempt timeout or end of backoff
+  uint32_t changedMs;    // last state change
+  uint32_t upCount;      // times the link came up
+};
+
+// Exponential backoff with equal jitter: half the delay is fixed, half random
+uint32_t backoffDelay(uint8_t failures, uint32_t random);
+
+void connectivityBegin(bool mqttEnabled);
+void connectivityLoop();
+
+bool wifiUp();
+bool timeSynced();
+bool mqttUp();
+
+const LinkStatus& wifiStatus();
+const LinkStatus& ntpStatus();
+const LinkStatus& mqttStatus();
@@ -0,0 +1,90 @@
+#include "dither.h"
+
+#include "hal.h"
+#include "cie_lut.h"
+#include "light.h"
+
+#define DITHER_ONE (1 << CIE_DUTY_FRAC_BITS)
+// Bounds the error a changed target inherits
+#define DITHER_MAX_ERROR (2 * DITHER_ONE)
+
+static uint16_t targets[LIGHT_MAX_CHANNELS];
+static uint16_t outputs[LIGHT_MAX_CHANNELS];
+// Light owed to each channel, target minus output times the periods it was held
+static int16_t errors[LIGHT_MAX_CHANNELS];
+static uint8_t channels = 0;
+static bool active = false;
+static uint32_t lastStepUs = 0;
+static DitherStats stats = {};
+
+// Account for the current outputs held `periods` long and pick the next ones.
+// Returns true when an output changed.
+static bool step(uint32_t periods) {
+  bool changed = false;
+  for (uint8_t channel = 0; channel < channels; channel++) {
+    uint16_t target = targets[channel];
+    uint16_t whole = target >> CIE_DUTY_FRAC_BITS;
+    uint16_t output;
+    if (DITHER_INTERVAL_US == 0 || whole >= DITHER_MAX_DUTY) {
+      output = (target + DITHER_ONE / 2) >> CIE_DUTY_FRAC_BITS;
+      errors[channel] = 0;
+    } else {
+      int32_t error = errors[channel] + ((int32_t)target - ((int32_t)outputs[channel] << CIE_DUTY_FRAC_BITS)) * (int32_t)periods;
+      if (error > DITHER_MAX_ERROR) error = DITHER_MAX_ERROR;
+      if (error < -DITHER_MAX_ERROR) error = -DITHER_MAX_ERROR;
+      errors[channel] = error;
+      // The upper step once the owed light reaches a whole step
+      output = whole + (error + (target & (DITHER_ONE - 1)) >= DITHER_ONE);
+    }
+    if (output != outputs[channel]) {
+      outputs[channel] = output;
+      changed = true;
+    }
+  }
+  return changed;
+}
+
+void ditherSet(const uint16_t* dutyFracs, uint8_t count) {
+  channels = count < LIGHT_MAX_CHANNELS ? count : LIGHT_MAX_CHANNELS;
+  active = false;
+  for (uint8_t channel = 0; channel < channels; channel++) {
+    targets[channel] = dutyFracs[channel];
+    // Whole duties and bright ones need no steps at all
+    if ((dutyFracs[channel] & (DITHER_ONE - 1)) && (dutyFracs[channel] >> CIE_DUTY_FRAC_BITS) < DITHER_MAX_DUTY) {
+      active = DITHER_INTERVAL_US > 0;
+    }
+  }
+  // The outputs written so far were held since the last step
+  step(0);
+  lastStepUs = halMicros();
+  halPwmWrite(outputs, channels);
+}
+
+void ditherLoop() {
+  if (!active) return;
+  uint32_t now = halMicros();
+  uint32_t elapsed = now - lastStepUs;
+  if (elapsed < DITHER_INTERVAL_US) return;
+
+  uint32_t periods = elapsed / DITHER_INTERVAL_US;
+  lastStepUs += periods * DITHER_INTERVAL_US;
+  stats.latePeriods += periods - 1;
+  if (periods > DITHER_ONE) periods = DITHER_ONE;
+
+  stats.steps++;
+  if (step(periods)) {
+    halPwmWrite(outputs, channels);
+    stats.writes++;
+  }
+  uint32_t took = halMicros() - now;
+  stats.totalMicros += took;
+  if (took > stats.maxStepMicros) stats.maxStepMicros = took;
+}
+
+bool ditherActive() {
+  return active;
+}
+
+const DitherStats& ditherStats() {
+  return stats;
+}
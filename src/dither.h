@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stdint.h>
+
+// Temporal dithering of the PWM output.
+// The light layer computes duties with CIE_DUTY_FRAC_BITS fractional bits,
+// 16 bits in total, but the PWM only takes whole steps, and at the bottom of
+// a sunrise duty 1 -> 2 is a doubling of the light. Low duties alternate
+// between the two neighbouring steps instead, so their average over time hits
+// the fraction. This is a first order sigma-delta weighted by how long each
+// output was held, so a late step (the loop was busy) does not bias the light.
+//
+// Steps run from loop(), not from a timer interrupt: on the ESP8266 timer1
+// belongs to the core's PWM generator and analogWrite() waits for it, which
+// is not allowed inside an ISR. A step costs the same fixed work per channel.
+
+// One step per PWM period at the default 1 kHz, 0 turns dithering off
+#ifndef DITHER_INTERVAL_US
+#define DITHER_INTERVAL_US 1000
+#endif
+// Only duties below this are dithered, above it one step is invisible
+#ifndef DITHER_MAX_DUTY
+#define DITHER_MAX_DUTY 64
+#endif
+
+struct DitherStats {
+  uint32_t steps;
+  uint32_t writes;        // steps that changed an output
+  uint32_t latePeriods;   // periods a step came late, the output was held longer
+  uint32_t maxStepMicros; // including the PWM write
+  uint32_t totalMicros;
+};
+
+// New targets with CIE_DUTY_FRAC_BITS fractional bits, writes the first step right away
+void ditherSet(const uint16_t* dutyFracs, uint8_t channels);
+// Step the dither when a period passed, call it from loop()
+void ditherLoop();
+// True while some channel is being dithered
+bool ditherActive();
+
+const DitherStats& ditherStats();
@@ -0,0 +1,354 @@
+#include "telegram_client.h"
+
+#include <ArduinoJson.h>
+
+#include "../connectivity.h"
+#include "../tasks.h"
+#include "../log.h"
+
+#define TELEGRAM_HOST "api.telegram.org"
+#define TELEGRAM_SEND_TIMEOUT_MS 10000
+// Bytes handled per loop() call, keeps a single step short
+#define TELEGRAM_READ_BUDGET 512
+
+enum ChunkState : uint8_t {
+  CHUNK_SIZE,
+  CHUNK_DATA,
+  CHUNK_DATA_END,
+  CHUNK_TRAILER,
+};
+
+static bool reached(uint32_t now, uint32_t deadline) {
+  return (int32_t)(now - deadline) >= 0;
+}
+
+TelegramClient::TelegramClient(const char* token, const char* chatId) : token(token), chatId(chatId) {}
+
+void TelegramClient::begin(MessageHandler messageHandler) {
+  handler = messageHandler;
+  client.setInsecure();
+  client.setSession(&session);
+  // Keep the socket calls inside loop() short
+  client.setTimeout(2000);
+}
+
+bool TelegramClient::send(const char* text) {
+  if (outgoingPending) return false;
+  strncpy(outgoing, text, sizeof(outgoing) - 1);
+  outgoing[sizeof(outgoing) - 1] = '\0';
+  outgoingPending = true;
+  return true;
+}
+
+void TelegramClient::loop() {
+  uint32_t now = millis();
+
+  switch (phase) {
+    case PHASE_IDLE:
+      if (!reached(now, retryAtMs)) break;
+      startRequest(outgoingPending ? REQUEST_SEND : REQUEST_UPDATES);
+      break;
+
+    case PHASE_CONNECT:
+      connect();
+      break;
+
+    case PHASE_REQUEST:
+      writeRequest();
+      break;
+
+    case PHASE_HEADERS:
+      // A long poll holds the connection, give it up when a reply has to go out
+      if (request == REQUEST_UPDATES && outgoingPending && statusCode == 0 && lineLength == 0 && !client.available()) {
+        client.stop();
+        phase = PHASE_IDLE;
+        break;
+      }
+      readHeaders();
+      break;
+
+    case PHASE_BODY:
+      readBody();
+      break;
+  }
+
+  if (phase == PHASE_HEADERS || phase == PHASE_BODY) {
+    uint32_t timeout = request == REQUEST_UPDATES ? (TELEGRAM_LONG_POLL_S + 10) * 1000UL : TELEGRAM_SEND_TIMEOUT_MS;
+    if (now - phaseStartMs > timeout) {
+      fail("response timeout");
+    }
+  }
+}
+
+void TelegramClient::startRequest(Request next) {
+  request = next;
+  phase = PHASE_CONNECT;
+}
+
+void TelegramClient::connect() {
+  if (client.connected()) {
+    // Kept alive from the previous request
+    phase = PHASE_REQUEST;
+    return;
+  }
+
+  // The only blocking step, the cached session turns it into a short resumption
+  uint32_t start = millis();
+  if (!client.connect(TELEGRAM_HOST, 443)) {
+    fail("connect failed");
+    return;
+  }
+  handshakeCount++;
+  handshakeMs = millis() - start;
+  phase = PHASE_REQUEST;
+}
+
+// Escape text for a JSON string, returns the written length
+static size_t escapeJson(char* out, size_t size, const char* text) {
+  size_t length = 0;
+  for (; *text && length + 7 < size; text++) {
+    char c = *text;
+    if (c == '"' || c == '\\') {
+      out[length++] = '\\';
+      out[length++] = c;
+    } else if (c == '\n') {
+      out[length++] = '\\';
+      out[length++] = 'n';
+    } else if ((uint8_t)c < 0x20) {
+      length += snprintf(out + length, size - length, "\\u%04x", c);
+    } else {
+      out[length++] = c;
+    }
+  }
+  out[length] = '\0';
+  return length;
+}
+
+void TelegramClient::writeRequest() {
+  static char buffer[TELEGRAM_TEXT_SIZE * 2 + 256];
+  int length;
+
+  if (request == REQUEST_UPDATES) {
+    // One update per request keeps the body small, the next poll starts right away
+    length = snprintf(buffer, sizeof(buffer),
+      "GET /bot%s/getUpdates?offset=%ld&limit=1&timeout=%d&allowed_updates=%%5B%%22message%%22%%5D HTTP/1.1\r\n"
+      "Host: " TELEGRAM_HOST "\r\n"
+      "Connection: keep-alive\r\n\r\n",
+      token, (long)lastUpdateId + 1, TELEGRAM_LONG_POLL_S);
+  } else {
+    static char text[TELEGRAM_TEXT_SIZE * 2];
+    escapeJson(text, sizeof(text), outgoing);
+    static char json[sizeof(text) + 64];
+    int jsonLength = snprintf(json, sizeof(json), "{\"chat_id\":\"%s\",\"text\":\"%s\"}", chatId, text);
+    length = snprintf(buffer, sizeof(buffer),
+      "POST /bot%s/sendMessage HTTP/1.1\r\n"
+      "Host: " TELEGRAM_HOST "\r\n"
+      "Connection: keep-alive\r\n"
+      "Content-Type: application/json\r\n"
+      "Content-Length: %d\r\n\r\n%s",
+      token, jsonLength, json);
+  }
+
+  if (length >= (int)sizeof(buffer) || client.write((const uint8_t*)buffer, length) != (size_t)length) {
+    fail("request write failed");
+    return;
+  }
+
+  lineLength = 0;
+  statusCode = 0;
+  contentLength = -1;
+  chunked = false;
+  keepAlive = true;
+  chunkState = CHUNK_SIZE;
+  bodyReceived = 0;
+  bodyLength = 0;
+  bodyOverflow = false;
+  phaseStartMs = millis();
+  phase = PHASE_HEADERS;
+}
+
+void TelegramClient::readHeaders() {
+  int budget = TELEGRAM_READ_BUDGET;
+  while (budget-- > 0 && client.available()) {
+    char c = client.read();
+    if (c == '\r') continue;
+    if (c != '\n') {
+      if (lineLength < sizeof(line) - 1) line[lineLength++] = c;
+      continue;
+    }
+
+    line[lineLength] = '\0';
+    if (lineLength == 0) {
+      // End of headers
+      phase = PHASE_BODY;
+      if (contentLength == 0) finishRequest();
+      return;
+    }
+    if (statusCode == 0 && strncmp(line, "HTTP/1.", 7) == 0) {
+      statusCode = atoi(line + 9);
+    } else if (strncasecmp(line, "Content-Length:", 15) == 0) {
+      contentLength = atol(line + 15);
+    } else if (strncasecmp(line, "Transfer-Encoding:", 18) == 0) {
+      chunked = strstr(line + 18, "chunked") != nullptr;
+    } else if (strncasecmp(line, "Connection:", 11) == 0) {
+      keepAlive = strstr(line + 11, "close") == nullptr;
+    }
+    lineLength = 0;
+  }
+
+  if (!client.connected() && !client.available()) {
+    fail("connection closed");
+  }
+}
+
+void TelegramClient::readBody() {
+  uint8_t data[128];
+  int budget = TELEGRAM_READ_BUDGET;
+
+  while (budget > 0 && client.available()) {
+    size_t want = sizeof(data);
+    if (contentLength >= 0 && !chunked && contentLength - bodyReceived < want) {
+      want = contentLength - bodyReceived;
+    }
+    int received = client.read(data, want);
+    if (received <= 0) break;
+    budget -= received;
+    bodyReceived += received;
+
+    if (chunked) {
+      if (readChunked(data, received)) {
+        finishRequest();
+        return;
+      }
+    } else {
+      appendBody(data, received);
+      if (contentLength >= 0 && bodyReceived >= (uint32_t)contentLength) {
+        finishRequest();
+        return;
+      }
+    }
+  }
+
+  if (!client.connected() && !client.available()) {
+    // Without a length the body ends with the connection
+    if (contentLength < 0 && !chunked) {
+      keepAlive = false;
+      finishRequest();
+    } else {
+      fail("connection closed");
+    }
+  }
+}
+
+bool TelegramClient::readChunked(const uint8_t* data, size_t length) {
+  for (size_t i = 0; i < length; i++) {
+    char c = data[i];
+    switch (chunkState) {
+      case CHUNK_SIZE:
+      case CHUNK_TRAILER:
+        if (c == '\r') break;
+        if (c != '\n') {
+          if (lineLength < sizeof(line) - 1) line[lineLength++] = c;
+          break;
+        }
+        line[lineLength] = '\0';
+        if (chunkState == CHUNK_TRAILER) {
+          // An empty line ends the trailers and the response
+          if (lineLength == 0) return true;
+        } else {
+          chunkRemaining = strtoul(line, nullptr, 16);
+          chunkState = chunkRemaining ? CHUNK_DATA : CHUNK_TRAILER;
+        }
+        lineLength = 0;
+        break;
+
+      case CHUNK_DATA: {
+        size_t take = length - i < chunkRemaining ? length - i : chunkRemaining;
+        appendBody(data + i, take);
+        chunkRemaining -= take;
+        i += take - 1;
+        if (chunkRemaining == 0) chunkState = CHUNK_DATA_END;
+        break;
+      }
+
+      case CHUNK_DATA_END:
+        if (c == '\n') chunkState = CHUNK_SIZE;
+        break;
+    }
+  }
+  return false;
+}
+
+void TelegramClient::appendBody(const uint8_t* data, size_t length) {
+  size_t room = sizeof(body) - 1 - bodyLength;
+  if (length > room) {
+    bodyOverflow = true;
+    length = room;
+  }
+  memcpy(body + bodyLength, data, length);
+  bodyLength += length;
+}
+
+void TelegramClient::finishRequest() {
+  body[bodyLength] = '\0';
+  if (!keepAlive) client.stop();
+  phase = PHASE_IDLE;
+
+  if (request == REQUEST_SEND) {
+    // Rejected messages are dropped, retrying them would fail the same way
+    if (statusCode != 200) logWarn("Telegram send failed: %d", statusCode);
+    outgoingPending = false;
+    failures = 0;
+    return;
+  }
+
+  if (statusCode != 200) {
+    fail("bad status");
+    return;
+  }
+  pollCount++;
+  failures = 0;
+  handleUpdates();
+}
+
+void TelegramClient::handleUpdates() {
+  if (bodyOverflow) {
+    // Too big to parse, skip the update so it is not fetched again
+    const char* id = strstr(body, "\"update_id\":");
+    if (id) lastUpdateId = atol(id + 12);
+    return;
+  }
+
+  StaticJsonDocument<128> filter;
+  filter["result"][0]["update_id"] = true;
+  filter["result"][0]["message"]["chat"]["id"] = true;
+  filter["result"][0]["message"]["text"] = true;
+
+  static StaticJsonDocument<512> doc;
+  DeserializationError error = deserializeJson(doc, body, bodyLength, DeserializationOption::Filter(filter));
+  if (error) {
+    logWarn("Telegram response not parsed: %s", error.c_str());
+    return;
+  }
+
+  long long allowedChat = atoll(chatId);
+  for (JsonObject update : doc["result"].as<JsonArray>()) {
+    lastUpdateId = update["update_id"].as<long>();
+    JsonObject message = update["message"];
+    const char* text = message["text"] | "";
+    if (message["chat"]["id"].as<long long>() != allowedChat) {
+      logWarn("Ignoring Telegram message from chat %lld", message["chat"]["id"].as<long long>());
+      continue;
+    }
+    if (handler && *text) handler(text, strlen(text));
+    tasksYield();
+  }
+}
+
+void TelegramClient::fail(const char* reason) {
+  logWarn("Telegram %s", reason);
+  client.stop();
+  phase = PHASE_IDLE;
+  retryAtMs = millis() + backoffDelay(failures, ESP.random());
+  if (failures < 255) failures++;
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <Arduino.h>
+#include <WiFiClientSecure.h>
+
+// Incremental Telegram Bot API client.
+// Each loop() call advances one phase (connect, request, headers, body) and
+// only reads what already arrived, so the main loop is never held for a
+// response. The TLS connection is kept alive between requests and its session
+// is cached, so a reconnect resumes instead of doing a full handshake.
+// Updates are fetched with long polling: a command arrives as soon as it is sent.
+
+#ifndef TELEGRAM_LONG_POLL_S
+#define TELEGRAM_LONG_POLL_S 20
+#endif
+#ifndef TELEGRAM_BODY_SIZE
+#define TELEGRAM_BODY_SIZE 2048
+#endif
+#define TELEGRAM_TEXT_SIZE 256
+
+class TelegramClient {
+public:
+  typedef void (*MessageHandler)(const char* text, size_t length);
+
+  TelegramClient(const char* token, const char* chatId);
+
+  void begin(MessageHandler handler);
+  // Advance the current request, call it from loop() while WiFi is up
+  void loop();
+  // Queue a message for the configured chat, false when one is still waiting
+  bool send(const char* text);
+
+  uint32_t polls() const { return pollCount; }
+  uint32_t handshakes() const { return handshakeCount; }
+  uint32_t lastHandshakeMs() const { return handshakeMs; }
+
+private:
+  enum Phase : uint8_t {
+    PHASE_IDLE,
+    PHASE_CONNECT,
+    PHASE_REQUEST,
+    PHASE_HEADERS,
+    PHASE_BODY,
+  };
+  enum Request : uint8_t {
+    REQUEST_UPDATES,
+    REQUEST_SEND,
+  };
+
+  void startRequest(Request request);
+  void connect();
+  void writeRequest();
+  void readHeaders();
+  void readBody();
+  bool readChunked(const uint8_t* data, size_t length);
+  void appendBody(const uint8_t* data, size_t length);
+  void finishRequest();
+  void handleUpdates();
+  void fail(const char* reason);
+
+  const char* token;
+  const char* chatId;
+  MessageHandler handler = nullptr;
+
+  BearSSL::WiFiClientSecure client;
+  BearSSL::Session session;
+
+  Phase phase = PHASE_IDLE;
+  Request request = REQUEST_UPDATES;
+  uint32_t phaseStartMs = 0;
+  uint32_t retryAtMs = 0;
+  uint8_t failures = 0;
+
+  // Response parsing
+  char line[128];
+  uint8_t lineLength = 0;
+  int statusCode = 0;
+  int32_t contentLength = -1;
+  bool chunked = false;
+  bool keepAlive = true;
+  uint8_t chunkState = 0;
+  uint32_t chunkRemaining = 0;
+  uint32_t bodyReceived = 0;
+  char body[TELEGRAM_BODY_SIZE];
+  uint16_t bodyLength = 0;
+  bool bodyOverflow = false;
+
+  int32_t lastUpdateId = 0;
+  char outgoing[TELEGRAM_TEXT_SIZE];
+  bool outgoingPending = false;
+
+  uint32_t pollCount = 0;
+  uint32_t handshakeCount = 0;
+  uint32_t handshakeMs = 0;
+};
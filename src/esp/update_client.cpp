@@ -0,0 +1,102 @@
+#include "update_client.h"
+
+#include "../log.h"
+
+// Header bytes handled per read() call
+#define UPDATE_HEADER_BUDGET 512
+
+UpdateClient::UpdateClient(const char* host, uint16_t port) : host(host), port(port) {}
+
+bool UpdateClient::get(const char* path, uint32_t from) {
+  stop();
+  client.setTimeout(1000);
+  if (!client.connect(host, port)) return false;
+  client.setNoDelay(true);
+
+  char request[192];
+  int length;
+  if (from) {
+    length = snprintf(request, sizeof(request), "GET %s HTTP/1.1\r\nHost: %s\r\nRange: bytes=%lu-\r\nConnection: close\r\n\r\n",
+                      path, host, (unsigned long)from);
+  } else {
+    length = snprintf(request, sizeof(request), "GET %s HTTP/1.1\r\nHost: %s\r\nConnection: close\r\n\r\n", path, host);
+  }
+  if (length >= (int)sizeof(request) || client.write((const uint8_t*)request, length) != (size_t)length) {
+    client.stop();
+    return false;
+  }
+
+  active = true;
+  inBody = false;
+  offset = from;
+  lineLength = 0;
+  statusCode = 0;
+  contentLength = -1;
+  chunked = false;
+  bodyReceived = 0;
+  return true;
+}
+
+// 1 at the end of the headers, 0 while waiting, -1 when the answer is not usable
+int8_t UpdateClient::readHeaders() {
+  int budget = UPDATE_HEADER_BUDGET;
+  while (budget-- > 0 && client.available()) {
+    char c = client.read();
+    if (c == '\r') continue;
+    if (c != '\n') {
+      if (lineLength < sizeof(line) - 1) line[lineLength++] = c;
+      continue;
+    }
+
+    line[lineLength] = '\0';
+    if (lineLength == 0) {
+      int expected = offset ? 206 : 200;
+      if (statusCode != expected || chunked) {
+        logWarn("Update server answered %d%s, expected %d", statusCode, chunked ? " chunked" : "", expected);
+        return -1;
+      }
+      return 1;
+    }
+    if (statusCode == 0 && strncmp(line, "HTTP/1.", 7) == 0) {
+      statusCode = atoi(line + 9);
+    } else if (strncasecmp(line, "Content-Length:", 15) == 0) {
+      contentLength = atol(line + 15);
+    } else if (strncasecmp(line, "Transfer-Encoding:", 18) == 0) {
+      chunked = strstr(line + 18, "chunked") != nullptr;
+    }
+    lineLength = 0;
+  }
+  return client.connected() || client.available() ? 0 : -1;
+}
+
+int32_t UpdateClient::read(uint8_t* data, size_t size) {
+  if (!active) return -2;
+  if (!inBody) {
+    int8_t headers = readHeaders();
+    if (headers < 0) {
+      stop();
+      return -2;
+    }
+    if (headers == 0) return 0;
+    inBody = true;
+  }
+
+  if (contentLength >= 0 && bodyReceived >= (uint32_t)contentLength) return -1;
+  size_t available = client.available();
+  if (!available) {
+    if (client.connected()) return 0;
+    // Without a length the body ends with the connection
+    return contentLength < 0 ? -1 : -2;
+  }
+  if (size > available) size = available;
+  if (contentLength >= 0 && size > (uint32_t)contentLength - bodyReceived) size = contentLength - bodyReceived;
+  int received = client.read(data, size);
+  if (received <= 0) return 0;
+  bodyReceived += received;
+  return received;
+}
+
+void UpdateClient::stop() {
+  client.stop();
+  active = false;
+}
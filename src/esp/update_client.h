@@ -0,0 +1,36 @@
+#pragma once
+
+#include <Arduino.h>
+#include <WiFiClient.h>
+
+// Plain HTTP GET against the local update server, for ota_pull.cpp.
+// get() connects and sends the request, only the connect can wait and the
+// server is on the LAN. read() parses the headers and hands out the body as it
+// arrives without waiting. A request from an offset carries a Range header and
+// needs a 206 answer, a server that ignores the range is treated as a failure.
+
+class UpdateClient {
+public:
+  UpdateClient(const char* host, uint16_t port);
+
+  bool get(const char* path, uint32_t offset);
+  // Body bytes, 0 while waiting, -1 once the body is complete, -2 on a failure
+  int32_t read(uint8_t* data, size_t size);
+  void stop();
+
+private:
+  int8_t readHeaders();
+
+  const char* host;
+  uint16_t port;
+  WiFiClient client;
+  bool active = false;
+  bool inBody = false;
+  uint32_t offset = 0;
+  char line[96];
+  uint8_t lineLength = 0;
+  int statusCode = 0;
+  int32_t contentLength = -1;
+  bool chunked = false;
+  uint32_t bodyReceived = 0;
+};
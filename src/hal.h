@@ -0,0 +1,91 @@
+#pragma once
+
+#include <Arduino.h>
+#include <time.h>
+
+// Thin hardware abstraction used by the core sunrise logic.
+// main.cpp implements it on the ESP8266, src/native/hal_native.cpp on Linux.
+
+// Milliseconds since boot
+uint32_t halMillis();
+uint32_t halMicros();
+// CPU cycle counter, it wraps after about a minute, and the CPU clock in MHz
+uint32_t halCycles();
+uint32_t halCpuMhz();
+// Free heap, largest free block and fragmentation in percent
+void halHeapInfo(uint32_t& freeBytes, uint32_t& largestBlock, uint8_t& fragmentation);
+// Current local time as epoch seconds
+time_t halNow();
+
+// Write PWM duties (0..1023) to the first `channels` LED outputs together
+void halPwmWrite(const uint16_t* duties, uint8_t channels);
+void halRestart();
+// Serial output without waiting, returns how many bytes the UART took
+size_t halSerialWrite(const char* data, size_t length);
+
+// Settings storage, SETTINGS_SECTORS flash sectors of SETTINGS_SECTOR_SIZE bytes. Like
+// NOR flash a write can only clear bits and erase sets every byte of the sector to 0xFF.
+// Offsets and sizes are multiples of 4 and buffers 4 byte aligned.
+#define SETTINGS_SECTOR_SIZE 4096
+#define SETTINGS_SECTORS 2
+bool halSettingsRead(uint8_t sector, uint32_t offset, void* data, size_t size);
+bool halSettingsWrite(uint8_t sector, uint32_t offset, const void* data, size_t size);
+bool halSettingsErase(uint8_t sector);
+
+// Small block of memory that survives a reset but not a power cut, holds garbage after power on
+bool halRtcRead(void* data, size_t size);
+bool halRtcWrite(const void* data, size_t size);
+
+// Network sinks used by the telemetry queue, false when the message could not be sent
+bool halMqttPublish(const char* topic, const char* payload, bool retained);
+bool halTelegramSend(const char* text);
+
+// Web server sockets (http_server.h), none of them waits for the network.
+// halHttpAccept() returns a new connection or -1, halHttpRead() the bytes read,
+// 0 when nothing arrived and -1 once the client closed, halHttpWrite() the bytes
+// taken, 0 while the send buffer is full and -1 when the connection is gone.
+bool halHttpListen(uint16_t port);
+int halHttpAccept();
+int32_t halHttpRead(int connection, void* data, size_t size);
+int32_t halHttpWrite(int connection, const void* data, size_t length);
+void halHttpClose(int connection);
+
+// Dashboard event stream: number of connected clients, and one event to all of them
+uint8_t halEventClients();
+bool halEventSend(const char* data);
+
+// Connectivity, driven by connectivity.cpp, every call must return quickly
+uint32_t halRandom();
+void halWifiBegin();
+bool halWifiConnected();
+// WiFi came up, on boot and after every reconnect
+void halOnWifiUp();
+// Send an SNTP request, halNtpPoll() returns true once the reply arrived
+void halNtpRequest();
+bool halNtpPoll(uint64_t& utcMs);
+// The disciplined clock (clock.h) was synced, utcEpoch is its current time
+void halSetUtcTime(uint32_t utcEpoch);
+// One connection attempt to the broker, bounded by short socket timeouts
+bool halMqttConnect();
+bool halMqttConnected();
+void halMqttLoop();
+
+// Peer sync multicast group (peer_sync.h), a unique id for this unit, one datagram
+// to the group, and the next waiting datagram or 0. Both return at once.
+uint32_t halPeerId();
+bool halPeerSend(const void* data, size_t length);
+size_t halPeerReceive(void* data, size_t size);
+
+// Pull updates from the update server (ota_pull.h), one HTTP GET at a time.
+// halUpdateGet() requests `path` from byte `offset` on, halUpdateRead() hands out
+// the body as it arrives: the byte count, 0 while waiting, -1 once the body is
+// complete and -2 when the request failed. Neither waits for the network.
+bool halUpdateGet(const char* path, uint32_t offset);
+int32_t halUpdateRead(uint8_t* data, size_t size);
+void halUpdateClose();
+// Write an image of `size` bytes next to the running firmware, a gzip image is
+// unpacked by the boot loader. halUpdateEnd(true) makes it boot next time,
+// halUpdateEnd(false) drops it.
+bool halUpdateBegin(uint32_t size);
+bool halUpdateWrite(const uint8_t* data, size_t length);
+bool halUpdateEnd(bool install);
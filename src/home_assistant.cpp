@@ -0,0 +1,195 @@
+#include "home_assistant.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "hal.h"
+#include "sunrise.h"
+#include "telemetry.h"
+#include "connectivity.h"
+#include "log.h"
+
+// Level an "ON" without brightness goes back to
+static int lastOnBrightness = -1;
+// MQTT connection the light was last announced on, see LinkStatus::upCount
+static uint32_t announcedUpCount = 0;
+
+// ----------------- Command parsing -----------------
+
+// Cursor over the unparsed part of the payload
+struct JsonCursor {
+  const char* pos;
+  const char* end;
+};
+
+static void skipSpaces(JsonCursor& json) {
+  while (json.pos < json.end && (*json.pos == ' ' || *json.pos == '\t' || *json.pos == '\r' || *json.pos == '\n')) {
+    json.pos++;
+  }
+}
+
+static bool expectChar(JsonCursor& json, char c) {
+  skipSpaces(json);
+  if (json.pos == json.end || *json.pos != c) return false;
+  json.pos++;
+  return true;
+}
+
+// A string, points into the payload with any escapes left undecoded
+static bool parseString(JsonCursor& json, const char*& text, size_t& length) {
+  if (!expectChar(json, '"')) return false;
+  text = json.pos;
+  while (json.pos < json.end && *json.pos != '"') {
+    // An escaped quote does not end the string
+    if (*json.pos == '\\' && ++json.pos == json.end) return false;
+    json.pos++;
+  }
+  length = json.pos - text;
+  return expectChar(json, '"');
+}
+
+// A non-negative number in thousandths, "1.5" is 1500
+static bool parseMilli(JsonCursor& json, uint32_t& value) {
+  skipSpaces(json);
+  uint64_t whole = 0;
+  int digits = 0;
+  while (json.pos < json.end && *json.pos >= '0' && *json.pos <= '9') {
+    if (++digits > 9) return false;
+    whole = whole * 10 + (*json.pos++ - '0');
+  }
+  if (!digits) return false;
+  uint32_t fraction = 0;
+  if (json.pos < json.end && *json.pos == '.') {
+    json.pos++;
+    uint32_t scale = 100;
+    while (json.pos < json.end && *json.pos >= '0' && *json.pos <= '9') {
+      fraction += (*json.pos++ - '0') * scale;
+      scale /= 10;
+    }
+  }
+  uint64_t milli = whole * 1000 + fraction;
+  value = milli > UINT32_MAX ? UINT32_MAX : milli;
+  return true;
+}
+
+static bool textIs(const char* text, size_t length, const char* expected) {
+  return strlen(expected) == length && memcmp(text, expected, length) == 0;
+}
+
+// Values of keys we do not use: strings, numbers, true, false and null
+static bool skipValue(JsonCursor& json) {
+  skipSpaces(json);
+  if (json.pos == json.end) return false;
+  if (*json.pos == '"') {
+    const char* text;
+    size_t length;
+    return parseString(json, text, length);
+  }
+  const char* start = json.pos;
+  while (json.pos < json.end && *json.pos != ',' && *json.pos != '}' && *json.pos != '{' && *json.pos != '[') {
+    json.pos++;
+  }
+  return json.pos > start && json.pos < json.end && *json.pos != '{' && *json.pos != '[';
+}
+
+const char* parseLightCommand(const char* payload, size_t length, LightCommand& command) {
+  JsonCursor json = { payload, payload + length };
+  command.fields = 0;
+  if (!expectChar(json, '{')) return "Expected a JSON object";
+  if (expectChar(json, '}')) return "Empty command";
+
+  do {
+    const char* key;
+    size_t keyLength;
+    if (!parseString(json, key, keyLength) || !expectChar(json, ':')) return "Expected a field name";
+
+    if (textIs(key, keyLength, "state")) {
+      const char* value;
+      size_t valueLength;
+      if (!parseString(json, value, valueLength)) return "state must be ON or OFF";
+      if (textIs(value, valueLength, "ON")) command.on = true;
+      else if (textIs(value, valueLength, "OFF")) command.on = false;
+      else return "state must be ON or OFF";
+      command.fields |= LIGHT_STATE;
+    } else if (textIs(key, keyLength, "brightness")) {
+      uint32_t milli;
+      if (!parseMilli(json, milli) || milli > (uint32_t)CIE_MAX_LEVEL * 1000) return "brightness must be between 0 and 1023";
+      command.brightness = milli / 1000;
+      command.fields |= LIGHT_BRIGHTNESS;
+    } else if (textIs(key, keyLength, "transition")) {
+      if (!parseMilli(json, command.transitionMs) || command.transitionMs > HA_MAX_TRANSITION_MS) {
+        return "transition must be between 0 and 86400 seconds";
+      }
+      command.fields |= LIGHT_TRANSITION;
+    } else if (textIs(key, keyLength, "effect")) {
+      const char* value;
+      size_t valueLength;
+      if (!parseString(json, value, valueLength) || !textIs(value, valueLength, "sunrise")) return "Unknown effect";
+      command.sunrise = true;
+      command.fields |= LIGHT_EFFECT;
+    } else if (!skipValue(json)) {
+      return "Unsupported value";
+    }
+  } while (expectChar(json, ','));
+
+  if (!expectChar(json, '}')) return "Expected , or }";
+  skipSpaces(json);
+  if (json.pos != json.end) return "Unexpected data after the object";
+  return nullptr;
+}
+
+// ----------------- Commands -----------------
+
+bool applyLightCommand(const LightCommand& command) {
+  if (command.fields & LIGHT_EFFECT) {
+    startBrightnessIncrease();
+    return true;
+  }
+
+  uint32_t transitionMs = command.fields & LIGHT_TRANSITION ? command.transitionMs : 0;
+  bool off = (command.fields & LIGHT_STATE && !command.on) ||
+             (command.fields & LIGHT_BRIGHTNESS && command.brightness == 0);
+  if (off) {
+    if (currentBrightness > 0) lastOnBrightness = currentBrightness;
+    return fadeBrightness(0, transitionMs);
+  }
+
+  int level;
+  if (command.fields & LIGHT_BRIGHTNESS) {
+    level = command.brightness;
+  } else if ((currentBrightness > 0 || sunriseRunning()) && !(command.fields & LIGHT_TRANSITION)) {
+    // Already on or a sunrise is starting, leave it alone
+    return true;
+  } else {
+    level = lastOnBrightness > 0 ? lastOnBrightness : maxBrightness;
+  }
+  lastOnBrightness = level;
+  return fadeBrightness(level, transitionMs);
+}
+
+// ----------------- Discovery -----------------
+
+size_t formatDiscoveryJson(char* buffer, size_t size) {
+  int length = snprintf(buffer, size,
+    "{\"name\":null,\"unique_id\":\"" HA_NODE_ID "_light\",\"schema\":\"json\","
+    "\"command_topic\":\"" HA_COMMAND_TOPIC "\",\"state_topic\":\"" MQTT_STATE_TOPIC "\","
+    "\"availability_topic\":\"" HA_AVAILABILITY_TOPIC "\","
+    "\"brightness\":true,\"brightness_scale\":%d,\"supported_color_modes\":[\"brightness\"],"
+    "\"effect\":true,\"effect_list\":[\"sunrise\"],"
+    "\"device\":{\"identifiers\":[\"" HA_NODE_ID "\"],\"name\":\"MorningLEDs\",\"model\":\"Sunrise lamp\"}}",
+    CIE_MAX_LEVEL);
+  return length < (int)size ? length : size - 1;
+}
+
+void homeAssistantLoop() {
+  const LinkStatus& mqtt = mqttStatus();
+  if (mqtt.state != LINK_UP || mqtt.upCount == announcedUpCount) return;
+
+  char json[HA_DISCOVERY_SIZE];
+  formatDiscoveryJson(json, sizeof(json));
+  if (halMqttPublish(HA_CONFIG_TOPIC, json, true) && halMqttPublish(HA_AVAILABILITY_TOPIC, "online", true)) {
+    announcedUpCount = mqtt.upCount;
+    // Home Assistant reads the state once it subscribed
+    telemetryStateChangedNow();
+  }
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Home Assistant MQTT light.
+// After every broker connect the light is announced with a retained discovery
+// config (JSON schema, brightness and a "sunrise" effect), so it shows up in
+// Home Assistant without YAML. Its state is the retained status document on
+// MQTT_STATE_TOPIC, which carries the state/brightness/effect keys Home
+// Assistant reads. A command's transition runs on the ramp, so a 30 minute
+// fade is one message.
+
+#ifndef HA_DISCOVERY_PREFIX
+#define HA_DISCOVERY_PREFIX "homeassistant"
+#endif
+#define HA_NODE_ID "morningleds"
+#define HA_CONFIG_TOPIC HA_DISCOVERY_PREFIX "/light/" HA_NODE_ID "/config"
+#define HA_COMMAND_TOPIC "home/morningleds/light/set"
+// "online" retained after connect, "offline" is the broker's last will
+#define HA_AVAILABILITY_TOPIC "home/morningleds/availability"
+#define HA_DISCOVERY_SIZE 448
+// Longest transition, like the sunrise duration
+#define HA_MAX_TRANSITION_MS (24UL * 3600 * 1000)
+
+enum LightCommandField : uint8_t {
+  LIGHT_STATE = 1,
+  LIGHT_BRIGHTNESS = 2,
+  LIGHT_TRANSITION = 4,
+  LIGHT_EFFECT = 8,
+};
+
+struct LightCommand {
+  uint8_t fields;
+  bool on;
+  int brightness;
+  uint32_t transitionMs;
+  bool sunrise; // effect "sunrise", the only one
+};
+
+// Parse {"state":"ON","brightness":512,"transition":1.5,"effect":"sunrise"},
+// any subset, unknown keys are skipped. Returns nullptr or what was wrong.
+const char* parseLightCommand(const char* json, size_t length, LightCommand& command);
+// Commands are queued by ingressLight() and applied from ingressLoop()
+bool applyLightCommand(const LightCommand& command);
+// Announce the light once per broker connection, call it from loop()
+void homeAssistantLoop();
+
+size_t formatDiscoveryJson(char* buffer, size_t size);
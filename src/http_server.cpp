@@ -0,0 +1,502 @@
+#include "http_server.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "hal.h"
+#include "tasks.h"
+#include "log.h"
+
+// A streamed body takes at most this many buffer refills per loop pass, the next pass continues
+#define HTTP_REFILLS_PER_PASS 2
+// Chunk framing around a filled piece: "%04x\r\n" before, "\r\n" after, room for the last "0\r\n\r\n"
+#define HTTP_CHUNK_HEAD 6
+#define HTTP_CHUNK_TAIL 7
+
+enum SlotState : uint8_t {
+  SLOT_FREE,
+  SLOT_READING, // waiting for a whole request
+  SLOT_WRITING, // sending the response, nothing is read meanwhile
+};
+
+struct Slot {
+  int socket;
+  SlotState state;
+  bool keepAlive;
+  bool answered;
+  bool chunked;
+  uint16_t requests;      // on this connection
+  uint16_t received;      // bytes in request, a pipelined next request can follow the current one
+  uint16_t outLength;
+  uint16_t outSent;
+  HttpFill fill;          // nullptr once the body is complete
+  uint32_t cursor;
+  uint32_t end;
+  uint32_t lastActivityMs;
+  char request[HTTP_REQUEST_SIZE + 1];
+  char output[HTTP_OUTPUT_SIZE];
+};
+
+static const HttpRoute* routeTable = nullptr;
+static uint8_t routeCount = 0;
+static Slot slots[HTTP_MAX_CONNECTIONS];
+static int eventSockets[HTTP_EVENT_CLIENTS];
+static uint8_t eventCount = 0;
+static uint32_t lastEventWriteMs = 0;
+static HttpStats stats = {};
+
+static bool before(uint32_t a, uint32_t b) {
+  return (int32_t)(a - b) < 0;
+}
+
+static const char* statusText(int status) {
+  switch (status) {
+    case 200: return "OK";
+    case 202: return "Accepted";
+    case 304: return "Not Modified";
+    case 400: return "Bad Request";
+    case 404: return "Not Found";
+    case 405: return "Method Not Allowed";
+    case 413: return "Payload Too Large";
+    case 431: return "Request Header Fields Too Large";
+    case 503: return "Service Unavailable";
+    default: return "Internal Server Error";
+  }
+}
+
+static void closeSlot(Slot& slot) {
+  halHttpClose(slot.socket);
+  slot.socket = -1;
+  slot.state = SLOT_FREE;
+}
+
+// Status line and headers into the empty output buffer, the length when it fits
+static size_t writeHead(Slot& slot, int status, const char* contentType, const char* lengthHeader,
+                        const char* headers) {
+  char type[64] = "";
+  if (contentType) snprintf(type, sizeof(type), "Content-Type: %s\r\n", contentType);
+  int length = snprintf(slot.output, sizeof(slot.output), "HTTP/1.1 %d %s\r\n%s%sConnection: %s\r\n%s\r\n", status,
+                        statusText(status), type, lengthHeader, slot.keepAlive ? "keep-alive" : "close", headers);
+  if (length < 0 || (size_t)length >= sizeof(slot.output)) return 0;
+  return length;
+}
+
+void httpReply(const HttpRequest& request, int status, const char* contentType, const char* body,
+               const char* headers) {
+  Slot& slot = slots[request.slot];
+  if (slot.answered) return;
+  size_t bodyLength = body ? strlen(body) : 0;
+  char lengthHeader[32];
+  snprintf(lengthHeader, sizeof(lengthHeader), "Content-Length: %u\r\n", (unsigned)bodyLength);
+  size_t length = writeHead(slot, status, contentType, lengthHeader, headers);
+  if (!length || length + bodyLength > sizeof(slot.output)) {
+    // Larger bodies are streamed, this is a bug in the handler
+    logError("HTTP reply to %s does not fit the output buffer", request.path);
+    slot.keepAlive = false;
+    length = writeHead(slot, 500, "text/plain", "Content-Length: 0\r\n", "");
+    bodyLength = 0;
+  }
+  memcpy(slot.output + length, body, bodyLength);
+  slot.outLength = length + bodyLength;
+  slot.outSent = 0;
+  slot.fill = nullptr;
+  slot.answered = true;
+}
+
+void httpStream(const HttpRequest& request, int status, const char* contentType, int32_t length, HttpFill fill,
+                uint32_t cursor, uint32_t end, const char* headers) {
+  Slot& slot = slots[request.slot];
+  if (slot.answered) return;
+  char lengthHeader[32];
+  if (length < 0) {
+    strcpy(lengthHeader, "Transfer-Encoding: chunked\r\n");
+  } else {
+    snprintf(lengthHeader, sizeof(lengthHeader), "Content-Length: %lu\r\n", (unsigned long)length);
+  }
+  slot.outLength = writeHead(slot, status, contentType, lengthHeader, headers);
+  slot.outSent = 0;
+  slot.chunked = length < 0;
+  slot.fill = fill;
+  slot.cursor = cursor;
+  slot.end = end;
+  slot.answered = true;
+}
+
+// The next piece of a streamed body into the drained output buffer
+static void refill(Slot& slot) {
+  slot.outSent = 0;
+  if (!slot.chunked) {
+    slot.outLength = slot.fill(slot.cursor, slot.end, slot.output, sizeof(slot.output));
+    if (!slot.outLength) slot.fill = nullptr;
+    return;
+  }
+  size_t length = slot.fill(slot.cursor, slot.end, slot.output + HTTP_CHUNK_HEAD,
+                            sizeof(slot.output) - HTTP_CHUNK_HEAD - HTTP_CHUNK_TAIL);
+  if (!length) {
+    memcpy(slot.output, "0\r\n\r\n", 5);
+    slot.outLength = 5;
+    slot.fill = nullptr;
+    return;
+  }
+  char head[HTTP_CHUNK_HEAD + 1];
+  snprintf(head, sizeof(head), "%04x\r\n", (unsigned)length);
+  memcpy(slot.output, head, HTTP_CHUNK_HEAD);
+  memcpy(slot.output + HTTP_CHUNK_HEAD + length, "\r\n", 2);
+  slot.outLength = HTTP_CHUNK_HEAD + length + 2;
+}
+
+// ----------------- Requests -----------------
+
+static char* findHeaderEnd(char* data, size_t length) {
+  for (size_t i = 3; i < length; i++) {
+    if (data[i] == '\n' && data[i - 1] == '\r' && data[i - 2] == '\n' && data[i - 3] == '\r') return data + i + 1;
+  }
+  return nullptr;
+}
+
+// The value when the line is the named header, nullptr otherwise
+static char* headerValue(char* line, const char* name) {
+  size_t length = strlen(name);
+  if (strncasecmp(line, name, length) != 0 || line[length] != ':') return nullptr;
+  char* value = line + length + 1;
+  while (*value == ' ') value++;
+  return value;
+}
+
+// Looked up before the headers are cut, to know whether the body is complete
+static unsigned long contentLength(char* headers, const char* headerEnd) {
+  for (char* line = headers; line < headerEnd;) {
+    char* value = headerValue(line, "Content-Length");
+    if (value) return strtoul(value, nullptr, 10);
+    char* next = strstr(line, "\r\n");
+    if (!next) break;
+    line = next + 2;
+  }
+  return 0;
+}
+
+static void answerError(const HttpRequest& request, int status, const char* body) {
+  stats.errors++;
+  httpReply(request, status, "text/plain", body);
+}
+
+static void dispatch(Slot& slot, HttpRequest& request) {
+  bool pathFound = false;
+  for (uint8_t i = 0; i < routeCount; i++) {
+    if (strcmp(routeTable[i].path, request.path) != 0) continue;
+    pathFound = true;
+    if (routeTable[i].method != request.method) continue;
+    routeTable[i].handler(request);
+    if (!slot.answered && slot.state != SLOT_FREE) {
+      logError("HTTP handler for %s did not answer", request.path);
+      slot.keepAlive = false;
+      answerError(request, 500, "No response");
+    }
+    return;
+  }
+  answerError(request, pathFound ? 405 : 404, pathFound ? "Method not allowed" : "Not found");
+}
+
+// Parse the request at the front of the buffer once it is complete and answer it.
+// False while it is still arriving.
+static bool handleRequest(Slot& slot, uint8_t index) {
+  HttpRequest request = {};
+  request.slot = index;
+  request.path = "";
+  slot.request[slot.received] = '\0';
+  char* headerEnd = findHeaderEnd(slot.request, slot.received);
+  if (!headerEnd) {
+    if (slot.received < HTTP_REQUEST_SIZE) return false;
+    slot.keepAlive = false;
+    answerError(request, 431, "Request too large");
+    return true;
+  }
+
+  size_t headerLength = headerEnd - slot.request;
+  size_t bodyLength = contentLength(slot.request, headerEnd);
+  if (headerLength + bodyLength > HTTP_REQUEST_SIZE) {
+    slot.keepAlive = false;
+    answerError(request, 413, "Body too large");
+    return true;
+  }
+  if (slot.received < headerLength + bodyLength) return false;
+
+  // Header lines are cut in place, the body stays where it is
+  slot.request[headerLength - 2] = '\0';
+  char* line = slot.request;
+  char* next = strstr(line, "\r\n");
+  if (next) *next = '\0';
+  char* target = strchr(line, ' ');
+  char* version = target ? strchr(target + 1, ' ') : nullptr;
+  if (!version) {
+    slot.keepAlive = false;
+    answerError(request, 400, "Malformed request");
+    return true;
+  }
+  *target++ = '\0';
+  *version++ = '\0';
+  request.method = strcmp(line, "GET") == 0 ? HTTP_METHOD_GET :
+                   strcmp(line, "POST") == 0 ? HTTP_METHOD_POST : HTTP_METHOD_OTHER;
+  char* query = strchr(target, '?');
+  if (query) *query++ = '\0';
+  request.path = target;
+  request.query = query ? query : "";
+  request.ifNoneMatch = "";
+  // HTTP/1.0 closes unless asked otherwise
+  slot.keepAlive = strcmp(version, "HTTP/1.0") != 0;
+  while (next) {
+    line = next + 2;
+    next = strstr(line, "\r\n");
+    if (next) *next = '\0';
+    char* value;
+    if ((value = headerValue(line, "Connection"))) {
+      if (strcasecmp(value, "close") == 0) slot.keepAlive = false;
+      if (strcasecmp(value, "keep-alive") == 0) slot.keepAlive = true;
+    } else if ((value = headerValue(line, "If-None-Match"))) {
+      request.ifNoneMatch = value;
+    }
+  }
+
+  request.body = headerEnd;
+  request.bodyLength = bodyLength;
+  size_t consumed = headerLength + bodyLength;
+  // The body ends in a terminator for the handler, the byte under it can belong to the next request
+  char saved = slot.request[consumed];
+  slot.request[consumed] = '\0';
+  stats.requests++;
+  if (slot.requests++) stats.reused++;
+  if (slot.requests == HTTP_KEEPALIVE_REQUESTS) slot.keepAlive = false;
+  dispatch(slot, request);
+  if (slot.state == SLOT_FREE) return true;
+  slot.request[consumed] = saved;
+  slot.received -= consumed;
+  memmove(slot.request, slot.request + consumed, slot.received);
+  return true;
+}
+
+// ----------------- Connections -----------------
+
+static void startReading(Slot& slot, uint8_t index, uint32_t now) {
+  slot.state = SLOT_READING;
+  slot.answered = false;
+  slot.lastActivityMs = now;
+  // A pipelined request may already be complete
+  if (slot.received && handleRequest(slot, index) && slot.state != SLOT_FREE) slot.state = SLOT_WRITING;
+}
+
+static void readRequest(Slot& slot, uint8_t index, uint32_t now) {
+  int32_t length = halHttpRead(slot.socket, slot.request + slot.received, HTTP_REQUEST_SIZE - slot.received);
+  if (length < 0) {
+    closeSlot(slot);
+    return;
+  }
+  if (length == 0) {
+    if (now - slot.lastActivityMs > HTTP_IDLE_TIMEOUT_MS) {
+      // An idle kept alive connection is not an error, a request cut off midway is
+      if (slot.received) stats.timeouts++;
+      closeSlot(slot);
+    }
+    return;
+  }
+  slot.received += length;
+  slot.lastActivityMs = now;
+  if (handleRequest(slot, index) && slot.state != SLOT_FREE) slot.state = SLOT_WRITING;
+}
+
+static void writeResponse(Slot& slot, uint8_t index, uint32_t now) {
+  for (uint8_t refills = 0;;) {
+    if (slot.outSent < slot.outLength) {
+      int32_t length = halHttpWrite(slot.socket, slot.output + slot.outSent, slot.outLength - slot.outSent);
+      if (length < 0) {
+        closeSlot(slot);
+        return;
+      }
+      if (length > 0) {
+        slot.outSent += length;
+        slot.lastActivityMs = now;
+      }
+      if (slot.outSent < slot.outLength) {
+        if (now - slot.lastActivityMs > HTTP_WRITE_TIMEOUT_MS) {
+          stats.timeouts++;
+          closeSlot(slot);
+        }
+        return;
+      }
+    }
+    if (!slot.fill) break;
+    if (refills++ == HTTP_REFILLS_PER_PASS) return;
+    refill(slot);
+  }
+
+  if (!slot.keepAlive) {
+    closeSlot(slot);
+    return;
+  }
+  startReading(slot, index, now);
+}
+
+// A free slot, or else the one kept alive the longest without a request
+static int8_t slotForNewClient(uint32_t now) {
+  int8_t idlest = -1;
+  for (uint8_t i = 0; i < HTTP_MAX_CONNECTIONS; i++) {
+    const Slot& slot = slots[i];
+    if (slot.state == SLOT_FREE) return i;
+    if (slot.state != SLOT_READING || slot.received || !slot.requests) continue;
+    if (now - slot.lastActivityMs < HTTP_REUSE_IDLE_MS) continue;
+    if (idlest < 0 || before(slot.lastActivityMs, slots[idlest].lastActivityMs)) idlest = i;
+  }
+  return idlest;
+}
+
+static void acceptConnections(uint32_t now) {
+  // Clients beyond the slots wait in the network stack's backlog
+  for (;;) {
+    int8_t index = slotForNewClient(now);
+    if (index < 0) return;
+    int socket = halHttpAccept();
+    if (socket < 0) return;
+    Slot& slot = slots[index];
+    if (slot.state != SLOT_FREE) {
+      // Browsers keep spare connections open, they reconnect when they need them
+      closeSlot(slot);
+      stats.reclaimed++;
+    }
+    slot.socket = socket;
+    slot.requests = 0;
+    slot.received = 0;
+    slot.outLength = 0;
+    slot.outSent = 0;
+    slot.fill = nullptr;
+    startReading(slot, index, now);
+    stats.connections++;
+    uint8_t used = 0;
+    for (const Slot& other : slots) {
+      if (other.state != SLOT_FREE) used++;
+    }
+    if (used > stats.maxSlotsUsed) stats.maxSlotsUsed = used;
+  }
+}
+
+void httpServerBegin(const HttpRoute* routes, uint8_t count, uint16_t port) {
+  routeTable = routes;
+  routeCount = count;
+  for (Slot& slot : slots) {
+    slot.socket = -1;
+    slot.state = SLOT_FREE;
+  }
+  if (!halHttpListen(port)) logError("HTTP server cannot listen on port %u", port);
+}
+
+static void eventsLoop(uint32_t now);
+
+void httpServerLoop() {
+  if (!routeTable) return;
+  uint32_t now = halMillis();
+  acceptConnections(now);
+  for (uint8_t i = 0; i < HTTP_MAX_CONNECTIONS; i++) {
+    Slot& slot = slots[i];
+    if (slot.state == SLOT_READING) readRequest(slot, i, now);
+    if (slot.state == SLOT_WRITING) writeResponse(slot, i, now);
+  }
+  eventsLoop(now);
+}
+
+static const char* argValue(const HttpRequest& request, const char* name) {
+  size_t length = strlen(name);
+  for (const char* arg = request.query; *arg;) {
+    if (strncmp(arg, name, length) == 0 && arg[length] == '=') return arg + length + 1;
+    const char* next = strchr(arg, '&');
+    if (!next) break;
+    arg = next + 1;
+  }
+  return nullptr;
+}
+
+bool httpArg(const HttpRequest& request, const char* name, int& value) {
+  const char* text = argValue(request, name);
+  if (text) value = atoi(text);
+  return text;
+}
+
+bool httpArg(const HttpRequest& request, const char* name, uint32_t& value) {
+  const char* text = argValue(request, name);
+  if (text) value = strtoul(text, nullptr, 10);
+  return text;
+}
+
+// ----------------- Events -----------------
+
+static void dropEventClient(uint8_t index) {
+  halHttpClose(eventSockets[index]);
+  // Keep the live clients packed at the front
+  eventSockets[index] = eventSockets[--eventCount];
+}
+
+// The whole text or nothing, a partial event would corrupt the stream
+static bool writeEvent(int socket, const char* text, size_t length) {
+  return halHttpWrite(socket, text, length) == (int32_t)length;
+}
+
+bool httpAcceptEvents(const HttpRequest& request, const char* initialData) {
+  if (eventCount == HTTP_EVENT_CLIENTS) return false;
+  Slot& slot = slots[request.slot];
+
+  char text[160 + HTTP_EVENT_SIZE];
+  int length = snprintf(text, sizeof(text),
+                        "HTTP/1.1 200 OK\r\n"
+                        "Content-Type: text/event-stream\r\n"
+                        "Cache-Control: no-cache\r\n"
+                        "Connection: keep-alive\r\n"
+                        "\r\n"
+                        "retry: 3000\n\n"
+                        "data: %s\n\n", initialData);
+  // The connection leaves its slot, which is free for the next client
+  int socket = slot.socket;
+  slot.socket = -1;
+  slot.state = SLOT_FREE;
+  slot.answered = true;
+  if (length < 0 || (size_t)length >= sizeof(text) || !writeEvent(socket, text, length)) {
+    halHttpClose(socket);
+    return true;
+  }
+  eventSockets[eventCount++] = socket;
+  return true;
+}
+
+uint8_t httpEventClients() {
+  return eventCount;
+}
+
+bool httpEventSend(const char* data) {
+  if (!eventCount) return false;
+  char text[HTTP_EVENT_SIZE + 8];
+  int length = snprintf(text, sizeof(text), "data: %s\n\n", data);
+  if (length < 0 || (size_t)length >= sizeof(text)) return false;
+  for (uint8_t i = eventCount; i-- > 0;) {
+    if (!writeEvent(eventSockets[i], text, length)) dropEventClient(i);
+    // A write can wait on the network stack, the light goes first
+    tasksYield();
+  }
+  lastEventWriteMs = halMillis();
+  return eventCount > 0;
+}
+
+static void eventsLoop(uint32_t now) {
+  char discard[64];
+  for (uint8_t i = eventCount; i-- > 0;) {
+    // Nothing is expected from an event client, reading shows when it went away
+    if (halHttpRead(eventSockets[i], discard, sizeof(discard)) < 0) dropEventClient(i);
+  }
+  if (eventCount && now - lastEventWriteMs >= HTTP_EVENT_KEEPALIVE_MS) {
+    for (uint8_t i = eventCount; i-- > 0;) {
+      if (!writeEvent(eventSockets[i], ":\n\n", 3)) dropEventClient(i);
+    }
+    lastEventWriteMs = now;
+  }
+}
+
+const HttpStats& httpServerStats() {
+  return stats;
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Event driven HTTP/1.1 server for the dashboard and the API.
+// A few connection slots, each with a fixed request and output buffer, are
+// advanced a step per loop() pass: read what arrived, parse once the request
+// is complete, answer, write what the socket takes. Nothing waits for a
+// client, so a phone on bad WiFi only holds its own slot while other tabs are
+// served. Connections are kept alive. Bodies that do not fit the output buffer
+// are streamed: a fill function produces the next piece whenever the buffer
+// has drained, with a Content-Length when the size is known, chunked otherwise.
+// Server-Sent Events leave the slots for a table of their own, see httpAcceptEvents().
+
+#ifndef HTTP_PORT
+#define HTTP_PORT 80
+#endif
+#ifndef HTTP_MAX_CONNECTIONS
+#define HTTP_MAX_CONNECTIONS 4
+#endif
+// Request line, headers and body of one request
+#ifndef HTTP_REQUEST_SIZE
+#define HTTP_REQUEST_SIZE 768
+#endif
+// One piece of a response with its chunk framing, a metrics chunk fits
+#ifndef HTTP_OUTPUT_SIZE
+#define HTTP_OUTPUT_SIZE 1100
+#endif
+// Open dashboards, each holds its connection but no buffers
+#ifndef HTTP_EVENT_CLIENTS
+#define HTTP_EVENT_CLIENTS 3
+#endif
+#define HTTP_EVENT_SIZE 400
+// A kept alive connection without a request, or a request not complete, for this long is closed
+#define HTTP_IDLE_TIMEOUT_MS 5000
+// A connection is closed after this many requests, so clients waiting for a slot get their turn
+#define HTTP_KEEPALIVE_REQUESTS 100
+// When every slot is taken, a connection kept alive this long without a request makes room for a new client
+#define HTTP_REUSE_IDLE_MS 1000
+// A client that takes nothing of the response for this long is dropped
+#define HTTP_WRITE_TIMEOUT_MS 10000
+// Comment line sent to idle event clients so proxies and the browser keep the stream open
+#define HTTP_EVENT_KEEPALIVE_MS 15000
+
+enum HttpMethod : uint8_t {
+  HTTP_METHOD_GET,
+  HTTP_METHOD_POST,
+  HTTP_METHOD_OTHER,
+};
+
+// Parsed in place in the slot's buffer, valid until the handler returns
+struct HttpRequest {
+  HttpMethod method;
+  const char* path;        // without the query
+  const char* query;       // "" when there is none
+  const char* ifNoneMatch; // "" when the header is absent
+  const char* body;
+  size_t bodyLength;
+  uint8_t slot;
+};
+
+// Write the next piece of a streamed body into buffer from `cursor` on, advance
+// it and return the length, 0 once the body is complete. `end` is what the
+// handler passed along with the cursor.
+typedef size_t (*HttpFill)(uint32_t& cursor, uint32_t end, char* buffer, size_t size);
+typedef void (*HttpHandler)(const HttpRequest& request);
+
+struct HttpRoute {
+  HttpMethod method;
+  const char* path;
+  HttpHandler handler;
+};
+
+struct HttpStats {
+  uint32_t connections;
+  uint32_t requests;
+  uint32_t reused;       // requests on a connection kept alive from an earlier one
+  uint32_t errors;       // answered by the server itself: malformed, too large, not found
+  uint32_t timeouts;
+  uint32_t reclaimed;    // idle kept alive connections closed for a new client
+  uint8_t maxSlotsUsed;
+};
+
+// Listen on `port` and answer with the routes, the table must outlive the server
+void httpServerBegin(const HttpRoute* routes, uint8_t count, uint16_t port);
+// Advance every connection a step, call it from loop()
+void httpServerLoop();
+
+// A handler answers once with one of these. Extra headers are whole lines ending in "\r\n".
+void httpReply(const HttpRequest& request, int status, const char* contentType, const char* body,
+               const char* headers = "");
+// length -1 sends the body chunked
+void httpStream(const HttpRequest& request, int status, const char* contentType, int32_t length, HttpFill fill,
+                uint32_t cursor, uint32_t end, const char* headers = "");
+// Integer query argument, false when it is missing
+bool httpArg(const HttpRequest& request, const char* name, int& value);
+bool httpArg(const HttpRequest& request, const char* name, uint32_t& value);
+
+// Answer with an event stream starting with initialData and keep the connection.
+// False when every event slot is taken, the request still has to be answered.
+bool httpAcceptEvents(const HttpRequest& request, const char* initialData);
+uint8_t httpEventClients();
+// One event to every client, a client that cannot take it whole is dropped
+bool httpEventSend(const char* data);
+
+const HttpStats& httpServerStats();
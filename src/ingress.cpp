@@ -0,0 +1,198 @@
+#include "ingress.h"
+
+#include <atomic>
+#include <string.h>
+
+#include "commands.h"
+#include "telemetry.h"
+#include "log.h"
+
+static_assert((INGRESS_QUEUE_SIZE & (INGRESS_QUEUE_SIZE - 1)) == 0 && INGRESS_QUEUE_SIZE <= 128,
+              "INGRESS_QUEUE_SIZE must be a power of 2 up to 128");
+#define INGRESS_MASK (INGRESS_QUEUE_SIZE - 1)
+
+struct IngressEntry {
+  IngressKind kind;
+  uint8_t replySinks;
+  uint16_t length;
+  union {
+    SettingsUpdate settings;
+    LightCommand light;
+    char text[INGRESS_TEXT_SIZE];
+  };
+};
+
+static IngressEntry entries[INGRESS_QUEUE_SIZE];
+// Free running, head is only written by the producer and tail by the consumer.
+// Only loads and stores are used, they need no atomic read-modify-write.
+static std::atomic<uint8_t> head(0);
+static std::atomic<uint8_t> tail(0);
+static IngressStats stats = {};
+
+// Slot for a new entry, nullptr when the queue is full
+static IngressEntry* reserve() {
+  uint8_t h = head.load(std::memory_order_relaxed);
+  if ((uint8_t)(h - tail.load(std::memory_order_acquire)) == INGRESS_QUEUE_SIZE) {
+    stats.dropped++;
+    return nullptr;
+  }
+  return &entries[h & INGRESS_MASK];
+}
+
+static void publish() {
+  head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+  stats.queued++;
+}
+
+// MQTT and Telegram senders only learn about a rejection from a reply
+static void replyRejected(uint8_t replySinks, MessageKey key, const char* format, const char* error) {
+  telemetrySetReplySinks(replySinks);
+  sendKeyedMessagef(key, true, false, format, error);
+  telemetrySetReplySinks(0);
+}
+
+const char* ingressSettings(const SettingsUpdate& update, uint8_t replySinks) {
+  const char* error = validateSettings(update);
+  if (error) return error;
+  IngressEntry* entry = reserve();
+  if (!entry) return "Too many pending commands";
+  entry->kind = INGRESS_SETTINGS;
+  entry->replySinks = replySinks;
+  entry->settings = update;
+  publish();
+  return nullptr;
+}
+
+const char* ingressCommand(const char* text, size_t length, uint8_t replySinks) {
+  const char* start = text;
+  while (start < text + length && (*start == ' ' || *start == '\r' || *start == '\n')) start++;
+  if (start < text + length && *start == '{') {
+    // Settings objects coalesce with the dashboard's, so they are queued parsed
+    SettingsUpdate update;
+    const char* error = parseSettingsJson(text, length, update);
+    if (!error) error = ingressSettings(update, replySinks);
+    if (error) replyRejected(replySinks, MESSAGE_NO_KEY, "Settings rejected: %s", error);
+    return error;
+  }
+
+  if (length > INGRESS_TEXT_SIZE) {
+    logWarn("Command of %u bytes dropped", (unsigned)length);
+    replyRejected(replySinks, MESSAGE_NO_KEY, "%s", "Command too long");
+    return "Command too long";
+  }
+  IngressEntry* entry = reserve();
+  if (!entry) {
+    logWarn("Ingress queue full, command dropped");
+    // A burst past the queue gets one reply
+    replyRejected(replySinks, MESSAGE_QUEUE_FULL, "%s", "Too many pending commands");
+    return "Too many pending commands";
+  }
+  entry->kind = INGRESS_COMMAND;
+  entry->replySinks = replySinks;
+  entry->length = length;
+  memcpy(entry->text, text, length);
+  publish();
+  return nullptr;
+}
+
+const char* ingressLight(const char* json, size_t length) {
+  LightCommand command;
+  const char* error = parseLightCommand(json, length, command);
+  if (!error) {
+    IngressEntry* entry = reserve();
+    if (entry) {
+      entry->kind = INGRESS_LIGHT;
+      entry->replySinks = 0;
+      entry->light = command;
+      publish();
+      return nullptr;
+    }
+    error = "Too many pending commands";
+  }
+  logWarn("Light command rejected: %s", error);
+  sendMessagef(true, false, "Light command rejected: %s", error);
+  // Home Assistant assumed the change, correct it
+  telemetryStateChangedNow();
+  return error;
+}
+
+// ----------------- Drain -----------------
+
+// Later fields replace earlier ones, the sunrise time is one field
+static void mergeSettings(SettingsUpdate& into, const SettingsUpdate& update) {
+  if (update.fields & SETTING_BRIGHTNESS) into.currentBrightness = update.currentBrightness;
+  if (update.fields & SETTING_MAX_BRIGHTNESS) into.maxBrightness = update.maxBrightness;
+  if (update.fields & SETTING_DURATION) into.sunriseDuration = update.sunriseDuration;
+  if (update.fields & SETTING_SUNRISE_TIME) {
+    into.hour = update.hour;
+    into.minute = update.minute;
+  }
+  into.fields |= update.fields;
+}
+
+static void applyPendingSettings(SettingsUpdate& pending, uint8_t& sinks) {
+  if (!pending.fields) return;
+  telemetrySetReplySinks(sinks);
+  // Validated when queued, only the free schedule check can change in between
+  const char* error = applySettings(pending);
+  if (error) sendMessagef(true, false, "Settings rejected: %s", error);
+  telemetrySetReplySinks(0);
+  stats.applied++;
+  pending.fields = 0;
+  sinks = 0;
+}
+
+void ingressLoop() {
+  uint8_t t = tail.load(std::memory_order_relaxed);
+  uint8_t h = head.load(std::memory_order_acquire);
+  if (t == h) return;
+
+  SettingsUpdate pending = {};
+  uint8_t pendingSinks = 0;
+  for (; t != h; t++) {
+    const IngressEntry& entry = entries[t & INGRESS_MASK];
+    switch (entry.kind) {
+      case INGRESS_SETTINGS:
+        if (pending.fields) stats.coalesced++;
+        mergeSettings(pending, entry.settings);
+        pendingSinks |= entry.replySinks;
+        break;
+
+      case INGRESS_LIGHT: {
+        // A later light command before the next text command replaces this one
+        bool replaced = false;
+        for (uint8_t next = t + 1; next != h; next++) {
+          IngressKind kind = entries[next & INGRESS_MASK].kind;
+          if (kind == INGRESS_COMMAND) break;
+          if (kind == INGRESS_LIGHT) {
+            replaced = true;
+            break;
+          }
+        }
+        if (replaced) {
+          stats.coalesced++;
+          break;
+        }
+        // Light commands and settings both set the brightness, keep their order
+        applyPendingSettings(pending, pendingSinks);
+        applyLightCommand(entry.light);
+        stats.applied++;
+        break;
+      }
+
+      case INGRESS_COMMAND:
+        applyPendingSettings(pending, pendingSinks);
+        telemetrySetReplySinks(entry.replySinks);
+        actByMessage(entry.text, entry.length);
+        telemetrySetReplySinks(0);
+        stats.applied++;
+        break;
+    }
+  }
+  applyPendingSettings(pending, pendingSinks);
+  tail.store(h, std::memory_order_release);
+}
+
+const IngressStats& ingressStats() {
+  return stats;
+}
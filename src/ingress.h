@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "sunrise.h"
+#include "home_assistant.h"
+
+// Ingress command queue.
+// The web server, MQTT and Telegram callbacks do not act on commands, they
+// validate them and push typed entries into a fixed single producer, single
+// consumer ring. ingressLoop() drains it once per loop() pass. While draining,
+// repeated settings of the same parameter collapse to the latest value and
+// are applied and reported once, and only the last light command of a burst
+// runs. Text commands keep their order, a pending settings update is applied
+// before the next text command so the two never swap.
+
+// Entries, a power of 2
+#ifndef INGRESS_QUEUE_SIZE
+#define INGRESS_QUEUE_SIZE 8
+#endif
+// Longest text command, the MQTT and Telegram payloads are copied. A /program
+// with every keyframe fits.
+#define INGRESS_TEXT_SIZE 192
+
+enum IngressKind : uint8_t {
+  INGRESS_SETTINGS, // validated SettingsUpdate, coalesced per field
+  INGRESS_LIGHT,    // parsed Home Assistant command, the last one wins
+  INGRESS_COMMAND,  // text command for actByMessage()
+};
+
+struct IngressStats {
+  uint32_t queued;
+  uint32_t coalesced; // entries folded into a later one
+  uint32_t dropped;   // queue full
+  uint32_t applied;
+};
+
+// Producers. Each returns nullptr when queued, otherwise why not.
+// replySinks are the extra telemetry sinks replies go to, see telemetrySetReplySinks()
+const char* ingressSettings(const SettingsUpdate& update, uint8_t replySinks);
+// A text command, a settings JSON object is validated and queued as settings.
+// A rejected one is also replied to the sender.
+const char* ingressCommand(const char* text, size_t length, uint8_t replySinks);
+// A payload from HA_COMMAND_TOPIC
+const char* ingressLight(const char* json, size_t length);
+
+// Apply everything queued, call it once per loop()
+void ingressLoop();
+
+const IngressStats& ingressStats();
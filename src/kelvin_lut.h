@@ -0,0 +1,80 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "cie_lut.h"
+
+// Color temperature -> linear RGB of a black body, red is always full below 6600 K.
+// From Mitchell Charity's black body sRGB table (10 degree CMFs), with the sRGB
+// gamma removed so the values are linear PWM weights, scaled to KELVIN_ONE.
+
+#define KELVIN_LUT_MIN 1000
+#define KELVIN_LUT_MAX 6500
+#define KELVIN_LUT_STEP 100
+#define KELVIN_LUT_SIZE ((KELVIN_LUT_MAX - KELVIN_LUT_MIN) / KELVIN_LUT_STEP + 1)
+// Channel weight of 1.0
+#define KELVIN_ONE 32768
+
+struct KelvinGreenBlue {
+  uint16_t green;
+  uint16_t blue;
+};
+
+static const KelvinGreenBlue kelvinLut[KELVIN_LUT_SIZE] PROGMEM = {
+  {  1296,     0 }, // 1000 K
+  {  2065,     0 }, // 1100 K
+  {  2834,     0 }, // 1200 K
+  {  3587,     0 }, // 1300 K
+  {  4264,     0 }, // 1400 K
+  {  5011,     0 }, // 1500 K
+  {  5618,     0 }, // 1600 K
+  {  6265,     0 }, // 1700 K
+  {  6837,     0 }, // 1800 K
+  {  7437,     0 }, // 1900 K
+  {  8328,   198 }, // 2000 K
+  {  8864,   498 }, // 2100 K
+  {  9561,   825 }, // 2200 K
+  { 10289,  1209 }, // 2300 K
+  { 11048,  1629 }, // 2400 K
+  { 11679,  2123 }, // 2500 K
+  { 12329,  2562 }, // 2600 K
+  { 13001,  3123 }, // 2700 K
+  { 13693,  3668 }, // 2800 K
+  { 14407,  4264 }, // 2900 K
+  { 14956,  4818 }, // 3000 K
+  { 15706,  5514 }, // 3100 K
+  { 16284,  6155 }, // 3200 K
+  { 16873,  6837 }, // 3300 K
+  { 17474,  7561 }, // 3400 K
+  { 18088,  8197 }, // 3500 K
+  { 18715,  9001 }, // 3600 K
+  { 19139,  9704 }, // 3700 K
+  { 19786, 10438 }, // 3800 K
+  { 20225, 11361 }, // 3900 K
+  { 20893, 12001 }, // 4000 K
+  { 21345, 12831 }, // 4100 K
+  { 21803, 13693 }, // 4200 K
+  { 22267, 14407 }, // 4300 K
+  { 22737, 15328 }, // 4400 K
+  { 23212, 16090 }, // 4500 K
+  { 23693, 16873 }, // 4600 K
+  { 24180, 17678 }, // 4700 K
+  { 24672, 18504 }, // 4800 K
+  { 25171, 19353 }, // 4900 K
+  { 25422, 20225 }, // 5000 K
+  { 25929, 21118 }, // 5100 K
+  { 26442, 21803 }, // 5200 K
+  { 26701, 22737 }, // 5300 K
+  { 27223, 23452 }, // 5400 K
+  { 27486, 24425 }, // 5500 K
+  { 28016, 25171 }, // 5600 K
+  { 28284, 25929 }, // 5700 K
+  { 28553, 26701 }, // 5800 K
+  { 29095, 27486 }, // 5900 K
+  { 29369, 28284 }, // 6000 K
+  { 29644, 29095 }, // 6100 K
+  { 29920, 29920 }, // 6200 K
+  { 30198, 30759 }, // 6300 K
+  { 30759, 31611 }, // 6400 K
+  { 31041, 32186 }, // 6500 K
+};
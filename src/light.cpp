@@ -0,0 +1,93 @@
+#include "light.h"
+
+#include "hal.h"
+#include "ramp.h"
+#include "kelvin_lut.h"
+#include "dither.h"
+
+// Level fraction covered by one curve row
+#define CURVE_ROW_BITS 10
+static_assert((CIE_LEVELS << RAMP_LEVEL_FRAC_BITS) == (LIGHT_CURVE_STEPS << CURVE_ROW_BITS), "curve must span every level");
+
+static uint8_t channels = 0;
+// Channel weights out of KELVIN_ONE, one row past the top level for the interpolation
+static uint16_t curve[LIGHT_CURVE_STEPS + 1][LIGHT_MAX_CHANNELS];
+// Duties with CIE_DUTY_FRAC_BITS fractional bits, the dither turns them into PWM steps
+static uint16_t duties[LIGHT_MAX_CHANNELS];
+
+static uint16_t rowKelvin(uint8_t row) {
+  return LIGHT_START_KELVIN + (int32_t)(LIGHT_END_KELVIN - LIGHT_START_KELVIN) * row / LIGHT_CURVE_STEPS;
+}
+
+// Linear green and blue of a black body, interpolated between the 100 K table steps
+static void blackBody(uint16_t kelvin, uint32_t& green, uint32_t& blue) {
+  if (kelvin < KELVIN_LUT_MIN) kelvin = KELVIN_LUT_MIN;
+  if (kelvin > KELVIN_LUT_MAX) kelvin = KELVIN_LUT_MAX;
+  uint16_t index = (kelvin - KELVIN_LUT_MIN) / KELVIN_LUT_STEP;
+  uint16_t frac = (kelvin - KELVIN_LUT_MIN) % KELVIN_LUT_STEP;
+  uint16_t next = index + 1 < KELVIN_LUT_SIZE ? index + 1 : index;
+  uint32_t g0 = pgm_read_word(&kelvinLut[index].green);
+  uint32_t g1 = pgm_read_word(&kelvinLut[next].green);
+  uint32_t b0 = pgm_read_word(&kelvinLut[index].blue);
+  uint32_t b1 = pgm_read_word(&kelvinLut[next].blue);
+  green = (g0 * (KELVIN_LUT_STEP - frac) + g1 * frac) / KELVIN_LUT_STEP;
+  blue = (b0 * (KELVIN_LUT_STEP - frac) + b1 * frac) / KELVIN_LUT_STEP;
+}
+
+// Share of the cool strip for a color temperature, blended in mired so it looks even
+static uint32_t coolShare(uint16_t kelvin) {
+  if (kelvin <= LIGHT_WARM_KELVIN) return 0;
+  if (kelvin >= LIGHT_COOL_KELVIN) return KELVIN_ONE;
+  uint32_t warmMired = 1000000UL / LIGHT_WARM_KELVIN;
+  uint32_t coolMired = 1000000UL / LIGHT_COOL_KELVIN;
+  return (warmMired - 1000000UL / kelvin) * KELVIN_ONE / (warmMired - coolMired);
+}
+
+void lightBegin(LightLayout layout) {
+  channels = layout;
+  for (uint8_t row = 0; row <= LIGHT_CURVE_STEPS; row++) {
+    uint16_t kelvin = rowKelvin(row);
+    uint16_t* mix = curve[row];
+    if (layout == LIGHT_RGB) {
+      uint32_t green;
+      uint32_t blue;
+      blackBody(kelvin, green, blue);
+      mix[0] = KELVIN_ONE;
+      mix[1] = green;
+      mix[2] = blue;
+    } else if (layout == LIGHT_WARM_COOL) {
+      // The two strips add up to the same light output at any temperature
+      uint32_t cool = coolShare(kelvin);
+      mix[0] = KELVIN_ONE - cool;
+      mix[1] = cool;
+    } else {
+      mix[0] = KELVIN_ONE;
+    }
+  }
+}
+
+void lightWrite(uint32_t levelFrac, uint16_t dutyFrac) {
+  uint32_t row = levelFrac >> CURVE_ROW_BITS;
+  if (row >= LIGHT_CURVE_STEPS) row = LIGHT_CURVE_STEPS - 1;
+  int32_t frac = levelFrac - (row << CURVE_ROW_BITS);
+  const uint16_t* low = curve[row];
+  const uint16_t* high = curve[row + 1];
+
+  for (uint8_t channel = 0; channel < channels; channel++) {
+    uint32_t weight = low[channel] + (((int32_t)high[channel] - low[channel]) * frac >> CURVE_ROW_BITS);
+    duties[channel] = ((uint32_t)dutyFrac * weight + (1UL << 14)) >> 15;
+  }
+  ditherSet(duties, channels);
+}
+
+uint8_t lightChannels() {
+  return channels;
+}
+
+const uint16_t* lightDuties() {
+  return duties;
+}
+
+uint16_t lightKelvin(uint16_t level) {
+  return LIGHT_START_KELVIN + (int32_t)(LIGHT_END_KELVIN - LIGHT_START_KELVIN) * level / CIE_LEVELS;
+}
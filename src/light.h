@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stdint.h>
+
+// Multi-channel light output.
+// Every write sets all channels at once from one brightness and a color
+// temperature that follows the perceptual level: a sunrise starts deep amber
+// and ends in daylight, and a dimmed light stays warm. The channel mix along
+// that curve is built once by lightBegin() from the black body table, so a
+// ramp tick only interpolates two rows in fixed point.
+
+// The value is the number of channels, one PWM pin each
+enum LightLayout : uint8_t {
+  LIGHT_MONO = 1,      // single white channel, like before
+  LIGHT_WARM_COOL = 2, // warm white, cool white
+  LIGHT_RGB = 3,       // red, green, blue
+};
+#define LIGHT_MAX_CHANNELS 3
+
+// Color temperature at level 0 and at the top level
+#ifndef LIGHT_START_KELVIN
+#define LIGHT_START_KELVIN 1800
+#endif
+#ifndef LIGHT_END_KELVIN
+#define LIGHT_END_KELVIN 5000
+#endif
+// Color temperature of the two white strips in LIGHT_WARM_COOL
+#ifndef LIGHT_WARM_KELVIN
+#define LIGHT_WARM_KELVIN 2700
+#endif
+#ifndef LIGHT_COOL_KELVIN
+#define LIGHT_COOL_KELVIN 6500
+#endif
+
+// Rows of the level -> channel mix curve
+#define LIGHT_CURVE_STEPS 64
+
+void lightBegin(LightLayout layout);
+// Write dutyFrac (CIE_DUTY_FRAC_BITS fractional bits) at the color of levelFrac
+// (RAMP_LEVEL_FRAC_BITS fractional bits) to every channel with one PWM write,
+// the fraction is kept for the dither, see dither.h
+void lightWrite(uint32_t levelFrac, uint16_t dutyFrac);
+
+uint8_t lightChannels();
+// Duties of the last write with CIE_DUTY_FRAC_BITS fractional bits, one per channel
+const uint16_t* lightDuties();
+// Color temperature at a whole level
+uint16_t lightKelvin(uint16_t level);
@@ -0,0 +1,116 @@
+#include "log.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "hal.h"
+
+static_assert((LOG_BUFFER_SIZE & (LOG_BUFFER_SIZE - 1)) == 0, "LOG_BUFFER_SIZE must be a power of 2");
+#define LOG_MASK (LOG_BUFFER_SIZE - 1)
+
+static char ring[LOG_BUFFER_SIZE];
+// Byte positions since boot, the ring holds oldest..end
+static uint32_t oldest = 0;
+static uint32_t end = 0;
+static uint32_t serialPosition = 0;
+static uint32_t dumpPosition = 0;
+static bool dumpActive = false;
+static LogStats stats = {};
+
+static const char levelLetters[] = "-EWID";
+
+// Positions are compared with a signed difference, they wrap after 4 GB of log
+static bool before(uint32_t a, uint32_t b) {
+  return (int32_t)(a - b) < 0;
+}
+
+void logWrite(uint8_t level, const char* format, ...) {
+  char line[LOG_LINE_SIZE];
+  uint32_t now = halMillis();
+  int prefix = snprintf(line, sizeof(line), "%lu.%03lu %c ", (unsigned long)(now / 1000), (unsigned long)(now % 1000),
+                        levelLetters[level <= LOG_LEVEL_DEBUG ? level : 0]);
+  va_list args;
+  va_start(args, format);
+  int written = vsnprintf(line + prefix, sizeof(line) - prefix, format, args);
+  va_end(args);
+  size_t length = prefix + (written > 0 ? written : 0);
+  if (length > sizeof(line) - 2) {
+    length = sizeof(line) - 2;
+    stats.truncated++;
+  }
+  line[length++] = '\n';
+
+  // Make room by dropping whole lines from the front
+  while (end + length - oldest > LOG_BUFFER_SIZE) {
+    while (ring[oldest++ & LOG_MASK] != '\n') {}
+    stats.overwritten++;
+  }
+  for (size_t i = 0; i < length; i++) {
+    ring[(end + i) & LOG_MASK] = line[i];
+  }
+  end += length;
+  stats.lines++;
+}
+
+void logLoop() {
+  if (before(serialPosition, oldest)) {
+    stats.serialSkipped += oldest - serialPosition;
+    serialPosition = oldest;
+  }
+  // At most two contiguous pieces, the UART takes what fits in its FIFO
+  while (serialPosition != end) {
+    size_t offset = serialPosition & LOG_MASK;
+    size_t length = end - serialPosition;
+    if (length > LOG_BUFFER_SIZE - offset) length = LOG_BUFFER_SIZE - offset;
+    size_t taken = halSerialWrite(ring + offset, length);
+    serialPosition += taken;
+    if (taken < length) break;
+  }
+
+  if (dumpActive && halMqttConnected()) {
+    char chunk[LOG_DUMP_CHUNK_SIZE + 1];
+    uint32_t position = dumpPosition;
+    size_t length = logRead(position, chunk, sizeof(chunk));
+    if (!length) {
+      dumpActive = false;
+    } else if (halMqttPublish(MQTT_LOG_DUMP_TOPIC, chunk, false)) {
+      dumpPosition = position;
+    }
+  }
+}
+
+uint32_t logOldest() {
+  return oldest;
+}
+
+uint32_t logEnd() {
+  return end;
+}
+
+size_t logRead(uint32_t& position, char* buffer, size_t size) {
+  if (before(position, oldest) || before(end, position)) position = oldest;
+  size_t length = end - position;
+  if (length > size - 1) length = size - 1;
+  for (size_t i = 0; i < length; i++) {
+    buffer[i] = ring[(position + i) & LOG_MASK];
+  }
+  // Cut after the last whole line, unless not even one line fits
+  if (position + length != end) {
+    size_t whole = length;
+    while (whole && buffer[whole - 1] != '\n') whole--;
+    if (whole) length = whole;
+  }
+  buffer[length] = '\0';
+  position += length;
+  return length;
+}
+
+void logDumpRequested(uint32_t since) {
+  dumpPosition = since;
+  dumpActive = true;
+}
+
+const LogStats& logStats() {
+  return stats;
+}
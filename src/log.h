@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Leveled log in a fixed ring buffer.
+// A log call formats one line with printf arguments straight into the ring,
+// nothing is allocated and nothing waits on the UART: logLoop() drains new
+// lines to Serial as far as its transmit FIFO takes them. When the ring is
+// full the oldest lines are overwritten. Lines are numbered by their byte
+// position since boot, so /log and the MQTT dump can fetch only what is new.
+// Calls below LOG_LEVEL compile to nothing, their arguments are not evaluated.
+
+#define LOG_LEVEL_NONE 0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_INFO 3
+#define LOG_LEVEL_DEBUG 4
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+#ifndef LOG_BUFFER_SIZE
+#define LOG_BUFFER_SIZE 2048
+#endif
+// Longest line, longer ones are cut
+#define LOG_LINE_SIZE 128
+
+#define MQTT_LOG_DUMP_TOPIC "home/morningleds/log"
+// One MQTT dump message, below the MQTT client's 512 byte buffer
+#define LOG_DUMP_CHUNK_SIZE 400
+
+#define logError(...) do { if (LOG_LEVEL >= LOG_LEVEL_ERROR) logWrite(LOG_LEVEL_ERROR, __VA_ARGS__); } while (0)
+#define logWarn(...) do { if (LOG_LEVEL >= LOG_LEVEL_WARN) logWrite(LOG_LEVEL_WARN, __VA_ARGS__); } while (0)
+#define logInfo(...) do { if (LOG_LEVEL >= LOG_LEVEL_INFO) logWrite(LOG_LEVEL_INFO, __VA_ARGS__); } while (0)
+#define logDebug(...) do { if (LOG_LEVEL >= LOG_LEVEL_DEBUG) logWrite(LOG_LEVEL_DEBUG, __VA_ARGS__); } while (0)
+
+struct LogStats {
+  uint32_t lines;
+  uint32_t overwritten; // lines lost to the ring wrapping
+  uint32_t serialSkipped; // bytes overwritten before Serial got them
+  uint32_t truncated;   // lines cut at LOG_LINE_SIZE
+};
+
+// Use the macros above, they compile out below LOG_LEVEL
+void logWrite(uint8_t level, const char* format, ...) __attribute__((format(printf, 2, 3)));
+// Drain to Serial and send a requested MQTT dump, call it from loop()
+void logLoop();
+
+// Position of the oldest line still held and of the end of the log
+uint32_t logOldest();
+uint32_t logEnd();
+// Copies whole lines from `position` on (moved up to the oldest line when it
+// was overwritten), advances it and returns the length, 0 at the end
+size_t logRead(uint32_t& position, char* buffer, size_t size);
+// Publish the lines from `since` on to MQTT_LOG_DUMP_TOPIC, a chunk per loop
+void logDumpRequested(uint32_t since);
+
+const LogStats& logStats();
@@ -1,23 +1,47 @@
 #include <ESP8266WiFi.h>
 #include <WiFiClientSecure.h>
-#include <UniversalTelegramBot.h>
-#include <NTPClient.h>
 #include <WiFiUdp.h>
 #include <TimeLib.h>
-#include <TimeAlarms.h>
 
 #include <ArduinoOTA.h>
+#include <Updater.h>
 #include <PubSubClient.h>
 
 #include "config.h"
+#include "hal.h"
+#include "sunrise.h"
+#include "commands.h"
+#include "telemetry.h"
+#include "connectivity.h"
+#include "state_push.h"
+#include "settings_store.h"
+#include "clock.h"
+#include "warm_start.h"
+#include "timezone.h"
+#include "light.h"
+#include "metrics.h"
+#include "tasks.h"
+#include "log.h"
+#include "home_assistant.h"
+#include "ingress.h"
+#include "peer_sync.h"
+#include "ota_pull.h"
 
 #ifdef ENABLE_WEB_SERVER
-#include <ESP8266WebServer.h>
-ESP8266WebServer server(80);
+#include "web.h"
+#include "http_server.h"
+WiFiServer webServer(HTTP_PORT);
+// Sockets of the web server, shared by connection slots and event clients, one
+// more for a new client accepted before the idle connection it replaces is closed
+#define WEB_SOCKETS (HTTP_MAX_CONNECTIONS + HTTP_EVENT_CLIENTS + 1)
+WiFiClient webClients[WEB_SOCKETS];
+bool webClientUsed[WEB_SOCKETS];
 #endif
 
 WiFiUDP ntpUDP;
-NTPClient timeClient(ntpUDP, "pool.ntp.org");
+#define NTP_SERVER "pool.ntp.org"
+#define NTP_LOCAL_PORT 2390
+bool otaStarted = false;
 
 #ifdef ENABLE_MQTT
 WiFiClient espClient;
@@ -25,108 +49,96 @@ PubSubClient client(espClient);
 #endif
 
 #ifdef ENABLE_TELEGRAM_BOT
-WiFiClientSecure secured_client;
-UniversalTelegramBot bot(token, secured_client);
+#include "esp/telegram_client.h"
+TelegramClient telegram(token, CHAT_ID);
 #endif
 
+#ifdef ENABLE_PULL_OTA
+#include "esp/update_client.h"
+UpdateClient updateClient(OTA_SERVER_HOST, OTA_SERVER_PORT);
+#endif
 
-// Variables to store the set time
-int targetHour = -1;
-int targetMinute = -1;
-int adjustedHour = -1;
-int adjustedMinute = -1;
-bool isTimeSet = false;
-bool timerActive = false;
-unsigned long lastBrightnessIncrease = 0;
-unsigned long lastTimeBotRan;
-int maxBrightness = MAX_BRIGHTNESS;
-int brightnessDuration = SUNRISE_DURATION_MINUTES;
-int currentBrightness = 0;
-int messageCheckInterval = 20000; // Check for new messages every ... seconds
-int lastUpdateId = 0;
+#ifdef ENABLE_PEER_SYNC
+#include <ESP8266mDNS.h>
+WiFiUDP peerUDP;
+#endif
 
 // Forward declarations
-void updateTimeOffset();
-bool isDST(long epochTime);
-
-void brightnessIncrease();
-void handleNewMessages(int numNewMessages);
-void startBrightnessIncrease();
-void actByMessage(String message);
-void sendMessageToTelegram(String message);
-void sendMessageToMQQT(String message);
+void updateTimeOffset(uint32_t utcEpoch);
+time_t localClockTime();
+void startOTA();
+
+void handleTelegramMessage(const char* text, size_t length);
 void mqttCallback(char* topic, byte* payload, unsigned int length);
-void reconnect();
-void sendMessage(String message, boolean isMQQT, boolean isTelegram);
-String getMainHTML();
-void handleSliderChange();
-void handleSetSunrise();
+void beginLoopTasks();
 
-AlarmId brightnessIncreaseRoutineAlarm;
-AlarmId brightnessIncrementTimer;
+// One pin per light channel, see LightLayout. A single white strip by default
+#ifndef LIGHT_LAYOUT
+#define LIGHT_LAYOUT LIGHT_MONO
+#define LED_PINS { LED_PIN }
+#endif
+static const uint8_t ledPins[] = LED_PINS;
+static_assert(sizeof(ledPins) == LIGHT_LAYOUT, "LED_PINS needs one pin per channel of LIGHT_LAYOUT");
+
+// Settings live in the sector reserved for EEPROM and the last sector of the file system
+// area below it. Neither the EEPROM library nor a file system is used.
+extern "C" uint32_t _EEPROM_start;
+extern "C" uint32_t _FS_end;
+static const uint32_t settingsSectorAddress[SETTINGS_SECTORS] = {
+  (uint32_t)&_EEPROM_start - 0x40200000,
+  (uint32_t)&_FS_end - 0x40200000 - SPI_FLASH_SEC_SIZE,
+};
 
 void setup() {
 
-  pinMode(LED_PIN, OUTPUT);
+  for (uint8_t pin : ledPins) {
+    pinMode(pin, OUTPUT);
+  }
   analogWriteRange(1023); // Set PWM range to 1023
+  lightBegin(LIGHT_LAYOUT);
   Serial.begin(115200);
-
-  // Connect to Wi-Fi
-  WiFi.begin(ssid, password);
-  while (WiFi.status() != WL_CONNECTED) {
-    delay(500);
-    Serial.print(".");
-  }
-  Serial.println("WiFi connected");
-  // Print IP
-  Serial.println(WiFi.localIP());
-
+  maxBrightness = MAX_BRIGHTNESS;
+  brightnessDuration = SUNRISE_DURATION_MINUTES;
+  sunriseBegin();
+  // Messages are queued from here on and sent once the network is up,
+  // so a sunrise or program resumed by the warm start is reported too
+  uint8_t telemetrySinks = 0;
+  #ifdef ENABLE_MQTT
+  telemetrySinks |= SINK_MQTT;
+  #endif
   #ifdef ENABLE_TELEGRAM_BOT
-  secured_client.setInsecure(); 
+  telemetrySinks |= SINK_TELEGRAM;
   #endif
+  telemetryBegin(telemetrySinks);
+  // Saved settings replace the defaults and the LEDs go back to their last level right away
+  bool restored = settingsRestore();
+  // After a reset the clock and a running sunrise continue from RTC memory, NTP only refines them
+  warmStartRestore();
+  // DST transitions are precomputed from the TZ string, see config.h
+  bool timezoneValid = timezoneBegin(TIMEZONE);
+  // TimeLib follows the disciplined clock, re-reading it every second
+  setSyncProvider(localClockTime);
+  setSyncInterval(1);
+  if (clockValid()) {
+    updateTimeOffset(clockUtc());
+    sunriseClockSet();
+  }
 
-  // Update time from ntp, try again if failed
-  while (!timeClient.update()) {
-    Serial.println("Failed to update time from NTP server");
-    delay(2000);
+  if (!timezoneValid) {
+    sendMessage("Invalid TIMEZONE in config.h, using UTC", true, true);
   }
 
- 
-  // ----------------- Time -----------------
+  // ----------------- Network -----------------
 
-  timeClient.begin();
-  timeClient.update();
-  updateTimeOffset(); // Initial time offset adjustment
-  unsigned long epochTime = timeClient.getEpochTime();
-  setTime(epochTime);
-  
-  // ----------------- General Init -----------------
-  
-  lastTimeBotRan = millis();
-  Alarm.delay(0);
-  
-  // ----------------- OTA -----------------
-  ArduinoOTA.setHostname("MorningLEDs"); // Set a hostname (optional)
-  ArduinoOTA.onStart([]() {
-    Serial.println("Start updating...");
-  });
-  ArduinoOTA.onEnd([]() {
-    Serial.println("\nEnd");
-  });
-  ArduinoOTA.onProgress([](unsigned int progress, unsigned int total) {
-    Serial.printf("Progress: %u%%\r", (progress / (total / 100)));
-  });
-  ArduinoOTA.onError([](ota_error_t error) {
-    Serial.printf("Error[%u]: ", error);
-    if (error == OTA_AUTH_ERROR) Serial.println("Auth Failed");
-    else if (error == OTA_BEGIN_ERROR) Serial.println("Begin Failed");
-    else if (error == OTA_CONNECT_ERROR) Serial.println("Connect Failed");
-    else if (error == OTA_RECEIVE_ERROR) Serial.println("Receive Failed");
-    else if (error == OTA_END_ERROR) Serial.println("End Failed");
-  });
+  // WiFi, NTP and MQTT connect in the background from loop(), see connectivity.cpp
+  WiFi.mode(WIFI_STA);
+  WiFi.persistent(false);
+  WiFi.setAutoReconnect(true);
+  ntpUDP.begin(NTP_LOCAL_PORT);
 
-  ArduinoOTA.begin();
-  Serial.println("OTA ready");
+  #ifdef ENABLE_TELEGRAM_BOT
+  telegram.begin(handleTelegramMessage);
+  #endif
 
   // ----------------- MQTT -----------------
 
@@ -134,461 +146,508 @@ void setup() {
   #ifdef ENABLE_MQTT
   client.setServer(mqtt_server, 1883);
   client.setCallback(mqttCallback);
+  client.setBufferSize(512); // Room for the JSON state document and the discovery config
+  // Keep a connection attempt to an unreachable broker short, it runs inside loop()
+  espClient.setTimeout(MQTT_CONNECT_TIMEOUT_MS);
+  client.setSocketTimeout(1);
+  connectivityBegin(true);
+  #else
+  connectivityBegin(false);
   #endif
   
   // ----------------- Webpage ----------------
   
+  // Event driven, several dashboards and API clients are served at once, see http_server.h
   #ifdef ENABLE_WEB_SERVER
-
-  // TODO - Save time input in webpage
-  server.on("/", HTTP_GET, []() {
-    server.send(200, "text/html", getMainHTML());
-  });
-  server.on("/currentBrightness", HTTP_GET, handleSliderChange);
-  server.on("/maxBrightness", HTTP_GET, handleSliderChange);
-  server.on("/sunriseDuration", HTTP_GET, handleSliderChange);
-  server.on("/setSunrise", HTTP_GET, handleSetSunrise);
-  server.on("/reboot", HTTP_GET, []() {
-    server.send(200, "text/plain", "Rebooting...");
-    ESP.restart();
-  });
-
-  server.on("/getInitialValues", HTTP_GET, []() {
-    StaticJsonDocument<200> doc;
-    doc["currentBrightness"] = currentBrightness;
-    doc["maxBrightness"] = maxBrightness;
-    doc["sunriseDuration"] = brightnessDuration;
-    
-    String output;
-    serializeJson(doc, output);
-    server.send(200, "application/json", output);
-  });
-  server.begin();
+  webBegin(HTTP_PORT);
   #endif
   
   // ----------------- Init message -----------------
 
-  // client.loop();
-  sendMessage("MorningLEDs started", true, true);
+  sendMessagef(true, true, "MorningLEDs started%s", restored ? ", settings restored" : "");
+
+  #ifdef ENABLE_PEER_SYNC
+  peerSyncBegin();
+  #endif
+  #ifdef ENABLE_PULL_OTA
+  otaPullBegin();
+  #endif
 
+  beginLoopTasks();
 
 }
 
-#ifdef ENABLE_WEB_SERVER
+void startOTA() {
+  // Needs the network, runs the first time WiFi comes up
+  ArduinoOTA.setHostname("MorningLEDs"); // Set a hostname (optional)
+  ArduinoOTA.onStart([]() {
+    logInfo("OTA update started");
+  });
+  ArduinoOTA.onEnd([]() {
+    logInfo("OTA update finished");
+  });
+  ArduinoOTA.onProgress([](unsigned int progress, unsigned int total) {
+    logDebug("OTA progress %u%%", progress / (total / 100));
+  });
+  ArduinoOTA.onError([](ota_error_t error) {
+    const char* reason = "unknown error";
+    if (error == OTA_AUTH_ERROR) reason = "auth failed";
+    else if (error == OTA_BEGIN_ERROR) reason = "begin failed";
+    else if (error == OTA_CONNECT_ERROR) reason = "connect failed";
+    else if (error == OTA_RECEIVE_ERROR) reason = "receive failed";
+    else if (error == OTA_END_ERROR) reason = "end failed";
+    logError("OTA error %u: %s", error, reason);
+  });
 
-void handleSliderChange() {
-  String sliderId;
-  if (server.hasArg("value")) {
-    int value = server.arg("value").toInt();
-    // Determine which slider sent the request
-    if (server.uri() == "/currentBrightness") {
-      // send message to actByMessage to change brightness
-      actByMessage("/setbrightness " + String(value));
-    } else if (server.uri() == "/maxBrightness") {
-      // send message to actByMessage to change max brightness
-      actByMessage("/setmaxbrightness " + String(value));
-
-    } else if (server.uri() == "/sunriseDuration") {
-      // send message to actByMessage to change sunrise duration
-      actByMessage("/setduration " + String(value));
-    }
-  } else {
-    server.send(400, "text/plain", "Missing value");
-  }
+  ArduinoOTA.begin();
+  otaStarted = true;
+  logInfo("OTA ready");
 }
 
-void handleSetSunrise() {
-    if (!server.hasArg("hour") || !server.hasArg("minute")) {
-        server.send(400, "text/plain", "Hour or minute parameter missing");
-        return;
+#ifdef ENABLE_MQTT
+void mqttCallback(char* topic, byte* payload, unsigned int length) {
+    // Parse in place, the payload is not null terminated
+    logInfo("MQTT command on %s: %.*s", topic, (int)length, (const char*)payload);
+    if (strcmp(topic, HA_COMMAND_TOPIC) == 0) {
+      ingressLight((const char*)payload, length);
+      return;
     }
-    int hour = server.arg("hour").toInt();
-    int minute = server.arg("minute").toInt();
-    
-    // Set the time by sending a message to actByMessage
-    actByMessage("/settime " + String(hour) + ":" + String(minute));
+    ingressCommand((const char*)payload, length, 0);
+}
+#endif
+
+#ifdef ENABLE_TELEGRAM_BOT
+void handleTelegramMessage(const char* text, size_t length) {
+  // Only called for the configured chat, replies go back there as well as to MQTT
+  logInfo("Telegram command: %.*s", (int)length, text);
+  ingressCommand(text, length, SINK_TELEGRAM);
+}
+#endif
 
 
-    server.send(200, "text/plain", "Sunrise settings updated");
+// ----------------- Loop tasks -----------------
+
+static void clockTask() {
+  clockLoop();
+  // Local time moves at DST transitions without waiting for an NTP sync
+  if (sunriseLocalTimeShifted()) {
+    updateTimeOffset(clockUtc());
+  }
 }
 
+// If ENABLE_TELEGRAM_BOT is defined, advance the Telegram long poll, it never waits for the server
+#ifdef ENABLE_TELEGRAM_BOT
+static void telegramTask() {
+  if (wifiUp()) {
+    telegram.loop();
+  }
+}
 #endif
 
-#ifdef ENABLE_MQTT
-void mqttCallback(char* topic, byte* payload, unsigned int length) {
-    payload[length] = '\0'; // Null-terminate the payload
-    String message = String((char*)payload);
-    Serial.println(message);
-    actByMessage(message);    
+static void telemetryTask() {
+  telemetryLoop();
+  statePushLoop();
+  homeAssistantLoop();
+  logLoop();
 }
 
+static void storeTask() {
+  settingsStoreLoop();
+  warmStartLoop();
+}
 
-void reconnect() {
-  while (!client.connected()) {
-    if (client.connect("ESP8266Client")) {
-      // client.subscribe("home/morningleds/alarmTime");
-      client.subscribe(MQTT_TOPIC);
-    }
-    delay(2000);
+#ifdef ENABLE_PEER_SYNC
+static void peerTask() {
+  if (wifiUp()) {
+    MDNS.update();
+    peerSyncLoop();
   }
 }
 #endif
 
+static void otaTask() {
+  if (otaStarted) {
+    ArduinoOTA.handle();
+  }
+}
 
-void loop() {
-  
+// The light runs every PWM period ahead of everything else, see tasks.h.
+// Budgets are what a run may take before it counts as an overrun.
+static const Task loopTasks[] = {
+  { "light", sunriseOutputLoop, TASK_DEADLINE, STAGE_SUNRISE, SUNRISE_OUTPUT_INTERVAL_US, 0, sunriseOutputActive },
   #ifdef ENABLE_WEB_SERVER
-  server.handleClient();
+  { "web", webLoop, TASK_BUDGETED, STAGE_WEB, 0, 5000, nullptr },
   #endif
-
-  #ifdef ENABLE_MQTT
-  if (!client.connected()) {
-    reconnect();
-  }
-  client.loop();
+  { "net", connectivityLoop, TASK_BUDGETED, STAGE_NET, 0, 5000, nullptr },
+  { "clock", clockTask, TASK_ALWAYS, STAGE_CLOCK, 0, 0, nullptr },
+  #ifdef ENABLE_TELEGRAM_BOT
+  { "telegram", telegramTask, TASK_BUDGETED, STAGE_TELEGRAM, 0, 5000, nullptr },
+  #endif
+  { "ingress", ingressLoop, TASK_ALWAYS, STAGE_INGRESS, 0, 0, nullptr },
+  #ifdef ENABLE_PEER_SYNC
+  { "peers", peerTask, TASK_BUDGETED, STAGE_PEERS, 0, 5000, nullptr },
+  #endif
+  { "telemetry", telemetryTask, TASK_BUDGETED, STAGE_TELEMETRY, 0, 5000, nullptr },
+  { "store", storeTask, TASK_BUDGETED, STAGE_STORE, 0, 20000, nullptr },
+  { "ota", otaTask, TASK_ALWAYS, STAGE_OTA, 0, 0, nullptr },
+  #ifdef ENABLE_PULL_OTA
+  { "update", otaPullLoop, TASK_BUDGETED, STAGE_UPDATE, 0, 20000, nullptr },
   #endif
+};
 
-  // If ENABLE_TELEGRAM_BOT is defined, check for new messages from telegram
-  #ifdef ENABLE_TELEGRAM_BOT
+void beginLoopTasks() {
+  tasksBegin(loopTasks, sizeof(loopTasks) / sizeof(loopTasks[0]));
+}
 
-  if (millis() - lastTimeBotRan > messageCheckInterval) { // Check for new messages every 5 seconds
-    Serial.println("Checking for new messages...");
-    int numNewMessages = bot.getUpdates(lastUpdateId + 1);
-    if (numNewMessages > 0) {
-      Serial.println("Got message");
-      handleNewMessages(numNewMessages);
-    }
-    lastTimeBotRan = millis();
+void loop() {
+  // Each task is timed into its histogram, see /metrics
+  uint32_t loopStart = metricsStart();
+  tasksLoop();
+  metricsEnd(STAGE_LOOP, loopStart);
+  metricsLoop();
+}
+
+time_t localClockTime() {
+  // 0 tells TimeLib the time is not known yet
+  if (!clockValid()) {
+    return 0;
   }
+  return timezoneLocal(clockUtc());
+}
 
-  #endif
+void updateTimeOffset(uint32_t utcEpoch) {
+  // Runs on every NTP sync and DST transition, only report when DST actually changed
+  static int lastDST = -1;
+  bool dst = timezoneIsDst(utcEpoch);
+  setTime(timezoneLocal(utcEpoch));
+  if (dst != lastDST) {
+    sendMessage(dst ? "DST is active" : "DST is not active", true, false);
+    lastDST = dst;
+  }
+}
 
-  Alarm.delay(0);
-  ArduinoOTA.handle();
+// ----------------- HAL -----------------
 
+uint32_t halMillis() {
+  return millis();
 }
 
-void updateTimeOffset() {
-  if (isDST(timeClient.getEpochTime())) {
-    timeClient.setTimeOffset(10800); // UTC+3 for DST
-    sendMessage("DST is active", true, false);
-  } else {
-    timeClient.setTimeOffset(7200); // UTC+2 for Standard Time
-    sendMessage("DST is not active", true, false);
-  }
+uint32_t halMicros() {
+  return micros();
 }
 
-bool isDST(long epochTime) {
-  time_t rawtime = (time_t)epochTime;
-  struct tm *timeinfo = localtime(&rawtime);
+uint32_t halCycles() {
+  return ESP.getCycleCount();
+}
 
-  int month = timeinfo->tm_mon + 1;
-  int day = timeinfo->tm_mday;
-  int wday = timeinfo->tm_wday;
+uint32_t halCpuMhz() {
+  return ESP.getCpuFreqMHz();
+}
 
-  if (month < 3 || month > 10)  return false; // DST is between March and October
-  if (month > 3 && month < 10)  return true;
+void halHeapInfo(uint32_t& freeBytes, uint32_t& largestBlock, uint8_t& fragmentation) {
+  ESP.getHeapStats(&freeBytes, &largestBlock, &fragmentation);
+}
 
-  int previousSunday = day - wday;
-  if (month == 3) return previousSunday >= 24; // DST starts last Sunday in March
-  if (month == 10) return previousSunday < 24; // DST ends last Sunday in October
+time_t halNow() {
+  return now();
+}
 
-  return false; // Default to standard time
+void halPwmWrite(const uint16_t* duties, uint8_t channels) {
+  // Only changed channels are touched, the phase locked waveform generator
+  // applies each new duty at the start of a period so the channels move together
+  static uint16_t written[LIGHT_MAX_CHANNELS] = { 0xFFFF, 0xFFFF, 0xFFFF };
+  for (uint8_t channel = 0; channel < channels; channel++) {
+    if (duties[channel] != written[channel]) {
+      analogWrite(ledPins[channel], duties[channel]);
+      written[channel] = duties[channel];
+    }
+  }
 }
 
-void brightnessIncrease() {
-  Serial.println("Increasing brightness");
-  // Calculate the brightness increase per step
+void halRestart() {
+  ESP.restart();
+}
 
-  // Increase brightness by analogWrite (PWM) to the LED_PIN
-  currentBrightness += 1;
-  if (currentBrightness > maxBrightness) {
-    currentBrightness = maxBrightness;
-    analogWrite(LED_PIN, currentBrightness);
+size_t halSerialWrite(const char* data, size_t length) {
+  // Only what fits in the UART FIFO, a full write would wait at 115200 baud
+  size_t room = Serial.availableForWrite();
+  if (length > room) length = room;
+  return length ? Serial.write((const uint8_t*)data, length) : 0;
+}
 
-    // Disable the timer
-    Alarm.free(brightnessIncrementTimer);
-    Serial.println("Brightness increase finished");
-    sendMessage("Brightness increase finished", true, false);
-    return;
-  }
-  analogWrite(LED_PIN, currentBrightness);
-  // bot.sendMessage(CHAT_ID, "Brightness increased to: " + String(currentBrightness));
-  Serial.println("Brightness increased to: " + String(currentBrightness));
-  sendMessage("Brightness increased to: " + String(currentBrightness), true, false);
+bool halSettingsRead(uint8_t sector, uint32_t offset, void* data, size_t size) {
+  if (sector >= SETTINGS_SECTORS) return false;
+  return ESP.flashRead(settingsSectorAddress[sector] + offset, (uint32_t*)data, size);
 }
 
-void startBrightnessIncrease() {
-  sendMessage("Brightness increase started", true, false);
-  // Start the process of gradually increasing brightness from 0 to maxBrightness over brightnessDuration minutes
-  // Do it using a Alarm.timerRepeat untill maxBrightness is reached and then disable the timer
+bool halSettingsWrite(uint8_t sector, uint32_t offset, const void* data, size_t size) {
+  if (sector >= SETTINGS_SECTORS) return false;
+  return ESP.flashWrite(settingsSectorAddress[sector] + offset, (const uint32_t*)data, size);
+}
 
-  // Calculate seconds for each step
-  int secondsPerStep = (brightnessDuration * 60) / maxBrightness;
+bool halSettingsErase(uint8_t sector) {
+  if (sector >= SETTINGS_SECTORS) return false;
+  return ESP.flashEraseSector(settingsSectorAddress[sector] / SPI_FLASH_SEC_SIZE);
+}
 
-  if (secondsPerStep < 1) {
-    secondsPerStep = 1;
-  }
+// The first 128 bytes of RTC user memory carry the OTA command for the bootloader
+#define RTC_WARM_START_BLOCK 32
 
-  // Set the initial brightness to 0
-  currentBrightness = 0;
-  
-  // Start the timer
-  brightnessIncrementTimer = Alarm.timerRepeat(secondsPerStep, brightnessIncrease);
-  sendMessage("Brightness increase started, secondsPerStep: " + String(secondsPerStep), true, false);
+bool halRtcRead(void* data, size_t size) {
+  return ESP.rtcUserMemoryRead(RTC_WARM_START_BLOCK, (uint32_t*)data, size);
+}
 
-  // Cancel the alarm
-  // Alarm.free(alarmId);
+bool halRtcWrite(const void* data, size_t size) {
+  return ESP.rtcUserMemoryWrite(RTC_WARM_START_BLOCK, (uint32_t*)data, size);
 }
 
-#ifdef ENABLE_TELEGRAM_BOT
-void handleNewMessages(int numNewMessages) {
-  for (int i = 0; i < numNewMessages; i++) {
-    int newUpdateId = bot.messages[i].update_id;
-    lastUpdateId = newUpdateId;
-    String chat_id = String(bot.messages[i].chat_id);
-    String text = bot.messages[i].text;
-    Serial.println("Got message from telegram, chat id  " + chat_id + ": " + text);
-    // Example command: /settime 14:30
-    
-  }
+uint32_t halRandom() {
+  return ESP.random();
 }
-#endif
 
-void actByMessage(String message){
-  if (message.startsWith("/settime")) {
-      int splitIndex = message.indexOf(' ');
-      if (splitIndex != -1) {
-        String timeText = message.substring(splitIndex + 1);
-        int hour = timeText.substring(0, timeText.indexOf(':')).toInt();
-        int minute = timeText.substring(timeText.indexOf(':') + 1).toInt();
-
-        if (hour >= 0 && hour <= 23 && minute >= 0 && minute <= 59) {
-          targetHour = hour;
-          targetMinute = minute;
-
-          int adjustedHour = targetHour;
-          int adjustedMinute = targetMinute - brightnessDuration;
-
-          // Adjust hour and minute if minute becomes negative
-          if (adjustedMinute < 0) {
-            int hourAdjustment = (abs(adjustedMinute) / 60) + 1;
-            adjustedMinute += 60 * hourAdjustment;
-            adjustedHour -= hourAdjustment;
-
-            // Handle day wrap-around
-            if (adjustedHour < 0) {
-              adjustedHour += 24;
-            }
-          }
-
-          // Alarm.free(); // Clear existing alarms
-          brightnessIncreaseRoutineAlarm = Alarm.alarmOnce(adjustedHour, adjustedMinute, 0, startBrightnessIncrease);
-          sendMessage("Time set to " + String(adjustedHour) + ":" + String(adjustedMinute), true, false);
-          sendMessage("Minutes untill alarm: " + String((Alarm.getNextTrigger() - now())/60), true, false);
-        } else {
-          sendMessage("Invalid time format. Please use HH:MM format.", true, false);
-        }
-      } else {
-        sendMessage("Please specify a time. Example: /settime 14:30", true, false);
-      }
-    }
-  if (message == "/status") {
-    // Print if alarm in enabled
-    if (!Alarm.getNextTrigger(brightnessIncreaseRoutineAlarm)) {
-      sendMessage("Alarm is disabled", true, false);
-    }
-    else{
-      sendMessage("Alarm is enabled", true, false);
-    }
+void halWifiBegin() {
+  logInfo("Connecting to WiFi");
+  WiFi.begin(ssid, password);
+}
 
-    sendMessage("now: " + String(now()), true, false);
-    sendMessage("next alarm: " + String(Alarm.getNextTrigger()), true, false);
-    sendMessage("minutes untill alarm: " + String((Alarm.getNextTrigger() - now())/60), true, false);
+bool halWifiConnected() {
+  return WiFi.status() == WL_CONNECTED;
+}
 
+void halOnWifiUp() {
+  IPAddress ip = WiFi.localIP();
+  logInfo("WiFi connected, IP: %u.%u.%u.%u", ip[0], ip[1], ip[2], ip[3]);
+  if (!otaStarted) {
+    startOTA();
   }
-  if (message.startsWith("/setduration")) {
-    brightnessDuration = message.substring(message.indexOf(' ') + 1).toInt();
-    sendMessage("Brightness duration set to " + String(brightnessDuration) + " minutes", true, false);
+  #ifdef ENABLE_PEER_SYNC
+  // Joined again after every reconnect, the group membership does not survive it
+  peerUDP.stop();
+  peerUDP.beginMulticast(WiFi.localIP(), IPAddress(PEER_GROUP_IP), PEER_PORT);
+  // Only announced, peers are found by their beacons since mDNS queries block
+  static bool mdnsStarted = false;
+  if (!mdnsStarted) {
+    char host[24];
+    snprintf(host, sizeof(host), "morningleds-%06x", ESP.getChipId());
+    mdnsStarted = MDNS.begin(host);
+    if (mdnsStarted) MDNS.addService("morningleds", "udp", PEER_PORT);
   }
-  if (message.startsWith("/setbrightness")) {
-    int brightness = message.substring(message.indexOf(' ') + 1).toInt();
-    if (brightness >= 0 && brightness <= 1023) {
-      currentBrightness = brightness;
-      analogWrite(LED_PIN, currentBrightness);
-      sendMessage("Brightness set to " + String(currentBrightness), true, false);
-    } else {
-      sendMessage("Invalid brightness value. Please use a value between 0 and 1023", true, false);
-    }
+  #endif
+}
+
+void halNtpRequest() {
+  // Plain SNTP request, the reply is picked up by halNtpPoll() on a later loop
+  uint8_t packet[48] = {0};
+  packet[0] = 0b11100011; // LI unsynchronized, version 4, client mode
+  while (ntpUDP.parsePacket() > 0) {
+    // drop late replies to older requests, parsePacket() moves to the next one
   }
-  if (message.startsWith("/setmaxbrightness")) {
-    int brightness = message.substring(message.indexOf(' ') + 1).toInt();
-    if (brightness >= 0 && brightness <= 1023) {
-      maxBrightness = brightness;
-      sendMessage("Max brightness set to " + String(maxBrightness), true, false);
-    } else {
-      sendMessage("Invalid brightness value. Please use a value between 0 and 1023", true, false);
-    }
+  ntpUDP.beginPacket(NTP_SERVER, 123);
+  ntpUDP.write(packet, sizeof(packet));
+  ntpUDP.endPacket();
+}
+
+bool halNtpPoll(uint64_t& utcMs) {
+  if (ntpUDP.parsePacket() < 48) {
+    return false;
   }
-  if (message == "/reboot") {
-    ESP.restart();
+  uint8_t packet[48];
+  ntpUDP.read(packet, sizeof(packet));
+  // Transmit timestamp, seconds since 1900 and a 32 bit fraction
+  uint32_t ntpSeconds = (uint32_t)packet[40] << 24 | (uint32_t)packet[41] << 16 | (uint32_t)packet[42] << 8 | packet[43];
+  uint32_t fraction = (uint32_t)packet[44] << 24 | (uint32_t)packet[45] << 16 | (uint32_t)packet[46] << 8 | packet[47];
+  if (ntpSeconds == 0) {
+    return false;
   }
+  utcMs = (uint64_t)(ntpSeconds - 2208988800UL) * 1000 + (((uint64_t)fraction * 1000) >> 32);
+  return true;
 }
 
-void sendMessage(String message, boolean isMQQT, boolean isTelegram) {
-  /*
-    Send a message to either MQQT or Telegram or both, MQTT is default
-  */
+void halSetUtcTime(uint32_t utcEpoch) {
+  updateTimeOffset(utcEpoch);
+  sunriseClockSet();
+}
+
+bool halMqttConnect() {
   #ifdef ENABLE_MQTT
-  if (isMQQT) {
-    sendMessageToMQQT(message);
+  // The broker marks the Home Assistant light unavailable when the connection drops
+  if (client.connect("ESP8266Client", HA_AVAILABILITY_TOPIC, 0, true, "offline")) {
+    client.subscribe(MQTT_TOPIC);
+    client.subscribe(HA_COMMAND_TOPIC);
+    return true;
   }
   #endif
+  return false;
+}
 
-  #ifdef ENABLE_TELEGRAM_BOT
-  if (isTelegram) {
-    sendMessageToTelegram(message);
+bool halMqttConnected() {
+  #ifdef ENABLE_MQTT
+  return client.connected();
+  #else
+  return false;
+  #endif
+}
+
+void halMqttLoop() {
+  #ifdef ENABLE_MQTT
+  client.loop();
+  #endif
+}
+
+bool halMqttPublish(const char* topic, const char* payload, bool retained) {
+  #ifdef ENABLE_MQTT
+  if (client.connected()) {
+    return client.publish(topic, payload, retained);
   }
   #endif
+  return false;
 }
 
-#ifdef ENABLE_TELEGRAM_BOT
-void sendMessageToTelegram(String message) {
-  bot.sendMessage(CHAT_ID, message);
+bool halTelegramSend(const char* text) {
+  #ifdef ENABLE_TELEGRAM_BOT
+  return telegram.send(text);
+  #else
+  return false;
+  #endif
 }
-#endif
 
-#ifdef ENABLE_MQTT
-void sendMessageToMQQT(String message) {
-  client.publish("home/morningleds/terminalOut", message.c_str());
+#ifdef ENABLE_WEB_SERVER
+bool halHttpListen(uint16_t port) {
+  webServer.begin(port);
+  webServer.setNoDelay(true);
+  return true;
+}
+
+int halHttpAccept() {
+  for (uint8_t i = 0; i < WEB_SOCKETS; i++) {
+    if (webClientUsed[i]) continue;
+    WiFiClient client = webServer.accept();
+    if (!client) return -1;
+    client.setNoDelay(true);
+    webClients[i] = client;
+    webClientUsed[i] = true;
+    return i;
+  }
+  return -1;
+}
+
+int32_t halHttpRead(int connection, void* data, size_t size) {
+  WiFiClient& client = webClients[connection];
+  int available = client.available();
+  if (available <= 0) return client.connected() ? 0 : -1;
+  return client.read((uint8_t*)data, (size_t)available < size ? available : size);
+}
+
+int32_t halHttpWrite(int connection, const void* data, size_t length) {
+  WiFiClient& client = webClients[connection];
+  if (!client.connected()) return -1;
+  // Only what fits the send buffer, write() would otherwise wait for acknowledgements
+  size_t room = client.availableForWrite();
+  if (length > room) length = room;
+  return length ? client.write((const uint8_t*)data, length) : 0;
+}
+
+void halHttpClose(int connection) {
+  webClients[connection].stop();
+  webClients[connection] = WiFiClient();
+  webClientUsed[connection] = false;
 }
 #endif
 
+uint8_t halEventClients() {
+  #ifdef ENABLE_WEB_SERVER
+  return httpEventClients();
+  #else
+  return 0;
+  #endif
+}
 
-String getMainHTML() {
-    return R"rawliteral(
-
-<!DOCTYPE html>
-<html>
-<head>
-    <title>Sunrise Control Dashboard</title>
-    <style>
-        body { font-family: Arial, sans-serif; display: flex; flex-direction: column; align-items: center; justify-content: center; height: 100vh; margin: 0; background-color: #f0f0f0; }
-        h1 { color: #333; }
-        .slider-container { display: flex; flex-direction: column; width: 100%; max-width: 600px; padding: 0 20px; }
-        .description { display: flex; align-items: center; margin: 10px 0; }
-        .description label { flex-basis: 180px; text-align: right; margin-right: 20px; }
-        .slider { -webkit-appearance: none; width: calc(100% - 200px); height: 15px; border-radius: 5px; background: #d3d3d3; outline: none; opacity: 0.7; transition: opacity .2s; }
-        .slider:hover { opacity: 1; }
-        .slider::-webkit-slider-thumb { -webkit-appearance: none; appearance: none; width: 25px; height: 25px; border-radius: 50%; background: #4CAF50; cursor: pointer; }
-        .slider::-moz-range-thumb { width: 25px; height: 25px; border-radius: 50%; background: #4CAF50; cursor: pointer; }
-        .value-display { font-weight: bold; margin-left: 10px; }
-        .time-container {
-            display: flex;
-            flex-direction: column;
-            align-items: center;
-            width: 100%;
-            max-width: 400px;
-        }
-        input[type="time"] {
-            width: 70%;
-            padding: 8px;
-            border: 1px solid #ccc;
-            border-radius: 4px;
-            box-sizing: border-box;
-        }
-        button { border: none; color: white; padding: 15px 32px; text-align: center; text-decoration: none; display: inline-block; font-size: 16px; margin: 4px 2px; cursor: pointer; background-color: #4CAF50; border-radius: 12px; }
-    </style>
-</head>
-<body>
-    <h1>Sunrise Control Dashboard</h1>
-    <div class="slider-container">
-        <div class="description">
-            <label for="currentBrightness">Set Current Brightness:</label>
-            <input type="range" id="currentBrightness" class="slider" min="0" max="1023" />
-            <span id="currentBrightnessValue" class="value-display"></span>
-        </div>
-        <div class="description">
-            <label for="maxBrightness">Max Brightness:</label>
-            <input type="range" id="maxBrightness" class="slider" min="1" max="1023" />
-            <span id="maxBrightnessValue" class="value-display"></span>
-        </div>
-        <div class="description">
-            <label for="sunriseDuration">Sunrise Duration (minutes):</label>
-            <input type="range" id="sunriseDuration" class="slider" min="5" max="120" />
-            <span id="sunriseDurationValue" class="value-display"></span>
-        </div>
-    </div>
-    <div class="time-container">
-        <div class="description">
-            <label>Set Sunrise Time:</label>
-            <input type="time" id="sunriseTime">
-        </div>
-    </div>
-    <button onclick="setSunrise()">Set Sunrise</button>
-    <button onclick="reboot()">Reboot</button>
-    <script>
-        document.addEventListener('DOMContentLoaded', function() {
-            fetchInitialValues();
-        });
-
-        function fetchInitialValues() {
-            fetch('/getInitialValues')
-                .then(response => response.json())
-                .then(data => {
-                    document.getElementById('currentBrightness').value = data.currentBrightness;
-                    updateSliderDisplay('currentBrightness', data.currentBrightness);
-                    
-                    document.getElementById('maxBrightness').value = data.maxBrightness;
-                    updateSliderDisplay('maxBrightness', data.maxBrightness);
-                    
-                    document.getElementById('sunriseDuration').value = data.sunriseDuration;
-                    updateSliderDisplay('sunriseDuration', data.sunriseDuration);
-                }).catch(error => console.error('Error fetching initial slider values:', error));
-        }
-
-        function updateSliderDisplay(id, value) {
-            document.getElementById(id + "Value").innerText = value;
-        }
-
-        document.querySelectorAll('.slider').forEach(item => {
-            item.addEventListener('change', event => {
-                let id = event.target.id;
-                let value = event.target.value;
-                fetch(`/${id}?value=${value}`);
-                updateSliderDisplay(id, value);
-            });
-        });
-
-    </script>
-    <script>
-    function setSunrise() {
-            const timeValue = document.getElementById('sunriseTime').value;
-            const [hour, minute] = timeValue.split(':');
-            const currentBrightness = document.getElementById('currentBrightness').value;
-            const maxBrightness = document.getElementById('maxBrightness').value;
-            const sunriseDuration = document.getElementById('sunriseDuration').value;
-
-            fetch(`/setSunrise?hour=${hour}&minute=${minute}&currentBrightness=${currentBrightness}&maxBrightness=${maxBrightness}&sunriseDuration=${sunriseDuration}`)
-                .then(response => {
-                    if (!response.ok) throw new Error('Network response was not ok');
-                    return response.text();
-                })
-                .then(text => console.log(text))
-                .catch(error => console.error('Failed to set sunrise:', error));
-        }
-    function reboot() {
-        fetch(`/reboot`)
-            .then(response => {
-                if (!response.ok) throw new Error('Network response was not ok');
-                return response.text();
-            })
-            .then(text => console.log(text))
-            .catch(error => console.error('Failed to reboot:', error));
-    }
-</script>
-</body>
-</html>
+bool halEventSend(const char* data) {
+  #ifdef ENABLE_WEB_SERVER
+  return httpEventSend(data);
+  #else
+  return false;
+  #endif
+}
+
+uint32_t halPeerId() {
+  return ESP.getChipId();
+}
 
-)rawliteral";
+bool halPeerSend(const void* data, size_t length) {
+  #ifdef ENABLE_PEER_SYNC
+  if (!wifiUp() || !peerUDP.beginPacketMulticast(IPAddress(PEER_GROUP_IP), PEER_PORT, WiFi.localIP())) return false;
+  peerUDP.write((const uint8_t*)data, length);
+  return peerUDP.endPacket();
+  #else
+  return false;
+  #endif
+}
+
+size_t halPeerReceive(void* data, size_t size) {
+  #ifdef ENABLE_PEER_SYNC
+  int length = peerUDP.parsePacket();
+  if (length <= 0) return 0;
+  // Longer datagrams are not ours, report them whole so they are dropped
+  if ((size_t)length > size) return length;
+  return peerUDP.read((uint8_t*)data, size);
+  #else
+  return 0;
+  #endif
+}
+
+bool halUpdateGet(const char* path, uint32_t offset) {
+  #ifdef ENABLE_PULL_OTA
+  return wifiUp() && updateClient.get(path, offset);
+  #else
+  return false;
+  #endif
+}
+
+int32_t halUpdateRead(uint8_t* data, size_t size) {
+  #ifdef ENABLE_PULL_OTA
+  return updateClient.read(data, size);
+  #else
+  return -2;
+  #endif
+}
+
+void halUpdateClose() {
+  #ifdef ENABLE_PULL_OTA
+  updateClient.stop();
+  #endif
+}
+
+// The last byte is held back until the image is installed. Updater has no abort,
+// but end() on an incomplete image drops it, so a rejected image never boots.
+static uint8_t updateHeldByte;
+static bool updateHolding = false;
+
+bool halUpdateBegin(uint32_t size) {
+  if (Update.isRunning()) Update.end();
+  updateHolding = false;
+  return Update.begin(size);
+}
+
+bool halUpdateWrite(const uint8_t* data, size_t length) {
+  if (!length) return true;
+  if (updateHolding && Update.write(&updateHeldByte, 1) != 1) return false;
+  if (length > 1 && Update.write((uint8_t*)data, length - 1) != length - 1) return false;
+  updateHeldByte = data[length - 1];
+  updateHolding = true;
+  return true;
+}
+
+bool halUpdateEnd(bool install) {
+  bool complete = install && updateHolding && Update.write(&updateHeldByte, 1) == 1;
+  updateHolding = false;
+  if (!complete) {
+    if (Update.isRunning()) Update.end();
+    return !install;
+  }
+  if (!Update.end()) {
+    logError("Update rejected by the updater: %s", Update.getErrorString().c_str());
+    return false;
+  }
+  return true;
 }
@@ -0,0 +1,226 @@
+#include "metrics.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+
+#include "hal.h"
+#include "tasks.h"
+
+static const char* const stageNames[STAGE_COUNT] = {
+  "web", "net", "clock", "telegram", "sunrise", "telemetry", "store", "ota", "ingress", "peers", "update", "loop",
+};
+
+static StageHistogram stages[STAGE_COUNT];
+// Microseconds per cycle in 16.16 fixed point, refreshed once a second
+static uint32_t microsPerCycleQ16 = 0;
+static uint32_t loopsThisSecond = 0;
+static uint32_t loopsPerSecond = 0;
+static uint32_t secondStartMs = 0;
+static uint32_t lastPublishMs = 0;
+
+// Index of the smallest bound 4^(k+2) us that holds `micros`
+static uint8_t bucketIndex(uint32_t micros) {
+  if (micros <= 16) return 0;
+  uint8_t bits = 32 - __builtin_clz(micros - 1);
+  uint8_t index = (bits - 3) / 2;
+  return index < METRICS_BUCKETS - 1 ? index : METRICS_BUCKETS - 1;
+}
+
+static void refreshCpuClock() {
+  microsPerCycleQ16 = 65536UL / halCpuMhz();
+}
+
+uint32_t metricsStart() {
+  return halCycles();
+}
+
+uint32_t metricsEnd(MetricStage stage, uint32_t startCycles) {
+  uint32_t now = halCycles();
+  if (!microsPerCycleQ16) refreshCpuClock();
+  uint32_t micros = ((uint64_t)(now - startCycles) * microsPerCycleQ16) >> 16;
+  StageHistogram& histogram = stages[stage];
+  histogram.buckets[bucketIndex(micros)]++;
+  histogram.totalMicros += micros;
+  histogram.count++;
+  if (micros > histogram.maxMicros) histogram.maxMicros = micros;
+  return now;
+}
+
+void metricsLoop() {
+  uint32_t now = halMillis();
+  loopsThisSecond++;
+  if (now - secondStartMs >= 1000) {
+    loopsPerSecond = loopsThisSecond;
+    loopsThisSecond = 0;
+    secondStartMs = now;
+    refreshCpuClock();
+  }
+
+  if (now - lastPublishMs >= METRICS_PUBLISH_INTERVAL_MS && halMqttConnected()) {
+    lastPublishMs = now;
+    char json[METRICS_JSON_SIZE];
+    formatMetricsJson(json, sizeof(json));
+    halMqttPublish(MQTT_METRICS_TOPIC, json, true);
+  }
+}
+
+uint32_t metricsLoopsPerSecond() {
+  return loopsPerSecond;
+}
+
+const StageHistogram& metricsStage(MetricStage stage) {
+  return stages[stage < STAGE_COUNT ? stage : STAGE_LOOP];
+}
+
+// ----------------- Output -----------------
+
+// Appends like snprintf, the length never runs past the buffer
+static void append(char* buffer, size_t size, size_t& length, const char* format, ...) __attribute__((format(printf, 4, 5)));
+
+static void append(char* buffer, size_t size, size_t& length, const char* format, ...) {
+  if (length + 1 >= size) return;
+  va_list args;
+  va_start(args, format);
+  int written = vsnprintf(buffer + length, size - length, format, args);
+  va_end(args);
+  if (written > 0) length += (size_t)written < size - length ? (size_t)written : size - length - 1;
+}
+
+// Prometheus wants seconds, printed without floating point
+static void appendSeconds(char* buffer, size_t size, size_t& length, uint64_t micros) {
+  append(buffer, size, length, "%lu.%06lu", (unsigned long)(micros / 1000000), (unsigned long)(micros % 1000000));
+}
+
+static void appendGauge(char* buffer, size_t size, size_t& length, const char* name, const char* help, uint32_t value) {
+  append(buffer, size, length, "# HELP morningleds_%s %s\n# TYPE morningleds_%s gauge\nmorningleds_%s %lu\n",
+         name, help, name, name, (unsigned long)value);
+}
+
+struct TaskFamily {
+  const char* name;
+  const char* help;
+  uint32_t TaskStats::*field;
+  bool deadlineOnly;
+  bool seconds; // a gauge of microseconds, printed as seconds
+};
+
+static const TaskFamily taskFamilies[] = {
+  { "runs_total", "Task runs", &TaskStats::runs, false, false },
+  { "deferred_total", "Passes a task was held back for a deadline", &TaskStats::deferred, false, false },
+  { "over_budget_total", "Runs longer than the task budget", &TaskStats::overBudget, false, false },
+  { "deadline_missed_total", "Runs that started later than the deadline slack", &TaskStats::missedDeadlines, true, false },
+  { "lateness_max_seconds", "Latest start of a deadline task since boot", &TaskStats::maxLatenessUs, true, true },
+};
+#define TASK_FAMILIES (sizeof(taskFamilies) / sizeof(taskFamilies[0]))
+
+size_t formatMetricsPrometheus(uint8_t part, char* buffer, size_t size) {
+  size_t length = 0;
+  buffer[0] = '\0';
+
+  if (part == 0) {
+    uint32_t freeBytes;
+    uint32_t largestBlock;
+    uint8_t fragmentation;
+    halHeapInfo(freeBytes, largestBlock, fragmentation);
+    appendGauge(buffer, size, length, "uptime_seconds", "Time since boot", halMillis() / 1000);
+    appendGauge(buffer, size, length, "loops_per_second", "loop() iterations in the last second", loopsPerSecond);
+    appendGauge(buffer, size, length, "heap_free_bytes", "Free heap", freeBytes);
+    appendGauge(buffer, size, length, "heap_max_block_bytes", "Largest free heap block", largestBlock);
+    appendGauge(buffer, size, length, "heap_fragmentation_percent", "Heap fragmentation", fragmentation);
+    append(buffer, size, length, "# HELP morningleds_max_stall_seconds Longest loop() iteration since boot\n"
+                                 "# TYPE morningleds_max_stall_seconds gauge\nmorningleds_max_stall_seconds ");
+    appendSeconds(buffer, size, length, stages[STAGE_LOOP].maxMicros);
+    append(buffer, size, length, "\n");
+    return length;
+  }
+
+  // One stage per part, the histogram family header goes with the first one
+  uint8_t stage = part - 1;
+  if (stage < STAGE_COUNT) {
+    const StageHistogram& histogram = stages[stage];
+    if (stage == 0) {
+      append(buffer, size, length, "# HELP morningleds_stage_seconds Time spent in each loop() stage\n"
+                                   "# TYPE morningleds_stage_seconds histogram\n");
+    }
+    uint32_t cumulative = 0;
+    for (uint8_t bucket = 0; bucket < METRICS_BUCKETS; bucket++) {
+      cumulative += histogram.buckets[bucket];
+      append(buffer, size, length, "morningleds_stage_seconds_bucket{stage=\"%s\",le=\"", stageNames[stage]);
+      if (bucket < METRICS_BUCKETS - 1) {
+        appendSeconds(buffer, size, length, 16UL << (2 * bucket));
+      } else {
+        append(buffer, size, length, "+Inf");
+      }
+      append(buffer, size, length, "\"} %lu\n", (unsigned long)cumulative);
+    }
+    append(buffer, size, length, "morningleds_stage_seconds_sum{stage=\"%s\"} ", stageNames[stage]);
+    appendSeconds(buffer, size, length, histogram.totalMicros);
+    append(buffer, size, length, "\nmorningleds_stage_seconds_count{stage=\"%s\"} %lu\n",
+           stageNames[stage], (unsigned long)histogram.count);
+    return length;
+  }
+
+  if (stage == STAGE_COUNT) {
+    append(buffer, size, length, "# HELP morningleds_stage_max_seconds Longest run of each loop() stage since boot\n"
+                                 "# TYPE morningleds_stage_max_seconds gauge\n");
+    for (uint8_t i = 0; i < STAGE_COUNT; i++) {
+      append(buffer, size, length, "morningleds_stage_max_seconds{stage=\"%s\"} ", stageNames[i]);
+      appendSeconds(buffer, size, length, stages[i].maxMicros);
+      append(buffer, size, length, "\n");
+    }
+    return length;
+  }
+
+  // One task counter family per part
+  uint8_t family = stage - STAGE_COUNT - 1;
+  if (family < TASK_FAMILIES) {
+    const TaskFamily& task = taskFamilies[family];
+    append(buffer, size, length, "# HELP morningleds_task_%s %s\n# TYPE morningleds_task_%s %s\n",
+           task.name, task.help, task.name, task.seconds ? "gauge" : "counter");
+    for (uint8_t i = 0; i < tasksCount(); i++) {
+      if (task.deadlineOnly && tasksGet(i).kind != TASK_DEADLINE) continue;
+      append(buffer, size, length, "morningleds_task_%s{task=\"%s\"} ", task.name, tasksGet(i).name);
+      uint32_t value = tasksStats(i).*task.field;
+      if (task.seconds) {
+        appendSeconds(buffer, size, length, value);
+      } else {
+        append(buffer, size, length, "%lu", (unsigned long)value);
+      }
+      append(buffer, size, length, "\n");
+    }
+    return length;
+  }
+  return 0;
+}
+
+size_t formatMetricsJson(char* buffer, size_t size) {
+  uint32_t freeBytes;
+  uint32_t largestBlock;
+  uint8_t fragmentation;
+  halHeapInfo(freeBytes, largestBlock, fragmentation);
+
+  size_t length = 0;
+  buffer[0] = '\0';
+  append(buffer, size, length,
+         "{\"uptime\":%lu,\"loopsPerSecond\":%lu,\"maxStallUs\":%lu,\"heapFree\":%lu,\"heapMaxBlock\":%lu,"
+         "\"heapFragmentation\":%u,\"stages\":{",
+         (unsigned long)(halMillis() / 1000), (unsigned long)loopsPerSecond, (unsigned long)stages[STAGE_LOOP].maxMicros,
+         (unsigned long)freeBytes, (unsigned long)largestBlock, fragmentation);
+  // [mean, max] microseconds per stage
+  for (uint8_t stage = 0; stage < STAGE_COUNT; stage++) {
+    const StageHistogram& histogram = stages[stage];
+    append(buffer, size, length, "%s\"%s\":[%lu,%lu]", stage ? "," : "", stageNames[stage],
+           (unsigned long)(histogram.count ? histogram.totalMicros / histogram.count : 0), (unsigned long)histogram.maxMicros);
+  }
+  // Deadline tasks, the light
+  uint32_t missed = 0;
+  uint32_t maxLatenessUs = 0;
+  for (uint8_t i = 0; i < tasksCount(); i++) {
+    if (tasksGet(i).kind != TASK_DEADLINE) continue;
+    missed += tasksStats(i).missedDeadlines;
+    if (tasksStats(i).maxLatenessUs > maxLatenessUs) maxLatenessUs = tasksStats(i).maxLatenessUs;
+  }
+  append(buffer, size, length, "},\"missedDeadlines\":%lu,\"maxLatenessUs\":%lu}", (unsigned long)missed,
+         (unsigned long)maxLatenessUs);
+  return length;
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Loop instrumentation.
+// Every loop() stage is timed with the CPU cycle counter into a fixed latency
+// histogram, recording costs two counter reads and an increment. Nothing is
+// formatted until /metrics is scraped (Prometheus text) or the summary is
+// published retained on MQTT_METRICS_TOPIC once a minute.
+
+enum MetricStage : uint8_t {
+  STAGE_WEB,       // web server and event stream
+  STAGE_NET,       // WiFi, NTP and MQTT
+  STAGE_CLOCK,
+  STAGE_TELEGRAM,
+  STAGE_SUNRISE,   // schedules, ramp and output
+  STAGE_TELEMETRY, // message queue and dashboard push
+  STAGE_STORE,     // settings and warm start
+  STAGE_OTA,
+  STAGE_INGRESS,   // queued commands
+  STAGE_PEERS,     // peer sync beacons
+  STAGE_UPDATE,    // update downloads from the update server
+  STAGE_LOOP,      // the whole loop() iteration
+  STAGE_COUNT,
+};
+
+// Bucket bounds are powers of 4 microseconds, 16 us up to about 1 s, then +Inf
+#define METRICS_BUCKETS 10
+
+#ifndef METRICS_PUBLISH_INTERVAL_MS
+#define METRICS_PUBLISH_INTERVAL_MS 60000UL
+#endif
+#define MQTT_METRICS_TOPIC "home/morningleds/metrics"
+#define METRICS_JSON_SIZE 480
+// One Prometheus chunk holds one stage or the task counters
+#define METRICS_CHUNK_SIZE 1024
+
+struct StageHistogram {
+  uint32_t buckets[METRICS_BUCKETS]; // not cumulative, Prometheus output sums them
+  uint64_t totalMicros;
+  uint32_t count;
+  uint32_t maxMicros;
+};
+
+// Start of a stage, pass the result to metricsEnd()
+uint32_t metricsStart();
+// Returns the end of the stage, which is the start of the next one
+uint32_t metricsEnd(MetricStage stage, uint32_t startCycles);
+// Loop rate and publishing, call it once per loop()
+void metricsLoop();
+
+uint32_t metricsLoopsPerSecond();
+const StageHistogram& metricsStage(MetricStage stage);
+
+// Prometheus text in chunks, part 0 first, returns 0 once every part was written
+size_t formatMetricsPrometheus(uint8_t part, char* buffer, size_t size);
+// Compact summary for MQTT: per stage mean and max microseconds
+size_t formatMetricsJson(char* buffer, size_t size);
@@ -0,0 +1,170 @@
+#include "Arduino.h"
+
+#include "../hal.h"
+
+HardwareSerial Serial;
+
+String::String(const char* cstr) {
+  assign(cstr ? cstr : "", cstr ? strlen(cstr) : 0);
+}
+
+String::String(const String& other) {
+  assign(other.c_str(), other.length());
+}
+
+String::String(String&& other) {
+  *this = static_cast<String&&>(other);
+}
+
+String::String(char c) {
+  assign(&c, 1);
+}
+
+String::String(int value) : String((long)value) {}
+
+String::String(unsigned int value) : String((unsigned long)value) {}
+
+String::String(long value) {
+  char buffer[24];
+  int length = snprintf(buffer, sizeof(buffer), "%ld", value);
+  assign(buffer, length);
+}
+
+String::String(unsigned long value) {
+  char buffer[24];
+  int length = snprintf(buffer, sizeof(buffer), "%lu", value);
+  assign(buffer, length);
+}
+
+String::String(long long value) {
+  char buffer[24];
+  int length = snprintf(buffer, sizeof(buffer), "%lld", value);
+  assign(buffer, length);
+}
+
+String::~String() {
+  release();
+}
+
+String& String::operator=(const String& other) {
+  if (this != &other) {
+    len = 0;
+    concat(other.c_str(), other.length());
+  }
+  return *this;
+}
+
+String& String::operator=(String&& other) {
+  if (this == &other) return *this;
+  release();
+  if (other.isSSO()) {
+    memcpy(sso, other.sso, sizeof(sso));
+  } else {
+    heap = other.heap;
+    capacity = other.capacity;
+    other.heap = nullptr;
+    other.capacity = SSO_CAPACITY;
+  }
+  len = other.len;
+  other.len = 0;
+  other.sso[0] = '\0';
+  return *this;
+}
+
+String& String::operator=(const char* cstr) {
+  len = 0;
+  concat(cstr, strlen(cstr));
+  return *this;
+}
+
+bool String::reserve(size_t size) {
+  if (size <= capacity) return true;
+  // Grow like the ESP8266 core does, straight to the requested size
+  char* buffer = new char[size + 1];
+  memcpy(buffer, c_str(), len + 1);
+  release();
+  heap = buffer;
+  capacity = size;
+  return true;
+}
+
+bool String::concat(const char* cstr, size_t length) {
+  // Appending part of ourselves, keep the source valid across a reallocation
+  const char* own = c_str();
+  if (cstr >= own && cstr <= own + len && len + length > capacity) {
+    String copy(*this);
+    return concat(copy.c_str() + (cstr - own), length);
+  }
+  reserve(len + length);
+  char* buffer = isSSO() ? sso : heap;
+  memmove(buffer + len, cstr, length);
+  len += length;
+  buffer[len] = '\0';
+  return true;
+}
+
+bool String::startsWith(const String& prefix) const {
+  return prefix.len <= len && strncmp(c_str(), prefix.c_str(), prefix.len) == 0;
+}
+
+int String::indexOf(char c, unsigned int from) const {
+  if (from >= len) return -1;
+  const char* found = strchr(c_str() + from, c);
+  return found ? (int)(found - c_str()) : -1;
+}
+
+String String::substring(unsigned int from, unsigned int to) const {
+  if (from > to) {
+    unsigned int swap = from;
+    from = to;
+    to = swap;
+  }
+  if (to > len) to = len;
+  if (from > len) from = len;
+  String result;
+  result.concat(c_str() + from, to - from);
+  return result;
+}
+
+void String::assign(const char* cstr, size_t length) {
+  len = 0;
+  concat(cstr, length);
+}
+
+void String::release() {
+  delete[] heap;
+  heap = nullptr;
+  capacity = SSO_CAPACITY;
+}
+
+String operator+(const String& lhs, const String& rhs) {
+  String result(lhs);
+  result += rhs;
+  return result;
+}
+
+String operator+(const String& lhs, const char* rhs) {
+  String result(lhs);
+  result += rhs;
+  return result;
+}
+
+String operator+(const char* lhs, const String& rhs) {
+  String result(lhs);
+  result += rhs;
+  return result;
+}
+
+size_t HardwareSerial::print(const char* text) {
+  return echo ? fputs(text, stdout) : strlen(text);
+}
+
+size_t HardwareSerial::println(const char* text) {
+  size_t written = print(text);
+  if (echo) fputc('\n', stdout);
+  return written + 1;
+}
+
+unsigned long millis() {
+  return halMillis();
+}
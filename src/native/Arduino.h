@@ -0,0 +1,89 @@
+#pragma once
+
+// Minimal Arduino shim for the native environment.
+// Only what the core sunrise logic needs: String, Serial, PROGMEM and a few typedefs.
+// String mirrors the ESP8266 core layout (11 byte SSO, heap buffer beyond that)
+// so allocation counts measured on Linux match the board.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+// Flash is ordinary memory on the host
+#define PROGMEM
+#define memcpy_P memcpy
+
+class String {
+public:
+  String(const char* cstr = "");
+  String(const String& other);
+  String(String&& other);
+  explicit String(char c);
+  explicit String(int value);
+  explicit String(unsigned int value);
+  explicit String(long value);
+  explicit String(unsigned long value);
+  explicit String(long long value);
+  ~String();
+
+  String& operator=(const String& other);
+  String& operator=(String&& other);
+  String& operator=(const char* cstr);
+
+  String& operator+=(const String& other) { concat(other.c_str(), other.length()); return *this; }
+  String& operator+=(const char* cstr) { concat(cstr, strlen(cstr)); return *this; }
+  String& operator+=(char c) { concat(&c, 1); return *this; }
+  bool concat(const char* cstr, size_t length);
+  bool reserve(size_t size);
+
+  const char* c_str() const { return isSSO() ? sso : heap; }
+  size_t length() const { return len; }
+  char operator[](size_t index) const { return c_str()[index]; }
+
+  bool startsWith(const String& prefix) const;
+  bool equals(const char* cstr) const { return strcmp(c_str(), cstr) == 0; }
+  bool operator==(const String& other) const { return len == other.len && equals(other.c_str()); }
+  bool operator==(const char* cstr) const { return equals(cstr); }
+  bool operator!=(const char* cstr) const { return !equals(cstr); }
+  int indexOf(char c, unsigned int from = 0) const;
+  String substring(unsigned int from) const { return substring(from, len); }
+  String substring(unsigned int from, unsigned int to) const;
+  long toInt() const { return atol(c_str()); }
+
+private:
+  enum { SSO_CAPACITY = 11 };
+
+  bool isSSO() const { return heap == nullptr; }
+  void assign(const char* cstr, size_t length);
+  void release();
+
+  char sso[SSO_CAPACITY + 1] = {0};
+  char* heap = nullptr;
+  size_t len = 0;
+  size_t capacity = SSO_CAPACITY;
+};
+
+String operator+(const String& lhs, const String& rhs);
+String operator+(const String& lhs, const char* rhs);
+String operator+(const char* lhs, const String& rhs);
+
+class HardwareSerial {
+public:
+  void begin(unsigned long) {}
+  size_t print(const char* text);
+  size_t print(const String& text) { return print(text.c_str()); }
+  size_t println(const char* text);
+  size_t println(const String& text) { return println(text.c_str()); }
+
+  // Serial output is dropped unless enabled, benchmarks keep it off
+  bool echo = false;
+};
+
+extern HardwareSerial Serial;
+
+unsigned long millis();
@@ -0,0 +1,426 @@
+// Microbenchmarks for the core sunrise logic, built by the native environment:
+//   pio run -e native && .pio/build/native/program [filter]
+// Reports ns/op and heap allocations per operation.
+
+#include <chrono>
+#include <new>
+
+#include "Arduino.h"
+#include "hal_native.h"
+#include "../hal.h"
+#include "../sunrise.h"
+#include "../commands.h"
+#include "../telemetry.h"
+#include "../connectivity.h"
+#include "../state_push.h"
+#include "../settings_store.h"
+#include "../clock.h"
+#include "../scheduler.h"
+#include "../timezone.h"
+#include "../light.h"
+#include "../dither.h"
+#include "../metrics.h"
+#include "../tasks.h"
+#include "../log.h"
+#include "../home_assistant.h"
+#include "../ingress.h"
+#include "../program.h"
+#include "../sha256.h"
+
+// ----------------- Allocation counting -----------------
+
+static uint64_t allocationCount = 0;
+static uint64_t allocationBytes = 0;
+
+void* operator new(size_t size) {
+  allocationCount++;
+  allocationBytes += size;
+  void* ptr = malloc(size ? size : 1);
+  if (!ptr) throw std::bad_alloc();
+  return ptr;
+}
+
+void* operator new[](size_t size) {
+  return operator new(size);
+}
+
+void operator delete(void* ptr) noexcept {
+  free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept {
+  free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+  free(ptr);
+}
+
+void operator delete[](void* ptr, size_t) noexcept {
+  free(ptr);
+}
+
+// ----------------- Harness -----------------
+
+static const char* benchFilter = nullptr;
+static volatile uint32_t sink = 0;
+
+template <typename Fn>
+static void bench(const char* name, uint32_t iterations, Fn fn) {
+  if (benchFilter && !strstr(name, benchFilter)) return;
+
+  // Warm up caches and lazy state before measuring
+  for (uint32_t i = 0; i < iterations / 10 + 1; i++) fn(i);
+
+  uint64_t allocationsBefore = allocationCount;
+  uint64_t bytesBefore = allocationBytes;
+  uint32_t messagesBefore = nativeMessageCount();
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < iterations; i++) fn(i);
+  auto end = std::chrono::steady_clock::now();
+
+  double ns = std::chrono::duration<double, std::nano>(end - start).count() / iterations;
+  double allocations = (double)(allocationCount - allocationsBefore) / iterations;
+  double bytes = (double)(allocationBytes - bytesBefore) / iterations;
+  double messages = (double)(nativeMessageCount() - messagesBefore) / iterations;
+  printf("%-28s %10.1f ns/op %8.2f allocs/op %8.1f B/op %6.2f msgs/op\n", name, ns, allocations, bytes, messages);
+}
+
+// pio test links the sources with each test's own main()
+#ifndef PIO_UNIT_TESTING
+int main(int argc, char** argv) {
+  if (argc > 1) benchFilter = argv[1];
+
+  nativeSetMillis(0);
+  nativeSetNow(1700000000);
+  maxBrightness = 1023;
+  brightnessDuration = 45;
+  sunriseBegin();
+  lightBegin(LIGHT_MONO);
+  telemetryBegin(SINK_MQTT | SINK_TELEGRAM);
+  connectivityBegin(true);
+  nativeLoop();
+
+  printf("%-28s %16s %19s %13s %13s\n", "benchmark", "time", "heap", "bytes", "messages");
+
+  // ----------------- Command parsing -----------------
+
+  bench("parse/setbrightness", 200000, [](uint32_t i) {
+    actByMessage(i & 1 ? "/setbrightness 512" : "/setbrightness 511");
+  });
+  bench("parse/setmaxbrightness", 200000, [](uint32_t) {
+    actByMessage("/setmaxbrightness 1023");
+  });
+  bench("parse/settime", 200000, [](uint32_t) {
+    actByMessage("/settime 06:30");
+  });
+  bench("parse/unknown", 200000, [](uint32_t) {
+    actByMessage("/nothing");
+  });
+  bench("parse/mqtt_payload", 200000, [](uint32_t) {
+    // Not null terminated, parsed straight from the PubSubClient buffer
+    static const char payload[] = "/setbrightness 512xxxx";
+    actByMessage(payload, 18);
+  });
+  bench("parse/settings_json", 200000, [](uint32_t) {
+    // What POST /api/config and an MQTT settings object cost, one alarm reschedule
+    actByMessage("{\"hour\":6,\"minute\":30,\"maxBrightness\":900,\"sunriseDuration\":45}");
+  });
+  bench("parse/web_slider", 200000, [](uint32_t i) {
+    // What the web slider handler does for every change
+    setBrightness(i & 1023);
+  });
+
+  // ----------------- Status serialization -----------------
+
+  bench("status/command", 100000, [](uint32_t) {
+    actByMessage("/status");
+  });
+  bench("status/brightness_message", 200000, [](uint32_t i) {
+    sendMessagef(true, false, "Brightness increased to: %d", (int)(i & 1023));
+  });
+  bench("status/json", 200000, [](uint32_t) {
+    char json[STATUS_JSON_SIZE];
+    sink += formatStatusJson(json, sizeof(json));
+  });
+  bench("status/telemetry_drain", 200000, [](uint32_t) {
+    sendMessage("Brightness set to 512", true, true);
+    telemetryStateChanged();
+    nativeAdvanceMillis(1);
+    telemetryLoop();
+  });
+
+  // ----------------- Ramp -----------------
+
+  bench("ramp/tick", 1000000, [](uint32_t i) {
+    static SunriseRamp ramp;
+    if (!ramp.isActive()) ramp.start(i, 45UL * 60000UL, 0, 1023);
+    ramp.tick(i);
+    sink += ramp.pwmDuty();
+  });
+  bench("ramp/brightness_increase", 1000000, [](uint32_t) {
+    // Full 20 ms loop tick: ramp math, output and reporting
+    if (!sunriseRamp.isActive()) startBrightnessIncrease();
+    nativeAdvanceMillis(RAMP_TICK_INTERVAL_MS);
+    sunriseLoop();
+  });
+  bench("ramp/full_sunrise", 3, [](uint32_t) {
+    // A whole 45 minute sunrise with the firmware loop running every millisecond,
+    // msgs/op is the broker traffic of one sunrise
+    startBrightnessIncrease();
+    while (sunriseRamp.isActive()) {
+      nativeAdvanceMillis(1);
+      nativeLoop();
+    }
+    for (int i = 0; i < 10000; i++) {
+      nativeAdvanceMillis(1);
+      nativeLoop();
+    }
+  });
+  bench("ramp/cie_duty", 1000000, [](uint32_t i) {
+    sink += cieDuty(i & 1023);
+  });
+  bench("ramp/tick_eased", 1000000, [](uint32_t i) {
+    static SunriseRamp ramp;
+    if (!ramp.isActive()) ramp.start(i, 45UL * 60000UL, 0, 1023, RAMP_EASE_IN_OUT);
+    ramp.tick(i);
+    sink += ramp.pwmDuty();
+  });
+
+  // ----------------- Light programs -----------------
+
+  bench("program/compile", 100000, [](uint32_t) {
+    // Parsed, validated and compiled once when the program is set
+    static const char text[] = "0 0, 30 1023 in, 90 1023, 100 0 out";
+    ProgramKeyframe keyframes[PROGRAM_MAX_KEYFRAMES];
+    uint8_t count;
+    sink += parseProgramKeyframes(text, sizeof(text) - 1, keyframes, count) == nullptr;
+    sink += programSet(PROGRAM_SLOTS - 1, keyframes, count) == nullptr;
+  });
+  bench("program/tick", 1000000, [](uint32_t) {
+    // Full 20 ms loop tick of a running program, segments switch on the way
+    if (programRunning() < 0) startProgram(PROGRAM_SLOTS - 1);
+    nativeAdvanceMillis(RAMP_TICK_INTERVAL_MS);
+    sunriseLoop();
+  });
+
+  // ----------------- Light output -----------------
+
+  bench("light/write_mono", 1000000, [](uint32_t i) {
+    uint32_t levelFrac = i & 0xFFFF;
+    lightWrite(levelFrac, cieDutyFrac(levelFrac >> RAMP_LEVEL_FRAC_BITS));
+  });
+  lightBegin(LIGHT_RGB);
+  bench("light/write_rgb", 1000000, [](uint32_t i) {
+    // Color mix of every channel and one batched write, what a ramp tick costs on an RGB strip
+    uint32_t levelFrac = i & 0xFFFF;
+    lightWrite(levelFrac, cieDutyFrac(levelFrac >> RAMP_LEVEL_FRAC_BITS));
+  });
+  bench("light/begin_rgb", 10000, [](uint32_t) {
+    lightBegin(LIGHT_RGB);
+  });
+  bench("light/dither_step", 1000000, [](uint32_t) {
+    // Duty 1.25 on all three channels, a step every loop iteration
+    static const uint16_t low[3] = { 80, 80, 80 };
+    static bool set = false;
+    if (!set) ditherSet(low, 3);
+    set = true;
+    nativeAdvanceMillis(1);
+    ditherLoop();
+  });
+  lightBegin(LIGHT_MONO);
+  bench("light/dither_idle", 1000000, [](uint32_t) {
+    // Bright or whole duties, what every loop iteration pays
+    static const uint16_t bright[1] = { 512 << CIE_DUTY_FRAC_BITS };
+    static bool set = false;
+    if (!set) ditherSet(bright, 1);
+    set = true;
+    nativeAdvanceMillis(1);
+    ditherLoop();
+  });
+
+  // ----------------- Dashboard push -----------------
+
+  bench("push/state_delta", 1000000, [](uint32_t i) {
+    // One slider change per delta, what a dragged slider costs per frame
+    char delta[STATE_DELTA_JSON_SIZE];
+    currentBrightness = i & 1023;
+    sink += formatStateDelta(delta, sizeof(delta));
+  });
+  bench("push/loop_sunrise", 1000000, [](uint32_t) {
+    // Loop iteration with a client listening while a ramp runs
+    nativeSetEventClients(1);
+    if (!sunriseRamp.isActive()) startBrightnessIncrease();
+    nativeAdvanceMillis(1);
+    sunriseLoop();
+    statePushLoop();
+    nativeSetEventClients(0);
+  });
+
+  // ----------------- Settings store -----------------
+
+  bench("store/loop_unchanged", 1000000, [](uint32_t) {
+    nativeAdvanceMillis(1);
+    settingsStoreLoop();
+  });
+  bench("store/slider_drag", 200000, [](uint32_t i) {
+    // A slider moving every 10 ms only reaches flash once it stops
+    maxBrightness = i & 1023;
+    nativeAdvanceMillis(10);
+    settingsStoreLoop();
+  });
+  bench("store/restore", 10000, [](uint32_t) {
+    sink += settingsRestore();
+  });
+
+  bench("net/connectivity_loop", 1000000, [](uint32_t) {
+    nativeAdvanceMillis(1);
+    connectivityLoop();
+  });
+
+  // ----------------- Scheduler -----------------
+
+  schedulerAdd(6, 30, SCHEDULE_WEEKDAYS);
+  schedulerAdd(8, 0, SCHEDULE_WEEKENDS);
+  bench("sched/loop_idle", 1000000, [](uint32_t) {
+    // Nothing due, a single compare against the heap top
+    schedulerLoop(halNow());
+  });
+  bench("sched/next_trigger", 1000000, [](uint32_t) {
+    sink += schedulerNextTrigger();
+  });
+  bench("sched/add_remove", 200000, [](uint32_t i) {
+    int id = schedulerAdd(i % 24, i % 60, SCHEDULE_DAILY);
+    schedulerRemove(id);
+  });
+  bench("sched/fire_weekly", 100000, [](uint32_t) {
+    // Pop the due event and queue its next day, the sunrise itself is not started
+    static time_t now = halNow();
+    now = schedulerNextTrigger();
+    schedulerLoop(now);
+    sunriseRamp.stop();
+  });
+  bench("parse/schedule", 200000, [](uint32_t) {
+    actByMessage("/schedule 7:15 mon-wed,fri");
+    actByMessage("/unschedule 2");
+  });
+
+  // ----------------- Loop tasks -----------------
+
+  bench("tasks/loop_idle", 1000000, [](uint32_t) {
+    // One firmware loop() pass with nothing to do, the light task due every pass
+    nativeAdvanceMillis(1);
+    nativeLoop();
+  });
+  bench("tasks/yield", 1000000, [](uint32_t) {
+    // A yield point inside a task when no deadline is due
+    tasksYield();
+  });
+
+  // ----------------- Home Assistant -----------------
+
+  bench("ha/parse_command", 200000, [](uint32_t) {
+    static const char payload[] = "{\"state\":\"ON\",\"brightness\":512,\"transition\":1800.5}";
+    LightCommand command;
+    sink += parseLightCommand(payload, sizeof(payload) - 1, command) == nullptr;
+  });
+  bench("ha/fade_command", 200000, [](uint32_t i) {
+    // One message starts a whole fade on the ramp
+    static const char* payloads[] = { "{\"brightness\":800,\"transition\":1800}", "{\"state\":\"OFF\",\"transition\":2}" };
+    const char* payload = payloads[i & 1];
+    sink += ingressLight(payload, strlen(payload)) == nullptr;
+    ingressLoop();
+  });
+
+  // ----------------- Ingress -----------------
+
+  bench("ingress/slider_burst", 100000, [](uint32_t i) {
+    // A slider drag arriving between two loop() passes, applied and reported once
+    for (int step = 0; step < INGRESS_QUEUE_SIZE; step++) {
+      SettingsUpdate update = {};
+      update.fields = SETTING_BRIGHTNESS;
+      update.currentBrightness = (i + step * 16) & 1023;
+      sink += ingressSettings(update, 0) == nullptr;
+    }
+    ingressLoop();
+  });
+  bench("ingress/command", 200000, [](uint32_t i) {
+    // Queue a text command and run it on the next pass
+    static const char* commands[] = { "/settime 6:30", "/setduration 30" };
+    const char* command = commands[i & 1];
+    sink += ingressCommand(command, strlen(command), 0) == nullptr;
+    ingressLoop();
+  });
+
+  // ----------------- Updates -----------------
+
+  bench("ota/sha256_512", 100000, [](uint32_t i) {
+    // One read of a pulled image, hashed as it streams to flash
+    static Sha256 sha;
+    static uint8_t data[512];
+    if (i == 0) sha256Begin(sha);
+    data[0] = i;
+    sha256Update(sha, data, sizeof(data));
+  });
+
+  // ----------------- Log -----------------
+
+  bench("log/write", 1000000, [](uint32_t i) {
+    // One formatted line into the ring, nothing waits on the UART
+    logInfo("Brightness %u of %d", i & 1023, 1023);
+  });
+  bench("log/write_disabled", 1000000, [](uint32_t i) {
+    logDebug("Brightness %u of %d", i & 1023, 1023);
+  });
+  bench("log/read", 100000, [](uint32_t) {
+    // A whole /log fetch
+    char chunk[LOG_DUMP_CHUNK_SIZE + 1];
+    uint32_t position = logOldest();
+    size_t length;
+    while ((length = logRead(position, chunk, sizeof(chunk)))) sink += length;
+  });
+
+  // ----------------- Metrics -----------------
+
+  bench("metrics/stage", 1000000, [](uint32_t) {
+    // What every instrumented stage adds to loop()
+    uint32_t start = metricsStart();
+    nativeAdvanceMillis(1);
+    sink += metricsEnd(STAGE_SUNRISE, start);
+  });
+  bench("metrics/prometheus", 10000, [](uint32_t) {
+    // One /metrics scrape, only paid when scraped
+    char chunk[METRICS_CHUNK_SIZE];
+    for (uint8_t part = 0;; part++) {
+      size_t length = formatMetricsPrometheus(part, chunk, sizeof(chunk));
+      if (!length) break;
+      sink += length;
+    }
+  });
+  bench("metrics/json", 100000, [](uint32_t) {
+    char json[METRICS_JSON_SIZE];
+    sink += formatMetricsJson(json, sizeof(json));
+  });
+
+  // ----------------- Time -----------------
+
+  bench("time/clock_utc", 1000000, [](uint32_t) {
+    // TimeLib reads the disciplined clock through this once a second
+    nativeAdvanceMillis(1);
+    sink += clockUtc();
+  });
+  timezoneBegin(TIMEZONE);
+  bench("time/tz_local", 1000000, [](uint32_t i) {
+    // Replaces isDST(), which ran localtime() and the EU rule every second
+    sink += timezoneLocal(1700000000UL + (i % 8760) * 3600UL);
+  });
+  bench("time/tz_transition_due", 1000000, [](uint32_t i) {
+    sink += timezoneTransitionDue(1700000000UL + i);
+  });
+  bench("time/tz_begin", 100000, [](uint32_t) {
+    sink += timezoneBegin("CET-1CEST,M3.5.0,M10.5.0/3");
+  });
+
+  return 0;
+}
+#endif
@@ -0,0 +1,533 @@
+#include "hal_native.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "../hal.h"
+#include "../sunrise.h"
+#include "../telemetry.h"
+#include "../connectivity.h"
+#include "../state_push.h"
+#include "../settings_store.h"
+#include "../clock.h"
+#include "../warm_start.h"
+#include "../timezone.h"
+#include "../light.h"
+#include "../metrics.h"
+#include "../tasks.h"
+#include "../log.h"
+#include "../home_assistant.h"
+#include "../ingress.h"
+#include "../peer_sync.h"
+#include "../ota_pull.h"
+#include "../http_server.h"
+#include "../web.h"
+
+static uint32_t virtualMillis = 0;
+static time_t bootLocalEpoch = 0;
+static uint16_t pwmDuties[LIGHT_MAX_CHANNELS];
+static uint32_t pwmWrites = 0;
+static uint32_t messageCount = 0;
+static uint32_t messageBytes = 0;
+static bool echoMessages = false;
+static bool wifiAvailable = true;
+static bool brokerAvailable = true;
+static bool mqttConnected = false;
+static bool ntpPending = false;
+static uint8_t settingsSectors[SETTINGS_SECTORS][SETTINGS_SECTOR_SIZE];
+static bool settingsSectorReady = false;
+static uint32_t rtcMemory[16];
+static bool rtcWritten = false;
+static uint8_t eventClients = 0;
+static uint32_t eventCount = 0;
+static uint32_t eventBytes = 0;
+static int peerSocket = -1;
+static int httpListenSocket = -1;
+static uint64_t (*trueUtcMs)() = nullptr;
+static uint32_t restartRequests = 0;
+static uint32_t peerId = 0;
+
+struct NativeFile {
+  const char* path;
+  const uint8_t* data;
+  size_t size;
+};
+// The manifest and the image
+static NativeFile updateFiles[2];
+static const NativeFile* updateRequest = nullptr;
+static uint32_t updateOffset = 0;
+static uint32_t updateBreakAt = 0;
+static uint32_t updateImageSize = 0;
+static uint32_t updateWritten = 0;
+static bool updateOpen = false;
+static uint32_t updateInstalled = 0;
+
+void nativeSetMillis(uint32_t ms) {
+  virtualMillis = ms;
+}
+
+void nativeAdvanceMillis(uint32_t ms) {
+  virtualMillis += ms;
+}
+
+void nativeSetNow(time_t localEpoch) {
+  bootLocalEpoch = localEpoch - virtualMillis / 1000;
+}
+
+uint16_t nativePwmDuty(uint8_t channel) {
+  return channel < LIGHT_MAX_CHANNELS ? pwmDuties[channel] : 0;
+}
+
+uint32_t nativePwmWrites() {
+  return pwmWrites;
+}
+
+uint32_t nativeMessageCount() {
+  return messageCount;
+}
+
+uint32_t nativeMessageBytes() {
+  return messageBytes;
+}
+
+void nativeEchoMessages(bool enable) {
+  echoMessages = enable;
+}
+
+void nativeSetEventClients(uint8_t clients) {
+  eventClients = clients;
+}
+
+uint32_t nativeEventCount() {
+  return eventCount;
+}
+
+uint32_t nativeEventBytes() {
+  return eventBytes;
+}
+
+void nativeSetWifi(bool up) {
+  wifiAvailable = up;
+  if (!up) mqttConnected = false;
+}
+
+void nativeSetBroker(bool up) {
+  brokerAvailable = up;
+  if (!up) mqttConnected = false;
+}
+
+static void telemetryTask() {
+  telemetryLoop();
+  statePushLoop();
+  homeAssistantLoop();
+  logLoop();
+}
+
+static void storeTask() {
+  settingsStoreLoop();
+  warmStartLoop();
+}
+
+static void clockTask() {
+  clockLoop();
+  // halNow() follows DST transitions on its own, sunriseLoop() already moved the schedules
+  sunriseLocalTimeShifted();
+}
+
+// The same tasks as the board's loop() without Telegram and ArduinoOTA, the web
+// server only serves once webBegin() was called
+static const Task loopTasks[] = {
+  { "light", sunriseOutputLoop, TASK_DEADLINE, STAGE_SUNRISE, SUNRISE_OUTPUT_INTERVAL_US, 0, sunriseOutputActive },
+  { "web", webLoop, TASK_BUDGETED, STAGE_WEB, 0, 5000, nullptr },
+  { "net", connectivityLoop, TASK_BUDGETED, STAGE_NET, 0, 5000, nullptr },
+  { "clock", clockTask, TASK_ALWAYS, STAGE_CLOCK, 0, 0, nullptr },
+  { "ingress", ingressLoop, TASK_ALWAYS, STAGE_INGRESS, 0, 0, nullptr },
+  { "peers", peerSyncLoop, TASK_BUDGETED, STAGE_PEERS, 0, 5000, nullptr },
+  { "telemetry", telemetryTask, TASK_BUDGETED, STAGE_TELEMETRY, 0, 5000, nullptr },
+  { "store", storeTask, TASK_BUDGETED, STAGE_STORE, 0, 20000, nullptr },
+  { "update", otaPullLoop, TASK_BUDGETED, STAGE_UPDATE, 0, 20000, nullptr },
+};
+
+void nativeSetUpdateFile(const char* path, const void* data, size_t size) {
+  for (NativeFile& file : updateFiles) {
+    if (!file.path || strcmp(file.path, path) == 0) {
+      file = { path, (const uint8_t*)data, size };
+      return;
+    }
+  }
+}
+
+void nativeBreakUpdateAt(uint32_t breakAt) {
+  updateBreakAt = breakAt;
+}
+
+uint32_t nativeUpdateInstalled() {
+  return updateInstalled;
+}
+
+// Behaves like NOR flash, a fresh sector reads as erased
+static void prepareSettingsSector() {
+  if (!settingsSectorReady) {
+    memset(settingsSectors, 0xFF, sizeof(settingsSectors));
+    settingsSectorReady = true;
+  }
+}
+
+void nativeUseBoardClock(uint64_t (*utcMs)()) {
+  trueUtcMs = utcMs;
+}
+
+uint32_t nativeRestartRequests() {
+  return restartRequests;
+}
+
+void nativeSavePersistent(NativePersistent& state) {
+  prepareSettingsSector();
+  memcpy(state.settings, settingsSectors, sizeof(state.settings));
+  memcpy(state.rtc, rtcMemory, sizeof(state.rtc));
+  state.rtcWritten = rtcWritten;
+}
+
+void nativeRestorePersistent(const NativePersistent& state, bool powerCut) {
+  memcpy(settingsSectors, state.settings, sizeof(settingsSectors));
+  settingsSectorReady = true;
+  memcpy(rtcMemory, state.rtc, sizeof(rtcMemory));
+  rtcWritten = state.rtcWritten && !powerCut;
+}
+
+bool nativePeerBegin(uint32_t id) {
+  peerId = id;
+  int fd = socket(AF_INET, SOCK_DGRAM, 0);
+  if (fd < 0) return false;
+  // Every process on the host binds the same port
+  int on = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+  setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));
+  sockaddr_in address = {};
+  address.sin_family = AF_INET;
+  address.sin_port = htons(PEER_PORT);
+  address.sin_addr.s_addr = htonl(INADDR_ANY);
+  const uint8_t group[] = { PEER_GROUP_IP };
+  ip_mreq membership = {};
+  memcpy(&membership.imr_multiaddr.s_addr, group, 4);
+  membership.imr_interface.s_addr = htonl(INADDR_LOOPBACK);
+  in_addr loopback = {};
+  loopback.s_addr = htonl(INADDR_LOOPBACK);
+  uint8_t ttl = 0;
+  if (bind(fd, (sockaddr*)&address, sizeof(address)) < 0 ||
+      setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &membership, sizeof(membership)) < 0 ||
+      setsockopt(fd, IPPROTO_IP, IP_MULTICAST_IF, &loopback, sizeof(loopback)) < 0 ||
+      setsockopt(fd, IPPROTO_IP, IP_MULTICAST_LOOP, &on, sizeof(on)) < 0 ||
+      setsockopt(fd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl)) < 0) {
+    perror("peer socket");
+    close(fd);
+    return false;
+  }
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+  peerSocket = fd;
+  return true;
+}
+
+void nativeLoop() {
+  static bool tasksStarted = false;
+  if (!tasksStarted) {
+    tasksBegin(loopTasks, sizeof(loopTasks) / sizeof(loopTasks[0]));
+    tasksStarted = true;
+  }
+  uint32_t loopStart = metricsStart();
+  tasksLoop();
+  metricsEnd(STAGE_LOOP, loopStart);
+  metricsLoop();
+}
+
+// ----------------- HAL -----------------
+
+uint32_t halMillis() {
+  return virtualMillis;
+}
+
+uint32_t halMicros() {
+  return virtualMillis * 1000;
+}
+
+// Virtual like the rest of the time, a simulated 80 MHz CPU
+uint32_t halCycles() {
+  return virtualMillis * 80000;
+}
+
+uint32_t halCpuMhz() {
+  return 80;
+}
+
+void halHeapInfo(uint32_t& freeBytes, uint32_t& largestBlock, uint8_t& fragmentation) {
+  // Not tracked on the host, the benchmarks count allocations instead
+  freeBytes = 0;
+  largestBlock = 0;
+  fragmentation = 0;
+}
+
+time_t halNow() {
+  // The board's local time is 0 until NTP or RTC memory set the clock
+  if (trueUtcMs) return clockValid() ? timezoneLocal(clockUtc()) : 0;
+  return bootLocalEpoch + virtualMillis / 1000;
+}
+
+void halPwmWrite(const uint16_t* duties, uint8_t channels) {
+  for (uint8_t channel = 0; channel < channels && channel < LIGHT_MAX_CHANNELS; channel++) {
+    pwmDuties[channel] = duties[channel];
+  }
+  pwmWrites++;
+}
+
+void halRestart() {
+  restartRequests++;
+  if (echoMessages) printf("restart requested\n");
+}
+
+size_t halSerialWrite(const char* data, size_t length) {
+  if (Serial.echo) fwrite(data, 1, length, stdout);
+  return length;
+}
+
+uint32_t halRandom() {
+  return (uint32_t)rand();
+}
+
+bool halRtcRead(void* data, size_t size) {
+  // Like power on: nothing to read until something was written
+  if (!rtcWritten || size > sizeof(rtcMemory)) return false;
+  memcpy(data, rtcMemory, size);
+  return true;
+}
+
+bool halRtcWrite(const void* data, size_t size) {
+  if (size > sizeof(rtcMemory)) return false;
+  memcpy(rtcMemory, data, size);
+  rtcWritten = true;
+  return true;
+}
+
+void halWifiBegin() {
+}
+
+bool halWifiConnected() {
+  return wifiAvailable;
+}
+
+void halOnWifiUp() {
+}
+
+void halNtpRequest() {
+  ntpPending = wifiAvailable;
+}
+
+bool halNtpPoll(uint64_t& utcMs) {
+  // The virtual clock is exact, answer with it
+  if (!ntpPending) return false;
+  ntpPending = false;
+  utcMs = trueUtcMs ? trueUtcMs() : (uint64_t)halNow() * 1000 + virtualMillis % 1000;
+  return true;
+}
+
+void halSetUtcTime(uint32_t) {
+  sunriseClockSet();
+}
+
+bool halSettingsRead(uint8_t sector, uint32_t offset, void* data, size_t size) {
+  prepareSettingsSector();
+  if (sector >= SETTINGS_SECTORS || offset + size > SETTINGS_SECTOR_SIZE) return false;
+  memcpy(data, settingsSectors[sector] + offset, size);
+  return true;
+}
+
+bool halSettingsWrite(uint8_t sector, uint32_t offset, const void* data, size_t size) {
+  prepareSettingsSector();
+  if (sector >= SETTINGS_SECTORS || offset % 4 || size % 4 || offset + size > SETTINGS_SECTOR_SIZE) return false;
+  const uint8_t* bytes = (const uint8_t*)data;
+  for (size_t i = 0; i < size; i++) {
+    settingsSectors[sector][offset + i] &= bytes[i];
+  }
+  return true;
+}
+
+bool halSettingsErase(uint8_t sector) {
+  prepareSettingsSector();
+  if (sector >= SETTINGS_SECTORS) return false;
+  memset(settingsSectors[sector], 0xFF, SETTINGS_SECTOR_SIZE);
+  return true;
+}
+
+bool halMqttConnect() {
+  mqttConnected = wifiAvailable && brokerAvailable;
+  return mqttConnected;
+}
+
+bool halMqttConnected() {
+  return mqttConnected;
+}
+
+void halMqttLoop() {
+}
+
+bool halMqttPublish(const char* topic, const char* payload, bool retained) {
+  if (!mqttConnected) return false;
+  messageCount++;
+  messageBytes += strlen(topic) + strlen(payload);
+  if (echoMessages) {
+    printf("[mqtt%s] %s: %s\n", retained ? " retained" : "", topic, payload);
+  }
+  return true;
+}
+
+bool halTelegramSend(const char* text) {
+  messageCount++;
+  messageBytes += strlen(text);
+  if (echoMessages) {
+    printf("[telegram] %s\n", text);
+  }
+  return true;
+}
+
+// Real sockets on the loopback host, for the load test
+bool halHttpListen(uint16_t port) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0) return false;
+  int on = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+  sockaddr_in address = {};
+  address.sin_family = AF_INET;
+  address.sin_port = htons(port);
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (bind(fd, (sockaddr*)&address, sizeof(address)) < 0 || listen(fd, 64) < 0) {
+    perror("http socket");
+    close(fd);
+    return false;
+  }
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+  httpListenSocket = fd;
+  return true;
+}
+
+int halHttpAccept() {
+  if (httpListenSocket < 0) return -1;
+  int fd = accept(httpListenSocket, nullptr, nullptr);
+  if (fd < 0) return -1;
+  int on = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+  return fd;
+}
+
+int32_t halHttpRead(int connection, void* data, size_t size) {
+  ssize_t length = recv(connection, data, size, MSG_DONTWAIT);
+  if (length > 0) return length;
+  if (length < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return 0;
+  return -1;
+}
+
+int32_t halHttpWrite(int connection, const void* data, size_t length) {
+  ssize_t sent = send(connection, data, length, MSG_DONTWAIT | MSG_NOSIGNAL);
+  if (sent >= 0) return sent;
+  return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+}
+
+void halHttpClose(int connection) {
+  close(connection);
+}
+
+// Simulated clients on top of the real ones
+uint8_t halEventClients() {
+  return eventClients + httpEventClients();
+}
+
+bool halEventSend(const char* data) {
+  bool sent = httpEventSend(data);
+  if (!eventClients) return sent;
+  eventCount++;
+  eventBytes += strlen(data);
+  if (echoMessages) {
+    printf("[event] %s\n", data);
+  }
+  return true;
+}
+
+uint32_t halPeerId() {
+  return peerId;
+}
+
+bool halPeerSend(const void* data, size_t length) {
+  if (peerSocket < 0) return false;
+  sockaddr_in group = {};
+  group.sin_family = AF_INET;
+  group.sin_port = htons(PEER_PORT);
+  const uint8_t ip[] = { PEER_GROUP_IP };
+  memcpy(&group.sin_addr.s_addr, ip, 4);
+  return sendto(peerSocket, data, length, 0, (sockaddr*)&group, sizeof(group)) == (ssize_t)length;
+}
+
+size_t halPeerReceive(void* data, size_t size) {
+  if (peerSocket < 0) return 0;
+  // MSG_TRUNC gives the real length of a datagram too long for the buffer
+  ssize_t length = recv(peerSocket, data, size, MSG_TRUNC);
+  return length > 0 ? length : 0;
+}
+
+bool halUpdateGet(const char* path, uint32_t offset) {
+  if (!wifiAvailable) return false;
+  updateRequest = nullptr;
+  for (const NativeFile& file : updateFiles) {
+    if (file.path && strcmp(file.path, path) == 0 && offset <= file.size) updateRequest = &file;
+  }
+  // A missing file still connects, its read fails like a 404
+  updateOffset = offset;
+  return true;
+}
+
+int32_t halUpdateRead(uint8_t* data, size_t size) {
+  if (!updateRequest) return -2;
+  if (updateBreakAt && updateOffset >= updateBreakAt) {
+    updateBreakAt = 0;
+    updateRequest = nullptr;
+    return -2;
+  }
+  uint32_t remaining = updateRequest->size - updateOffset;
+  if (!remaining) return -1;
+  if (updateBreakAt && updateBreakAt - updateOffset < remaining) remaining = updateBreakAt - updateOffset;
+  // About one TCP segment per read
+  if (size > 1460) size = 1460;
+  if (size > remaining) size = remaining;
+  memcpy(data, updateRequest->data + updateOffset, size);
+  updateOffset += size;
+  return size;
+}
+
+void halUpdateClose() {
+  updateRequest = nullptr;
+}
+
+bool halUpdateBegin(uint32_t size) {
+  // Room for a 1 MB sketch like on a 4 MB board
+  if (size > 1024 * 1024) return false;
+  updateImageSize = size;
+  updateWritten = 0;
+  updateOpen = true;
+  return true;
+}
+
+bool halUpdateWrite(const uint8_t*, size_t length) {
+  if (!updateOpen || updateWritten + length > updateImageSize) return false;
+  updateWritten += length;
+  return true;
+}
+
+bool halUpdateEnd(bool install) {
+  bool complete = updateOpen && updateWritten == updateImageSize;
+  updateOpen = false;
+  if (!install) return true;
+  if (complete) updateInstalled = updateImageSize;
+  return complete;
+}
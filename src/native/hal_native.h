@@ -0,0 +1,66 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "../hal.h"
+
+// Controls for the native HAL. Time is virtual, it only moves when told to,
+// which keeps benchmarks and simulations deterministic.
+
+void nativeSetMillis(uint32_t ms);
+void nativeAdvanceMillis(uint32_t ms);
+// Set the local wall clock, it advances together with millis
+void nativeSetNow(time_t localEpoch);
+
+// Last duty written with halPwmWrite() to a channel
+uint16_t nativePwmDuty(uint8_t channel = 0);
+// Batched writes, one per ramp tick
+uint32_t nativePwmWrites();
+// Messages published to MQTT or Telegram since start
+uint32_t nativeMessageCount();
+uint32_t nativeMessageBytes();
+// Print every sent message to stdout
+void nativeEchoMessages(bool enable);
+
+// Simulated dashboard event stream, no clients by default
+void nativeSetEventClients(uint8_t clients);
+uint32_t nativeEventCount();
+uint32_t nativeEventBytes();
+
+// Simulated network, both links are up by default
+void nativeSetWifi(bool up);
+void nativeSetBroker(bool up);
+
+// Join the peer sync multicast group on the loopback host as unit `id`, so several
+// processes on one machine find each other. Until then nothing is sent or received.
+bool nativePeerBegin(uint32_t id);
+
+// Update server and flash for pull updates. Files are served from memory, a request
+// breaks off once after `breakAt` bytes of the file when set, like a WiFi hiccup.
+void nativeSetUpdateFile(const char* path, const void* data, size_t size);
+void nativeBreakUpdateAt(uint32_t breakAt);
+// Size of the image halUpdateEnd(true) installed, 0 when none
+uint32_t nativeUpdateInstalled();
+
+// Run the wall clock like the board does: halNow() is local time from the
+// disciplined clock (clock.h) and the time zone, unknown until NTP or RTC
+// memory set it, and NTP answers with utcMs(), the simulation's true time.
+// DST transitions shift the schedules like on the board.
+void nativeUseBoardClock(uint64_t (*utcMs)());
+// halRestart() calls since start
+uint32_t nativeRestartRequests();
+
+// What survives a reset: the settings sectors, and RTC memory unless the power was cut.
+// Saved before a simulated reboot and restored in the fresh process that boots next.
+struct NativePersistent {
+  uint8_t settings[SETTINGS_SECTORS][SETTINGS_SECTOR_SIZE];
+  uint32_t rtc[16];
+  bool rtcWritten;
+};
+void nativeSavePersistent(NativePersistent& state);
+void nativeRestorePersistent(const NativePersistent& state, bool powerCut);
+
+// One iteration of the firmware loop: fires due schedules, ticks the ramp and pushes state
+void nativeLoop();
@@ -0,0 +1,92 @@
+// One unit of a peer sync group on the host, built by the native_peers environment.
+// Start a few in separate terminals, each with its own id and clock drift:
+//   .pio/build/native_peers/program 1 0
+//   .pio/build/native_peers/program 2 150
+//   .pio/build/native_peers/program 3 -150 /setduration 1
+// A command given after the drift runs three seconds in, once the units found
+// each other; "sunrise" starts one. Lines typed on stdin are commands too.
+// Every second a unit prints its level, the leader and the phase error.
+
+#include <chrono>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "Arduino.h"
+#include "hal_native.h"
+#include "../hal.h"
+#include "../sunrise.h"
+#include "../commands.h"
+#include "../telemetry.h"
+#include "../connectivity.h"
+#include "../light.h"
+#include "../ingress.h"
+#include "../peer_sync.h"
+
+static void runCommand(const char* command) {
+  if (strcmp(command, "sunrise") == 0) {
+    startBrightnessIncrease();
+  } else {
+    ingressCommand(command, strlen(command), 0);
+  }
+}
+
+int main(int argc, char** argv) {
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s ID [DRIFT_PPM] [COMMAND...]\n", argv[0]);
+    return 1;
+  }
+  uint32_t id = strtoul(argv[1], nullptr, 0);
+  double drift = argc > 2 ? atof(argv[2]) / 1e6 : 0;
+  char command[INGRESS_TEXT_SIZE] = "";
+  for (int i = 3; i < argc; i++) {
+    if (i > 3) strncat(command, " ", sizeof(command) - strlen(command) - 1);
+    strncat(command, argv[i], sizeof(command) - strlen(command) - 1);
+  }
+
+  // Units boot at different times, their millis() have nothing in common
+  srand(id * 2654435761u ^ (uint32_t)time(nullptr));
+  uint32_t bootOffset = rand();
+  nativeSetMillis(bootOffset);
+  nativeSetNow(1700000000);
+  sunriseBegin();
+  lightBegin(LIGHT_MONO);
+  telemetryBegin(SINK_MQTT);
+  connectivityBegin(true);
+  nativeEchoMessages(true);
+  if (!nativePeerBegin(id)) return 1;
+  peerSyncBegin();
+
+  fcntl(STDIN_FILENO, F_SETFL, fcntl(STDIN_FILENO, F_GETFL) | O_NONBLOCK);
+  auto start = std::chrono::steady_clock::now();
+  uint32_t lastPrint = 0;
+  bool commandSent = !command[0];
+  char line[INGRESS_TEXT_SIZE];
+  for (;;) {
+    double realMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    uint32_t elapsed = (uint32_t)(realMs * (1 + drift));
+    nativeSetMillis(bootOffset + elapsed);
+    nativeLoop();
+
+    if (!commandSent && elapsed >= 3000) {
+      runCommand(command);
+      commandSent = true;
+    }
+    if (fgets(line, sizeof(line), stdin)) {
+      line[strcspn(line, "\r\n")] = '\0';
+      if (line[0]) runCommand(line);
+    }
+    if (elapsed - lastPrint >= 1000) {
+      lastPrint = elapsed;
+      const PeerSyncStats& stats = peerSyncStats();
+      printf("[%08lx] t=%lu level=%d active=%d leader=%08lx peers=%u phase=%ldms corrections=%lu\n",
+             (unsigned long)id, (unsigned long)(elapsed / 1000), currentBrightness, sunriseRamp.isActive(),
+             (unsigned long)peerSyncLeader(), peerCount(), (long)stats.lastPhaseErrorMs,
+             (unsigned long)stats.phaseCorrections);
+      fflush(stdout);
+    }
+    usleep(1000);
+  }
+}
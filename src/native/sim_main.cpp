@@ -0,0 +1,511 @@
+// Simulation of a unit over days of virtual time, built by the native_sim environment:
+//   .pio/build/native_sim/program [-v] SCRIPT [TRACE.csv]
+// The firmware runs from a virtual clock with the board's time keeping: NTP,
+// the disciplined clock with a drifting crystal, the time zone with its DST
+// transitions and the RTC memory warm start. The script is a trace of events
+// in true local time, see scripts/sim_week.txt:
+//   timezone EET-2EEST,M3.5.0/3,M10.5.0/4
+//   start 2025-03-27T21:00           where the simulation starts
+//   end +7d                           absolute, or relative to the start
+//   drift 40                          crystal error in ppm
+//   trace 60                          brightness sample interval in seconds
+//   at 2025-03-27T22:00 /settime 6:30 a command, like from MQTT
+//   at +10m burst 20 /setbrightness 5 the same command 20 times in one loop pass
+//   at +1h sunrise                    start a sunrise by hand
+//   at +1h wifi down                  wifi or broker, down or up
+//   at +30s reboot 3                  reset, off for 3 s; powercut also loses RTC memory
+// Relative times count from the previous line. Every boot runs in a fresh
+// process, so RAM is lost on a reboot while the settings sector and RTC memory
+// carry over. The firmware steps every RAMP_TICK_INTERVAL_MS while the light
+// changes or something is about to happen, and 5 seconds at a time otherwise.
+// Writes the brightness over time to TRACE.csv and prints for every alarm when
+// it started and ended against the true time.
+
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "Arduino.h"
+#include "hal_native.h"
+#include "../hal.h"
+#include "../sunrise.h"
+#include "../scheduler.h"
+#include "../telemetry.h"
+#include "../connectivity.h"
+#include "../settings_store.h"
+#include "../warm_start.h"
+#include "../clock.h"
+#include "../timezone.h"
+#include "../light.h"
+#include "../ingress.h"
+
+#define SIM_MAX_EVENTS 256
+#define SIM_MAX_ALARMS 256
+#define SIM_IDLE_STEP_MS 5000
+#define SIM_BUSY_STEP_MS RAMP_TICK_INTERVAL_MS
+// Fine steps this long after boot and script events, and before a schedule fires
+#define SIM_SETTLE_MS 5000
+#define SIM_DEFAULT_DOWN_MS 2000
+
+enum SimAction : uint8_t {
+  SIM_COMMAND,
+  SIM_SUNRISE,
+  SIM_WIFI,
+  SIM_BROKER,
+  SIM_REBOOT,
+  SIM_POWER_CUT,
+};
+
+struct SimEvent {
+  uint64_t utcMs;
+  SimAction action;
+  bool up;          // wifi and broker
+  uint16_t count;   // commands sent in the same pass
+  uint32_t downMs;  // reboots
+  char text[INGRESS_TEXT_SIZE];
+};
+
+struct SimAlarm {
+  time_t scheduled;   // local time the schedule fired for, the start of its ramp
+  uint32_t leadS;     // sunrise duration, 0 for a program
+  uint64_t startUtcMs;
+  int32_t startErrorMs;
+  int32_t endErrorMs;
+  bool ended;
+  bool completed;     // reached the maximum brightness
+};
+
+// Shared by the processes of every boot, anything else is lost on a reboot
+struct SimState {
+  uint64_t nowUtcMs;
+  uint64_t bootUtcMs;
+  uint64_t lastEventUtcMs;
+  uint64_t nextTraceUtcMs;
+  uint16_t nextEvent;
+  bool finished;
+  bool powerCut;
+  bool wifiUp;
+  bool brokerUp;
+  uint32_t boots;
+  uint64_t loops;
+  int16_t activeAlarm;
+  uint16_t alarmCount;
+  uint16_t notLit;
+  SimAlarm alarms[SIM_MAX_ALARMS];
+  NativePersistent persistent;
+};
+
+static char simTimezone[64] = TIMEZONE;
+static uint64_t startUtcMs = 0;
+static uint64_t endUtcMs = 0;
+static int32_t driftPpm = 0;
+static uint32_t traceIntervalMs = 60000;
+static SimEvent events[SIM_MAX_EVENTS];
+static uint16_t eventCount = 0;
+static bool verbose = false;
+static FILE* trace = nullptr;
+static SimState* sim = nullptr;
+
+// ----------------- Time -----------------
+
+static uint64_t trueUtcMs() {
+  return sim->nowUtcMs;
+}
+
+static uint64_t trueLocalMs(uint64_t utcMs) {
+  return (uint64_t)timezoneLocal(utcMs / 1000) * 1000 + utcMs % 1000;
+}
+
+static time_t localToUtc(time_t local) {
+  // The offset at the guess is right except within the hour of a transition
+  time_t guess = local - timezoneOffset(local);
+  return local - timezoneOffset(guess);
+}
+
+// A time in the hour skipped at a DST change is due when local time jumps past it
+static time_t dueLocal(time_t local) {
+  time_t utc = localToUtc(local);
+  if (timezoneLocal(utc) == local) return local;
+  return timezoneLocal(timezoneNextTransition(utc - 86400));
+}
+
+static void formatLocal(uint64_t localMs, char* buffer, size_t size, bool millis) {
+  time_t seconds = localMs / 1000;
+  tm fields;
+  gmtime_r(&seconds, &fields);
+  size_t length = strftime(buffer, size, "%Y-%m-%d %H:%M:%S", &fields);
+  if (millis) snprintf(buffer + length, size - length, ".%03u", (unsigned)(localMs % 1000));
+}
+
+// The unit's millis(), its crystal is off by driftPpm
+static uint32_t deviceMillis() {
+  int64_t elapsed = sim->nowUtcMs - sim->bootUtcMs;
+  return (uint32_t)(elapsed + elapsed * driftPpm / 1000000);
+}
+
+// ----------------- Script -----------------
+
+// "2025-03-27T21:00[:SS]" in local time, or "+90s", "+15m", "+6h", "+2d" after `previous`
+static bool parseTime(const char* text, uint64_t previous, uint64_t& utcMs) {
+  if (text[0] == '+') {
+    char* unit;
+    double amount = strtod(text + 1, &unit);
+    uint32_t scale = *unit == 's' ? 1000 : *unit == 'm' ? 60000 : *unit == 'h' ? 3600000 : *unit == 'd' ? 86400000 : 0;
+    if (!scale || unit[1]) return false;
+    utcMs = previous + (uint64_t)(amount * scale);
+    return true;
+  }
+  tm fields = {};
+  int second = 0;
+  if (sscanf(text, "%d-%d-%dT%d:%d:%d", &fields.tm_year, &fields.tm_mon, &fields.tm_mday, &fields.tm_hour,
+             &fields.tm_min, &second) < 5) {
+    return false;
+  }
+  fields.tm_year -= 1900;
+  fields.tm_mon -= 1;
+  fields.tm_sec = second;
+  utcMs = (uint64_t)localToUtc(timegm(&fields)) * 1000;
+  return true;
+}
+
+static const char* parseAction(char* text, SimEvent& event) {
+  char* argument = text + strcspn(text, " ");
+  if (*argument) *argument++ = '\0';
+  event.count = 1;
+  if (strcmp(text, "burst") == 0) {
+    event.count = strtoul(argument, &argument, 10);
+    while (*argument == ' ') argument++;
+    if (!event.count) return "burst needs a count";
+    text = argument;
+    argument = text + strcspn(text, " ");
+    if (*argument) *argument++ = '\0';
+  }
+  if (text[0] == '/' || text[0] == '{') {
+    event.action = SIM_COMMAND;
+    snprintf(event.text, sizeof(event.text), "%s%s%s", text, *argument ? " " : "", argument);
+  } else if (strcmp(text, "sunrise") == 0) {
+    event.action = SIM_SUNRISE;
+  } else if (strcmp(text, "wifi") == 0 || strcmp(text, "broker") == 0) {
+    event.action = text[0] == 'w' ? SIM_WIFI : SIM_BROKER;
+    if (strcmp(argument, "up") != 0 && strcmp(argument, "down") != 0) return "expected up or down";
+    event.up = strcmp(argument, "up") == 0;
+  } else if (strcmp(text, "reboot") == 0 || strcmp(text, "powercut") == 0) {
+    event.action = text[0] == 'r' ? SIM_REBOOT : SIM_POWER_CUT;
+    event.downMs = *argument ? atof(argument) * 1000 : SIM_DEFAULT_DOWN_MS;
+  } else {
+    return "unknown action";
+  }
+  return nullptr;
+}
+
+static bool loadScript(const char* path) {
+  FILE* file = fopen(path, "r");
+  if (!file) {
+    perror(path);
+    return false;
+  }
+  timezoneBegin(simTimezone);
+  char line[256];
+  uint64_t previous = 0;
+  for (uint16_t number = 1; fgets(line, sizeof(line), file); number++) {
+    line[strcspn(line, "#\r\n")] = '\0';
+    char key[16];
+    char value[200];
+    if (sscanf(line, "%15s %199[^\n]", key, value) < 2) continue;
+    // Trailing spaces before a comment
+    for (size_t i = strlen(value); i && value[i - 1] == ' ';) value[--i] = '\0';
+
+    const char* error = nullptr;
+    if (strcmp(key, "timezone") == 0) {
+      snprintf(simTimezone, sizeof(simTimezone), "%s", value);
+      if (!timezoneBegin(simTimezone)) error = "invalid TZ string";
+    } else if (strcmp(key, "start") == 0) {
+      if (!parseTime(value, 0, startUtcMs) || value[0] == '+') error = "start needs a date";
+      previous = startUtcMs;
+    } else if (strcmp(key, "end") == 0) {
+      if (!parseTime(value, startUtcMs, endUtcMs)) error = "invalid time";
+    } else if (strcmp(key, "drift") == 0) {
+      driftPpm = atoi(value);
+    } else if (strcmp(key, "trace") == 0) {
+      traceIntervalMs = atof(value) * 1000;
+    } else if (strcmp(key, "at") == 0) {
+      char* action = value + strcspn(value, " ");
+      if (*action) *action++ = '\0';
+      SimEvent& event = events[eventCount];
+      if (eventCount == SIM_MAX_EVENTS) {
+        error = "too many events";
+      } else if (!startUtcMs) {
+        error = "start has to come first";
+      } else if (!parseTime(value, previous, event.utcMs)) {
+        error = "invalid time";
+      } else if (event.utcMs < previous) {
+        error = "events have to be in order";
+      } else if (!(error = parseAction(action, event))) {
+        previous = event.utcMs;
+        eventCount++;
+      }
+    } else {
+      error = "unknown keyword";
+    }
+    if (error) {
+      fprintf(stderr, "%s:%u: %s\n", path, number, error);
+      fclose(file);
+      return false;
+    }
+  }
+  fclose(file);
+  if (!startUtcMs || endUtcMs <= startUtcMs) {
+    fprintf(stderr, "%s: needs a start and an end after it\n", path);
+    return false;
+  }
+  return true;
+}
+
+// ----------------- One boot -----------------
+
+static void writeTrace(const char* note) {
+  if (!trace) return;
+  char local[32];
+  formatLocal(trueLocalMs(sim->nowUtcMs), local, sizeof(local), true);
+  int64_t clockErrorMs = clockValid() ? (int64_t)(clockUtcMs() - sim->nowUtcMs) : 0;
+  fprintf(trace, "%s,%d,%u,%d,%lld,%s\n", local, currentBrightness, nativePwmDuty(), sunriseRamp.isActive(),
+          (long long)clockErrorMs, note);
+}
+
+// Off for downMs, the next process boots from what survived
+static void shutDown(uint32_t downMs, bool powerCut) {
+  writeTrace(powerCut ? "power cut" : "reboot");
+  nativeSavePersistent(sim->persistent);
+  sim->powerCut = powerCut;
+  sim->nowUtcMs += downMs;
+  sim->bootUtcMs = sim->nowUtcMs;
+}
+
+// True when the event reboots the unit
+static bool applyEvent(const SimEvent& event) {
+  sim->lastEventUtcMs = sim->nowUtcMs;
+  switch (event.action) {
+    case SIM_COMMAND:
+      for (uint16_t i = 0; i < event.count; i++) {
+        ingressCommand(event.text, strlen(event.text), 0);
+      }
+      return false;
+    case SIM_SUNRISE:
+      startBrightnessIncrease();
+      return false;
+    case SIM_WIFI:
+      sim->wifiUp = event.up;
+      nativeSetWifi(event.up);
+      return false;
+    case SIM_BROKER:
+      sim->brokerUp = event.up;
+      nativeSetBroker(event.up);
+      return false;
+    case SIM_REBOOT:
+    case SIM_POWER_CUT:
+      shutDown(event.downMs, event.action == SIM_POWER_CUT);
+      return true;
+  }
+  return false;
+}
+
+// A schedule that was pending before the pass fired during it
+static void checkAlarm(time_t pending, uint32_t previousEndMs) {
+  if (!pending || schedulerNextTrigger() == pending || halNow() < pending) return;
+  bool started = sunriseRamp.isActive() && sunriseRamp.endMs() != previousEndMs;
+  if (!started) {
+    sim->notLit++;
+    return;
+  }
+  if (sim->alarmCount == SIM_MAX_ALARMS) return;
+  SimAlarm& alarm = sim->alarms[sim->alarmCount];
+  alarm.scheduled = dueLocal(pending);
+  alarm.leadS = sunriseRunning() ? brightnessDuration * 60 : 0;
+  alarm.startUtcMs = sim->nowUtcMs;
+  alarm.startErrorMs = (int64_t)trueLocalMs(sim->nowUtcMs) - (int64_t)alarm.scheduled * 1000;
+  sim->activeAlarm = sim->alarmCount++;
+  writeTrace("alarm");
+}
+
+static void checkAlarmEnd() {
+  if (sim->activeAlarm < 0 || sunriseRamp.isActive()) return;
+  SimAlarm& alarm = sim->alarms[sim->activeAlarm];
+  alarm.ended = true;
+  alarm.completed = currentBrightness >= maxBrightness;
+  alarm.endErrorMs = (int64_t)trueLocalMs(sim->nowUtcMs) - ((int64_t)alarm.scheduled + alarm.leadS) * 1000;
+  sim->activeAlarm = -1;
+  writeTrace("ramp end");
+}
+
+static uint32_t stepMs(time_t pending) {
+  uint64_t now = sim->nowUtcMs;
+  if (sunriseRamp.isActive() || now - sim->bootUtcMs < SIM_SETTLE_MS || now - sim->lastEventUtcMs < SIM_SETTLE_MS) {
+    return SIM_BUSY_STEP_MS;
+  }
+  if (pending && halNow() && pending - halNow() <= SIM_SETTLE_MS / 1000) return SIM_BUSY_STEP_MS;
+  // Around a DST change, a schedule in the skipped hour is due when the board sees the jump
+  uint64_t transitionMs = (uint64_t)timezoneNextTransition((now - SIM_SETTLE_MS) / 1000) * 1000;
+  if (transitionMs && transitionMs - now + SIM_SETTLE_MS <= 2 * SIM_SETTLE_MS) return SIM_BUSY_STEP_MS;
+  uint64_t step = SIM_IDLE_STEP_MS;
+  if (sim->nextEvent < eventCount && events[sim->nextEvent].utcMs - now < step) step = events[sim->nextEvent].utcMs - now;
+  if (sim->nextTraceUtcMs - now < step) step = sim->nextTraceUtcMs - now;
+  return step ? step : 1;
+}
+
+static void boot() {
+  // Like setup() in main.cpp
+  nativeRestorePersistent(sim->persistent, sim->powerCut);
+  nativeUseBoardClock(trueUtcMs);
+  nativeEchoMessages(verbose);
+  nativeSetWifi(sim->wifiUp);
+  nativeSetBroker(sim->brokerUp);
+  lightBegin(LIGHT_MONO);
+  sunriseBegin();
+  telemetryBegin(SINK_MQTT);
+  settingsRestore();
+  warmStartRestore();
+  timezoneBegin(simTimezone);
+  if (clockValid()) sunriseClockSet();
+  connectivityBegin(true);
+  sim->boots++;
+  if (sim->activeAlarm >= 0 && !sunriseRamp.isActive()) {
+    // The reboot ended the ramp for good, the warm start did not pick it up
+    sim->alarms[sim->activeAlarm].ended = true;
+    sim->activeAlarm = -1;
+  }
+  writeTrace(sim->boots == 1 ? "start" : "boot");
+
+  uint32_t restarts = nativeRestartRequests();
+  while (sim->nowUtcMs < endUtcMs) {
+    while (sim->nextEvent < eventCount && events[sim->nextEvent].utcMs <= sim->nowUtcMs) {
+      if (applyEvent(events[sim->nextEvent++])) return;
+    }
+    time_t pending = schedulerNextTrigger();
+    uint32_t previousEndMs = sunriseRamp.isActive() ? sunriseRamp.endMs() : 0;
+    nativeSetMillis(deviceMillis());
+    nativeLoop();
+    sim->loops++;
+    checkAlarm(pending, previousEndMs);
+    checkAlarmEnd();
+    if (sim->nowUtcMs >= sim->nextTraceUtcMs) {
+      writeTrace("");
+      sim->nextTraceUtcMs += traceIntervalMs;
+    }
+    // /reboot, or an installed update
+    if (nativeRestartRequests() != restarts) {
+      shutDown(SIM_DEFAULT_DOWN_MS, false);
+      return;
+    }
+    sim->nowUtcMs += stepMs(pending);
+  }
+  sim->finished = true;
+}
+
+// ----------------- Report -----------------
+
+static void printReport(double seconds) {
+  char from[32];
+  char to[32];
+  formatLocal(trueLocalMs(startUtcMs), from, sizeof(from), false);
+  formatLocal(trueLocalMs(endUtcMs), to, sizeof(to), false);
+  printf("Simulated %s to %s (%.1f days) in %.3f s, %llu loop passes, %u boots\n\n", from, to,
+         (endUtcMs - startUtcMs) / 86400000.0, seconds, (unsigned long long)sim->loops, sim->boots);
+
+  printf("%5s  %-19s  %-23s  %12s  %12s\n", "alarm", "scheduled start", "started (true time)", "start error", "end error");
+  int64_t startSum = 0;
+  int32_t startWorst = 0;
+  int32_t endWorst = 0;
+  uint16_t completed = 0;
+  for (uint16_t i = 0; i < sim->alarmCount; i++) {
+    const SimAlarm& alarm = sim->alarms[i];
+    char scheduled[32];
+    char started[32];
+    char endError[24] = "-";
+    formatLocal((uint64_t)alarm.scheduled * 1000, scheduled, sizeof(scheduled), false);
+    formatLocal(trueLocalMs(alarm.startUtcMs), started, sizeof(started), true);
+    if (alarm.ended && alarm.completed && alarm.leadS) {
+      snprintf(endError, sizeof(endError), "%+ld ms", (long)alarm.endErrorMs);
+      if (abs(alarm.endErrorMs) > abs(endWorst)) endWorst = alarm.endErrorMs;
+      completed++;
+    } else if (alarm.ended && alarm.leadS) {
+      snprintf(endError, sizeof(endError), "interrupted");
+    }
+    printf("%5u  %-19s  %-23s  %+9ld ms  %12s\n", i + 1, scheduled, started, (long)alarm.startErrorMs, endError);
+    startSum += alarm.startErrorMs;
+    if (abs(alarm.startErrorMs) > abs(startWorst)) startWorst = alarm.startErrorMs;
+  }
+  printf("\n%u alarms, start error mean %+.0f ms, worst %+ld ms; %u sunrises completed, end error worst %+ld ms",
+         sim->alarmCount, sim->alarmCount ? (double)startSum / sim->alarmCount : 0.0, (long)startWorst, completed,
+         (long)endWorst);
+  printf("; %u schedules fired without light\n", sim->notLit);
+}
+
+int main(int argc, char** argv) {
+  int arg = 1;
+  if (arg < argc && strcmp(argv[arg], "-v") == 0) {
+    verbose = true;
+    arg++;
+  }
+  if (arg >= argc) {
+    fprintf(stderr, "usage: %s [-v] SCRIPT [TRACE.csv]\n", argv[0]);
+    return 1;
+  }
+  if (!loadScript(argv[arg])) return 1;
+  if (arg + 1 < argc) {
+    trace = fopen(argv[arg + 1], "w");
+    if (!trace) {
+      perror(argv[arg + 1]);
+      return 1;
+    }
+    fprintf(trace, "local_time,brightness,duty,ramp,clock_error_ms,note\n");
+  }
+
+  sim = (SimState*)mmap(nullptr, sizeof(SimState), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (sim == MAP_FAILED) {
+    perror("mmap");
+    return 1;
+  }
+  memset(sim, 0, sizeof(*sim));
+  sim->nowUtcMs = startUtcMs;
+  sim->bootUtcMs = startUtcMs;
+  sim->nextTraceUtcMs = startUtcMs;
+  sim->lastEventUtcMs = startUtcMs;
+  sim->wifiUp = true;
+  sim->brokerUp = true;
+  sim->activeAlarm = -1;
+  // A unit fresh from the factory: erased flash, RTC memory holds garbage
+  sim->persistent.rtcWritten = false;
+  memset(sim->persistent.settings, 0xFF, sizeof(sim->persistent.settings));
+
+  auto start = std::chrono::steady_clock::now();
+  while (!sim->finished) {
+    fflush(stdout);
+    if (trace) fflush(trace);
+    pid_t child = fork();
+    if (child < 0) {
+      perror("fork");
+      return 1;
+    }
+    if (child == 0) {
+      boot();
+      fflush(stdout);
+      if (trace) fflush(trace);
+      _exit(0);
+    }
+    int status;
+    waitpid(child, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+      fprintf(stderr, "boot %u crashed\n", sim->boots);
+      return 1;
+    }
+  }
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  if (trace) fclose(trace);
+  printReport(seconds);
+  return 0;
+}
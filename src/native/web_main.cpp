@@ -0,0 +1,234 @@
+// Load test of the web server, built by the native_web environment:
+//   .pio/build/native_web/program [CLIENTS] [SECONDS] [PORT]
+// The firmware loop runs on the main thread with the real web server on a
+// loopback port, while CLIENTS threads send requests back to back on kept alive
+// connections, rotating through the dashboard, /getInitialValues and the
+// setters. One more client is slow like a phone on bad WiFi: it sends each
+// request a few bytes at a time. Prints requests per second and latency
+// percentiles per endpoint, and how many requests the slow client got through.
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
+#include <chrono>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "Arduino.h"
+#include "hal_native.h"
+#include "../hal.h"
+#include "../sunrise.h"
+#include "../telemetry.h"
+#include "../connectivity.h"
+#include "../light.h"
+#include "../http_server.h"
+#include "../web.h"
+
+typedef std::chrono::steady_clock Clock;
+
+struct Endpoint {
+  const char* name;
+  const char* request; // %d is a value that changes with every request
+};
+
+static const Endpoint endpoints[] = {
+  { "/", "GET / HTTP/1.1\r\nHost: test\r\nAccept-Encoding: gzip\r\n\r\n" },
+  { "/getInitialValues", "GET /getInitialValues HTTP/1.1\r\nHost: test\r\n\r\n" },
+  { "/currentBrightness", "GET /currentBrightness?value=%d HTTP/1.1\r\nHost: test\r\n\r\n" },
+  { "/setSunrise", "GET /setSunrise?hour=6&minute=%d&sunriseDuration=30 HTTP/1.1\r\nHost: test\r\n\r\n" },
+  { "POST /api/config", "POST /api/config HTTP/1.1\r\nHost: test\r\nContent-Type: application/json\r\n"
+                        "Content-Length: %d\r\n\r\n%s" },
+};
+#define ENDPOINT_COUNT (sizeof(endpoints) / sizeof(endpoints[0]))
+
+struct ClientResult {
+  std::vector<uint32_t> latencyUs[ENDPOINT_COUNT];
+  uint32_t failures = 0;
+  uint32_t reconnects = 0;
+};
+
+static std::atomic<bool> running(true);
+static uint16_t port = 8080;
+
+static int connectServer() {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in address = {};
+  address.sin_family = AF_INET;
+  address.sin_port = htons(port);
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (connect(fd, (sockaddr*)&address, sizeof(address)) < 0) {
+    close(fd);
+    return -1;
+  }
+  int on = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+  timeval timeout = { 2, 0 };
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  return fd;
+}
+
+static int formatRequest(uint8_t endpoint, uint32_t sequence, char* request, size_t size) {
+  if (endpoint == 4) {
+    char body[64];
+    int length = snprintf(body, sizeof(body), "{\"maxBrightness\":%u}", 500 + sequence % 500);
+    return snprintf(request, size, endpoints[endpoint].request, length, body);
+  }
+  return snprintf(request, size, endpoints[endpoint].request, (int)(sequence % 60));
+}
+
+// Reads one response, true when it was a success status with the whole body
+static bool readResponse(int fd, char* buffer, size_t size, size_t& buffered, bool& closing) {
+  char* headerEnd = nullptr;
+  while (!(headerEnd = (char*)memmem(buffer, buffered, "\r\n\r\n", 4))) {
+    ssize_t length = recv(fd, buffer + buffered, size - buffered, 0);
+    if (length <= 0) return false;
+    buffered += length;
+  }
+  int status = atoi(buffer + 9);
+  *headerEnd = '\0';
+  size_t headerLength = headerEnd + 4 - buffer;
+  bool chunked = strstr(buffer, "Transfer-Encoding: chunked");
+  closing = strstr(buffer, "Connection: close");
+  const char* lengthHeader = strstr(buffer, "Content-Length: ");
+  if (chunked || !lengthHeader) return false;
+  size_t total = headerLength + strtoul(lengthHeader + 16, nullptr, 10);
+  while (buffered < total) {
+    ssize_t length = recv(fd, buffer + buffered, size - buffered, 0);
+    if (length <= 0) return false;
+    buffered += length;
+  }
+  buffered -= total;
+  memmove(buffer, buffer + total, buffered);
+  return status >= 200 && status < 300;
+}
+
+static bool sendAll(int fd, const char* data, size_t length, bool slowly) {
+  while (length) {
+    size_t piece = slowly ? std::min<size_t>(length, 8) : length;
+    ssize_t sent = send(fd, data, piece, MSG_NOSIGNAL);
+    if (sent <= 0) return false;
+    data += sent;
+    length -= sent;
+    if (slowly) std::this_thread::sleep_for(std::chrono::milliseconds(40));
+  }
+  return true;
+}
+
+static void runClient(uint32_t id, bool slow, ClientResult* result) {
+  char request[256];
+  char buffer[8192];
+  size_t buffered = 0;
+  int fd = -1;
+  for (uint32_t sequence = id * 7; running; sequence++) {
+    if (fd < 0) {
+      fd = connectServer();
+      buffered = 0;
+      if (fd < 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        continue;
+      }
+      result->reconnects++;
+    }
+    uint8_t endpoint = slow ? 1 : sequence % ENDPOINT_COUNT;
+    int length = formatRequest(endpoint, sequence, request, sizeof(request));
+    Clock::time_point start = Clock::now();
+    bool closing = false;
+    if (!sendAll(fd, request, length, slow) || !readResponse(fd, buffer, sizeof(buffer), buffered, closing)) {
+      // A closed kept alive connection is normal, anything else counts
+      if (running) result->failures++;
+      close(fd);
+      fd = -1;
+      continue;
+    }
+    uint32_t latencyUs = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start).count();
+    result->latencyUs[endpoint].push_back(latencyUs);
+    if (closing) {
+      close(fd);
+      fd = -1;
+    }
+  }
+  if (fd >= 0) close(fd);
+}
+
+static uint32_t percentile(std::vector<uint32_t>& values, uint8_t percent) {
+  if (values.empty()) return 0;
+  size_t index = (values.size() - 1) * percent / 100;
+  std::nth_element(values.begin(), values.begin() + index, values.end());
+  return values[index];
+}
+
+int main(int argc, char** argv) {
+  uint32_t clientCount = argc > 1 ? strtoul(argv[1], nullptr, 10) : HTTP_MAX_CONNECTIONS - 1;
+  uint32_t seconds = argc > 2 ? strtoul(argv[2], nullptr, 10) : 5;
+  if (argc > 3) port = strtoul(argv[3], nullptr, 10);
+
+  nativeSetMillis(0);
+  nativeSetNow(1700000000);
+  sunriseBegin();
+  lightBegin(LIGHT_MONO);
+  telemetryBegin(0);
+  connectivityBegin(false);
+  webBegin(port);
+
+  std::vector<ClientResult> results(clientCount + 1);
+  std::vector<std::thread> threads;
+  for (uint32_t i = 0; i < clientCount; i++) {
+    threads.emplace_back(runClient, i, false, &results[i]);
+  }
+  threads.emplace_back(runClient, clientCount, true, &results[clientCount]);
+
+  // The firmware loop, millis() follows the real time
+  Clock::time_point start = Clock::now();
+  uint64_t loops = 0;
+  for (;;) {
+    uint32_t elapsedMs = std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - start).count();
+    if (elapsedMs >= seconds * 1000) break;
+    nativeSetMillis(elapsedMs);
+    nativeLoop();
+    loops++;
+  }
+  running = false;
+  // Clients waiting for an answer need the loop to get one
+  for (Clock::time_point stop = Clock::now(); Clock::now() - stop < std::chrono::milliseconds(2500);) {
+    nativeSetMillis(std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - start).count());
+    nativeLoop();
+  }
+  for (std::thread& thread : threads) thread.join();
+
+  printf("%u clients and 1 slow client, %u s, %u connection slots, %.0f loop passes/s\n\n", clientCount, seconds,
+         HTTP_MAX_CONNECTIONS, (double)loops / seconds);
+  printf("%-20s %10s %10s %10s %10s\n", "endpoint", "requests/s", "p50 us", "p99 us", "max us");
+  uint32_t total = 0;
+  for (uint8_t endpoint = 0; endpoint < ENDPOINT_COUNT; endpoint++) {
+    std::vector<uint32_t> latencies;
+    for (uint32_t i = 0; i < clientCount; i++) {
+      latencies.insert(latencies.end(), results[i].latencyUs[endpoint].begin(), results[i].latencyUs[endpoint].end());
+    }
+    total += latencies.size();
+    uint32_t maximum = latencies.empty() ? 0 : *std::max_element(latencies.begin(), latencies.end());
+    printf("%-20s %10.0f %10u %10u %10u\n", endpoints[endpoint].name, (double)latencies.size() / seconds,
+           percentile(latencies, 50), percentile(latencies, 99), maximum);
+  }
+  uint32_t failures = 0;
+  uint32_t reconnects = 0;
+  for (const ClientResult& result : results) {
+    failures += result.failures;
+    reconnects += result.reconnects;
+  }
+  ClientResult& slow = results[clientCount];
+  printf("%-20s %10.0f\n\n", "all", (double)total / seconds);
+  printf("slow client: %u requests, p50 %u ms\n", (unsigned)slow.latencyUs[1].size(),
+         percentile(slow.latencyUs[1], 50) / 1000);
+  const HttpStats& stats = httpServerStats();
+  printf("connections %u (clients opened %u), kept alive requests %u of %u, failures %u, timeouts %u, reclaimed %u\n",
+         stats.connections, reconnects, stats.reused, stats.requests, failures, stats.timeouts, stats.reclaimed);
+  return 0;
+}
@@ -0,0 +1,343 @@
+#include "ota_pull.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "hal.h"
+#include "sha256.h"
+#include "sunrise.h"
+#include "scheduler.h"
+#include "clock.h"
+#include "warm_start.h"
+#include "telemetry.h"
+#include "log.h"
+
+#define OTA_MANIFEST_SIZE 128
+#define OTA_VERSION_SIZE 24
+
+static bool started = false;
+static OtaState state = OTA_IDLE;
+static OtaStats stats = {};
+static bool manualCheck = false;
+static bool installDeferred = false;
+static bool downtimeReported = false;
+static uint32_t nextCheckMs = 0;
+static uint32_t retryAtMs = 0;
+static uint32_t retryDelayMs = 0;
+static uint8_t retries = 0;
+static uint32_t requestStartMs = 0;
+static uint32_t lastDataMs = 0;
+static uint32_t restartAtMs = 0;
+
+static char manifest[OTA_MANIFEST_SIZE];
+static uint8_t manifestLength = 0;
+static char version[OTA_VERSION_SIZE];
+static uint8_t expectedSha[SHA256_SIZE];
+static Sha256 sha;
+static bool imageOpen = false;
+
+static bool reached(uint32_t now, uint32_t deadline) {
+  return (int32_t)(now - deadline) >= 0;
+}
+
+// A running ramp comes first, flash writes stall the CPU while a sector is erased.
+// A dithered steady level is not waited for, it could stay on all night.
+static bool lightBusy() {
+  return sunriseRamp.isActive();
+}
+
+static void finishCheck(uint32_t now) {
+  halUpdateClose();
+  state = OTA_IDLE;
+  manualCheck = false;
+  nextCheckMs = now + OTA_CHECK_INTERVAL_MS;
+}
+
+static void checkFailed(uint32_t now, const char* reason) {
+  logWarn("Update check failed: %s", reason);
+  if (manualCheck) sendMessagef(true, false, "Update check failed: %s", reason);
+  finishCheck(now);
+}
+
+static void abortDownload(uint32_t now, const char* reason) {
+  halUpdateClose();
+  if (imageOpen) halUpdateEnd(false);
+  imageOpen = false;
+  logError("Update %s failed: %s", version, reason);
+  sendMessagef(true, false, "Update %s failed: %s", version, reason);
+  finishCheck(now);
+}
+
+// ----------------- Download -----------------
+
+static void endRequest(uint32_t now) {
+  halUpdateClose();
+  stats.transferMs += now - requestStartMs;
+}
+
+// Backs off after a failed request, gives up after OTA_MAX_RETRIES of them in a row
+static void retryLater(uint32_t now, const char* reason) {
+  if (++retries > OTA_MAX_RETRIES) {
+    abortDownload(now, reason);
+    return;
+  }
+  logWarn("Update download broke off at %lu of %lu bytes: %s", (unsigned long)stats.received,
+          (unsigned long)stats.imageSize, reason);
+  retryDelayMs = retryDelayMs ? retryDelayMs * 2 : OTA_RETRY_MIN_MS;
+  if (retryDelayMs > OTA_RETRY_MAX_MS) retryDelayMs = OTA_RETRY_MAX_MS;
+  retryAtMs = now + retryDelayMs;
+  state = OTA_WAITING;
+}
+
+static void requestImage(uint32_t now) {
+  // A connect can block for a second, a server that is gone is not asked every loop()
+  if (!halUpdateGet(OTA_IMAGE_PATH, stats.received)) {
+    retryLater(now, "update server not reachable");
+    return;
+  }
+  if (stats.received) {
+    stats.resumes++;
+    logInfo("Update download resumed at %lu bytes", (unsigned long)stats.received);
+  }
+  requestStartMs = now;
+  lastDataMs = now;
+  state = OTA_DOWNLOADING;
+}
+
+static void downloadBroke(uint32_t now, const char* reason) {
+  endRequest(now);
+  retryLater(now, reason);
+}
+
+static void verifyImage(uint32_t now) {
+  endRequest(now);
+  uint8_t digest[SHA256_SIZE];
+  sha256End(sha, digest);
+  if (memcmp(digest, expectedSha, SHA256_SIZE) != 0) {
+    stats.rejected++;
+    abortDownload(now, "SHA-256 does not match the manifest");
+    return;
+  }
+  stats.downloads++;
+  stats.bytesPerSecond = stats.transferMs ? (uint64_t)stats.imageSize * 1000 / stats.transferMs : stats.imageSize;
+  logInfo("Update %s verified", version);
+  sendMessagef(true, false, "Update %s downloaded, %lu bytes in %lu s (%lu bytes/s, %lu resumes)", version,
+               (unsigned long)stats.imageSize, (unsigned long)(stats.transferMs / 1000),
+               (unsigned long)stats.bytesPerSecond, (unsigned long)stats.resumes);
+  installDeferred = false;
+  state = OTA_READY;
+}
+
+static void readImage(uint32_t now) {
+  if (lightBusy()) {
+    // Picked up again with a Range request once the light is idle
+    endRequest(now);
+    retryAtMs = now;
+    state = OTA_WAITING;
+    return;
+  }
+
+  uint8_t data[512];
+  for (uint32_t budget = OTA_READ_BUDGET; budget && stats.received < stats.imageSize;) {
+    uint32_t want = stats.imageSize - stats.received;
+    if (want > sizeof(data)) want = sizeof(data);
+    int32_t length = halUpdateRead(data, want);
+    if (length == 0) {
+      if (now - lastDataMs > OTA_STALL_TIMEOUT_MS) downloadBroke(now, "stalled");
+      return;
+    }
+    if (length < 0) {
+      downloadBroke(now, length == -1 ? "image shorter than the manifest says" : "connection lost");
+      return;
+    }
+    if (!halUpdateWrite(data, length)) {
+      abortDownload(now, "flash write failed");
+      return;
+    }
+    sha256Update(sha, data, length);
+    stats.received += length;
+    lastDataMs = now;
+    // A request that delivers again has its backoff reset
+    retries = 0;
+    retryDelayMs = 0;
+    budget = (uint32_t)length < budget ? budget - length : 0;
+  }
+  if (stats.received == stats.imageSize) verifyImage(now);
+}
+
+// ----------------- Manifest -----------------
+
+static const char* startDownload(uint32_t now) {
+  manifest[manifestLength] = '\0';
+  unsigned long size = 0;
+  char hex[SHA256_SIZE * 2 + 2];
+  if (sscanf(manifest, "%23s %lu %65s", version, &size, hex) != 3 || !sha256FromHex(hex, strlen(hex), expectedSha)) {
+    return "manifest is not VERSION SIZE SHA256";
+  }
+  if (strcmp(version, FIRMWARE_VERSION) == 0) {
+    logInfo("Firmware %s is up to date", version);
+    if (manualCheck) sendMessagef(true, false, "Firmware %s is up to date", version);
+    finishCheck(now);
+    return nullptr;
+  }
+  if (!size || !halUpdateBegin(size)) return "no room for the image";
+
+  halUpdateClose();
+  imageOpen = true;
+  sha256Begin(sha);
+  stats.imageSize = size;
+  stats.received = 0;
+  stats.transferMs = 0;
+  stats.resumes = 0;
+  retries = 0;
+  retryDelayMs = 0;
+  sendMessagef(true, false, "Downloading update %s, %lu bytes", version, size);
+  retryAtMs = now;
+  state = OTA_WAITING;
+  return nullptr;
+}
+
+static void readManifest(uint32_t now) {
+  int32_t length = halUpdateRead((uint8_t*)manifest + manifestLength, sizeof(manifest) - 1 - manifestLength);
+  if (length > 0) {
+    manifestLength += length;
+    lastDataMs = now;
+    if (manifestLength == sizeof(manifest) - 1) checkFailed(now, "manifest too long");
+    return;
+  }
+  if (length == 0) {
+    if (now - lastDataMs > OTA_STALL_TIMEOUT_MS) checkFailed(now, "no answer");
+    return;
+  }
+  if (length == -2) {
+    checkFailed(now, "no manifest on the server");
+    return;
+  }
+  const char* error = startDownload(now);
+  if (error) checkFailed(now, error);
+}
+
+static void startCheck(uint32_t now) {
+  stats.checks++;
+  manifestLength = 0;
+  if (!halUpdateGet(OTA_MANIFEST_PATH, 0)) {
+    checkFailed(now, "server unreachable");
+    return;
+  }
+  lastDataMs = now;
+  state = OTA_CHECKING;
+}
+
+// ----------------- Install -----------------
+
+static void installWhenIdle(uint32_t now) {
+  time_t next = schedulerNextTrigger();
+  bool scheduleSoon = next && next - halNow() < OTA_QUIET_SECONDS;
+  if (lightBusy() || scheduleSoon) {
+    if (!installDeferred) logInfo("Update %s waits for the light to be idle", version);
+    installDeferred = true;
+    return;
+  }
+  imageOpen = false;
+  if (!halUpdateEnd(true)) {
+    abortDownload(now, "the image was not accepted");
+    return;
+  }
+  sendMessagef(true, false, "Installing update %s, restarting", version);
+  restartAtMs = now + OTA_RESTART_DELAY_MS;
+  state = OTA_RESTARTING;
+}
+
+// The boot before the firmware ran is hidden from millis(), the first NTP
+// sample shows it as the error of the clock restored from RTC memory
+static void reportDowntime() {
+  if (downtimeReported || !warmStartStats().updateInstalled || clockSource() != CLOCK_NTP) return;
+  int32_t hiddenMs = clockStats().lastErrorMs > 0 ? clockStats().lastErrorMs : 0;
+  stats.downtimeMs = warmStartStats().lightReadyMs + hiddenMs;
+  downtimeReported = true;
+  sendMessagef(true, false, "Updated to %s, the light was off for %lu ms", FIRMWARE_VERSION,
+               (unsigned long)stats.downtimeMs);
+}
+
+// ----------------- Loop -----------------
+
+void otaPullBegin() {
+  started = true;
+  nextCheckMs = halMillis() + OTA_FIRST_CHECK_MS;
+}
+
+void otaPullLoop() {
+  if (!started) return;
+  uint32_t now = halMillis();
+  reportDowntime();
+
+  switch (state) {
+    case OTA_IDLE:
+      if (reached(now, nextCheckMs) && halWifiConnected()) startCheck(now);
+      break;
+
+    case OTA_CHECKING:
+      readManifest(now);
+      break;
+
+    case OTA_DOWNLOADING:
+      readImage(now);
+      break;
+
+    case OTA_WAITING:
+      if (reached(now, retryAtMs) && !lightBusy() && halWifiConnected()) requestImage(now);
+      break;
+
+    case OTA_READY:
+      installWhenIdle(now);
+      break;
+
+    case OTA_RESTARTING:
+      if (reached(now, restartAtMs)) {
+        // The clock goes into RTC memory right before the reset, the downtime is measured from it
+        warmStartSaveForUpdate();
+        halRestart();
+      }
+      break;
+  }
+}
+
+void otaPullCheck() {
+  if (!started) {
+    sendMessage("Pull updates are off, enable them with ENABLE_PULL_OTA", true, false);
+    return;
+  }
+  switch (state) {
+    case OTA_IDLE:
+      manualCheck = true;
+      nextCheckMs = halMillis();
+      sendMessagef(true, false, "Firmware %s, checking for updates", FIRMWARE_VERSION);
+      break;
+    case OTA_CHECKING:
+      sendMessage("Checking for updates", true, false);
+      break;
+    case OTA_DOWNLOADING:
+    case OTA_WAITING:
+      sendMessagef(true, false, "Update %s: %lu of %lu bytes%s", version, (unsigned long)stats.received,
+                   (unsigned long)stats.imageSize, state == OTA_WAITING ? ", paused" : "");
+      break;
+    case OTA_READY:
+      sendMessagef(true, false, "Update %s is ready, it installs once the light is idle", version);
+      break;
+    case OTA_RESTARTING:
+      sendMessagef(true, false, "Installing update %s", version);
+      break;
+  }
+}
+
+bool otaPullEnabled() {
+  return started;
+}
+
+OtaState otaPullState() {
+  return state;
+}
+
+const OtaStats& otaPullStats() {
+  return stats;
+}
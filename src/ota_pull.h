@@ -0,0 +1,74 @@
+#pragma once
+
+#include <stdint.h>
+
+// Pull updates from a local update server.
+// Every few hours the unit fetches a one line manifest, "VERSION SIZE SHA256",
+// and when the version differs from its own it downloads the gzip image next
+// to it, which the boot loader unpacks. The image is written to flash as it
+// streams in and hashed on the way. A broken connection is picked up where it
+// stopped with a Range request, so a WiFi hiccup costs a few seconds instead of
+// the whole download. Only an image whose SHA-256 matches is installed, and
+// only while no ramp runs and no schedule is about to fire. The light is off
+// for the reboot alone, its length is reported once NTP tells how long the
+// boot really took. scripts/publish_update.py prepares and serves the files.
+
+// Paths on the update server
+#ifndef OTA_MANIFEST_PATH
+#define OTA_MANIFEST_PATH "/morningleds/firmware.txt"
+#endif
+#ifndef OTA_IMAGE_PATH
+#define OTA_IMAGE_PATH "/morningleds/firmware.bin.gz"
+#endif
+// The running version, a new one is whatever the manifest names that differs
+#ifndef FIRMWARE_VERSION
+#define FIRMWARE_VERSION "dev"
+#endif
+#ifndef OTA_CHECK_INTERVAL_MS
+#define OTA_CHECK_INTERVAL_MS (6 * 3600000UL)
+#endif
+// First check after boot, once the network had time to come up
+#define OTA_FIRST_CHECK_MS 60000
+// A request that delivers nothing for this long is broken off and resumed
+#define OTA_STALL_TIMEOUT_MS 15000
+// Resume backoff, and how many resumes in a row before the download is given up
+#define OTA_RETRY_MIN_MS 2000
+#define OTA_RETRY_MAX_MS 300000UL
+#define OTA_MAX_RETRIES 10
+// Image bytes handled per loop pass
+#define OTA_READ_BUDGET 2048
+// No install this close before a schedule fires
+#define OTA_QUIET_SECONDS 300
+// Time for the install message to go out before the reboot
+#define OTA_RESTART_DELAY_MS 2000
+
+enum OtaState : uint8_t {
+  OTA_IDLE,
+  OTA_CHECKING,    // fetching the manifest
+  OTA_DOWNLOADING,
+  OTA_WAITING,     // download paused for the light, or waiting to resume
+  OTA_READY,       // verified, waiting for the light to be idle
+  OTA_RESTARTING,
+};
+
+struct OtaStats {
+  uint32_t checks;
+  uint32_t downloads;      // images downloaded and verified
+  uint32_t resumes;        // requests that continued a broken download
+  uint32_t rejected;       // images with a wrong checksum
+  uint32_t imageSize;
+  uint32_t received;       // bytes of the current image
+  uint32_t transferMs;     // time spent in requests for the current image
+  uint32_t bytesPerSecond; // of the last finished download
+  uint32_t downtimeMs;     // light off for the update this boot came from, 0 until known
+};
+
+// Start checking, call it in setup()
+void otaPullBegin();
+// Check, download and install, call it from loop()
+void otaPullLoop();
+// Check the server now, or report how the running update is doing
+void otaPullCheck();
+bool otaPullEnabled();
+OtaState otaPullState();
+const OtaStats& otaPullStats();
@@ -0,0 +1,416 @@
+#include "peer_sync.h"
+
+#include <string.h>
+
+#include "crc32.h"
+#include "hal.h"
+#include "sunrise.h"
+#include "scheduler.h"
+#include "telemetry.h"
+#include "log.h"
+
+#define PEER_MAGIC 0x4C4D
+#define PEER_VERSION 1
+
+enum PeerPacketType : uint8_t {
+  PEER_BEACON = 1,
+  PEER_CONFIG = 2,
+};
+
+enum PeerFlags : uint8_t {
+  PEER_RAMP_ACTIVE = 1,
+  PEER_RAMP_SUNRISE = 2,
+};
+
+// Every unit runs this firmware on a little endian CPU, packets are sent as the structs are
+struct PeerHeader {
+  uint16_t magic;
+  uint8_t version;
+  uint8_t type;
+  uint32_t id;
+};
+
+// A change is newer with a higher sequence number, on a tie the lower owner id wins
+struct PeerVersion {
+  uint32_t seq;
+  uint32_t owner;
+};
+
+struct PeerBeacon {
+  PeerHeader header;
+  PeerVersion state;
+  PeerVersion config;
+  uint32_t configCrc;
+  uint32_t rampElapsedMs;
+  uint32_t rampDurationMs;
+  uint16_t level;
+  uint16_t rampFrom;
+  uint16_t rampTo;
+  uint8_t flags;
+  uint8_t easing;
+};
+
+struct PeerSchedule {
+  int8_t hour;
+  int8_t minute;
+  uint8_t days;
+  uint8_t skipNext;
+  uint8_t program;
+};
+
+struct PeerConfigBody {
+  int16_t maxBrightness;
+  int16_t sunriseDuration;
+  PeerSchedule schedules[SCHEDULER_MAX_SCHEDULES];
+};
+
+struct PeerConfigPacket {
+  PeerHeader header;
+  PeerVersion config;
+  PeerConfigBody body;
+};
+
+// What the light is doing, the level only counts while no ramp runs
+struct LightSignature {
+  bool active;
+  uint32_t startMs;
+  uint32_t durationMs;
+  uint16_t from;
+  uint16_t to;
+  uint8_t easing;
+  uint16_t level;
+};
+
+static bool started = false;
+static uint32_t selfId = 0;
+static uint32_t leaderId = 0;
+static PeerInfo peers[PEER_MAX];
+static uint8_t peerTotal = 0;
+static PeerVersion stateVersion = {};
+static PeerVersion configVersion = {};
+static uint32_t configCrc = 0;
+static LightSignature knownLight = {};
+static uint32_t lastBeaconMs = 0;
+static uint32_t lastConfigCheckMs = 0;
+static uint32_t lastConfigSentMs = 0;
+// Leader ramp start in local milliseconds, one per beacon
+static uint32_t phaseEstimates[PEER_PHASE_WINDOW];
+static uint8_t phaseCount = 0;
+static uint8_t phaseNext = 0;
+static PeerSyncStats stats = {};
+
+static bool newer(const PeerVersion& a, const PeerVersion& b) {
+  return a.seq != b.seq ? a.seq > b.seq : a.owner < b.owner;
+}
+
+// ----------------- Light state -----------------
+
+static uint32_t rampStartMs() {
+  return sunriseRamp.endMs() - sunriseRamp.duration();
+}
+
+static LightSignature currentLight() {
+  LightSignature light = {};
+  light.active = sunriseRamp.isActive();
+  if (light.active) {
+    light.startMs = rampStartMs();
+    light.durationMs = sunriseRamp.duration();
+    light.from = sunriseRamp.fromLevel();
+    light.to = sunriseRamp.toLevel();
+    light.easing = sunriseRamp.easing();
+  } else {
+    light.level = currentBrightness;
+  }
+  return light;
+}
+
+static bool sameLight(const LightSignature& a, const LightSignature& b) {
+  return a.active == b.active && a.startMs == b.startMs && a.durationMs == b.durationMs && a.from == b.from &&
+         a.to == b.to && a.easing == b.easing && a.level == b.level;
+}
+
+// The last ramp, running or finished, is the one in the beacon
+static bool sameRamp(const PeerBeacon& beacon) {
+  return sunriseRamp.duration() == beacon.rampDurationMs && sunriseRamp.fromLevel() == beacon.rampFrom &&
+         sunriseRamp.toLevel() == beacon.rampTo && sunriseRamp.easing() == beacon.easing;
+}
+
+static void sendBeacon(uint32_t now) {
+  PeerBeacon beacon = {};
+  beacon.header = { PEER_MAGIC, PEER_VERSION, PEER_BEACON, selfId };
+  beacon.state = stateVersion;
+  beacon.config = configVersion;
+  beacon.configCrc = configCrc;
+  beacon.level = currentBrightness;
+  if (sunriseRamp.isActive()) {
+    beacon.flags = PEER_RAMP_ACTIVE | (sunriseRunning() ? PEER_RAMP_SUNRISE : 0);
+    // From the start time, elapsed() is only as fresh as the last tick
+    beacon.rampElapsedMs = now - rampStartMs();
+    beacon.rampDurationMs = sunriseRamp.duration();
+    beacon.rampFrom = sunriseRamp.fromLevel();
+    beacon.rampTo = sunriseRamp.toLevel();
+    beacon.easing = sunriseRamp.easing();
+  }
+  if (halPeerSend(&beacon, sizeof(beacon))) stats.beaconsSent++;
+  lastBeaconMs = now;
+}
+
+// Take over another unit's light as it is now
+static void mirror(const PeerBeacon& beacon, uint32_t now) {
+  if (beacon.flags & PEER_RAMP_ACTIVE) {
+    followRamp(now - beacon.rampElapsedMs, beacon.rampDurationMs, beacon.rampFrom, beacon.rampTo,
+               (RampEasing)beacon.easing, beacon.flags & PEER_RAMP_SUNRISE);
+  } else {
+    followLevel(beacon.level);
+  }
+  knownLight = currentLight();
+  phaseCount = 0;
+  phaseNext = 0;
+}
+
+static void lockPhase(const PeerBeacon& beacon, uint32_t now) {
+  phaseEstimates[phaseNext] = now - beacon.rampElapsedMs;
+  phaseNext = (phaseNext + 1) % PEER_PHASE_WINDOW;
+  if (phaseCount < PEER_PHASE_WINDOW) phaseCount++;
+
+  // A delayed beacon makes the start look later, the earliest estimate is the best one
+  uint32_t localStart = rampStartMs();
+  int32_t best = (int32_t)(phaseEstimates[0] - localStart);
+  for (uint8_t i = 1; i < phaseCount; i++) {
+    int32_t error = (int32_t)(phaseEstimates[i] - localStart);
+    if (error < best) best = error;
+  }
+  stats.lastPhaseErrorMs = -best;
+  if (best > PEER_PHASE_TOLERANCE_MS || best < -PEER_PHASE_TOLERANCE_MS) {
+    followRamp(localStart + best, sunriseRamp.duration(), sunriseRamp.fromLevel(), sunriseRamp.toLevel(),
+               sunriseRamp.easing(), beacon.flags & PEER_RAMP_SUNRISE);
+    knownLight = currentLight();
+    stats.phaseCorrections++;
+  }
+}
+
+// Same state as the leader, keep to its ramp and level
+static void followLeader(const PeerBeacon& beacon, uint32_t now) {
+  if (beacon.flags & PEER_RAMP_ACTIVE) {
+    if (sameRamp(beacon)) {
+      lockPhase(beacon, now);
+    } else {
+      mirror(beacon, now);
+    }
+    return;
+  }
+  // A follower that is a little behind finishes on its own
+  bool finishing = sunriseRamp.isActive() && sameRamp(beacon) && beacon.level == sunriseRamp.toLevel();
+  bool differs = sunriseRamp.isActive() ? !finishing : currentBrightness != beacon.level;
+  if (differs) mirror(beacon, now);
+}
+
+// Changes made here get a new version, the natural end of a ramp and the next
+// segment of a program do not. The leader tells about both right away.
+static void detectLightChange(uint32_t now) {
+  LightSignature light = currentLight();
+  if (sameLight(light, knownLight)) return;
+  bool ended = knownLight.active && !light.active && light.level == knownLight.to;
+  bool nextSegment = knownLight.active && light.active && light.startMs == knownLight.startMs + knownLight.durationMs &&
+                     light.from == knownLight.to;
+  knownLight = light;
+  if (ended) return;
+  if (!nextSegment) {
+    stateVersion = { stateVersion.seq + 1, selfId };
+    phaseCount = 0;
+    phaseNext = 0;
+  }
+  sendBeacon(now);
+}
+
+// ----------------- Configuration -----------------
+
+static void buildConfig(PeerConfigBody& body) {
+  memset(&body, 0, sizeof(body));
+  body.maxBrightness = maxBrightness;
+  body.sunriseDuration = brightnessDuration;
+  for (uint8_t id = 0; id < SCHEDULER_MAX_SCHEDULES; id++) {
+    const Schedule& schedule = schedulerGet(id);
+    body.schedules[id] = { schedule.hour, schedule.minute, schedule.days, schedule.skipNext, schedule.program };
+  }
+}
+
+static uint32_t currentConfigCrc() {
+  PeerConfigBody body;
+  buildConfig(body);
+  return crc32(&body, sizeof(body));
+}
+
+static void sendConfig(uint32_t now) {
+  PeerConfigPacket packet;
+  memset(&packet, 0, sizeof(packet));
+  packet.header = { PEER_MAGIC, PEER_VERSION, PEER_CONFIG, selfId };
+  packet.config = configVersion;
+  buildConfig(packet.body);
+  if (halPeerSend(&packet, sizeof(packet))) stats.configsSent++;
+  lastConfigSentMs = now;
+}
+
+static void applyConfig(const PeerConfigPacket& packet) {
+  const PeerConfigBody& body = packet.body;
+  if (body.maxBrightness < 0 || body.maxBrightness > CIE_MAX_LEVEL || body.sunriseDuration < 1 ||
+      body.sunriseDuration > 24 * 60) {
+    return;
+  }
+  maxBrightness = body.maxBrightness;
+  brightnessDuration = body.sunriseDuration;
+  sunriseDurationChanged();
+  for (uint8_t id = 0; id < SCHEDULER_MAX_SCHEDULES; id++) {
+    const PeerSchedule& schedule = body.schedules[id];
+    if (schedule.hour < 0) {
+      schedulerRemove(id);
+    } else {
+      schedulerRestore(id, { schedule.hour, schedule.minute, schedule.days, schedule.skipNext != 0, schedule.program });
+    }
+  }
+  configVersion = packet.config;
+  configCrc = currentConfigCrc();
+  stats.configsApplied++;
+  logInfo("Configuration from peer %08lx", (unsigned long)packet.header.id);
+  telemetryStateChangedNow();
+}
+
+// ----------------- Peers -----------------
+
+static void updateLeader() {
+  uint32_t leader = selfId;
+  for (uint8_t i = 0; i < peerTotal; i++) {
+    if (peers[i].id < leader) leader = peers[i].id;
+  }
+  if (leader != leaderId) {
+    logInfo("Peer leader is %08lx%s", (unsigned long)leader, leader == selfId ? ", this unit" : "");
+    leaderId = leader;
+  }
+}
+
+static void updatePeer(uint32_t id, uint32_t now, uint16_t level) {
+  uint8_t index = 0;
+  while (index < peerTotal && peers[index].id != id) index++;
+  if (index == peerTotal) {
+    if (peerTotal == PEER_MAX) return;
+    peerTotal++;
+    logInfo("Peer %08lx joined", (unsigned long)id);
+  }
+  peers[index] = { id, now, level };
+  updateLeader();
+}
+
+static void expirePeers(uint32_t now) {
+  for (uint8_t i = 0; i < peerTotal;) {
+    if (now - peers[i].lastSeenMs > PEER_TIMEOUT_MS) {
+      logInfo("Peer %08lx left", (unsigned long)peers[i].id);
+      peers[i] = peers[--peerTotal];
+    } else {
+      i++;
+    }
+  }
+  updateLeader();
+}
+
+static void handleBeacon(const PeerBeacon& beacon, uint32_t now) {
+  stats.beaconsReceived++;
+  updatePeer(beacon.header.id, now, beacon.level);
+
+  // Whoever has the newer configuration sends it
+  if (newer(configVersion, beacon.config) && now - lastConfigSentMs >= PEER_BEACON_INTERVAL_MS) {
+    sendConfig(now);
+  }
+
+  if (newer(beacon.state, stateVersion)) {
+    stateVersion = beacon.state;
+    mirror(beacon, now);
+    stats.statesAdopted++;
+    return;
+  }
+  if (beacon.state.seq == stateVersion.seq && beacon.state.owner == stateVersion.owner &&
+      beacon.header.id == leaderId && leaderId != selfId) {
+    followLeader(beacon, now);
+  }
+}
+
+static void receive(uint32_t now) {
+  union {
+    PeerHeader header;
+    PeerBeacon beacon;
+    PeerConfigPacket config;
+  } packet;
+  // A few per pass, a flood must not hold up the light
+  for (uint8_t i = 0; i < 4; i++) {
+    size_t length = halPeerReceive(&packet, sizeof(packet));
+    if (!length) return;
+    if (length < sizeof(PeerHeader) || packet.header.magic != PEER_MAGIC || packet.header.version != PEER_VERSION ||
+        packet.header.id == selfId) {
+      continue;
+    }
+    if (packet.header.type == PEER_BEACON && length == sizeof(PeerBeacon)) {
+      handleBeacon(packet.beacon, now);
+    } else if (packet.header.type == PEER_CONFIG && length == sizeof(PeerConfigPacket) &&
+               newer(packet.config.config, configVersion)) {
+      applyConfig(packet.config);
+    }
+  }
+}
+
+// ----------------- Loop -----------------
+
+void peerSyncBegin() {
+  selfId = halPeerId();
+  leaderId = selfId;
+  stateVersion = { 0, selfId };
+  configVersion = { 0, selfId };
+  configCrc = currentConfigCrc();
+  knownLight = currentLight();
+  lastBeaconMs = halMillis() - PEER_BEACON_INTERVAL_MS;
+  started = true;
+  logInfo("Peer sync as %08lx", (unsigned long)selfId);
+}
+
+void peerSyncLoop() {
+  if (!started) return;
+  uint32_t now = halMillis();
+
+  receive(now);
+  expirePeers(now);
+  detectLightChange(now);
+
+  if (now - lastConfigCheckMs >= PEER_CONFIG_CHECK_MS) {
+    lastConfigCheckMs = now;
+    uint32_t crc = currentConfigCrc();
+    if (crc != configCrc) {
+      configCrc = crc;
+      configVersion = { configVersion.seq + 1, selfId };
+      sendConfig(now);
+    }
+  }
+
+  if (now - lastBeaconMs >= PEER_BEACON_INTERVAL_MS) sendBeacon(now);
+}
+
+bool peerSyncMayFire() {
+  return !started || leaderId == selfId;
+}
+
+uint32_t peerSyncLeader() {
+  return leaderId;
+}
+
+bool peerSyncEnabled() {
+  return started;
+}
+
+uint8_t peerCount() {
+  return peerTotal;
+}
+
+const PeerInfo& peerGet(uint8_t index) {
+  return peers[index < peerTotal ? index : 0];
+}
+
+const PeerSyncStats& peerSyncStats() {
+  return stats;
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <stdint.h>
+
+// Several units lighting one room as one.
+// Every unit multicasts a small beacon once a second with its light state and
+// the version of its configuration (schedules, max brightness and duration).
+// The unit with the lowest id among those heard recently is the leader: only
+// it fires schedules, the others mirror its light. A ramp is locked by its
+// start time, which a follower derives from the leader's elapsed time with a
+// min filter over the last beacons, the least delayed one is closest, so no
+// wall clock is involved and NTP offsets do not matter. A change made on any
+// unit gets a higher sequence number and every unit adopts it, the same goes
+// for configuration changes, which are sent as a separate packet.
+// On the board the units also announce themselves over mDNS.
+
+// Multicast group and port, the same on every unit of a group
+#ifndef PEER_GROUP_IP
+#define PEER_GROUP_IP 239, 255, 77, 77
+#endif
+#ifndef PEER_PORT
+#define PEER_PORT 47777
+#endif
+#ifndef PEER_BEACON_INTERVAL_MS
+#define PEER_BEACON_INTERVAL_MS 1000
+#endif
+// A peer not heard for this long is gone, and with it maybe the leader
+#define PEER_TIMEOUT_MS (PEER_BEACON_INTERVAL_MS * 7 / 2)
+// Phase error a follower lets pass before it moves its ramp
+#ifndef PEER_PHASE_TOLERANCE_MS
+#define PEER_PHASE_TOLERANCE_MS 20
+#endif
+// Beacons the min filter looks at
+#define PEER_PHASE_WINDOW 8
+#define PEER_MAX 8
+// How often the configuration is checked for local changes
+#define PEER_CONFIG_CHECK_MS 100
+
+struct PeerInfo {
+  uint32_t id;
+  uint32_t lastSeenMs;
+  uint16_t level;
+};
+
+struct PeerSyncStats {
+  uint32_t beaconsSent;
+  uint32_t beaconsReceived;
+  uint32_t configsSent;
+  uint32_t configsApplied;
+  uint32_t statesAdopted;    // newer light state from another unit
+  uint32_t phaseCorrections;
+  int32_t lastPhaseErrorMs;  // follower ramp start minus the leader's, before correcting
+};
+
+// Start syncing, call it in setup() after the settings and the warm start were restored
+void peerSyncBegin();
+// Send and receive beacons, call it from loop()
+void peerSyncLoop();
+// Schedules fire on the leader only, true when sync is off
+bool peerSyncMayFire();
+uint32_t peerSyncLeader();
+bool peerSyncEnabled();
+
+// Peers heard within PEER_TIMEOUT_MS, this unit not included
+uint8_t peerCount();
+const PeerInfo& peerGet(uint8_t index);
+const PeerSyncStats& peerSyncStats();
@@ -0,0 +1,123 @@
+#include "program.h"
+
+struct ProgramSegment {
+  uint32_t durationMs;
+  int16_t levelDelta;
+  RampEasing easing;
+};
+
+// Compiled form, the level is only known at the start and changes by each segment
+struct ProgramPlan {
+  uint16_t startLevel;
+  uint8_t count;
+  ProgramSegment segments[PROGRAM_MAX_KEYFRAMES - 1];
+};
+
+static ProgramKeyframe sources[PROGRAM_SLOTS][PROGRAM_MAX_KEYFRAMES];
+static uint8_t sourceCounts[PROGRAM_SLOTS];
+static uint16_t revisions[PROGRAM_SLOTS];
+static ProgramPlan plans[PROGRAM_SLOTS];
+static int8_t running = -1;
+static uint8_t segment = 0;
+
+static const char* validate(const ProgramKeyframe* keyframes, uint8_t count) {
+  if (count < 2) return "A program needs at least two keyframes";
+  if (count > PROGRAM_MAX_KEYFRAMES) return "Too many keyframes";
+  if (keyframes[0].seconds != 0) return "The first keyframe must be at 0";
+  for (uint8_t i = 0; i < count; i++) {
+    if (keyframes[i].level > CIE_MAX_LEVEL) return "Levels must be between 0 and 1023";
+    if (keyframes[i].easing > RAMP_EASE_IN_OUT) return "Unknown easing";
+    if (i && keyframes[i].seconds < keyframes[i - 1].seconds) return "Keyframe times must not go back";
+  }
+  if (keyframes[count - 1].seconds == 0) return "A program must last at least a second";
+  if (keyframes[count - 1].seconds > PROGRAM_MAX_SECONDS) return "A program can last at most 24 hours";
+  return nullptr;
+}
+
+const char* programSet(uint8_t id, const ProgramKeyframe* keyframes, uint8_t count) {
+  if (id >= PROGRAM_SLOTS) return "No such program";
+  if (count) {
+    const char* error = validate(keyframes, count);
+    if (error) return error;
+  }
+  // The running segment finishes, the new plan is not mixed into it
+  if (running == id) running = -1;
+
+  ProgramPlan& plan = plans[id];
+  plan.count = count ? count - 1 : 0;
+  plan.startLevel = count ? keyframes[0].level : 0;
+  for (uint8_t i = 1; i < count; i++) {
+    plan.segments[i - 1] = {
+      (keyframes[i].seconds - keyframes[i - 1].seconds) * 1000,
+      (int16_t)(keyframes[i].level - keyframes[i - 1].level),
+      keyframes[i].easing,
+    };
+  }
+  for (uint8_t i = 0; i < count; i++) {
+    sources[id][i] = keyframes[i];
+  }
+  sourceCounts[id] = count;
+  revisions[id]++;
+  return nullptr;
+}
+
+uint8_t programKeyframes(uint8_t id, const ProgramKeyframe*& keyframes) {
+  if (id >= PROGRAM_SLOTS) return 0;
+  keyframes = sources[id];
+  return sourceCounts[id];
+}
+
+uint16_t programRevision(uint8_t id) {
+  return id < PROGRAM_SLOTS ? revisions[id] : 0;
+}
+
+uint32_t programDurationMs(uint8_t id) {
+  if (id >= PROGRAM_SLOTS || !sourceCounts[id]) return 0;
+  return sources[id][sourceCounts[id] - 1].seconds * 1000;
+}
+
+// ----------------- Playback -----------------
+
+static void startSegment(SunriseRamp& ramp, uint32_t startMs, uint16_t fromLevel) {
+  const ProgramSegment& next = plans[running].segments[segment];
+  ramp.start(startMs, next.durationMs, fromLevel, fromLevel + next.levelDelta, next.easing);
+}
+
+bool programStart(uint8_t id, SunriseRamp& ramp, uint32_t startMs) {
+  return programResume(id, 0, ramp, startMs);
+}
+
+bool programResume(uint8_t id, uint8_t index, SunriseRamp& ramp, uint32_t startMs) {
+  if (id >= PROGRAM_SLOTS || index >= plans[id].count) return false;
+  uint16_t level = plans[id].startLevel;
+  for (uint8_t i = 0; i < index; i++) {
+    level += plans[id].segments[i].levelDelta;
+  }
+  running = id;
+  segment = index;
+  startSegment(ramp, startMs, level);
+  return true;
+}
+
+bool programNextSegment(SunriseRamp& ramp) {
+  if (running < 0) return false;
+  if (++segment >= plans[running].count) {
+    running = -1;
+    return false;
+  }
+  // Chained on the end time, late ticks do not stretch the program
+  startSegment(ramp, ramp.endMs(), ramp.toLevel());
+  return true;
+}
+
+void programStop() {
+  running = -1;
+}
+
+int programRunning() {
+  return running;
+}
+
+uint8_t programSegment() {
+  return segment;
+}
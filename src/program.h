@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "ramp.h"
+
+// Light programs.
+// A program is a few keyframes: a time from its start, a level and the easing
+// of the segment that ends there, e.g. a sunrise, an hour at full brightness,
+// then a fade off. Setting a program validates it and compiles it into a table
+// of segments that only hold the step from the previous keyframe (duration,
+// level change, easing). A running program plays one segment at a time on the
+// sunrise ramp, so an output tick costs what it costs during a sunrise and
+// nothing is parsed or allocated while it runs.
+
+#ifndef PROGRAM_SLOTS
+#define PROGRAM_SLOTS 4
+#endif
+#ifndef PROGRAM_MAX_KEYFRAMES
+#define PROGRAM_MAX_KEYFRAMES 8
+#endif
+// Longest program, like the sunrise duration
+#define PROGRAM_MAX_SECONDS (24UL * 3600)
+
+struct ProgramKeyframe {
+  uint32_t seconds;  // from the start of the program
+  uint16_t level;
+  RampEasing easing; // of the segment that ends here, unused on the first keyframe
+};
+
+// Validate and compile into slot `id`, count 0 clears it. Returns nullptr or what was wrong.
+const char* programSet(uint8_t id, const ProgramKeyframe* keyframes, uint8_t count);
+// Keyframes as they were set, 0 for an empty slot
+uint8_t programKeyframes(uint8_t id, const ProgramKeyframe*& keyframes);
+// Counts up every time slot `id` is set, so a change is noticed without comparing keyframes
+uint16_t programRevision(uint8_t id);
+uint32_t programDurationMs(uint8_t id);
+
+// Start the first segment on the ramp at startMs, false for an empty slot
+bool programStart(uint8_t id, SunriseRamp& ramp, uint32_t startMs);
+// Start segment `segment` as if it began at startMs, after a reset
+bool programResume(uint8_t id, uint8_t segment, SunriseRamp& ramp, uint32_t startMs);
+// The ramp finished the current segment, start the next one where it ended.
+// Returns false when the program is over.
+bool programNextSegment(SunriseRamp& ramp);
+void programStop();
+// Id of the running program, -1 when none
+int programRunning();
+uint8_t programSegment();
@@ -0,0 +1,80 @@
+#include "ramp.h"
+
+const CieLut cieLut PROGMEM = buildCieLut();
+
+// Eased position for a linear position t, both in 1/65536
+static uint32_t ease(RampEasing easing, uint32_t t) {
+  switch (easing) {
+    case RAMP_EASE_IN:
+      return (uint64_t)t * t >> 16;
+    case RAMP_EASE_OUT: {
+      uint32_t left = 65536 - t;
+      return 65536 - ((uint64_t)left * left >> 16);
+    }
+    case RAMP_EASE_IN_OUT:
+      // Smoothstep, 3t^2 - 2t^3
+      return (uint64_t)t * t * (3 * 65536 - 2 * t) >> 32;
+    default:
+      return t;
+  }
+}
+
+void SunriseRamp::start(uint32_t nowMs, uint32_t duration, uint16_t fromLevel, uint16_t toLevel, RampEasing easing) {
+  if (fromLevel > CIE_MAX_LEVEL) fromLevel = CIE_MAX_LEVEL;
+  if (toLevel > CIE_MAX_LEVEL) toLevel = CIE_MAX_LEVEL;
+
+  startMs = nowMs;
+  durationMs = duration;
+  elapsedMs = 0;
+  fromFrac = (uint32_t)fromLevel << RAMP_LEVEL_FRAC_BITS;
+  spanFrac = ((int32_t)toLevel - (int32_t)fromLevel) << RAMP_LEVEL_FRAC_BITS;
+  shape = easing;
+  active = true;
+  setLevelFrac(fromFrac);
+}
+
+void SunriseRamp::stop() {
+  active = false;
+}
+
+bool SunriseRamp::tick(uint32_t nowMs) {
+  if (!active) return false;
+
+  // Unsigned subtraction keeps working across the millis() rollover
+  elapsedMs = nowMs - startMs;
+  if (elapsedMs >= durationMs) {
+    elapsedMs = durationMs;
+    setLevelFrac(fromFrac + spanFrac);
+    active = false;
+    return true;
+  }
+
+  int64_t delta;
+  if (shape == RAMP_LINEAR) {
+    delta = (int64_t)spanFrac * elapsedMs / durationMs;
+  } else {
+    delta = (int64_t)spanFrac * ease(shape, (uint64_t)elapsedMs * 65536 / durationMs) / 65536;
+  }
+  setLevelFrac(fromFrac + (int32_t)delta);
+  return false;
+}
+
+uint16_t SunriseRamp::progress() const {
+  if (durationMs == 0) return 1000;
+  return (uint16_t)((uint64_t)elapsedMs * 1000 / durationMs);
+}
+
+void SunriseRamp::setLevelFrac(uint32_t value) {
+  levelFrac = value;
+
+  // Interpolate linearly between the two neighbouring table entries
+  uint16_t index = value >> RAMP_LEVEL_FRAC_BITS;
+  uint32_t frac = value & ((1 << RAMP_LEVEL_FRAC_BITS) - 1);
+  uint32_t low = cieDutyFrac(index);
+  if (frac == 0 || index >= CIE_MAX_LEVEL) {
+    duty = low;
+    return;
+  }
+  uint32_t high = cieDutyFrac(index + 1);
+  duty = low + (((high - low) * frac) >> RAMP_LEVEL_FRAC_BITS);
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "cie_lut.h"
+
+// Fractional bits used for the ramp position between two whole levels
+#define RAMP_LEVEL_FRAC_BITS 6
+
+// How often the main loop should tick a running ramp
+#ifndef RAMP_TICK_INTERVAL_MS
+#define RAMP_TICK_INTERVAL_MS 20
+#endif
+
+// Shape of a ramp between its two levels
+enum RampEasing : uint8_t {
+  RAMP_LINEAR,
+  RAMP_EASE_IN,     // slow start
+  RAMP_EASE_OUT,    // slow end
+  RAMP_EASE_IN_OUT, // slow at both ends
+};
+
+/*
+  Time based brightness ramp.
+  The level is interpolated from millis() in fixed point, so the ramp always ends
+  exactly durationMs after it started no matter how often tick() is called, and
+  the output goes through the CIE lightness table with sub-level interpolation.
+  Eased ramps bend the time axis with a polynomial in fixed point.
+  No floating point is used after start().
+*/
+class SunriseRamp {
+public:
+  void start(uint32_t nowMs, uint32_t durationMs, uint16_t fromLevel, uint16_t toLevel, RampEasing easing = RAMP_LINEAR);
+  void stop();
+
+  // Advance the ramp to nowMs, returns true when the ramp finished on this tick
+  bool tick(uint32_t nowMs);
+
+  bool isActive() const { return active; }
+  // Whole perceptual level, 0..CIE_MAX_LEVEL
+  uint16_t level() const { return levelFrac >> RAMP_LEVEL_FRAC_BITS; }
+  // Level with RAMP_LEVEL_FRAC_BITS fractional bits, it picks the light color
+  uint32_t levelFraction() const { return levelFrac; }
+  // PWM duty with CIE_DUTY_FRAC_BITS fractional bits
+  uint16_t dutyFrac() const { return duty; }
+  // PWM duty ready for analogWrite()
+  uint16_t pwmDuty() const { return (duty + (1 << (CIE_DUTY_FRAC_BITS - 1))) >> CIE_DUTY_FRAC_BITS; }
+  // Progress in 1/1000
+  uint16_t progress() const;
+
+  // Enough to restart the ramp where it was, see resumeRamp()
+  uint32_t elapsed() const { return elapsedMs; }
+  uint32_t duration() const { return durationMs; }
+  // When the ramp reaches toLevel, the next segment of a program starts there
+  uint32_t endMs() const { return startMs + durationMs; }
+  RampEasing easing() const { return shape; }
+  uint16_t fromLevel() const { return fromFrac >> RAMP_LEVEL_FRAC_BITS; }
+  uint16_t toLevel() const { return (fromFrac + spanFrac) >> RAMP_LEVEL_FRAC_BITS; }
+
+private:
+  void setLevelFrac(uint32_t value);
+
+  bool active = false;
+  uint32_t startMs = 0;
+  uint32_t durationMs = 0;
+  uint32_t fromFrac = 0;
+  int32_t spanFrac = 0;
+  uint32_t elapsedMs = 0;
+  uint32_t levelFrac = 0;
+  uint16_t duty = 0;
+  RampEasing shape = RAMP_LINEAR;
+};
@@ -0,0 +1,293 @@
+#include "scheduler.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define SECONDS_PER_DAY 86400L
+
+struct HeapEntry {
+  time_t trigger;
+  uint8_t id;
+};
+
+static Schedule schedules[SCHEDULER_MAX_SCHEDULES];
+static HeapEntry heap[SCHEDULER_MAX_SCHEDULES];
+static uint8_t heapSize = 0;
+static ScheduleHandler onFire = nullptr;
+static uint32_t leadSeconds = 0;
+static bool clockKnown = false;
+static time_t lastNow = 0;
+
+static const char dayNames[7][4] = { "sun", "mon", "tue", "wed", "thu", "fri", "sat" };
+
+// ----------------- Heap -----------------
+
+static void swapEntries(uint8_t a, uint8_t b) {
+  HeapEntry entry = heap[a];
+  heap[a] = heap[b];
+  heap[b] = entry;
+}
+
+static void siftUp(uint8_t index) {
+  while (index > 0) {
+    uint8_t parent = (index - 1) / 2;
+    if (heap[parent].trigger <= heap[index].trigger) break;
+    swapEntries(parent, index);
+    index = parent;
+  }
+}
+
+static void siftDown(uint8_t index) {
+  while (true) {
+    uint8_t smallest = index;
+    uint8_t left = index * 2 + 1;
+    uint8_t right = left + 1;
+    if (left < heapSize && heap[left].trigger < heap[smallest].trigger) smallest = left;
+    if (right < heapSize && heap[right].trigger < heap[smallest].trigger) smallest = right;
+    if (smallest == index) break;
+    swapEntries(index, smallest);
+    index = smallest;
+  }
+}
+
+static void heapPush(time_t trigger, uint8_t id) {
+  heap[heapSize] = { trigger, id };
+  siftUp(heapSize++);
+}
+
+static void heapRemoveAt(uint8_t index) {
+  heap[index] = heap[--heapSize];
+  if (index < heapSize) {
+    siftDown(index);
+    siftUp(index);
+  }
+}
+
+static void heapRemoveId(uint8_t id) {
+  for (uint8_t i = 0; i < heapSize; i++) {
+    if (heap[i].id == id) {
+      heapRemoveAt(i);
+      return;
+    }
+  }
+}
+
+// ----------------- Schedules -----------------
+
+// First event of the schedule strictly after `after`, local epoch seconds
+static time_t nextTrigger(const Schedule& schedule, time_t after) {
+  time_t midnight = after - after % SECONDS_PER_DAY;
+  // 1970-01-01 was a Thursday
+  int weekday = (int)((midnight / SECONDS_PER_DAY + 4) % 7);
+  time_t offset = schedule.hour * 3600L + schedule.minute * 60L - (schedule.program ? 0 : (time_t)leadSeconds);
+
+  // The lead can move an event to the day before, so look one day further
+  for (int day = -1; day <= 8; day++) {
+    int scheduleDay = ((weekday + day) % 7 + 7) % 7;
+    if (schedule.days != SCHEDULE_ONCE && !(schedule.days & (1 << scheduleDay))) continue;
+    time_t trigger = midnight + day * SECONDS_PER_DAY + offset;
+    if (trigger > after) return trigger;
+  }
+  return 0;
+}
+
+static void queue(uint8_t id, time_t after) {
+  heapRemoveId(id);
+  if (!clockKnown || schedules[id].hour < 0) return;
+  time_t trigger = nextTrigger(schedules[id], after);
+  if (trigger) heapPush(trigger, id);
+}
+
+static void rebuild(time_t now) {
+  heapSize = 0;
+  for (uint8_t id = 0; id < SCHEDULER_MAX_SCHEDULES; id++) {
+    queue(id, now);
+  }
+}
+
+void schedulerBegin(ScheduleHandler handler) {
+  onFire = handler;
+  for (Schedule& schedule : schedules) {
+    schedule = { -1, 0, 0, false, 0 };
+  }
+}
+
+void schedulerClockSet(time_t now) {
+  lastNow = now;
+  if (!clockKnown) {
+    clockKnown = true;
+    rebuild(now);
+  }
+}
+
+void schedulerLoop(time_t now) {
+  if (!clockKnown) return;
+  // Stepped back further than a DST change, the queued events belong to another time
+  if (now + 3700 < lastNow) rebuild(now);
+  lastNow = now;
+
+  while (heapSize && heap[0].trigger <= now) {
+    HeapEntry due = heap[0];
+    Schedule& schedule = schedules[due.id];
+    heapRemoveAt(0);
+
+    bool fire = !schedule.skipNext && now - due.trigger <= SCHEDULER_LATE_LIMIT_S;
+    schedule.skipNext = false;
+    if (schedule.days == SCHEDULE_ONCE) {
+      schedule.hour = -1;
+    } else {
+      heapPush(nextTrigger(schedule, now), due.id);
+    }
+    if (fire && onFire) onFire(due.id);
+  }
+}
+
+void schedulerLocalShift(time_t now) {
+  // Moving overdue entries up to now keeps the heap order, they were the smallest
+  for (uint8_t i = 0; i < heapSize; i++) {
+    if (heap[i].trigger < now) heap[i].trigger = now;
+  }
+}
+
+void schedulerSetLead(uint32_t seconds, bool rebuildEvents) {
+  leadSeconds = seconds;
+  if (clockKnown && rebuildEvents) rebuild(lastNow);
+}
+
+int schedulerAdd(int hour, int minute, uint8_t days, uint8_t program) {
+  if (hour < 0 || hour > 23 || minute < 0 || minute > 59) return -1;
+  for (uint8_t id = 0; id < SCHEDULER_MAX_SCHEDULES; id++) {
+    if (schedules[id].hour < 0) {
+      schedules[id] = { (int8_t)hour, (int8_t)minute, (uint8_t)(days & SCHEDULE_DAILY), false, program };
+      queue(id, lastNow);
+      return id;
+    }
+  }
+  return -1;
+}
+
+int schedulerSetOnce(int hour, int minute) {
+  if (hour < 0 || hour > 23 || minute < 0 || minute > 59) return -1;
+  int id = schedulerFindOnce();
+  if (id < 0) return schedulerAdd(hour, minute, SCHEDULE_ONCE);
+  schedules[id] = { (int8_t)hour, (int8_t)minute, SCHEDULE_ONCE, false, 0 };
+  queue(id, lastNow);
+  return id;
+}
+
+int schedulerFindOnce() {
+  for (uint8_t id = 0; id < SCHEDULER_MAX_SCHEDULES; id++) {
+    if (schedules[id].hour >= 0 && schedules[id].days == SCHEDULE_ONCE) return id;
+  }
+  return -1;
+}
+
+bool schedulerRemove(uint8_t id) {
+  if (id >= SCHEDULER_MAX_SCHEDULES || schedules[id].hour < 0) return false;
+  schedules[id].hour = -1;
+  heapRemoveId(id);
+  return true;
+}
+
+bool schedulerRestore(uint8_t id, const Schedule& schedule) {
+  if (id >= SCHEDULER_MAX_SCHEDULES || schedule.hour < 0 || schedule.hour > 23 || schedule.minute < 0 ||
+      schedule.minute > 59) {
+    return false;
+  }
+  schedules[id] = schedule;
+  schedules[id].days &= SCHEDULE_DAILY;
+  queue(id, lastNow);
+  return true;
+}
+
+int schedulerSkipNext(int id) {
+  if (id < 0) {
+    id = schedulerNextId();
+    if (id < 0) return -1;
+  }
+  if (id >= SCHEDULER_MAX_SCHEDULES || schedules[id].hour < 0) return -1;
+  schedules[id].skipNext = true;
+  return id;
+}
+
+time_t schedulerNextTrigger() {
+  return heapSize ? heap[0].trigger : 0;
+}
+
+int schedulerNextId() {
+  return heapSize ? heap[0].id : -1;
+}
+
+const Schedule& schedulerGet(uint8_t id) {
+  return schedules[id < SCHEDULER_MAX_SCHEDULES ? id : 0];
+}
+
+uint8_t schedulerCount() {
+  uint8_t count = 0;
+  for (const Schedule& schedule : schedules) {
+    if (schedule.hour >= 0) count++;
+  }
+  return count;
+}
+
+// ----------------- Days -----------------
+
+static int dayIndex(const char* name, size_t length) {
+  if (length != 3) return -1;
+  for (int day = 0; day < 7; day++) {
+    if (strncasecmp(name, dayNames[day], 3) == 0) return day;
+  }
+  return -1;
+}
+
+static bool isWord(const char* text, size_t length, const char* word) {
+  return strlen(word) == length && strncasecmp(text, word, length) == 0;
+}
+
+bool parseScheduleDays(const char* text, size_t length, uint8_t& days) {
+  if (isWord(text, length, "daily")) {
+    days = SCHEDULE_DAILY;
+    return true;
+  }
+  if (isWord(text, length, "weekdays")) {
+    days = SCHEDULE_WEEKDAYS;
+    return true;
+  }
+  if (isWord(text, length, "weekends")) {
+    days = SCHEDULE_WEEKENDS;
+    return true;
+  }
+
+  // Comma separated days or ranges: mon-fri,sun, an empty item is an error
+  days = 0;
+  const char* end = text + length;
+  for (;;) {
+    const char* comma = (const char*)memchr(text, ',', end - text);
+    const char* itemEnd = comma ? comma : end;
+    const char* dash = (const char*)memchr(text, '-', itemEnd - text);
+
+    int first = dayIndex(text, (dash ? dash : itemEnd) - text);
+    int last = dash ? dayIndex(dash + 1, itemEnd - dash - 1) : first;
+    if (first < 0 || last < 0) return false;
+    // A range can wrap around the week: fri-mon
+    for (int day = first;; day = (day + 1) % 7) {
+      days |= 1 << day;
+      if (day == last) break;
+    }
+    if (!comma) return true;
+    text = comma + 1;
+  }
+}
+
+size_t formatScheduleDays(uint8_t days, char* buffer, size_t size) {
+  if (days == SCHEDULE_ONCE) return snprintf(buffer, size, "once");
+  if (days == SCHEDULE_DAILY) return snprintf(buffer, size, "daily");
+  size_t length = 0;
+  buffer[0] = '\0';
+  for (int day = 0; day < 7 && length < size; day++) {
+    if (!(days & (1 << day))) continue;
+    int written = snprintf(buffer + length, size - length, "%s%c%s", length ? "," : "", dayNames[day][0] - 32, dayNames[day] + 1);
+    if (written > 0) length += written;
+  }
+  return length < size ? length : size - 1;
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stdint.h>
+#include <time.h>
+
+// Sunrise schedules keyed on local epoch seconds.
+// A schedule is a wall clock time plus the weekdays it repeats on, or none for
+// a one-shot. Each enabled schedule has exactly one pending event in a binary
+// min-heap ordered by trigger time, so firing and rescheduling are O(log n)
+// and the next trigger is the heap top, O(1) for /status and the dashboard.
+// Events fire `lead` seconds before the schedule time, the sunrise duration.
+// A schedule can run a light program instead, it fires on its time.
+
+#ifndef SCHEDULER_MAX_SCHEDULES
+#define SCHEDULER_MAX_SCHEDULES 8
+#endif
+// An event found this late (clock jumped ahead) still fires, later ones are skipped
+#ifndef SCHEDULER_LATE_LIMIT_S
+#define SCHEDULER_LATE_LIMIT_S 600
+#endif
+
+#define SCHEDULE_ONCE 0
+#define SCHEDULE_DAILY 0x7F
+// Bit 0 is Sunday, like tm_wday
+#define SCHEDULE_WEEKDAYS 0x3E
+#define SCHEDULE_WEEKENDS 0x41
+
+struct Schedule {
+  int8_t hour;  // -1 for a free slot
+  int8_t minute;
+  uint8_t days; // weekday mask, SCHEDULE_ONCE for a one-shot
+  bool skipNext;
+  uint8_t program; // 0 for a sunrise, otherwise the program id + 1
+};
+
+typedef void (*ScheduleHandler)(uint8_t id);
+
+void schedulerBegin(ScheduleHandler handler);
+// Events need the clock, the first call after it is valid builds the heap
+void schedulerClockSet(time_t now);
+// Fire due events, call it from loop() with the local time
+void schedulerLoop(time_t now);
+// Local time jumps ahead to `now` at a DST transition, events in the skipped hour fire now.
+// Call it before schedulerLoop() sees the new time, or they are dropped as late.
+void schedulerLocalShift(time_t now);
+// Lead time in seconds, rebuilds every pending event. With rebuild false the
+// pending events keep their triggers until the next call that rebuilds.
+void schedulerSetLead(uint32_t seconds, bool rebuild = true);
+
+// Returns the schedule id, -1 when every slot is taken or the time is invalid
+int schedulerAdd(int hour, int minute, uint8_t days, uint8_t program = 0);
+// Replace the one-shot schedule, there is at most one
+int schedulerSetOnce(int hour, int minute);
+int schedulerFindOnce();
+bool schedulerRemove(uint8_t id);
+// Put a saved schedule back into its slot, so ids stay the same over a reboot
+bool schedulerRestore(uint8_t id, const Schedule& schedule);
+// Skip the next event of this schedule, or of whichever fires next with -1
+int schedulerSkipNext(int id);
+
+// Local epoch of the next event, 0 when nothing is scheduled
+time_t schedulerNextTrigger();
+int schedulerNextId();
+const Schedule& schedulerGet(uint8_t id);
+uint8_t schedulerCount();
+
+// Parse "mon-fri", "sat,sun", "daily", "weekdays" or "weekends" into a mask, false when invalid
+bool parseScheduleDays(const char* text, size_t length, uint8_t& days);
+// "Mon,Wed,Fri" style text for a mask
+size_t formatScheduleDays(uint8_t days, char* buffer, size_t size);
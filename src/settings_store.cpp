@@ -0,0 +1,345 @@
+#include "settings_store.h"
+
+#include <stddef.h>
+#include <string.h>
+
+#include "crc32.h"
+#include "hal.h"
+#include "sunrise.h"
+#include "scheduler.h"
+#include "program.h"
+
+#define RECORD_MAGIC 0x5352
+#define RECORD_VERSION 5
+
+#define RECORD_SETTINGS 0
+#define RECORD_PROGRAM 1
+
+struct StoredSchedule {
+  int8_t hour; // -1 for a free slot
+  int8_t minute;
+  uint8_t days;
+  uint8_t skipNext;
+  uint8_t program;
+};
+
+// Seconds in bits 0-16, level in 17-26, easing in 27-28, so a keyframe is one word
+#define KEYFRAME_LEVEL_SHIFT 17
+#define KEYFRAME_EASING_SHIFT 27
+static_assert(PROGRAM_MAX_SECONDS < (1U << KEYFRAME_LEVEL_SHIFT), "keyframe seconds do not fit");
+
+struct StoredSettings {
+  int16_t currentBrightness;
+  int16_t maxBrightness;
+  int16_t sunriseDuration;
+  StoredSchedule schedules[SCHEDULER_MAX_SCHEDULES];
+};
+
+// One program slot, only written when /program changes it
+struct StoredProgram {
+  uint8_t id;
+  uint8_t count;
+  uint32_t keyframes[PROGRAM_MAX_KEYFRAMES];
+};
+
+// Every slot of the log holds one record of either type. Flash writes are done in whole 32 bit words.
+struct alignas(4) StoredRecord {
+  uint16_t magic;
+  uint8_t version;
+  uint8_t type;
+  uint32_t sequence; // counts up over both sectors and both types, the highest valid one is the newest
+  union {
+    StoredSettings settings;
+    StoredProgram program;
+  };
+  uint32_t crc;
+};
+
+static_assert(sizeof(StoredRecord) % 4 == 0, "records must stay word sized");
+
+#define RECORD_SLOTS (SETTINGS_SECTOR_SIZE / sizeof(StoredRecord))
+
+// The newest record in flash of each kind, a sequence of 0 when there is none
+static StoredRecord saved;
+static StoredRecord savedPrograms[PROGRAM_SLOTS];
+static uint16_t savedProgramRevisions[PROGRAM_SLOTS];
+static uint32_t lastSequence = 0;
+static StoredSettings pending;
+static bool hasPending = false;
+static uint32_t pendingSinceMs = 0;
+static uint32_t programRetryMs = 0;
+static SettingsStoreStats stats = {};
+// The other sector is erased and ready for the next record once the active one is full
+static bool spareErased = false;
+
+static uint32_t recordCrc(const StoredRecord& record) {
+  return crc32(&record, offsetof(StoredRecord, crc));
+}
+
+static bool isValid(const StoredRecord& record) {
+  return record.magic == RECORD_MAGIC && record.version == RECORD_VERSION && record.crc == recordCrc(record);
+}
+
+static bool isErased(const StoredRecord& record) {
+  const uint32_t* words = (const uint32_t*)&record;
+  for (size_t i = 0; i < sizeof(record) / 4; i++) {
+    if (words[i] != 0xFFFFFFFF) return false;
+  }
+  return true;
+}
+
+static bool isNewer(const StoredRecord& record, const StoredRecord& than) {
+  return (int32_t)(record.sequence - than.sequence) > 0;
+}
+
+// Padding and the unused part of the union are zero, so equal contents give equal CRCs
+static void newRecord(StoredRecord& record, uint8_t type) {
+  memset(&record, 0, sizeof(record));
+  record.magic = RECORD_MAGIC;
+  record.version = RECORD_VERSION;
+  record.type = type;
+}
+
+static void currentSettings(StoredSettings& settings) {
+  memset(&settings, 0, sizeof(settings));
+  // A running ramp is not saved level by level, the level before it stays
+  settings.currentBrightness = sunriseRamp.isActive() ? saved.settings.currentBrightness : currentBrightness;
+  settings.maxBrightness = maxBrightness;
+  settings.sunriseDuration = brightnessDuration;
+  for (uint8_t id = 0; id < SCHEDULER_MAX_SCHEDULES; id++) {
+    const Schedule& schedule = schedulerGet(id);
+    settings.schedules[id] = { schedule.hour, schedule.minute, schedule.days, schedule.skipNext, schedule.program };
+  }
+}
+
+static void currentProgram(uint8_t id, StoredRecord& record) {
+  newRecord(record, RECORD_PROGRAM);
+  const ProgramKeyframe* keyframes;
+  record.program.id = id;
+  record.program.count = programKeyframes(id, keyframes);
+  for (uint8_t i = 0; i < record.program.count; i++) {
+    record.program.keyframes[i] = keyframes[i].seconds | (uint32_t)keyframes[i].level << KEYFRAME_LEVEL_SHIFT |
+                                  (uint32_t)keyframes[i].easing << KEYFRAME_EASING_SHIFT;
+  }
+}
+
+static bool sameSettings(const StoredSettings& a, const StoredSettings& b) {
+  return memcmp(&a, &b, sizeof(StoredSettings)) == 0;
+}
+
+static bool sameSchedules(const StoredSettings& a, const StoredSettings& b) {
+  return memcmp(a.schedules, b.schedules, sizeof(a.schedules)) == 0;
+}
+
+// Keep the record if it is the newest of its kind so far
+static void collect(const StoredRecord& record) {
+  if (record.type == RECORD_SETTINGS) {
+    if (!saved.sequence || isNewer(record, saved)) saved = record;
+  } else if (record.type == RECORD_PROGRAM && record.program.id < PROGRAM_SLOTS) {
+    StoredRecord& newest = savedPrograms[record.program.id];
+    if (!newest.sequence || isNewer(record, newest)) newest = record;
+  }
+}
+
+struct SectorScan {
+  uint16_t records;
+  uint16_t nextSlot; // RECORD_SLOTS when full
+  uint32_t newest;   // highest sequence, 0 when the sector holds no valid record
+};
+
+// Records are appended in order, a torn one is skipped
+static void scanSector(uint8_t sector, SectorScan& scan) {
+  scan.records = 0;
+  scan.nextSlot = RECORD_SLOTS;
+  scan.newest = 0;
+  for (uint16_t slot = 0; slot < RECORD_SLOTS; slot++) {
+    StoredRecord record;
+    if (!halSettingsRead(sector, slot * sizeof(record), &record, sizeof(record))) break;
+    if (isErased(record)) {
+      scan.nextSlot = slot;
+      break;
+    }
+    if (isValid(record) && record.sequence) {
+      collect(record);
+      scan.records++;
+      scan.newest = record.sequence;
+    }
+  }
+}
+
+static void restoreProgram(const StoredProgram& stored) {
+  ProgramKeyframe keyframes[PROGRAM_MAX_KEYFRAMES];
+  uint8_t count = stored.count <= PROGRAM_MAX_KEYFRAMES ? stored.count : 0;
+  for (uint8_t i = 0; i < count; i++) {
+    uint32_t packed = stored.keyframes[i];
+    keyframes[i] = { packed & ((1U << KEYFRAME_LEVEL_SHIFT) - 1), (uint16_t)(packed >> KEYFRAME_LEVEL_SHIFT & 0x3FF),
+                     (RampEasing)(packed >> KEYFRAME_EASING_SHIFT & 3) };
+  }
+  programSet(stored.id, keyframes, count);
+}
+
+bool settingsRestore() {
+  uint32_t start = halMicros();
+
+  // A power cut while moving to the other sector can leave records in both, the highest sequence wins
+  memset(&saved, 0, sizeof(saved));
+  memset(savedPrograms, 0, sizeof(savedPrograms));
+  SectorScan scans[SETTINGS_SECTORS];
+  int8_t active = -1;
+  lastSequence = 0;
+  for (uint8_t sector = 0; sector < SETTINGS_SECTORS; sector++) {
+    scanSector(sector, scans[sector]);
+    if (scans[sector].newest && (active < 0 || (int32_t)(scans[sector].newest - lastSequence) > 0)) {
+      active = sector;
+      lastSequence = scans[sector].newest;
+    }
+  }
+  stats.sector = active >= 0 ? active : 0;
+  stats.records = scans[stats.sector].records;
+  stats.nextSlot = scans[stats.sector].nextSlot;
+  // The other sector may hold old or torn records, it is erased before it is used
+  spareErased = false;
+
+  bool found = saved.sequence;
+  if (found) {
+    const StoredSettings& settings = saved.settings;
+    maxBrightness = settings.maxBrightness;
+    brightnessDuration = settings.sunriseDuration;
+    writeBrightness(settings.currentBrightness);
+    sunriseDurationChanged();
+    // Queued by sunriseClockSet() once the time is known
+    for (uint8_t id = 0; id < SCHEDULER_MAX_SCHEDULES; id++) {
+      const StoredSchedule& stored = settings.schedules[id];
+      if (stored.hour < 0) continue;
+      schedulerRestore(id, { stored.hour, stored.minute, stored.days, stored.skipNext != 0, stored.program });
+    }
+  } else {
+    newRecord(saved, RECORD_SETTINGS);
+    currentSettings(saved.settings);
+  }
+  for (uint8_t id = 0; id < PROGRAM_SLOTS; id++) {
+    if (savedPrograms[id].sequence) {
+      restoreProgram(savedPrograms[id].program);
+      found = true;
+    }
+    savedProgramRevisions[id] = programRevision(id);
+  }
+  stats.restoreMicros = halMicros() - start;
+  return found;
+}
+
+static bool writeVerified(uint8_t sector, uint16_t slot, const StoredRecord& record) {
+  StoredRecord check;
+  return halSettingsWrite(sector, slot * sizeof(record), &record, sizeof(record)) &&
+         halSettingsRead(sector, slot * sizeof(check), &check, sizeof(check)) && isValid(check) &&
+         check.sequence == record.sequence;
+}
+
+// The active sector is full: the newest settings and program records are copied to
+// the other sector followed by the new record, and the full one is erased only once
+// they all read back valid. A power cut at any point leaves every newest record, or
+// the one before the new record, in flash.
+static bool moveToSpare(const StoredRecord& record) {
+  uint8_t full = stats.sector;
+  uint8_t spare = (full + 1) % SETTINGS_SECTORS;
+  if (!spareErased) {
+    if (!halSettingsErase(spare)) return false;
+    stats.erases++;
+  }
+  spareErased = false;
+
+  uint16_t slot = 0;
+  if (record.type != RECORD_SETTINGS && saved.sequence) {
+    if (!writeVerified(spare, slot++, saved)) return false;
+  }
+  for (uint8_t id = 0; id < PROGRAM_SLOTS; id++) {
+    // An empty slot needs no record, it is what restore starts from
+    const StoredRecord& program = savedPrograms[id];
+    if (!program.sequence || !program.program.count) continue;
+    if (record.type == RECORD_PROGRAM && record.program.id == id) continue;
+    if (!writeVerified(spare, slot++, program)) return false;
+  }
+  if (!writeVerified(spare, slot++, record)) return false;
+
+  stats.sector = spare;
+  stats.nextSlot = slot;
+  stats.records = slot;
+  stats.writes += slot;
+  if (halSettingsErase(full)) {
+    stats.erases++;
+    spareErased = true;
+  }
+  return true;
+}
+
+static bool appendRecord(StoredRecord& record) {
+  record.sequence = lastSequence + 1;
+  record.crc = recordCrc(record);
+
+  if (stats.nextSlot >= RECORD_SLOTS) {
+    if (!moveToSpare(record)) return false;
+  } else {
+    // A failed or torn write leaves a bad CRC that restore skips, move past it either way
+    uint16_t slot = stats.nextSlot++;
+    if (!halSettingsWrite(stats.sector, slot * sizeof(record), &record, sizeof(record))) return false;
+    stats.writes++;
+    stats.records++;
+  }
+  lastSequence = record.sequence;
+  return true;
+}
+
+// A changed program is written right away, one per pass
+static void saveChangedProgram(uint32_t now) {
+  if (now - programRetryMs < SETTINGS_SAVE_DELAY_MS) return;
+  for (uint8_t id = 0; id < PROGRAM_SLOTS; id++) {
+    uint16_t revision = programRevision(id);
+    if (revision == savedProgramRevisions[id]) continue;
+    StoredRecord record;
+    currentProgram(id, record);
+    if (appendRecord(record)) {
+      savedPrograms[id] = record;
+      savedProgramRevisions[id] = revision;
+    } else {
+      // Try again after a delay
+      programRetryMs = now;
+    }
+    return;
+  }
+}
+
+void settingsStoreLoop() {
+  uint32_t now = halMillis();
+  saveChangedProgram(now);
+
+  StoredSettings current;
+  currentSettings(current);
+  if (sameSettings(current, saved.settings)) {
+    hasPending = false;
+    return;
+  }
+  // Every further change restarts the delay
+  if (!hasPending || !sameSettings(current, pending)) {
+    pending = current;
+    hasPending = true;
+    pendingSinceMs = now;
+    return;
+  }
+  // Schedules are not dragged around, and a fired one-shot must not come back after a reset
+  if (sameSchedules(current, saved.settings) && now - pendingSinceMs < SETTINGS_SAVE_DELAY_MS) return;
+
+  StoredRecord record;
+  newRecord(record, RECORD_SETTINGS);
+  record.settings = current;
+  if (appendRecord(record)) {
+    saved = record;
+    hasPending = false;
+  } else {
+    // Try again after another delay
+    pendingSinceMs = now;
+  }
+}
+
+const SettingsStoreStats& settingsStoreStats() {
+  return stats;
+}
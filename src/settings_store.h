@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdint.h>
+
+// Settings, sunrise schedules and light programs survive reboots, OTA and
+// brownouts. Every save appends a small CRC checked record to a flash sector and
+// the newest valid record wins, so a torn write just falls back to the previous
+// record. Each light program has records of its own, written only when it is
+// set. When the sector is full (about every 70 saves) the newest records move to
+// the other sector, and the full one is erased only after they verified, so
+// there is always a valid record in flash. Saves are debounced: a dragged slider
+// costs one record after it settles, not one per step. Schedule and program
+// changes are saved right away.
+
+// Time a change must stay unchanged before it is written
+#ifndef SETTINGS_SAVE_DELAY_MS
+#define SETTINGS_SAVE_DELAY_MS 5000
+#endif
+
+struct SettingsStoreStats {
+  uint8_t sector;    // the sector records are appended to
+  uint16_t records;  // valid records in that sector
+  uint16_t nextSlot; // where the next record goes
+  uint32_t writes;
+  uint32_t erases;
+  uint32_t restoreMicros;
+};
+
+// Read the log and apply the newest record, call it first thing in setup(),
+// the output is back at its last level before the network is touched.
+// Returns false when nothing was stored.
+bool settingsRestore();
+// Save changed settings once they settled, call it from loop()
+void settingsStoreLoop();
+
+const SettingsStoreStats& settingsStoreStats();
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// SHA-256 (FIPS 180-4), fed in pieces as an update image streams in
+struct Sha256 {
+  uint32_t state[8];
+  uint64_t length; // bytes hashed so far
+  uint8_t block[64];
+};
+
+#define SHA256_SIZE 32
+
+void sha256Begin(Sha256& sha);
+void sha256Update(Sha256& sha, const void* data, size_t length);
+void sha256End(Sha256& sha, uint8_t digest[SHA256_SIZE]);
+// Parse 64 hex digits, false when it is not a digest
+bool sha256FromHex(const char* hex, size_t length, uint8_t digest[SHA256_SIZE]);
@@ -0,0 +1,75 @@
+#include "state_push.h"
+
+#include <stdio.h>
+
+#include "hal.h"
+#include "sunrise.h"
+#include "scheduler.h"
+
+// What the dashboard was last told
+struct PushedState {
+  int currentBrightness;
+  int maxBrightness;
+  int sunriseDuration;
+  long nextAlarm;
+  int rampProgress;
+};
+
+// Every field differs from a real value, so the first delta carries everything
+static PushedState pushed = { -1, -1, -1, -1, -2 };
+static uint32_t lastPush = 0;
+
+static void appendField(char* buffer, size_t size, size_t& length, const char* name, long value) {
+  if (length >= size) return;
+  int written = snprintf(buffer + length, size - length, "%s\"%s\":%ld", length > 1 ? "," : "", name, value);
+  if (written > 0) length += written;
+}
+
+size_t formatStateDelta(char* buffer, size_t size) {
+  PushedState current = {
+    currentBrightness,
+    maxBrightness,
+    brightnessDuration,
+    (long)schedulerNextTrigger(),
+    sunriseRamp.isActive() ? sunriseRamp.progress() : -1,
+  };
+
+  size_t length = 1;
+  buffer[0] = '{';
+  if (current.currentBrightness != pushed.currentBrightness) {
+    appendField(buffer, size, length, "currentBrightness", current.currentBrightness);
+  }
+  if (current.maxBrightness != pushed.maxBrightness) {
+    appendField(buffer, size, length, "maxBrightness", current.maxBrightness);
+  }
+  if (current.sunriseDuration != pushed.sunriseDuration) {
+    appendField(buffer, size, length, "sunriseDuration", current.sunriseDuration);
+  }
+  if (current.nextAlarm != pushed.nextAlarm) {
+    appendField(buffer, size, length, "nextAlarm", current.nextAlarm);
+  }
+  if (current.rampProgress != pushed.rampProgress) {
+    appendField(buffer, size, length, "rampProgress", current.rampProgress);
+  }
+  pushed = current;
+
+  if (length == 1) return 0;
+  if (length + 1 >= size) length = size - 2;
+  buffer[length++] = '}';
+  buffer[length] = '\0';
+  return length;
+}
+
+void statePushLoop() {
+  uint32_t now = halMillis();
+  if (now - lastPush < STATE_PUSH_INTERVAL_MS) return;
+  lastPush = now;
+
+  // Nobody listening, a new client starts from the full state anyway
+  if (!halEventClients()) return;
+
+  char delta[STATE_DELTA_JSON_SIZE];
+  if (formatStateDelta(delta, sizeof(delta))) {
+    halEventSend(delta);
+  }
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Live state for the web dashboard.
+// Clients of the event stream get the full status JSON when they connect and
+// after that only the fields that changed, at most once per interval, so a
+// running sunrise costs a few small frames instead of repeated page polls.
+
+// Minimum time between two pushed deltas
+#ifndef STATE_PUSH_INTERVAL_MS
+#define STATE_PUSH_INTERVAL_MS 500
+#endif
+
+#define STATE_DELTA_JSON_SIZE 128
+
+// Format the fields that changed since the last call into buffer, returns the
+// length, 0 when nothing changed. The snapshot is updated either way.
+size_t formatStateDelta(char* buffer, size_t size);
+
+// Push a delta to the event stream when due, call it from loop()
+void statePushLoop();
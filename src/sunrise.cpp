@@ -0,0 +1,330 @@
+#include "sunrise.h"
+#include "hal.h"
+#include "telemetry.h"
+#include "scheduler.h"
+#include "light.h"
+#include "dither.h"
+#include "log.h"
+#include "program.h"
+#include "peer_sync.h"
+#include "clock.h"
+#include "timezone.h"
+
+int maxBrightness = 1023;
+int brightnessDuration = 45;
+int currentBrightness = 0;
+SunriseRamp sunriseRamp;
+unsigned long lastRampTick = 0;
+// Fades use the same ramp, they finish without a message
+static bool rampIsSunrise = false;
+static bool localTimeShifted = false;
+
+static void onScheduleFired(uint8_t id) {
+  // With peers only the leader fires, the others follow its light
+  if (!peerSyncMayFire()) return;
+  uint8_t program = schedulerGet(id).program;
+  if (program) {
+    startProgram(program - 1);
+    return;
+  }
+  startBrightnessIncrease();
+}
+
+void sunriseBegin() {
+  schedulerBegin(onScheduleFired);
+  sunriseDurationChanged();
+}
+
+void sunriseLoop() {
+  // A DST change moves the schedules before the scheduler sees the new local time,
+  // an event in the skipped hour would look late and be dropped otherwise
+  if (clockValid() && timezoneTransitionDue(clockUtc())) {
+    schedulerLocalShift(timezoneLocal(clockUtc()));
+    localTimeShifted = true;
+  }
+  schedulerLoop(halNow());
+  if (sunriseRamp.isActive() && halMillis() - lastRampTick >= RAMP_TICK_INTERVAL_MS) {
+    lastRampTick = halMillis();
+    brightnessIncrease();
+  }
+}
+
+void sunriseOutputLoop() {
+  sunriseLoop();
+  ditherLoop();
+}
+
+bool sunriseOutputActive() {
+  return sunriseRamp.isActive() || ditherActive();
+}
+
+bool sunriseRunning() {
+  return sunriseRamp.isActive() && rampIsSunrise;
+}
+
+void brightnessIncrease() {
+  // Advance the running ramp, the level is derived from elapsed time so late ticks catch up
+  int previousBrightness = currentBrightness;
+  int program = programRunning();
+  bool finished = sunriseRamp.tick(halMillis());
+  // A program goes on with its next segment from where the last one ended
+  while (finished && programNextSegment(sunriseRamp)) {
+    finished = sunriseRamp.tick(halMillis());
+  }
+  currentBrightness = sunriseRamp.level();
+  lightWrite(sunriseRamp.levelFraction(), sunriseRamp.dutyFrac());
+
+  if (finished) {
+    if (program >= 0) {
+      logInfo("Program %d finished", program);
+      sendMessagef(true, false, "Program %d finished", program);
+    } else if (rampIsSunrise) {
+      logInfo("Brightness increase finished");
+      sendMessage("Brightness increase finished", true, false);
+    } else {
+      logInfo("Fade to %d finished", currentBrightness);
+    }
+    telemetryStateChangedNow();
+    return;
+  }
+  // Only the latest level is published, rate limited by the telemetry queue
+  if (currentBrightness != previousBrightness) {
+    telemetryStateChanged();
+  }
+}
+
+void startBrightnessIncrease() {
+  // Ramp from 0 to maxBrightness over brightnessDuration minutes, ending exactly on time
+  unsigned long durationMs = (unsigned long)brightnessDuration * 60000UL;
+
+  currentBrightness = 0;
+  sunriseRamp.start(halMillis(), durationMs, 0, maxBrightness);
+  rampIsSunrise = true;
+  programStop();
+  lastRampTick = halMillis();
+  lightWrite(sunriseRamp.levelFraction(), sunriseRamp.dutyFrac());
+  sendMessagef(true, false, "Brightness increase started, duration: %d minutes", brightnessDuration);
+  telemetryStateChangedNow();
+}
+
+void resumeRamp(uint32_t elapsedMs, uint32_t durationMs, uint16_t fromLevel, uint16_t toLevel, RampEasing easing,
+                bool sunrise) {
+  // Started elapsedMs ago, the unsigned start time wraps like millis() does
+  followRamp(halMillis() - elapsedMs, durationMs, fromLevel, toLevel, easing, sunrise);
+  // A fade or a ramp followed from a peer goes on quietly, as it ran before
+  if (sunrise) {
+    sendMessagef(true, false, "Brightness increase resumed at %d.%d%%", sunriseRamp.progress() / 10,
+                 sunriseRamp.progress() % 10);
+  }
+}
+
+bool startProgram(uint8_t id) {
+  if (!programStart(id, sunriseRamp, halMillis())) {
+    sendMessagef(true, false, "Program %d is empty, set it with /program", id);
+    return false;
+  }
+  rampIsSunrise = false;
+  lastRampTick = halMillis();
+  brightnessIncrease();
+  sendMessagef(true, false, "Program %d started, duration: %lu minutes", id, (unsigned long)(programDurationMs(id) / 60000));
+  telemetryStateChangedNow();
+  return true;
+}
+
+void resumeProgram(uint8_t id, uint8_t segment, uint32_t elapsedMs) {
+  if (!programResume(id, segment, sunriseRamp, halMillis() - elapsedMs)) return;
+  rampIsSunrise = false;
+  lastRampTick = halMillis();
+  // Catches up over every segment that ended during the reset
+  brightnessIncrease();
+  if (programRunning() >= 0) {
+    sendMessagef(true, false, "Program %d resumed at keyframe %d", id, programSegment() + 1);
+  }
+}
+
+void followRamp(uint32_t startMs, uint32_t durationMs, uint16_t fromLevel, uint16_t toLevel, RampEasing easing, bool sunrise) {
+  sunriseRamp.start(startMs, durationMs, fromLevel, toLevel, easing);
+  rampIsSunrise = sunrise;
+  programStop();
+  lastRampTick = halMillis();
+  brightnessIncrease();
+}
+
+void followLevel(int level) {
+  sunriseRamp.stop();
+  programStop();
+  writeBrightness(level);
+  telemetryStateChangedNow();
+}
+
+void writeBrightness(int level) {
+  // Levels are perceptual, map them through the CIE table to a PWM duty
+  currentBrightness = level;
+  lightWrite((uint32_t)level << RAMP_LEVEL_FRAC_BITS, cieDutyFrac(level));
+}
+
+void sunriseClockSet() {
+  schedulerClockSet(halNow());
+}
+
+bool sunriseLocalTimeShifted() {
+  bool shifted = localTimeShifted;
+  localTimeShifted = false;
+  return shifted;
+}
+
+void sunriseDurationChanged(bool rebuild) {
+  schedulerSetLead(brightnessDuration * 60UL, rebuild);
+}
+
+// Report when the next sunrise starts
+static void reportNextSunrise() {
+  time_t next = schedulerNextTrigger();
+  if (!next) {
+    sendKeyedMessagef(MESSAGE_SUNRISE_TIME, true, false, "Sunrise set, it is scheduled once the time is known");
+    return;
+  }
+  sendKeyedMessagef(MESSAGE_SUNRISE_TIME, true, false, "Time set to %d:%02d, minutes untill alarm: %ld",
+                    (int)(next % 86400 / 3600), (int)(next % 3600 / 60), (long)(next - halNow()) / 60);
+}
+
+bool setSunriseTime(int hour, int minute) {
+  if (hour < 0 || hour > 23 || minute < 0 || minute > 59) {
+    sendMessage("Invalid time format. Please use HH:MM format.", true, false);
+    return false;
+  }
+  if (schedulerSetOnce(hour, minute) < 0) {
+    sendMessage("No free schedule, remove one with /unschedule", true, false);
+    return false;
+  }
+  reportNextSunrise();
+  telemetryStateChangedNow();
+  return true;
+}
+
+bool setSunriseDuration(int minutes) {
+  if (minutes < 1 || minutes > 24 * 60) {
+    sendMessage("Invalid duration. Please use a value between 1 and 1440 minutes", true, false);
+    return false;
+  }
+  brightnessDuration = minutes;
+  sunriseDurationChanged();
+  sendKeyedMessagef(MESSAGE_DURATION, true, false, "Brightness duration set to %d minutes", brightnessDuration);
+  telemetryStateChangedNow();
+  return true;
+}
+
+bool setBrightness(int level) {
+  if (level < 0 || level > CIE_MAX_LEVEL) {
+    sendMessage("Invalid brightness value. Please use a value between 0 and 1023", true, false);
+    return false;
+  }
+  // A manual brightness overrides a running sunrise or program
+  sunriseRamp.stop();
+  programStop();
+  writeBrightness(level);
+  sendKeyedMessagef(MESSAGE_BRIGHTNESS, true, false, "Brightness set to %d", currentBrightness);
+  telemetryStateChangedNow();
+  return true;
+}
+
+bool fadeBrightness(int level, uint32_t durationMs) {
+  if (!durationMs) return setBrightness(level);
+  if (level < 0 || level > CIE_MAX_LEVEL) {
+    sendMessage("Invalid brightness value. Please use a value between 0 and 1023", true, false);
+    return false;
+  }
+  // From wherever the light is now, a running sunrise or fade is replaced
+  sunriseRamp.start(halMillis(), durationMs, currentBrightness, level);
+  rampIsSunrise = false;
+  programStop();
+  lastRampTick = halMillis();
+  sendKeyedMessagef(MESSAGE_BRIGHTNESS, true, false, "Fading to %d over %lu seconds", level, (unsigned long)(durationMs / 1000));
+  telemetryStateChangedNow();
+  return true;
+}
+
+bool setMaxBrightness(int level) {
+  if (level < 0 || level > CIE_MAX_LEVEL) {
+    sendMessage("Invalid brightness value. Please use a value between 0 and 1023", true, false);
+    return false;
+  }
+  maxBrightness = level;
+  sendKeyedMessagef(MESSAGE_MAX_BRIGHTNESS, true, false, "Max brightness set to %d", maxBrightness);
+  telemetryStateChangedNow();
+  return true;
+}
+
+void reportStatus() {
+  // One JSON message instead of a publish per field
+  telemetryStatusRequested(true, false);
+}
+
+const char* validateSettings(const SettingsUpdate& update) {
+  if (update.fields & SETTING_BRIGHTNESS && (update.currentBrightness < 0 || update.currentBrightness > CIE_MAX_LEVEL)) {
+    return "currentBrightness must be between 0 and 1023";
+  }
+  if (update.fields & SETTING_MAX_BRIGHTNESS && (update.maxBrightness < 0 || update.maxBrightness > CIE_MAX_LEVEL)) {
+    return "maxBrightness must be between 0 and 1023";
+  }
+  if (update.fields & SETTING_DURATION && (update.sunriseDuration < 1 || update.sunriseDuration > 24 * 60)) {
+    return "sunriseDuration must be between 1 and 1440 minutes";
+  }
+  if (update.fields & SETTING_SUNRISE_TIME &&
+      (update.hour < 0 || update.hour > 23 || update.minute < 0 || update.minute > 59)) {
+    return "Invalid sunrise time";
+  }
+  if (update.fields & SETTING_SUNRISE_TIME && schedulerFindOnce() < 0 && schedulerCount() == SCHEDULER_MAX_SCHEDULES) {
+    return "No free schedule";
+  }
+  return nullptr;
+}
+
+const char* applySettings(const SettingsUpdate& update) {
+  // Nothing is applied unless every field is valid
+  const char* error = validateSettings(update);
+  if (error) return error;
+
+  if (update.fields & SETTING_MAX_BRIGHTNESS) {
+    maxBrightness = update.maxBrightness;
+  }
+  if (update.fields & SETTING_DURATION) {
+    brightnessDuration = update.sunriseDuration;
+  }
+  if (update.fields & SETTING_BRIGHTNESS) {
+    // A manual brightness overrides a running sunrise or program
+    sunriseRamp.stop();
+    programStop();
+    writeBrightness(update.currentBrightness);
+  }
+  // Schedules fire the duration ahead of their time. With a new alarm time as
+  // well, the heap is rebuilt once after the one-shot is in place.
+  bool newDuration = update.fields & SETTING_DURATION;
+  bool newTime = update.fields & SETTING_SUNRISE_TIME;
+  if (newDuration) {
+    sunriseDurationChanged(!newTime);
+  }
+  if (newTime) {
+    schedulerSetOnce(update.hour, update.minute);
+    if (newDuration) sunriseDurationChanged();
+    reportNextSunrise();
+  }
+
+  sendMessagef(true, false, "Settings updated: brightness %d, max brightness %d, duration %d minutes",
+               currentBrightness, maxBrightness, brightnessDuration);
+  telemetryStateChangedNow();
+  return nullptr;
+}
+
+size_t formatStatusJson(char* buffer, size_t size) {
+  time_t nextSunrise = schedulerNextTrigger();
+  int length = snprintf(buffer, size,
+    "{\"currentBrightness\":%d,\"maxBrightness\":%d,\"sunriseDuration\":%d,"
+    "\"now\":%ld,\"nextAlarm\":%ld,\"minutesToAlarm\":%ld,\"rampProgress\":%d,"
+    "\"program\":%d,\"state\":\"%s\",\"brightness\":%d,\"color_mode\":\"brightness\",\"effect\":%s}",
+    currentBrightness, maxBrightness, brightnessDuration,
+    (long)halNow(), (long)nextSunrise, nextSunrise ? (long)(nextSunrise - halNow()) / 60 : -1L,
+    sunriseRamp.isActive() ? sunriseRamp.progress() : -1, programRunning(),
+    currentBrightness > 0 ? "ON" : "OFF", currentBrightness, sunriseRunning() ? "\"sunrise\"" : "null");
+  return length < (int)size ? length : size - 1;
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <Arduino.h>
+
+#include "ramp.h"
+
+// Core sunrise logic, free of any network or board specific code so it also
+// builds for the native environment.
+
+// Period of the light output task, one PWM period so every dither step is on time
+#ifndef SUNRISE_OUTPUT_INTERVAL_US
+#define SUNRISE_OUTPUT_INTERVAL_US 1000
+#endif
+
+extern int maxBrightness;
+extern int brightnessDuration;
+extern int currentBrightness;
+extern SunriseRamp sunriseRamp;
+
+// Hook the sunrise up to the scheduler, call it once before restoring settings
+void sunriseBegin();
+// Fire due sunrise schedules and tick the running ramp, call it from loop()
+void sunriseLoop();
+// The light output task for the task scheduler: sunriseLoop() and the dither step
+void sunriseOutputLoop();
+// True while the output changes on its own and its deadlines matter
+bool sunriseOutputActive();
+// True while the running ramp is a sunrise, not a fade
+bool sunriseRunning();
+
+void brightnessIncrease();
+void startBrightnessIncrease();
+// Continue a sunrise or fade that was running before a reset, elapsedMs into it
+void resumeRamp(uint32_t elapsedMs, uint32_t durationMs, uint16_t fromLevel, uint16_t toLevel, RampEasing easing,
+                bool sunrise);
+// Play a light program from its first keyframe, see program.h. False for an empty slot.
+bool startProgram(uint8_t id);
+// Continue a program that was running before a reset, elapsedMs into segment `segment`
+void resumeProgram(uint8_t id, uint8_t segment, uint32_t elapsedMs);
+// Take over the light of another unit without a message, see peer_sync.h.
+// The ramp started at startMs on the local clock.
+void followRamp(uint32_t startMs, uint32_t durationMs, uint16_t fromLevel, uint16_t toLevel, RampEasing easing, bool sunrise);
+void followLevel(int level);
+void writeBrightness(int level);
+// The wall clock was set, schedules wait for it after boot
+void sunriseClockSet();
+// True once after sunriseLoop() passed a DST transition and moved the schedules,
+// the local time shown elsewhere follows then
+bool sunriseLocalTimeShifted();
+// The sunrise duration changed, schedules fire that much earlier than their time.
+// With rebuild false only the lead is set, see schedulerSetLead().
+void sunriseDurationChanged(bool rebuild = true);
+
+// Typed setters shared by every command source, they validate, apply and report.
+// Return false when the value was rejected.
+// One-shot sunrise at hour:minute, replaces the previous one-shot
+bool setSunriseTime(int hour, int minute);
+bool setSunriseDuration(int minutes);
+bool setBrightness(int level);
+// Fade from the current level on the ramp, durationMs 0 sets the level right away
+bool fadeBrightness(int level, uint32_t durationMs);
+bool setMaxBrightness(int level);
+void reportStatus();
+
+// Several settings changed together, only the fields flagged in `fields` are used
+enum SettingsField : uint8_t {
+  SETTING_BRIGHTNESS = 1,
+  SETTING_MAX_BRIGHTNESS = 2,
+  SETTING_DURATION = 4,
+  SETTING_SUNRISE_TIME = 8,
+};
+
+struct SettingsUpdate {
+  uint8_t fields;
+  int currentBrightness;
+  int maxBrightness;
+  int sunriseDuration;
+  int hour;
+  int minute;
+};
+
+// Validate every field first and apply all of them or none, the alarm is
+// rescheduled once. Returns nullptr on success, otherwise what was wrong.
+const char* applySettings(const SettingsUpdate& update);
+// Only the validation, for callers that apply later
+const char* validateSettings(const SettingsUpdate& update);
+
+// Device state as one JSON document, used for /status, the state topic and the dashboard.
+// It is also the state of the Home Assistant light, see home_assistant.h
+#define STATUS_JSON_SIZE 304
+size_t formatStatusJson(char* buffer, size_t size);
@@ -0,0 +1,110 @@
+#include "tasks.h"
+
+#include "hal.h"
+
+static const Task* table = nullptr;
+static uint8_t taskCount = 0;
+static TaskStats stats[TASKS_MAX];
+static uint32_t nextDueUs[TASKS_MAX];
+static uint8_t deferrals[TASKS_MAX];
+static uint8_t deadlineTasks[TASKS_MAX];
+static uint8_t deadlineCount = 0;
+static bool inDeadlineTask = false;
+
+static void runTask(uint8_t index) {
+  uint32_t startUs = halMicros();
+  uint32_t startCycles = metricsStart();
+  table[index].run();
+  metricsEnd(table[index].stage, startCycles);
+
+  TaskStats& task = stats[index];
+  uint32_t took = halMicros() - startUs;
+  task.runs++;
+  if (table[index].budgetUs && took > table[index].budgetUs) task.overBudget++;
+  task.costUs = took > task.costUs ? took : task.costUs - task.costUs / 8;
+}
+
+static bool isActive(const Task& task) {
+  return !task.active || task.active();
+}
+
+static void runDeadlines() {
+  if (inDeadlineTask) return;
+  inDeadlineTask = true;
+  for (uint8_t d = 0; d < deadlineCount; d++) {
+    uint8_t i = deadlineTasks[d];
+    const Task& task = table[i];
+    uint32_t now = halMicros();
+    int32_t lateness = now - nextDueUs[i];
+    if (lateness < 0) continue;
+
+    if (isActive(task)) {
+      if ((uint32_t)lateness > TASK_DEADLINE_SLACK_US) stats[i].missedDeadlines++;
+      if ((uint32_t)lateness > stats[i].maxLatenessUs) stats[i].maxLatenessUs = lateness;
+    }
+    runTask(i);
+    // Periods that were missed entirely are dropped, not run back to back
+    nextDueUs[i] += task.intervalUs;
+    if ((int32_t)(now - nextDueUs[i]) >= 0) nextDueUs[i] = now + task.intervalUs;
+  }
+  inDeadlineTask = false;
+}
+
+// Time left before the closest active deadline must start, INT32_MAX when none is active
+static int32_t deadlineSlack() {
+  int32_t slack = INT32_MAX;
+  uint32_t now = halMicros();
+  for (uint8_t d = 0; d < deadlineCount; d++) {
+    uint8_t i = deadlineTasks[d];
+    if (!isActive(table[i])) continue;
+    int32_t left = (int32_t)(nextDueUs[i] - now) + TASK_DEADLINE_SLACK_US;
+    if (left < slack) slack = left;
+  }
+  return slack;
+}
+
+void tasksBegin(const Task* tasks, uint8_t count) {
+  table = tasks;
+  taskCount = count < TASKS_MAX ? count : TASKS_MAX;
+  deadlineCount = 0;
+  uint32_t now = halMicros();
+  for (uint8_t i = 0; i < taskCount; i++) {
+    stats[i] = {};
+    nextDueUs[i] = now;
+    deferrals[i] = 0;
+    if (table[i].kind == TASK_DEADLINE) deadlineTasks[deadlineCount++] = i;
+  }
+}
+
+void tasksLoop() {
+  for (uint8_t i = 0; i < taskCount; i++) {
+    if (table[i].kind == TASK_DEADLINE) continue;
+    runDeadlines();
+    // Deadlines that were due just ran, so anything cheaper than the slack fits
+    if (table[i].kind == TASK_BUDGETED && stats[i].costUs > TASK_DEADLINE_SLACK_US &&
+        deferrals[i] < TASK_MAX_DEFERRALS && (int32_t)stats[i].costUs > deadlineSlack()) {
+      deferrals[i]++;
+      stats[i].deferred++;
+      continue;
+    }
+    deferrals[i] = 0;
+    runTask(i);
+  }
+  runDeadlines();
+}
+
+void tasksYield() {
+  runDeadlines();
+}
+
+uint8_t tasksCount() {
+  return taskCount;
+}
+
+const Task& tasksGet(uint8_t index) {
+  return table[index < taskCount ? index : 0];
+}
+
+const TaskStats& tasksStats(uint8_t index) {
+  return stats[index < TASKS_MAX ? index : 0];
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "metrics.h"
+
+// Cooperative task scheduler for loop().
+// Deadline tasks (the light output) run at a fixed interval and come first:
+// the scheduler runs a due one between every other task, and counts a missed
+// deadline when it starts more than TASK_DEADLINE_SLACK_US late. Budgeted
+// tasks (network) are held back while their recent cost would not fit before
+// the next deadline, at most TASK_MAX_DEFERRALS times in a row so they never
+// starve. Deadlines only hold anything back while the task's `active` hook
+// says the light is changing. Long tasks call tasksYield() at safe points.
+
+#ifndef TASK_DEADLINE_SLACK_US
+#define TASK_DEADLINE_SLACK_US 2000
+#endif
+#ifndef TASK_MAX_DEFERRALS
+#define TASK_MAX_DEFERRALS 20
+#endif
+#define TASKS_MAX 12
+
+enum TaskKind : uint8_t {
+  TASK_DEADLINE, // runs every intervalUs, before anything else
+  TASK_BUDGETED, // deferred when it would make a deadline late
+  TASK_ALWAYS,   // cheap, runs on every pass
+};
+
+struct Task {
+  const char* name;
+  void (*run)();
+  TaskKind kind;
+  MetricStage stage;   // timed into this metrics histogram
+  uint32_t intervalUs; // deadline tasks
+  uint32_t budgetUs;   // runs longer than this are counted, 0 for no budget
+  bool (*active)();    // deadline tasks, nullptr when always active
+};
+
+struct TaskStats {
+  uint32_t runs;
+  uint32_t deferred;
+  uint32_t overBudget;
+  uint32_t missedDeadlines;
+  uint32_t maxLatenessUs; // deadline tasks, while active
+  uint32_t costUs;        // recent cost, the highest run decaying by 1/8 per run
+};
+
+// The table is used in place, it has to outlive the scheduler
+void tasksBegin(const Task* tasks, uint8_t count);
+// One pass over every task, call it from loop()
+void tasksLoop();
+// Run deadline tasks that are due, safe to call from inside a task
+void tasksYield();
+
+uint8_t tasksCount();
+const Task& tasksGet(uint8_t index);
+const TaskStats& tasksStats(uint8_t index);
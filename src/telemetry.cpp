@@ -0,0 +1,222 @@
+#include "telemetry.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "hal.h"
+#include "sunrise.h"
+
+struct QueuedMessage {
+  MessageKey key;
+  uint16_t length;
+  char text[TELEMETRY_MESSAGE_SIZE];
+};
+
+// Fixed ring of messages, the oldest one is dropped when it overflows
+template <size_t N>
+class MessageRing {
+public:
+  bool empty() const { return count == 0; }
+  QueuedMessage& front() { return entries[head]; }
+  void pop() {
+    head = (head + 1) % N;
+    count--;
+  }
+
+  // Slot for a new message, reusing a queued one with the same key
+  QueuedMessage& push(MessageKey key, TelemetryStats& stats) {
+    if (key != MESSAGE_NO_KEY) {
+      for (size_t i = 0; i < count; i++) {
+        QueuedMessage& entry = entries[(head + i) % N];
+        if (entry.key == key) {
+          stats.coalesced++;
+          return entry;
+        }
+      }
+    }
+    if (count == N) {
+      pop();
+      stats.dropped++;
+    }
+    QueuedMessage& entry = entries[(head + count) % N];
+    count++;
+    entry.key = key;
+    stats.queued++;
+    return entry;
+  }
+
+private:
+  QueuedMessage entries[N];
+  size_t head = 0;
+  size_t count = 0;
+};
+
+class TokenBucket {
+public:
+  TokenBucket(uint8_t burst, uint16_t intervalMs) : tokens(burst), burst(burst), intervalMs(intervalMs) {}
+
+  bool available(uint32_t now) {
+    refill(now);
+    return tokens > 0;
+  }
+  void take() {
+    if (tokens > 0) tokens--;
+  }
+
+private:
+  void refill(uint32_t now) {
+    uint32_t elapsed = now - lastRefill;
+    if (elapsed < intervalMs) return;
+    uint32_t earned = elapsed / intervalMs;
+    lastRefill += earned * intervalMs;
+    tokens = earned + tokens >= burst ? burst : tokens + earned;
+  }
+
+  uint8_t tokens;
+  uint8_t burst;
+  uint16_t intervalMs;
+  uint32_t lastRefill = 0;
+};
+
+static uint8_t enabledSinks = 0;
+static MessageRing<TELEMETRY_MQTT_QUEUE_SIZE> mqttQueue;
+static MessageRing<TELEMETRY_TELEGRAM_QUEUE_SIZE> telegramQueue;
+static TokenBucket mqttBucket(TELEMETRY_MQTT_BURST, TELEMETRY_MQTT_INTERVAL_MS);
+static TokenBucket telegramBucket(TELEMETRY_TELEGRAM_BURST, TELEMETRY_TELEGRAM_INTERVAL_MS);
+
+static bool stateDirty = false;
+static bool stateForced = false;
+static uint32_t lastStatePublish = 0;
+static uint8_t statusSinks = 0;
+static uint8_t replySinks = 0;
+static TelemetryStats stats = {};
+
+void telemetryBegin(uint8_t sinks) {
+  enabledSinks = sinks;
+  // Publish the state once the broker is reachable
+  telemetryStateChangedNow();
+}
+
+static void enqueue(MessageKey key, uint8_t sinks, const char* format, va_list args) {
+  if (sinks & SINK_MQTT) sinks |= replySinks;
+  sinks &= enabledSinks;
+  if (!sinks) return;
+
+  QueuedMessage* first = nullptr;
+  if (sinks & SINK_MQTT) {
+    first = &mqttQueue.push(key, stats);
+  }
+  if (sinks & SINK_TELEGRAM) {
+    QueuedMessage& entry = telegramQueue.push(key, stats);
+    if (first) {
+      // Already formatted for MQTT, only copy it
+      int length = vsnprintf(first->text, sizeof(first->text), format, args);
+      first->length = length < (int)sizeof(first->text) ? length : sizeof(first->text) - 1;
+      memcpy(entry.text, first->text, first->length + 1);
+      entry.length = first->length;
+      return;
+    }
+    first = &entry;
+  }
+  int length = vsnprintf(first->text, sizeof(first->text), format, args);
+  first->length = length < (int)sizeof(first->text) ? length : sizeof(first->text) - 1;
+}
+
+void sendMessage(const char* message, bool isMQQT, bool isTelegram) {
+  sendMessagef(isMQQT, isTelegram, "%s", message);
+}
+
+void sendMessagef(bool isMQQT, bool isTelegram, const char* format, ...) {
+  va_list args;
+  va_start(args, format);
+  enqueue(MESSAGE_NO_KEY, (isMQQT ? SINK_MQTT : 0) | (isTelegram ? SINK_TELEGRAM : 0), format, args);
+  va_end(args);
+}
+
+void sendKeyedMessagef(MessageKey key, bool isMQQT, bool isTelegram, const char* format, ...) {
+  va_list args;
+  va_start(args, format);
+  enqueue(key, (isMQQT ? SINK_MQTT : 0) | (isTelegram ? SINK_TELEGRAM : 0), format, args);
+  va_end(args);
+}
+
+void telemetryStateChanged() {
+  stateDirty = true;
+}
+
+void telemetryStateChangedNow() {
+  stateDirty = true;
+  stateForced = true;
+}
+
+void telemetryStatusRequested(bool isMQQT, bool isTelegram) {
+  uint8_t sinks = (isMQQT ? SINK_MQTT | replySinks : 0) | (isTelegram ? SINK_TELEGRAM : 0);
+  statusSinks |= sinks & enabledSinks;
+}
+
+void telemetrySetReplySinks(uint8_t sinks) {
+  replySinks = sinks;
+}
+
+const TelemetryStats& telemetryStats() {
+  return stats;
+}
+
+static bool timedMqttPublish(const char* topic, const char* payload, bool retained) {
+  uint32_t start = halMicros();
+  bool sent = halMqttPublish(topic, payload, retained);
+  stats.publishMicros += halMicros() - start;
+  if (sent) stats.published++;
+  return sent;
+}
+
+static bool timedTelegramSend(const char* text) {
+  uint32_t start = halMicros();
+  bool sent = halTelegramSend(text);
+  stats.publishMicros += halMicros() - start;
+  if (sent) stats.published++;
+  return sent;
+}
+
+void telemetryLoop() {
+  uint32_t now = halMillis();
+
+  // At most one publish per sink per call keeps every loop iteration short
+  if (enabledSinks & SINK_MQTT && mqttBucket.available(now)) {
+    bool stateDue = stateDirty && (stateForced || now - lastStatePublish >= TELEMETRY_STATE_INTERVAL_MS);
+    if (stateDue || statusSinks & SINK_MQTT) {
+      char json[STATUS_JSON_SIZE];
+      formatStatusJson(json, sizeof(json));
+      if (stateDue) {
+        if (timedMqttPublish(MQTT_STATE_TOPIC, json, true)) {
+          mqttBucket.take();
+          stateDirty = false;
+          stateForced = false;
+          lastStatePublish = now;
+          stats.statePublished++;
+        }
+      } else if (timedMqttPublish(MQTT_LOG_TOPIC, json, false)) {
+        mqttBucket.take();
+        statusSinks &= ~SINK_MQTT;
+      }
+    } else if (!mqttQueue.empty() && timedMqttPublish(MQTT_LOG_TOPIC, mqttQueue.front().text, false)) {
+      mqttBucket.take();
+      mqttQueue.pop();
+    }
+  }
+
+  if (enabledSinks & SINK_TELEGRAM && telegramBucket.available(now)) {
+    if (statusSinks & SINK_TELEGRAM) {
+      char json[STATUS_JSON_SIZE];
+      formatStatusJson(json, sizeof(json));
+      if (timedTelegramSend(json)) {
+        telegramBucket.take();
+        statusSinks &= ~SINK_TELEGRAM;
+      }
+    } else if (!telegramQueue.empty() && timedTelegramSend(telegramQueue.front().text)) {
+      telegramBucket.take();
+      telegramQueue.pop();
+    }
+  }
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Outbound telemetry queue for MQTT and Telegram.
+// Messages are formatted into fixed ring buffers (one per sink) and drained from
+// loop() under a per sink rate limit, so callers never block on a publish.
+// Device state is not queued at all: it is marked dirty and published as one
+// retained JSON document with the latest values when the rate limit allows.
+
+#ifndef TELEMETRY_MESSAGE_SIZE
+#define TELEMETRY_MESSAGE_SIZE 128
+#endif
+#ifndef TELEMETRY_MQTT_QUEUE_SIZE
+#define TELEMETRY_MQTT_QUEUE_SIZE 8
+#endif
+#ifndef TELEMETRY_TELEGRAM_QUEUE_SIZE
+#define TELEMETRY_TELEGRAM_QUEUE_SIZE 4
+#endif
+
+// Token bucket per sink: one message per interval, bursts up to the size
+#ifndef TELEMETRY_MQTT_INTERVAL_MS
+#define TELEMETRY_MQTT_INTERVAL_MS 100
+#endif
+#define TELEMETRY_MQTT_BURST 10
+#ifndef TELEMETRY_TELEGRAM_INTERVAL_MS
+#define TELEMETRY_TELEGRAM_INTERVAL_MS 1000
+#endif
+#define TELEMETRY_TELEGRAM_BURST 3
+
+// Minimum time between two state publishes caused by a running ramp, it changes state every tick
+#ifndef TELEMETRY_STATE_INTERVAL_MS
+#define TELEMETRY_STATE_INTERVAL_MS 30000
+#endif
+
+#define MQTT_LOG_TOPIC "home/morningleds/terminalOut"
+#define MQTT_STATE_TOPIC "home/morningleds/state"
+
+enum TelemetrySink : uint8_t {
+  SINK_MQTT = 1,
+  SINK_TELEGRAM = 2,
+};
+
+// A queued message with a key is replaced by a newer one with the same key,
+// used for replies where only the latest value matters (slider drags)
+enum MessageKey : uint8_t {
+  MESSAGE_NO_KEY = 0,
+  MESSAGE_BRIGHTNESS,
+  MESSAGE_MAX_BRIGHTNESS,
+  MESSAGE_DURATION,
+  MESSAGE_SUNRISE_TIME,
+  MESSAGE_QUEUE_FULL,
+};
+
+struct TelemetryStats {
+  uint32_t queued;
+  uint32_t coalesced;
+  uint32_t dropped;
+  uint32_t published;
+  uint32_t statePublished;
+  uint32_t publishMicros; // total time spent inside publish calls
+};
+
+// Only sinks enabled here accept messages
+void telemetryBegin(uint8_t sinks);
+// Publish queued messages and dirty state, call it from loop()
+void telemetryLoop();
+
+void sendMessage(const char* message, bool isMQQT, bool isTelegram);
+void sendMessagef(bool isMQQT, bool isTelegram, const char* format, ...) __attribute__((format(printf, 3, 4)));
+void sendKeyedMessagef(MessageKey key, bool isMQQT, bool isTelegram, const char* format, ...) __attribute__((format(printf, 4, 5)));
+
+// While set, messages for MQTT also go to these sinks, so the reply to a
+// command reaches the place the command came from
+void telemetrySetReplySinks(uint8_t sinks);
+
+// State changed, publish it on the retained state topic
+void telemetryStateChanged();
+// Skip the state rate limit for the next publish, e.g. when a ramp finishes
+void telemetryStateChangedNow();
+// Send the status JSON as one message, repeated requests before it goes out collapse into one
+void telemetryStatusRequested(bool isMQQT, bool isTelegram);
+
+const TelemetryStats& telemetryStats();
@@ -0,0 +1,251 @@
+#include "timezone.h"
+
+#include <stdlib.h>
+
+#define SECONDS_PER_DAY 86400L
+
+// Day of a transition: Mm.w.d, Jn (1-365, no Feb 29) or n (0-365)
+struct TransitionRule {
+  char type; // 'M', 'J' or 'D'
+  uint8_t month;
+  uint8_t week;
+  uint8_t weekday;
+  uint16_t day;
+  int32_t time; // seconds after local midnight, can be negative or past 24h
+};
+
+struct Transition {
+  uint32_t utc;
+  int32_t offset; // seconds east of UTC from here on
+};
+
+static int32_t standardOffset = 0;
+static int32_t dstOffset = 0;
+static bool hasDst = false;
+static TransitionRule dstStart;
+static TransitionRule dstEnd;
+
+static Transition table[TIMEZONE_YEARS * 2];
+static uint8_t tableSize = 0;
+static int32_t tableBaseOffset = 0; // in effect before the first entry
+static uint32_t tableStart = 0;
+static uint32_t tableEnd = 0;
+static uint32_t nextTransition = 0;
+static bool nextTransitionKnown = false;
+
+// ----------------- Calendar -----------------
+
+static bool isLeapYear(int year) {
+  return (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+}
+
+// Days since 1970-01-01 of a proleptic Gregorian date
+static int32_t daysFromCivil(int year, int month, int day) {
+  year -= month <= 2;
+  int era = year / 400;
+  int yearOfEra = year - era * 400;
+  int dayOfYear = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+  int dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+  return era * 146097 + dayOfEra - 719468;
+}
+
+static int daysInMonth(int year, int month) {
+  static const uint8_t days[12] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+  return month == 2 && isLeapYear(year) ? 29 : days[month - 1];
+}
+
+// Local midnight of the rule's day in `year`, as days since 1970-01-01
+static int32_t ruleDay(const TransitionRule& rule, int year) {
+  int32_t newYear = daysFromCivil(year, 1, 1);
+  if (rule.type == 'J') {
+    return newYear + rule.day - 1 + (isLeapYear(year) && rule.day >= 60);
+  }
+  if (rule.type == 'D') {
+    return newYear + rule.day;
+  }
+  // Weekday d of week w, week 5 is the last one in the month
+  int32_t first = daysFromCivil(year, rule.month, 1);
+  int firstWeekday = (int)((first + 4) % 7); // 1970-01-01 was a Thursday
+  int day = 1 + (rule.weekday - firstWeekday + 7) % 7 + (rule.week - 1) * 7;
+  while (day > daysInMonth(year, rule.month)) day -= 7;
+  return first + day - 1;
+}
+
+// ----------------- Parsing -----------------
+
+static bool parseNumber(const char*& p, int& value, int maximum) {
+  if (*p < '0' || *p > '9') return false;
+  value = 0;
+  while (*p >= '0' && *p <= '9') {
+    value = value * 10 + (*p++ - '0');
+    if (value > maximum) return false;
+  }
+  return true;
+}
+
+// [+-]hh[:mm[:ss]] in seconds
+static bool parseTime(const char*& p, int32_t& seconds, int maxHours) {
+  int sign = 1;
+  if (*p == '+' || *p == '-') sign = *p++ == '-' ? -1 : 1;
+  int hours;
+  int minutes = 0;
+  int secs = 0;
+  if (!parseNumber(p, hours, maxHours)) return false;
+  if (*p == ':' && !parseNumber(++p, minutes, 59)) return false;
+  if (*p == ':' && !parseNumber(++p, secs, 59)) return false;
+  seconds = sign * (hours * 3600L + minutes * 60L + secs);
+  return true;
+}
+
+// Alphabetic name of three or more letters, or <anything> for names like <+03>
+static bool parseName(const char*& p) {
+  const char* start = p;
+  if (*p == '<') {
+    while (*p && *p != '>') p++;
+    if (*p != '>') return false;
+    return ++p - start >= 5;
+  }
+  while ((*p >= 'A' && *p <= 'Z') || (*p >= 'a' && *p <= 'z')) p++;
+  return p - start >= 3;
+}
+
+static bool parseRule(const char*& p, TransitionRule& rule) {
+  int a;
+  int b;
+  int c;
+  rule.time = 2 * 3600L;
+  if (*p == 'M') {
+    p++;
+    if (!parseNumber(p, a, 12) || *p++ != '.' || !parseNumber(p, b, 5) || *p++ != '.' || !parseNumber(p, c, 6)) {
+      return false;
+    }
+    if (a < 1 || b < 1) return false;
+    rule = { 'M', (uint8_t)a, (uint8_t)b, (uint8_t)c, 0, rule.time };
+  } else if (*p == 'J') {
+    p++;
+    if (!parseNumber(p, a, 365) || a < 1) return false;
+    rule = { 'J', 0, 0, 0, (uint16_t)a, rule.time };
+  } else {
+    if (!parseNumber(p, a, 365)) return false;
+    rule = { 'D', 0, 0, 0, (uint16_t)a, rule.time };
+  }
+  // Times past 24h and negative ones are allowed, like glibc does
+  return *p != '/' || parseTime(++p, rule.time, 167);
+}
+
+static bool parse(const char* p) {
+  int32_t west;
+  if (!parseName(p) || !parseTime(p, west, 24)) return false;
+  // POSIX offsets count west of Greenwich, "EET-2" is UTC+2
+  standardOffset = -west;
+  dstOffset = standardOffset;
+  hasDst = false;
+  if (!*p) return true;
+
+  if (!parseName(p)) return false;
+  hasDst = true;
+  dstOffset = standardOffset + 3600;
+  if (*p && *p != ',') {
+    if (!parseTime(p, west, 24)) return false;
+    dstOffset = -west;
+  }
+  if (!*p) {
+    // No rules given, the POSIX default is the US one
+    p = ",M3.2.0,M11.1.0";
+  }
+  if (*p++ != ',' || !parseRule(p, dstStart) || *p++ != ',' || !parseRule(p, dstEnd)) return false;
+  return !*p;
+}
+
+// ----------------- Table -----------------
+
+static void addTransition(uint32_t utc, int32_t offset) {
+  // Entries arrive almost sorted, a southern zone swaps two per year
+  uint8_t index = tableSize++;
+  while (index > 0 && table[index - 1].utc > utc) {
+    table[index] = table[index - 1];
+    index--;
+  }
+  table[index] = { utc, offset };
+}
+
+static void buildTable(int firstYear) {
+  if (firstYear < 1970) firstYear = 1970;
+  tableSize = 0;
+  tableStart = (uint32_t)daysFromCivil(firstYear, 1, 1) * SECONDS_PER_DAY;
+  tableEnd = (uint32_t)daysFromCivil(firstYear + TIMEZONE_YEARS, 1, 1) * SECONDS_PER_DAY;
+  tableBaseOffset = standardOffset;
+  if (!hasDst) return;
+
+  for (int year = firstYear; year < firstYear + TIMEZONE_YEARS; year++) {
+    // Rule times are local, in the offset in effect before the transition
+    addTransition(ruleDay(dstStart, year) * SECONDS_PER_DAY + dstStart.time - standardOffset, dstOffset);
+    addTransition(ruleDay(dstEnd, year) * SECONDS_PER_DAY + dstEnd.time - dstOffset, standardOffset);
+  }
+  // Before the first transition the other offset is in effect
+  tableBaseOffset = table[0].offset == dstOffset ? standardOffset : dstOffset;
+}
+
+// Rebuild when utc is outside the table, one year early so early January is covered too
+static void cover(uint32_t utc) {
+  if (utc >= tableStart && utc < tableEnd) return;
+  buildTable(1970 + (int)(utc / 31556952UL) - 1);
+}
+
+// Index of the first transition after utc
+static uint8_t upperBound(uint32_t utc) {
+  uint8_t low = 0;
+  uint8_t high = tableSize;
+  while (low < high) {
+    uint8_t middle = (low + high) / 2;
+    if (table[middle].utc <= utc) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+  return low;
+}
+
+bool timezoneBegin(const char* posixTz) {
+  bool valid = parse(posixTz);
+  if (!valid) {
+    standardOffset = 0;
+    dstOffset = 0;
+    hasDst = false;
+  }
+  // Start from the build year, the clock is usually not known yet
+  buildTable(atoi(__DATE__ + 7));
+  nextTransitionKnown = false;
+  return valid;
+}
+
+int32_t timezoneOffset(uint32_t utc) {
+  cover(utc);
+  uint8_t index = upperBound(utc);
+  return index ? table[index - 1].offset : tableBaseOffset;
+}
+
+time_t timezoneLocal(uint32_t utc) {
+  return (time_t)utc + timezoneOffset(utc);
+}
+
+bool timezoneIsDst(uint32_t utc) {
+  return hasDst && timezoneOffset(utc) == dstOffset;
+}
+
+uint32_t timezoneNextTransition(uint32_t utc) {
+  if (!hasDst) return 0;
+  cover(utc);
+  uint8_t index = upperBound(utc);
+  // Past the last entry the table is rebuilt at its end
+  return index < tableSize ? table[index].utc : tableEnd;
+}
+
+bool timezoneTransitionDue(uint32_t utc) {
+  if (nextTransitionKnown && (nextTransition == 0 || utc < nextTransition)) return false;
+  bool due = nextTransitionKnown;
+  nextTransition = timezoneNextTransition(utc);
+  nextTransitionKnown = true;
+  return due;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stdint.h>
+#include <time.h>
+
+// Local time from a POSIX TZ string, e.g. "CET-1CEST,M3.5.0,M10.5.0/3".
+// The string is parsed once and the UTC instants of the next years'
+// transitions are precomputed into a sorted table, so a local time query is a
+// binary search over a few dozen entries instead of a calendar calculation.
+// Queries outside the table rebuild it around the queried year.
+
+#ifndef TIMEZONE_YEARS
+#define TIMEZONE_YEARS 16
+#endif
+
+// Same rule the firmware used before, UTC+2 with DST on the EU dates
+#ifndef TIMEZONE
+#define TIMEZONE "EET-2EEST,M3.5.0/3,M10.5.0/4"
+#endif
+
+// Returns false when the string is not a valid TZ, the zone is UTC then
+bool timezoneBegin(const char* posixTz);
+
+// Seconds east of UTC in effect at utc
+int32_t timezoneOffset(uint32_t utc);
+time_t timezoneLocal(uint32_t utc);
+bool timezoneIsDst(uint32_t utc);
+// First transition after utc, 0 when the zone has no DST
+uint32_t timezoneNextTransition(uint32_t utc);
+// True once when utc passed a transition, so the caller re-offsets local time, call it from loop()
+bool timezoneTransitionDue(uint32_t utc);
@@ -0,0 +1,126 @@
+#include "warm_start.h"
+
+#include <stddef.h>
+
+#include "clock.h"
+#include "crc32.h"
+#include "hal.h"
+#include "sunrise.h"
+#include "telemetry.h"
+#include "program.h"
+
+#define WARM_START_MAGIC 0x57534332
+// The reset installs an update, the record was saved right before it
+#define WARM_START_UPDATE 1
+// The ramp is a sunrise, not a fade or a ramp followed from a peer
+#define WARM_START_SUNRISE 2
+
+struct alignas(4) WarmStartRecord {
+  uint32_t magic;
+  int32_t driftPpm;
+  uint32_t utcMsLow;
+  uint32_t utcMsHigh;
+  // Ramp start in UTC milliseconds, both 0 when no ramp is running
+  uint32_t rampStartLow;
+  uint32_t rampStartHigh;
+  uint32_t rampDurationMs;
+  uint16_t rampFrom;
+  uint16_t rampTo;
+  // Program id + 1 and its segment when the ramp is a program, 0 otherwise
+  uint8_t rampProgram;
+  uint8_t rampSegment;
+  uint8_t flags;
+  uint8_t rampEasing;
+  uint32_t crc;
+};
+
+static_assert(sizeof(WarmStartRecord) % 4 == 0, "RTC memory is written in words");
+
+static WarmStartStats stats = {};
+static uint32_t lastSaveMs = 0;
+static bool readyReported = false;
+
+static uint64_t join(uint32_t low, uint32_t high) {
+  return (uint64_t)high << 32 | low;
+}
+
+bool warmStartRestore() {
+  WarmStartRecord record;
+  if (!halRtcRead(&record, sizeof(record)) || record.magic != WARM_START_MAGIC ||
+      record.crc != crc32(&record, offsetof(WarmStartRecord, crc))) {
+    // Power on, RTC memory holds garbage
+    return false;
+  }
+
+  stats.updateInstalled = record.flags & WARM_START_UPDATE;
+  uint64_t utcMs = join(record.utcMsLow, record.utcMsHigh) + halMillis();
+  // The reset came at most one save interval after the record, half of it on average
+  if (!stats.updateInstalled) utcMs += WARM_START_SAVE_INTERVAL_MS / 2;
+  clockSet(utcMs, record.driftPpm, CLOCK_RTC);
+  stats.restored = true;
+
+  uint64_t rampStart = join(record.rampStartLow, record.rampStartHigh);
+  if (rampStart && rampStart < utcMs && record.rampProgram) {
+    // Later segments may still be ahead, they start from the program in flash
+    resumeProgram(record.rampProgram - 1, record.rampSegment, utcMs - rampStart);
+    stats.rampResumed = true;
+  } else if (rampStart && rampStart < utcMs && utcMs - rampStart < record.rampDurationMs) {
+    resumeRamp(utcMs - rampStart, record.rampDurationMs, record.rampFrom, record.rampTo,
+               (RampEasing)(record.rampEasing & 3), record.flags & WARM_START_SUNRISE);
+    stats.rampResumed = true;
+  }
+  stats.lightReadyMs = halMillis();
+  return true;
+}
+
+static void save(uint8_t flags) {
+  WarmStartRecord record = {};
+  record.flags = flags;
+  uint64_t utcMs = clockUtcMs();
+  record.magic = WARM_START_MAGIC;
+  record.driftPpm = clockDriftPpm();
+  record.utcMsLow = (uint32_t)utcMs;
+  record.utcMsHigh = (uint32_t)(utcMs >> 32);
+  if (sunriseRamp.isActive()) {
+    // Ticked every few ms, so elapsed() is current enough
+    uint64_t rampStart = utcMs - sunriseRamp.elapsed();
+    record.rampStartLow = (uint32_t)rampStart;
+    record.rampStartHigh = (uint32_t)(rampStart >> 32);
+    record.rampDurationMs = sunriseRamp.duration();
+    record.rampFrom = sunriseRamp.fromLevel();
+    record.rampTo = sunriseRamp.toLevel();
+    record.rampEasing = sunriseRamp.easing();
+    if (sunriseRunning()) record.flags |= WARM_START_SUNRISE;
+    if (programRunning() >= 0) {
+      record.rampProgram = programRunning() + 1;
+      record.rampSegment = programSegment();
+    }
+  }
+  record.crc = crc32(&record, offsetof(WarmStartRecord, crc));
+  halRtcWrite(&record, sizeof(record));
+}
+
+void warmStartLoop() {
+  uint32_t now = halMillis();
+
+  if (!readyReported && clockValid()) {
+    // After a cold start the clock only becomes valid with the first NTP reply
+    if (!stats.lightReadyMs) stats.lightReadyMs = now;
+    sendMessagef(true, false, "Light ready %lu ms after boot, clock from %s",
+                 (unsigned long)stats.lightReadyMs, stats.restored ? "RTC memory" : "NTP");
+    readyReported = true;
+  }
+
+  if (clockValid() && now - lastSaveMs >= WARM_START_SAVE_INTERVAL_MS) {
+    lastSaveMs = now;
+    save(0);
+  }
+}
+
+void warmStartSaveForUpdate() {
+  if (clockValid()) save(WARM_START_UPDATE);
+}
+
+const WarmStartStats& warmStartStats() {
+  return stats;
+}
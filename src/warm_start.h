@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stdint.h>
+
+// Warm start after a reset (watchdog, OTA, brownout, crash).
+// The clock and a running sunrise are written to RTC memory every second,
+// which keeps its content across resets but not across a power cut. On boot
+// the clock is restored from it before WiFi starts, so alarms fire on time
+// and an interrupted sunrise or program continues, and NTP only fine tunes it
+// later.
+
+#ifndef WARM_START_SAVE_INTERVAL_MS
+#define WARM_START_SAVE_INTERVAL_MS 1000
+#endif
+
+struct WarmStartStats {
+  bool restored;         // clock came from RTC memory
+  bool rampResumed;
+  bool updateInstalled;  // the reset installed a pulled update, see ota_pull.h
+  uint32_t lightReadyMs; // boot until output and clock were ready, 0 while waiting for NTP
+};
+
+// Restore the clock and a running ramp, call it in setup() after settingsRestore()
+bool warmStartRestore();
+// Save the clock and ramp, and report once the device is ready, call it from loop()
+void warmStartLoop();
+// Save right before the reset that installs an update, the downtime is measured from it
+void warmStartSaveForUpdate();
+
+const WarmStartStats& warmStartStats();
@@ -0,0 +1,181 @@
+#include "web.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "hal.h"
+#include "http_server.h"
+#include "sunrise.h"
+#include "commands.h"
+#include "ingress.h"
+#include "metrics.h"
+#include "log.h"
+#include "esp/dashboard_html.h"
+
+// Time for the reply to go out before the reboot
+#define WEB_RESTART_DELAY_MS 500
+
+static bool restartPending = false;
+static uint32_t restartAtMs = 0;
+
+// ----------------- Streamed bodies -----------------
+
+// Gzipped at build time (scripts/embed_dashboard.py) and copied from flash a piece at a time
+static size_t fillDashboard(uint32_t& cursor, uint32_t end, char* buffer, size_t size) {
+  size_t length = end - cursor < size ? end - cursor : size;
+  memcpy_P(buffer, DASHBOARD_HTML_GZ + cursor, length);
+  cursor += length;
+  return length;
+}
+
+// Prometheus text, one stage per piece
+static size_t fillMetrics(uint32_t& cursor, uint32_t, char* buffer, size_t size) {
+  size_t length = formatMetricsPrometheus(cursor, buffer, size);
+  if (length) cursor++;
+  return length;
+}
+
+// Whole log lines up to the end the request saw, later ones come with the next fetch
+static size_t fillLog(uint32_t& cursor, uint32_t end, char* buffer, size_t size) {
+  if ((int32_t)(end - cursor) <= 0) return 0;
+  if (end - cursor + 1 < size) size = end - cursor + 1;
+  return logRead(cursor, buffer, size);
+}
+
+// ----------------- Handlers -----------------
+
+static void handleDashboard(const HttpRequest& request) {
+  static const char cacheHeaders[] = "ETag: " DASHBOARD_ETAG "\r\nCache-Control: no-cache\r\n";
+  if (strcmp(request.ifNoneMatch, DASHBOARD_ETAG) == 0) {
+    httpReply(request, 304, nullptr, "", cacheHeaders);
+    return;
+  }
+  httpStream(request, 200, "text/html", sizeof(DASHBOARD_HTML_GZ), fillDashboard, 0, sizeof(DASHBOARD_HTML_GZ),
+             "ETag: " DASHBOARD_ETAG "\r\nCache-Control: no-cache\r\nContent-Encoding: gzip\r\n");
+}
+
+static void handleInitialValues(const HttpRequest& request) {
+  char output[STATUS_JSON_SIZE];
+  formatStatusJson(output, sizeof(output));
+  httpReply(request, 200, "application/json", output);
+}
+
+// Live state for the dashboard, the full state first and then only changes
+static void handleEvents(const HttpRequest& request) {
+  char output[STATUS_JSON_SIZE];
+  formatStatusJson(output, sizeof(output));
+  if (!httpAcceptEvents(request, output)) {
+    httpReply(request, 503, "text/plain", "Too many dashboards open");
+  }
+}
+
+static void handleMetrics(const HttpRequest& request) {
+  httpStream(request, 200, "text/plain; version=0.0.4", -1, fillMetrics, 0, 0);
+}
+
+static void handleLog(const HttpRequest& request) {
+  // Plain text lines, ?since= with the X-Log-End of the last fetch returns only new ones
+  uint32_t position;
+  if (!httpArg(request, "since", position)) position = logOldest();
+  uint32_t end = logEnd();
+  char headers[32];
+  snprintf(headers, sizeof(headers), "X-Log-End: %lu\r\n", (unsigned long)end);
+  httpStream(request, 200, "text/plain", -1, fillLog, position, end, headers);
+}
+
+static void applySetting(const HttpRequest& request, const SettingsUpdate& update, const char* reply) {
+  const char* error = ingressSettings(update, 0);
+  if (error) {
+    httpReply(request, 400, "text/plain", error);
+    return;
+  }
+  httpReply(request, 200, "text/plain", reply);
+}
+
+static void handleSliderChange(const HttpRequest& request, SettingsField field) {
+  // Each slider has its own route, a drag only keeps its latest value, see ingress.h
+  int value;
+  if (!httpArg(request, "value", value)) {
+    httpReply(request, 400, "text/plain", "Missing value");
+    return;
+  }
+  SettingsUpdate update = {};
+  update.fields = field;
+  if (field == SETTING_BRIGHTNESS) update.currentBrightness = value;
+  if (field == SETTING_MAX_BRIGHTNESS) update.maxBrightness = value;
+  if (field == SETTING_DURATION) update.sunriseDuration = value;
+  applySetting(request, update, "OK");
+}
+
+static void handleSetSunrise(const HttpRequest& request) {
+  SettingsUpdate update = {};
+  int hour, minute, value;
+  if (!httpArg(request, "hour", hour) || !httpArg(request, "minute", minute)) {
+    httpReply(request, 400, "text/plain", "Hour or minute parameter missing");
+    return;
+  }
+  // The dashboard sends every setting along with the time, apply them together
+  update.fields = SETTING_SUNRISE_TIME;
+  update.hour = hour;
+  update.minute = minute;
+  if (httpArg(request, "currentBrightness", value)) {
+    update.fields |= SETTING_BRIGHTNESS;
+    update.currentBrightness = value;
+  }
+  if (httpArg(request, "maxBrightness", value)) {
+    update.fields |= SETTING_MAX_BRIGHTNESS;
+    update.maxBrightness = value;
+  }
+  if (httpArg(request, "sunriseDuration", value)) {
+    update.fields |= SETTING_DURATION;
+    update.sunriseDuration = value;
+  }
+  applySetting(request, update, "Sunrise settings updated");
+}
+
+static void handleConfig(const HttpRequest& request) {
+  SettingsUpdate update;
+  const char* error = parseSettingsJson(request.body, request.bodyLength, update);
+  if (!error) error = ingressSettings(update, 0);
+
+  if (error) {
+    char output[64];
+    snprintf(output, sizeof(output), "{\"error\":\"%s\"}", error);
+    httpReply(request, 400, "application/json", output);
+    return;
+  }
+  // Applied on the next loop() pass, the new state follows on /events
+  httpReply(request, 202, "application/json", "{\"queued\":true}");
+}
+
+static void handleReboot(const HttpRequest& request) {
+  httpReply(request, 200, "text/plain", "Rebooting...");
+  restartPending = true;
+  restartAtMs = halMillis() + WEB_RESTART_DELAY_MS;
+}
+
+static const HttpRoute routes[] = {
+  { HTTP_METHOD_GET, "/", handleDashboard },
+  { HTTP_METHOD_GET, "/currentBrightness", [](const HttpRequest& r) { handleSliderChange(r, SETTING_BRIGHTNESS); } },
+  { HTTP_METHOD_GET, "/maxBrightness", [](const HttpRequest& r) { handleSliderChange(r, SETTING_MAX_BRIGHTNESS); } },
+  { HTTP_METHOD_GET, "/sunriseDuration", [](const HttpRequest& r) { handleSliderChange(r, SETTING_DURATION); } },
+  { HTTP_METHOD_GET, "/setSunrise", handleSetSunrise },
+  { HTTP_METHOD_POST, "/api/config", handleConfig },
+  { HTTP_METHOD_GET, "/getInitialValues", handleInitialValues },
+  { HTTP_METHOD_GET, "/events", handleEvents },
+  { HTTP_METHOD_GET, "/metrics", handleMetrics },
+  { HTTP_METHOD_GET, "/log", handleLog },
+  { HTTP_METHOD_GET, "/reboot", handleReboot },
+};
+
+void webBegin(uint16_t port) {
+  httpServerBegin(routes, sizeof(routes) / sizeof(routes[0]), port);
+}
+
+void webLoop() {
+  httpServerLoop();
+  if (restartPending && (int32_t)(halMillis() - restartAtMs) >= 0) {
+    restartPending = false;
+    halRestart();
+  }
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <stdint.h>
+
+// Dashboard and HTTP API on top of http_server.h: the gzipped page, the slider
+// and settings setters, live state on /events, /metrics, /log and /reboot.
+// Setters go through ingress.h like MQTT and Telegram.
+
+// Start serving on `port`, call it in setup()
+void webBegin(uint16_t port);
+// Serve clients, call it from loop()
+void webLoop();
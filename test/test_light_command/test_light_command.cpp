@@ -0,0 +1,120 @@
+// parseLightCommand() on payloads from HA_COMMAND_TOPIC, run with: pio test -e native
+
+#include <string.h>
+#include <unity.h>
+
+#include "home_assistant.h"
+
+struct LightCase {
+  const char* json;
+  const char* error; // nullptr when it parses
+  uint8_t fields = 0;
+  bool on = false;
+  int brightness = 0;
+  uint32_t transitionMs = 0;
+};
+
+static const LightCase cases[] = {
+  { "{\"state\":\"ON\"}", nullptr, LIGHT_STATE, true, 0, 0 },
+  { "{\"state\":\"OFF\",\"transition\":2.5}", nullptr, LIGHT_STATE | LIGHT_TRANSITION, false, 0, 2500 },
+  { " {\r\n \"brightness\" : 512 ,\t\"state\" : \"ON\" } \n", nullptr, LIGHT_STATE | LIGHT_BRIGHTNESS, true, 512, 0 },
+  { "{\"brightness\":0}", nullptr, LIGHT_BRIGHTNESS, false, 0, 0 },
+  { "{\"brightness\":1023}", nullptr, LIGHT_BRIGHTNESS, false, 1023, 0 },
+  { "{\"brightness\":12.5}", nullptr, LIGHT_BRIGHTNESS, false, 12, 0 },
+  { "{\"transition\":0.001}", nullptr, LIGHT_TRANSITION, false, 0, 1 },
+  { "{\"transition\":1.0000000000000000001}", nullptr, LIGHT_TRANSITION, false, 0, 1000 },
+  { "{\"transition\":86400}", nullptr, LIGHT_TRANSITION, false, 0, 86400000 },
+  { "{\"effect\":\"sunrise\"}", nullptr, LIGHT_EFFECT, false, 0, 0 },
+  { "{\"state\":\"OFF\",\"state\":\"ON\"}", nullptr, LIGHT_STATE, true, 0, 0 },
+  // Keys the light does not use are skipped
+  { "{\"color_temp\":300,\"state\":\"ON\"}", nullptr, LIGHT_STATE, true, 0, 0 },
+  { "{\"flash\":true,\"white\":null,\"state\":\"ON\",\"x\":false}", nullptr, LIGHT_STATE, true, 0, 0 },
+  { "{\"id\":123456789012345678901234567890,\"state\":\"ON\"}", nullptr, LIGHT_STATE, true, 0, 0 },
+  { "{\"name\":\"a,b}c\",\"state\":\"ON\"}", nullptr, LIGHT_STATE, true, 0, 0 },
+
+  // Escapes are skipped, not decoded
+  { "{\"name\":\"say \\\"hi\\\"\",\"state\":\"ON\"}", nullptr, LIGHT_STATE, true, 0, 0 },
+  { "{\"name\":\"back\\\\\",\"state\":\"ON\"}", nullptr, LIGHT_STATE, true, 0, 0 },
+  { "{\"na\\\"me\":1,\"state\":\"ON\"}", nullptr, LIGHT_STATE, true, 0, 0 },
+  { "{\"name\":\"\\u00e9\",\"state\":\"ON\"}", nullptr, LIGHT_STATE, true, 0, 0 },
+  { "{\"state\":\"O\\u004E\"}", "state must be ON or OFF" },
+  { "{\"name\":\"open\\\"}", "Unsupported value" },
+  { "{\"name\":\"ends in \\", "Unsupported value" },
+
+  // Malformed
+  { "", "Expected a JSON object" },
+  { "   ", "Expected a JSON object" },
+  { "[]", "Expected a JSON object" },
+  { "ON", "Expected a JSON object" },
+  { "{}", "Empty command" },
+  { "{", "Expected a field name" },
+  { "{\"state\"}", "Expected a field name" },
+  { "{state:\"ON\"}", "Expected a field name" },
+  { "{\"state\":\"ON\",}", "Expected a field name" },
+  { "{\"state\":\"ON\"", "Expected , or }" },
+  { "{\"state\":\"ON\" \"brightness\":1}", "Expected , or }" },
+  { "{\"state\":ON}", "state must be ON or OFF" },
+  { "{\"state\":\"on\"}", "state must be ON or OFF" },
+  { "{\"state\":\"ON", "state must be ON or OFF" },
+  { "{\"state\":1}", "state must be ON or OFF" },
+  { "{\"brightness\":-1}", "brightness must be between 0 and 1023" },
+  { "{\"brightness\":\"512\"}", "brightness must be between 0 and 1023" },
+  { "{\"brightness\":}", "brightness must be between 0 and 1023" },
+  { "{\"brightness\":1023.5}", "brightness must be between 0 and 1023" },
+  { "{\"brightness\":1e3}", "Expected , or }" },
+  { "{\"transition\":-1}", "transition must be between 0 and 86400 seconds" },
+  { "{\"transition\":86400.001}", "transition must be between 0 and 86400 seconds" },
+  { "{\"effect\":\"colorloop\"}", "Unknown effect" },
+  { "{\"effect\":null}", "Unknown effect" },
+  { "{\"color\":{\"r\":255}}", "Unsupported value" },
+  { "{\"list\":[1,2]}", "Unsupported value" },
+  { "{\"other\":,\"state\":\"ON\"}", "Unsupported value" },
+  { "{\"other\":", "Unsupported value" },
+
+  // Numbers too long for their field
+  { "{\"brightness\":0000000001}", "brightness must be between 0 and 1023" },
+  { "{\"brightness\":4294967296}", "brightness must be between 0 and 1023" },
+  { "{\"transition\":999999999}", "transition must be between 0 and 86400 seconds" },
+  { "{\"transition\":4294967.296}", "transition must be between 0 and 86400 seconds" },
+
+  // Trailing data
+  { "{\"state\":\"ON\"}x", "Unexpected data after the object" },
+  { "{\"state\":\"ON\"}{}", "Unexpected data after the object" },
+  { "{\"state\":\"ON\"},", "Unexpected data after the object" },
+  { "{\"state\":\"ON\"}}", "Unexpected data after the object" },
+};
+
+void setUp() {}
+void tearDown() {}
+
+static void test_light_command_cases() {
+  for (const LightCase& test : cases) {
+    LightCommand command = {};
+    const char* error = parseLightCommand(test.json, strlen(test.json), command);
+    TEST_ASSERT_EQUAL_STRING_MESSAGE(test.error, error, test.json);
+    if (error) continue;
+    TEST_ASSERT_EQUAL_HEX8_MESSAGE(test.fields, command.fields, test.json);
+    if (test.fields & LIGHT_STATE) TEST_ASSERT_EQUAL_INT_MESSAGE(test.on, command.on, test.json);
+    if (test.fields & LIGHT_BRIGHTNESS) TEST_ASSERT_EQUAL_INT_MESSAGE(test.brightness, command.brightness, test.json);
+    if (test.fields & LIGHT_TRANSITION) {
+      TEST_ASSERT_EQUAL_UINT32_MESSAGE(test.transitionMs, command.transitionMs, test.json);
+    }
+    if (test.fields & LIGHT_EFFECT) TEST_ASSERT_TRUE_MESSAGE(command.sunrise, test.json);
+  }
+}
+
+// MQTT payloads are not null terminated, nothing past the length is read
+static void test_light_command_stops_at_length() {
+  static const char payload[] = "{\"state\":\"ON\"}garbage";
+  LightCommand command = {};
+  TEST_ASSERT_NULL(parseLightCommand(payload, strlen("{\"state\":\"ON\"}"), command));
+  TEST_ASSERT_EQUAL_STRING("Expected , or }", parseLightCommand(payload, strlen("{\"state\":\"ON\""), command));
+  TEST_ASSERT_EQUAL_STRING("state must be ON or OFF", parseLightCommand(payload, strlen("{\"state\":\"O"), command));
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_light_command_cases);
+  RUN_TEST(test_light_command_stops_at_length);
+  return UNITY_END();
+}
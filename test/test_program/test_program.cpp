@@ -0,0 +1,133 @@
+// parseProgramKeyframes() and programSet() on /program keyframes, run with: pio test -e native
+
+#include <string.h>
+#include <unity.h>
+
+#include "commands.h"
+#include "program.h"
+
+struct ProgramCase {
+  const char* text;
+  const char* error; // from parsing or from programSet(), nullptr when the program is set
+  uint8_t count = 0;
+  uint32_t lastSeconds = 0;
+  uint16_t lastLevel = 0;
+  RampEasing lastEasing = RAMP_LINEAR;
+};
+
+static const ProgramCase cases[] = {
+  { "0 0, 30 1023", nullptr, 2, 1800, 1023, RAMP_LINEAR },
+  { "0 0, 30 1023 in, 90 1023, 100 0 out", nullptr, 4, 6000, 0, RAMP_EASE_OUT },
+  { "0 0,0:30 10 inout", nullptr, 2, 30, 10, RAMP_EASE_IN_OUT },
+  { "  0   512 ,\t1:05   0   linear  ", nullptr, 2, 65, 0, RAMP_LINEAR },
+  { "0 0, 1440 1023", nullptr, 2, 86400, 1023, RAMP_LINEAR },
+  { "0 0, +1 -0", nullptr, 2, 60, 0, RAMP_LINEAR },
+  { "0 0, 000000001 000001023", nullptr, 2, 60, 1023, RAMP_LINEAR },
+  { "0 0,1 1,2 2,3 3,4 4,5 5,6 6,7 7", nullptr, 8, 420, 7, RAMP_LINEAR },
+  { "0 5, 10 5, 10 900", nullptr, 3, 600, 900, RAMP_LINEAR },
+
+  // Malformed
+  { "", "Keyframes are MINUTES[:SS] LEVEL [EASING]" },
+  { "0", "Keyframes are MINUTES[:SS] LEVEL [EASING]" },
+  { "0 0,", "Keyframes are MINUTES[:SS] LEVEL [EASING]" },
+  { ",0 0", "Keyframes are MINUTES[:SS] LEVEL [EASING]" },
+  { "0 0,,1 1", "Keyframes are MINUTES[:SS] LEVEL [EASING]" },
+  { "a 0, 1 1", "Keyframes are MINUTES[:SS] LEVEL [EASING]" },
+  { "0 0, -1 1", "Keyframes are MINUTES[:SS] LEVEL [EASING]" },
+  { "0 0, 1:", "Seconds must be between 0 and 59" },
+  { "0 0, 1:60 1", "Seconds must be between 0 and 59" },
+  { "0 0, 1:-1 1", "Seconds must be between 0 and 59" },
+  { "0 0, 1441 1", "A program can last at most 24 hours" },
+  { "0 0, 1 1024", "Levels must be between 0 and 1023" },
+  { "0 0, 1 -1", "Levels must be between 0 and 1023" },
+  { "0 0, 1 1 fast", "Easing is linear, in, out or inout" },
+  { "0 0, 1 1 IN", "Easing is linear, in, out or inout" },
+  { "0 0, 1 1 in out", "Expected , between keyframes" },
+  { "0 0 1 1", "Easing is linear, in, out or inout" },
+  { "0 0;1 1", "Easing is linear, in, out or inout" },
+  { "0 0,1 1,2 2,3 3,4 4,5 5,6 6,7 7,8 8", "Too many keyframes" },
+
+  // Parsed but not a valid program
+  { "0 0", "A program needs at least two keyframes" },
+  { "1 0, 2 1023", "The first keyframe must be at 0" },
+  { "0 0, 10 1, 5 2", "Keyframe times must not go back" },
+  { "0 0, 0 1023", "A program must last at least a second" },
+  { "0 0, 1440:01 1023", "A program can last at most 24 hours" },
+
+  // Numbers too long for their field
+  { "0 0, 1000000000 1", "Keyframes are MINUTES[:SS] LEVEL [EASING]" },
+  { "0 0, 4294967297 1", "Keyframes are MINUTES[:SS] LEVEL [EASING]" },
+  { "0 0, 999999999 1", "A program can last at most 24 hours" },
+  { "0 0, 1:0000000001 1", "Seconds must be between 0 and 59" },
+  { "0 0, 1 4294968319", "Keyframes are MINUTES[:SS] LEVEL [EASING]" },
+  { "0 0, 1 999999999", "Levels must be between 0 and 1023" },
+};
+
+void setUp() {}
+void tearDown() {}
+
+static void test_program_cases() {
+  for (const ProgramCase& test : cases) {
+    ProgramKeyframe keyframes[PROGRAM_MAX_KEYFRAMES];
+    uint8_t count;
+    const char* error = parseProgramKeyframes(test.text, strlen(test.text), keyframes, count);
+    if (!error) error = programSet(0, keyframes, count);
+    TEST_ASSERT_EQUAL_STRING_MESSAGE(test.error, error, test.text);
+    if (error) continue;
+
+    const ProgramKeyframe* stored;
+    TEST_ASSERT_EQUAL_UINT8_MESSAGE(test.count, programKeyframes(0, stored), test.text);
+    const ProgramKeyframe& last = stored[test.count - 1];
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(test.lastSeconds, last.seconds, test.text);
+    TEST_ASSERT_EQUAL_INT_MESSAGE(test.lastLevel, last.level, test.text);
+    TEST_ASSERT_EQUAL_INT_MESSAGE(test.lastEasing, last.easing, test.text);
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(test.lastSeconds * 1000, programDurationMs(0), test.text);
+  }
+}
+
+// Keyframes that only come from restored or corrupted records
+static void test_program_set_rejects() {
+  ProgramKeyframe keyframes[PROGRAM_MAX_KEYFRAMES + 1] = {
+    { 0, 0, RAMP_LINEAR },
+    { 60, 1024, RAMP_LINEAR },
+  };
+  TEST_ASSERT_EQUAL_STRING("Levels must be between 0 and 1023", programSet(1, keyframes, 2));
+  keyframes[1] = { 60, 1023, (RampEasing)4 };
+  TEST_ASSERT_EQUAL_STRING("Unknown easing", programSet(1, keyframes, 2));
+  keyframes[1].easing = RAMP_EASE_IN;
+  TEST_ASSERT_EQUAL_STRING("No such program", programSet(PROGRAM_SLOTS, keyframes, 2));
+  for (uint8_t i = 2; i <= PROGRAM_MAX_KEYFRAMES; i++) keyframes[i] = { 60U * i, 0, RAMP_LINEAR };
+  TEST_ASSERT_EQUAL_STRING("Too many keyframes", programSet(1, keyframes, PROGRAM_MAX_KEYFRAMES + 1));
+
+  // A rejected program leaves the slot as it was
+  const ProgramKeyframe* stored;
+  TEST_ASSERT_EQUAL_UINT8(0, programKeyframes(1, stored));
+  TEST_ASSERT_NULL(programSet(1, keyframes, 2));
+  uint16_t revision = programRevision(1);
+  TEST_ASSERT_EQUAL_STRING("The first keyframe must be at 0", programSet(1, keyframes + 1, 2));
+  TEST_ASSERT_EQUAL_UINT8(2, programKeyframes(1, stored));
+  TEST_ASSERT_EQUAL_INT(revision, programRevision(1));
+  TEST_ASSERT_NULL(programSet(1, keyframes, 0));
+  TEST_ASSERT_EQUAL_UINT8(0, programKeyframes(1, stored));
+}
+
+// Keyframes are parsed from inside a command line, nothing past the length is read
+static void test_program_stops_at_length() {
+  static const char line[] = "0 0, 30 1023 in9";
+  ProgramKeyframe keyframes[PROGRAM_MAX_KEYFRAMES];
+  uint8_t count;
+  TEST_ASSERT_NULL(parseProgramKeyframes(line, strlen(line) - 1, keyframes, count));
+  TEST_ASSERT_EQUAL_UINT8(2, count);
+  TEST_ASSERT_EQUAL_INT(RAMP_EASE_IN, keyframes[1].easing);
+  TEST_ASSERT_NULL(parseProgramKeyframes(line, strlen("0 0, 30 10"), keyframes, count));
+  TEST_ASSERT_EQUAL_INT(10, keyframes[1].level);
+  TEST_ASSERT_EQUAL_STRING("Keyframes are MINUTES[:SS] LEVEL [EASING]", parseProgramKeyframes(line, strlen("0 0, 30"), keyframes, count));
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_program_cases);
+  RUN_TEST(test_program_set_rejects);
+  RUN_TEST(test_program_stops_at_length);
+  return UNITY_END();
+}
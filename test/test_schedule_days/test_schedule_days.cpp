@@ -0,0 +1,84 @@
+// parseScheduleDays() on the DAYS of /schedule add, run with: pio test -e native
+
+#include <string.h>
+#include <unity.h>
+
+#include "scheduler.h"
+
+struct DaysCase {
+  const char* text;
+  bool valid;
+  uint8_t days = 0;  // bit 0 is Sunday
+};
+
+static const DaysCase cases[] = {
+  { "daily", true, 0x7F },
+  { "DAILY", true, 0x7F },
+  { "weekdays", true, 0x3E },
+  { "Weekends", true, 0x41 },
+  { "sun", true, 0x01 },
+  { "SAT", true, 0x40 },
+  { "mon,wed,fri", true, 0x2A },
+  { "mon-fri", true, 0x3E },
+  { "mon-fri,sun", true, 0x3F },
+  { "fri-mon", true, 0x63 },
+  { "sat-sun", true, 0x41 },
+  { "wed-wed", true, 0x08 },
+  { "tue-mon", true, 0x7F },
+  { "mon,mon", true, 0x02 },
+
+  // Malformed
+  { "", false },
+  { "d", false },
+  { "dailyx", false },
+  { "weekday", false },
+  { "monday", false },
+  { "mo", false },
+  { "xyz", false },
+  { "mon-", false },
+  { "-fri", false },
+  { "mon-tue-wed", false },
+  { "mon--fri", false },
+  { " mon", false },
+  { "mon ,tue", false },
+  { "mon;tue", false },
+  { "once", false },
+
+  // Empty items
+  { ",", false },
+  { ",mon", false },
+  { "mon,,tue", false },
+  { "mon,", false },
+  { "daily,", false },
+};
+
+void setUp() {}
+void tearDown() {}
+
+static void test_schedule_days_cases() {
+  for (const DaysCase& test : cases) {
+    uint8_t days = 0xFF;
+    bool valid = parseScheduleDays(test.text, strlen(test.text), days);
+    TEST_ASSERT_EQUAL_INT_MESSAGE(test.valid, valid, test.text);
+    if (valid) TEST_ASSERT_EQUAL_HEX8_MESSAGE(test.days, days, test.text);
+  }
+}
+
+// Days are parsed from inside a command line, nothing past the length is read
+static void test_schedule_days_stops_at_length() {
+  static const char line[] = "mon-fri 06:30";
+  uint8_t days = 0;
+  TEST_ASSERT_TRUE(parseScheduleDays(line, 7, days));
+  TEST_ASSERT_EQUAL_HEX8(0x3E, days);
+  TEST_ASSERT_TRUE(parseScheduleDays(line, 3, days));
+  TEST_ASSERT_EQUAL_HEX8(0x02, days);
+  TEST_ASSERT_FALSE(parseScheduleDays(line, 4, days));
+  TEST_ASSERT_FALSE(parseScheduleDays(line, 0, days));
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_schedule_days_cases);
+  RUN_TEST(test_schedule_days_stops_at_length);
+  return UNITY_END();
+}
@@ -0,0 +1,124 @@
+// timezoneBegin() on POSIX TZ strings, run with: pio test -e native
+
+#include <unity.h>
+
+#include "timezone.h"
+
+// 2025-01-15 and 2025-07-15 at 12:00 UTC
+#define WINTER 1736942400UL
+#define SUMMER 1752580800UL
+
+struct ZoneCase {
+  const char* tz;
+  bool valid;
+  int32_t winter = 0;  // offset at WINTER, seconds east of UTC
+  int32_t summer = 0;
+  uint32_t next = 0;  // first transition after WINTER, 0 without DST
+};
+
+static const ZoneCase cases[] = {
+  { "EET-2EEST,M3.5.0/3,M10.5.0/4", true, 7200, 10800, 1743296400 },
+  { "CET-1CEST,M3.5.0,M10.5.0/3", true, 3600, 7200, 1743296400 },
+  { "GMT0BST,M3.5.0/1,M10.5.0", true, 0, 3600, 1743296400 },
+  { "UTC0", true, 0, 0, 0 },
+  { "UTC+0", true, 0, 0, 0 },
+  { "IST-5:30", true, 19800, 19800, 0 },
+  { "<+0530>-5:30", true, 19800, 19800, 0 },
+  { "<-03>3", true, -10800, -10800, 0 },
+  { "XXX-5:45:30", true, 20730, 20730, 0 },
+  { "LINT-14", true, 50400, 50400, 0 },
+  { "XXX24", true, -86400, -86400, 0 },
+  { "EET-0000000002", true, 7200, 7200, 0 },
+  // Without rules the US ones apply, 2025-03-09 07:00 UTC
+  { "EST5EDT", true, -18000, -14400, 1741503600 },
+  { "EST5EDT,M3.2.0/2:00:00,M11.1.0/2:00:00", true, -18000, -14400, 1741503600 },
+  { "EST5EDT4,M3.2.0,M11.1.0", true, -18000, -14400, 1741503600 },
+  // Rule times can be negative or past 24 hours
+  { "EST5EDT,M3.2.0/-1,M11.1.0/26", true, -18000, -14400, 1741492800 },
+  { "EST5EDT,M3.2.0/167,M11.1.0", true, -18000, -14400, 1742097600 },
+  // Southern zones are in DST over the new year
+  { "NZST-12NZDT,M9.5.0,M4.1.0/3", true, 46800, 43200, 1743861600 },
+  { "AEST-10AEDT,M10.1.0,M4.1.0/3", true, 39600, 36000, 1743868800 },
+  // Julian days, J60 is March 1st, 59 counts from 0
+  { "XXX3YYY,J60,J300", true, -10800, -7200, 1740805200 },
+  { "XXX3YYY,59,300", true, -10800, -7200, 1740805200 },
+
+  // Malformed
+  { "", false },
+  { "EET", false },
+  { "EE-2", false },
+  { "-2", false },
+  { "<+3>-3", false },
+  { "<+03-3", false },
+  { "EET-", false },
+  { "EET-2:", false },
+  { "EET-2:60", false },
+  { "EET-2:30:60", false },
+  { "XXX25", false },
+  { "EET-2EE", false },
+  { "EET-2EEST!", false },
+  { "EET-2EEST,", false },
+  { "EET-2EEST,M3.5.0/3", false },
+  { "EET-2EEST,M3.5.0/3,", false },
+  { "EET-2EEST;M3.5.0/3,M10.5.0/4", false },
+  { "EET-2EEST,M13.5.0,M10.5.0", false },
+  { "EET-2EEST,M0.5.0,M10.5.0", false },
+  { "EET-2EEST,M3.6.0,M10.5.0", false },
+  { "EET-2EEST,M3.0.0,M10.5.0", false },
+  { "EET-2EEST,M3.5.7,M10.5.0", false },
+  { "EET-2EEST,M3.5,M10.5.0", false },
+  { "EET-2EEST,M3..0,M10.5.0", false },
+  { "EET-2EEST,M3.5.0/,M10.5.0", false },
+  { "EET-2EEST,M3.5.0/168,M10.5.0", false },
+  { "XXX3YYY,J0,J300", false },
+  { "XXX3YYY,J366,J300", false },
+  { "XXX3YYY,366,300", false },
+  { "XXX3YYY,J,300", false },
+
+  // Numbers too long for their field
+  { "EET-99999999999", false },
+  { "EET-2:00000000059", true, 10740, 10740, 0 },
+  { "EET-2:99999999999", false },
+  { "EET-2EEST,M99999999999.5.0,M10.5.0", false },
+  { "EET-2EEST,M3.5.0/99999999999,M10.5.0", false },
+  { "XXX3YYY,J99999999999,J300", false },
+
+  // Trailing data
+  { "UTC0 ", false },
+  { "EET-2EEST,M3.5.0/3,M10.5.0/4 ", false },
+  { "EET-2EEST,M3.5.0/3,M10.5.0/4,", false },
+  { "EET-2EEST,M3.5.0/3,M10.5.0/4,M11.1.0", false },
+  { "EET-2EEST,M3.5.0/3,M10.5.0/4x", false },
+  { "EET-2EEST,M3.5.0/3:00:00:00,M10.5.0/4", false },
+};
+
+void setUp() {}
+void tearDown() {}
+
+static void test_timezone_cases() {
+  for (const ZoneCase& test : cases) {
+    // A rejected string leaves the zone at UTC, not at the one before it
+    timezoneBegin(TIMEZONE);
+    TEST_ASSERT_EQUAL_INT_MESSAGE(test.valid, timezoneBegin(test.tz), test.tz);
+    TEST_ASSERT_EQUAL_INT32_MESSAGE(test.winter, timezoneOffset(WINTER), test.tz);
+    TEST_ASSERT_EQUAL_INT32_MESSAGE(test.summer, timezoneOffset(SUMMER), test.tz);
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(test.next, timezoneNextTransition(WINTER), test.tz);
+  }
+}
+
+// The offset changes exactly at the transition
+static void test_timezone_transition_edges() {
+  TEST_ASSERT_TRUE(timezoneBegin(TIMEZONE));
+  TEST_ASSERT_EQUAL_INT32(7200, timezoneOffset(1743296399UL));
+  TEST_ASSERT_EQUAL_INT32(10800, timezoneOffset(1743296400UL));
+  TEST_ASSERT_EQUAL_UINT32(1761440400UL, timezoneNextTransition(1743296400UL));
+  TEST_ASSERT_EQUAL_INT32(10800, timezoneOffset(1761440399UL));
+  TEST_ASSERT_EQUAL_INT32(7200, timezoneOffset(1761440400UL));
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_timezone_cases);
+  RUN_TEST(test_timezone_transition_edges);
+  return UNITY_END();
+}